@@ -0,0 +1,664 @@
+/*
+ *  emu_bench.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person
+ *  obtaining a copy of this software and associated documentation
+ *  files (the "Software"), to deal in the Software without restriction,
+ *  including without limitation the rights to use, copy, modify,
+ *  merge, publish, distribute, sublicense, and/or sell copies of the
+ *  Software, and to permit persons to whom the Software is furnished
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Benchmark for the EMU driver. Generates a synthetic raster, then times
+// Create, CreateCopy, Open, random tile reads, a full scan and RAT reads
+// for each codec and thread count and prints the results as JSON.
+// See the README for the options.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gdal_priv.h"
+#include "gdal_rat.h"
+#include "cpl_string.h"
+#include "cpl_vsi.h"
+
+CPL_C_START
+void GDALRegister_EMU(void);
+CPL_C_END
+
+struct BenchConfig
+{
+    int nXSize = 4096;
+    int nYSize = 4096;
+    int nBands = 1;
+    GDALDataType eType = GDT_Byte;
+    double dEntropy = 0.5;        // 0 = smooth surface, 1 = lots of noise
+    double dNoDataFraction = 0.0; // fraction of blocks that are all nodata
+    int nRatRows = 0;
+    std::vector<int> threads = {1};
+    std::vector<std::string> codecs = {"ZLIB"};
+    double dLatencyMs = 0.0;      // added to each read request (see LATENCY_PREFIX)
+    int nRandomReads = 200;
+    int nOpens = 10;
+    unsigned int nSeed = 42;
+    std::string sDir = "/tmp";
+    std::string sOutput;          // stdout if empty
+    bool bKeep = false;
+};
+
+// ---------------------------------------------------------------------------
+// A VSI handler that passes everything through to the real file but sleeps
+// for each request, so reads behave a bit like /vsis3 without the network.
+// Only supports reading.
+
+static const char *LATENCY_PREFIX = "/vsilatency/";
+static double g_dLatencyMs = 0.0;
+static std::atomic<uint64_t> g_nRequests(0);
+
+static void addLatency()
+{
+    g_nRequests++;
+    if( g_dLatencyMs > 0 )
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(
+                    static_cast<int64_t>(g_dLatencyMs * 1000)));
+    }
+}
+
+static const char *underlyingName(const char *pszFilename)
+{
+    return pszFilename + strlen(LATENCY_PREFIX);
+}
+
+static int latencyStat(void *, const char *pszFilename, VSIStatBufL *pStatBuf, int nFlags)
+{
+    addLatency();
+    return VSIStatExL(underlyingName(pszFilename), pStatBuf, nFlags);
+}
+
+static void *latencyOpen(void *, const char *pszFilename, const char *pszAccess)
+{
+    if( strchr(pszAccess, 'w') || strchr(pszAccess, '+') || strchr(pszAccess, 'a') )
+    {
+        return nullptr;
+    }
+    addLatency();
+    return VSIFOpenL(underlyingName(pszFilename), "rb");
+}
+
+static vsi_l_offset latencyTell(void *pFile)
+{
+    return VSIFTellL(static_cast<VSILFILE*>(pFile));
+}
+
+static int latencySeek(void *pFile, vsi_l_offset nOffset, int nWhence)
+{
+    return VSIFSeekL(static_cast<VSILFILE*>(pFile), nOffset, nWhence);
+}
+
+static size_t latencyRead(void *pFile, void *pBuffer, size_t nSize, size_t nCount)
+{
+    addLatency();
+    return VSIFReadL(pBuffer, nSize, nCount, static_cast<VSILFILE*>(pFile));
+}
+
+// /vsis3 fetches the ranges in parallel so count it as one request
+static int latencyReadMultiRange(void *pFile, int nRanges, void **ppData,
+                    const vsi_l_offset *panOffsets, const size_t *panSizes)
+{
+    addLatency();
+    return VSIFReadMultiRangeL(nRanges, ppData, panOffsets, panSizes,
+                    static_cast<VSILFILE*>(pFile));
+}
+
+static int latencyEof(void *pFile)
+{
+    return VSIFEofL(static_cast<VSILFILE*>(pFile));
+}
+
+static int latencyClose(void *pFile)
+{
+    return VSIFCloseL(static_cast<VSILFILE*>(pFile));
+}
+
+static bool installLatencyHandler()
+{
+    VSIFilesystemPluginCallbacksStruct *pCallbacks = VSIAllocFilesystemPluginCallbacksStruct();
+    pCallbacks->stat = latencyStat;
+    pCallbacks->open = latencyOpen;
+    pCallbacks->tell = latencyTell;
+    pCallbacks->seek = latencySeek;
+    pCallbacks->read = latencyRead;
+    pCallbacks->read_multi_range = latencyReadMultiRange;
+    pCallbacks->eof = latencyEof;
+    pCallbacks->close = latencyClose;
+    bool bOK = VSIInstallPluginHandler(LATENCY_PREFIX, pCallbacks) == 0;
+    VSIFreeFilesystemPluginCallbacksStruct(pCallbacks);
+    return bOK;
+}
+
+// ---------------------------------------------------------------------------
+
+static double elapsedSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::vector<int> parseIntList(const char *pszList)
+{
+    std::vector<int> values;
+    char **papszItems = CSLTokenizeString2(pszList, ",", 0);
+    for( int n = 0; papszItems[n] != nullptr; n++ )
+    {
+        values.push_back(atoi(papszItems[n]));
+    }
+    CSLDestroy(papszItems);
+    return values;
+}
+
+static std::vector<std::string> parseStringList(const char *pszList)
+{
+    std::vector<std::string> values;
+    char **papszItems = CSLTokenizeString2(pszList, ",", 0);
+    for( int n = 0; papszItems[n] != nullptr; n++ )
+    {
+        values.push_back(papszItems[n]);
+    }
+    CSLDestroy(papszItems);
+    return values;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "Usage: emu_bench [--xsize N] [--ysize N] [--bands N] [--type Byte|Int16|...]\n"
+        "                 [--entropy 0..1] [--nodata-fraction 0..1] [--rat-rows N]\n"
+        "                 [--threads 1,4,...] [--codecs ZLIB,ZSTD,LZ4,NONE]\n"
+        "                 [--latency-ms F] [--reads N] [--opens N] [--seed N]\n"
+        "                 [--dir PATH] [--output FILE] [--keep]\n");
+}
+
+static bool parseArgs(int argc, char **argv, BenchConfig &config)
+{
+    for( int i = 1; i < argc; i++ )
+    {
+        const char *pszArg = argv[i];
+        if( EQUAL(pszArg, "--keep") )
+        {
+            config.bKeep = true;
+            continue;
+        }
+        if( i + 1 >= argc )
+        {
+            return false;
+        }
+        const char *pszValue = argv[++i];
+        if( EQUAL(pszArg, "--xsize") )
+            config.nXSize = atoi(pszValue);
+        else if( EQUAL(pszArg, "--ysize") )
+            config.nYSize = atoi(pszValue);
+        else if( EQUAL(pszArg, "--bands") )
+            config.nBands = atoi(pszValue);
+        else if( EQUAL(pszArg, "--type") )
+            config.eType = GDALGetDataTypeByName(pszValue);
+        else if( EQUAL(pszArg, "--entropy") )
+            config.dEntropy = CPLAtof(pszValue);
+        else if( EQUAL(pszArg, "--nodata-fraction") )
+            config.dNoDataFraction = CPLAtof(pszValue);
+        else if( EQUAL(pszArg, "--rat-rows") )
+            config.nRatRows = atoi(pszValue);
+        else if( EQUAL(pszArg, "--threads") )
+            config.threads = parseIntList(pszValue);
+        else if( EQUAL(pszArg, "--codecs") )
+            config.codecs = parseStringList(pszValue);
+        else if( EQUAL(pszArg, "--latency-ms") )
+            config.dLatencyMs = CPLAtof(pszValue);
+        else if( EQUAL(pszArg, "--reads") )
+            config.nRandomReads = atoi(pszValue);
+        else if( EQUAL(pszArg, "--opens") )
+            config.nOpens = atoi(pszValue);
+        else if( EQUAL(pszArg, "--seed") )
+            config.nSeed = static_cast<unsigned int>(atoi(pszValue));
+        else if( EQUAL(pszArg, "--dir") )
+            config.sDir = pszValue;
+        else if( EQUAL(pszArg, "--output") )
+            config.sOutput = pszValue;
+        else
+            return false;
+    }
+    return (config.nXSize > 0) && (config.nYSize > 0) && (config.nBands > 0) &&
+        (config.eType != GDT_Unknown) && !config.threads.empty() && !config.codecs.empty();
+}
+
+// Fill one block. A smooth surface plus noise scaled by the entropy.
+// Values are at least 1 so 0 can be the nodata.
+static void generateBlock(const BenchConfig &config, std::mt19937 &rng, int nBand,
+                int nXOff, int nYOff, int nXValid, int nYValid, bool bNoData,
+                std::vector<double> &values, std::vector<GByte> &block)
+{
+    values.resize(static_cast<size_t>(nXValid) * nYValid);
+    std::uniform_real_distribution<double> noise(-100.0, 100.0);
+    for( int y = 0; y < nYValid; y++ )
+    {
+        for( int x = 0; x < nXValid; x++ )
+        {
+            double dValue = 0;
+            if( !bNoData )
+            {
+                double dX = nXOff + x, dY = nYOff + y;
+                dValue = 120 + 60 * sin(dX / 97.0 + nBand) * cos(dY / 61.0);
+                if( config.dEntropy > 0 )
+                {
+                    dValue += noise(rng) * config.dEntropy;
+                }
+                if( !GDALDataTypeIsFloating(config.eType) )
+                {
+                    dValue = std::max(1.0, std::round(dValue));
+                }
+                else
+                {
+                    dValue = std::max(1.0, dValue);
+                }
+            }
+            values[x + static_cast<size_t>(y) * nXValid] = dValue;
+        }
+    }
+    int nTypeSize = GDALGetDataTypeSizeBytes(config.eType);
+    block.resize(values.size() * nTypeSize);
+    GDALCopyWords64(values.data(), GDT_Float64, sizeof(double), block.data(),
+                config.eType, nTypeSize, values.size());
+}
+
+struct BenchResult
+{
+    std::string sCodec;
+    int nThreads = 1;
+    bool bOK = true;
+    double dCreateSecs = 0;
+    double dRatWriteSecs = 0;
+    double dFileMB = 0;
+    double dRatio = 0;
+    double dCreateCopySecs = 0;
+    double dOpenMs = 0;
+    double dRandomReadMs = 0;  // per tile
+    uint64_t nRandomReadRequests = 0;
+    double dFullScanSecs = 0;
+    double dFullScanMBs = 0;
+    uint64_t nFullScanRequests = 0;
+    double dRatReadSecs = 0;
+};
+
+static GDALDataset *openForRead(const BenchConfig &config, const std::string &sFilename)
+{
+    std::string sPath = (config.dLatencyMs > 0) ? (LATENCY_PREFIX + sFilename) : sFilename;
+    return GDALDataset::Open(sPath.c_str(), GDAL_OF_RASTER | GDAL_OF_READONLY);
+}
+
+// time writing the synthetic raster (and RAT) with Create
+static bool benchCreate(const BenchConfig &config, const std::string &sFilename,
+                char **papszOptions, BenchResult &result)
+{
+    GDALDriver *pDriver = GetGDALDriverManager()->GetDriverByName("EMU");
+    double dWriteSecs = 0;
+    auto start = std::chrono::steady_clock::now();
+    GDALDataset *pDS = pDriver->Create(sFilename.c_str(), config.nXSize, config.nYSize,
+                config.nBands, config.eType, papszOptions);
+    if( pDS == nullptr )
+    {
+        return false;
+    }
+    dWriteSecs += elapsedSince(start);
+
+    for( int n = 1; n <= config.nBands; n++ )
+    {
+        pDS->GetRasterBand(n)->SetNoDataValue(0);
+    }
+
+    int nBlockXSize, nBlockYSize;
+    pDS->GetRasterBand(1)->GetBlockSize(&nBlockXSize, &nBlockYSize);
+    int nXBlocks = (config.nXSize + nBlockXSize - 1) / nBlockXSize;
+    int nYBlocks = (config.nYSize + nBlockYSize - 1) / nBlockYSize;
+
+    // same data for each run so the codecs are compared fairly
+    std::mt19937 rng(config.nSeed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<double> values;
+    std::vector<GByte> block;
+    CPLErr err = CE_None;
+    // one block of all the bands at a time, as RIOS does
+    for( int y = 0; (y < nYBlocks) && (err == CE_None); y++ )
+    {
+        for( int x = 0; (x < nXBlocks) && (err == CE_None); x++ )
+        {
+            bool bNoData = unit(rng) < config.dNoDataFraction;
+            int nXOff = x * nBlockXSize, nYOff = y * nBlockYSize;
+            int nXValid = std::min(nBlockXSize, config.nXSize - nXOff);
+            int nYValid = std::min(nBlockYSize, config.nYSize - nYOff);
+            for( int n = 1; (n <= config.nBands) && (err == CE_None); n++ )
+            {
+                generateBlock(config, rng, n, nXOff, nYOff, nXValid, nYValid, bNoData,
+                            values, block);
+                start = std::chrono::steady_clock::now();
+                err = pDS->GetRasterBand(n)->RasterIO(GF_Write, nXOff, nYOff, nXValid, nYValid,
+                            block.data(), nXValid, nYValid, config.eType, 0, 0, nullptr);
+                dWriteSecs += elapsedSince(start);
+            }
+        }
+    }
+
+    if( (err == CE_None) && (config.nRatRows > 0) )
+    {
+        start = std::chrono::steady_clock::now();
+        GDALRasterAttributeTable *pRAT = pDS->GetRasterBand(1)->GetDefaultRAT();
+        pRAT->CreateColumn("Count", GFT_Integer, GFU_PixelCount);
+        pRAT->CreateColumn("Mean", GFT_Real, GFU_Generic);
+        pRAT->CreateColumn("Class", GFT_String, GFU_Name);
+        pRAT->SetRowCount(config.nRatRows);
+        std::vector<int> ints(config.nRatRows);
+        std::vector<double> doubles(config.nRatRows);
+        std::vector<std::string> strings(config.nRatRows);
+        std::vector<char*> stringPtrs(config.nRatRows);
+        for( int n = 0; n < config.nRatRows; n++ )
+        {
+            ints[n] = static_cast<int>(rng() % 100000);
+            doubles[n] = unit(rng) * 1000.0;
+            strings[n] = CPLSPrintf("class_%d", static_cast<int>(rng() % 20));
+            stringPtrs[n] = const_cast<char*>(strings[n].c_str());
+        }
+        err = pRAT->ValuesIO(GF_Write, 0, 0, config.nRatRows, ints.data());
+        if( err == CE_None )
+            err = pRAT->ValuesIO(GF_Write, 1, 0, config.nRatRows, doubles.data());
+        if( err == CE_None )
+            err = pRAT->ValuesIO(GF_Write, 2, 0, config.nRatRows, stringPtrs.data());
+        result.dRatWriteSecs = elapsedSince(start);
+    }
+
+    // includes writing the index and waiting for any compression threads
+    start = std::chrono::steady_clock::now();
+    if( pDS->Close() != CE_None )
+    {
+        err = CE_Failure;
+    }
+    delete pDS;
+    dWriteSecs += elapsedSince(start);
+    result.dCreateSecs = dWriteSecs;
+
+    VSIStatBufL sStat;
+    if( VSIStatL(sFilename.c_str(), &sStat) == 0 )
+    {
+        result.dFileMB = sStat.st_size / (1024.0 * 1024.0);
+        double dRawMB = static_cast<double>(config.nXSize) * config.nYSize * config.nBands *
+                    GDALGetDataTypeSizeBytes(config.eType) / (1024.0 * 1024.0);
+        result.dRatio = (result.dFileMB > 0) ? dRawMB / result.dFileMB : 0;
+    }
+    return err == CE_None;
+}
+
+static bool benchCreateCopy(const BenchConfig &config, const std::string &sSrcFilename,
+                const std::string &sDstFilename, char **papszOptions, BenchResult &result)
+{
+    GDALDriver *pDriver = GetGDALDriverManager()->GetDriverByName("EMU");
+    auto start = std::chrono::steady_clock::now();
+    GDALDataset *pSrcDS = openForRead(config, sSrcFilename);
+    if( pSrcDS == nullptr )
+    {
+        return false;
+    }
+    GDALDataset *pDstDS = pDriver->CreateCopy(sDstFilename.c_str(), pSrcDS, FALSE,
+                    papszOptions, nullptr, nullptr);
+    bool bOK = (pDstDS != nullptr);
+    if( bOK )
+    {
+        bOK = (pDstDS->Close() == CE_None);
+        delete pDstDS;
+    }
+    GDALClose(pSrcDS);
+    result.dCreateCopySecs = elapsedSince(start);
+    return bOK;
+}
+
+static bool benchRead(const BenchConfig &config, const std::string &sFilename, BenchResult &result)
+{
+    // open
+    auto start = std::chrono::steady_clock::now();
+    for( int n = 0; n < config.nOpens; n++ )
+    {
+        GDALDataset *pDS = openForRead(config, sFilename);
+        if( pDS == nullptr )
+        {
+            return false;
+        }
+        GDALClose(pDS);
+    }
+    result.dOpenMs = elapsedSince(start) * 1000.0 / std::max(config.nOpens, 1);
+
+    // random tiles. ReadBlock goes straight to IReadBlock (no block cache)
+    GDALDataset *pDS = openForRead(config, sFilename);
+    if( pDS == nullptr )
+    {
+        return false;
+    }
+    int nBlockXSize, nBlockYSize;
+    pDS->GetRasterBand(1)->GetBlockSize(&nBlockXSize, &nBlockYSize);
+    int nXBlocks = (config.nXSize + nBlockXSize - 1) / nBlockXSize;
+    int nYBlocks = (config.nYSize + nBlockYSize - 1) / nBlockYSize;
+    int nTypeSize = GDALGetDataTypeSizeBytes(config.eType);
+    std::vector<GByte> block(static_cast<size_t>(nBlockXSize) * nBlockYSize * nTypeSize);
+    std::mt19937 rng(config.nSeed);
+    uint64_t nStartRequests = g_nRequests;
+    bool bOK = true;
+    start = std::chrono::steady_clock::now();
+    for( int n = 0; (n < config.nRandomReads) && bOK; n++ )
+    {
+        int nBand = 1 + static_cast<int>(rng() % config.nBands);
+        int x = static_cast<int>(rng() % nXBlocks);
+        int y = static_cast<int>(rng() % nYBlocks);
+        bOK = pDS->GetRasterBand(nBand)->ReadBlock(x, y, block.data()) == CE_None;
+    }
+    result.dRandomReadMs = elapsedSince(start) * 1000.0 / std::max(config.nRandomReads, 1);
+    result.nRandomReadRequests = g_nRequests - nStartRequests;
+    GDALClose(pDS);
+    if( !bOK )
+    {
+        return false;
+    }
+
+    // full scan. A strip of blocks of all the bands at a time so the
+    // prefetching can read and decompress the tiles in parallel.
+    pDS = openForRead(config, sFilename);
+    if( pDS == nullptr )
+    {
+        return false;
+    }
+    std::vector<GByte> strip(static_cast<size_t>(config.nXSize) * nBlockYSize *
+                    nTypeSize * config.nBands);
+    nStartRequests = g_nRequests;
+    start = std::chrono::steady_clock::now();
+    for( int nYOff = 0; (nYOff < config.nYSize) && bOK; nYOff += nBlockYSize )
+    {
+        int nYValid = std::min(nBlockYSize, config.nYSize - nYOff);
+        bOK = pDS->RasterIO(GF_Read, 0, nYOff, config.nXSize, nYValid, strip.data(),
+                    config.nXSize, nYValid, config.eType, config.nBands, nullptr,
+                    0, 0, 0, nullptr) == CE_None;
+    }
+    result.dFullScanSecs = elapsedSince(start);
+    result.nFullScanRequests = g_nRequests - nStartRequests;
+    double dRawMB = static_cast<double>(config.nXSize) * config.nYSize * config.nBands *
+                nTypeSize / (1024.0 * 1024.0);
+    result.dFullScanMBs = (result.dFullScanSecs > 0) ? dRawMB / result.dFullScanSecs : 0;
+
+    // RAT - whole columns
+    if( bOK && (config.nRatRows > 0) )
+    {
+        GDALRasterAttributeTable *pRAT = pDS->GetRasterBand(1)->GetDefaultRAT();
+        int nRows = pRAT->GetRowCount();
+        std::vector<int> ints(nRows);
+        std::vector<double> doubles(nRows);
+        std::vector<char*> strings(nRows);
+        start = std::chrono::steady_clock::now();
+        bOK = (pRAT->ValuesIO(GF_Read, 0, 0, nRows, ints.data()) == CE_None) &&
+            (pRAT->ValuesIO(GF_Read, 1, 0, nRows, doubles.data()) == CE_None) &&
+            (pRAT->ValuesIO(GF_Read, 2, 0, nRows, strings.data()) == CE_None);
+        result.dRatReadSecs = elapsedSince(start);
+        if( bOK )
+        {
+            for( char *pszString : strings )
+            {
+                CPLFree(pszString);
+            }
+        }
+    }
+    GDALClose(pDS);
+    return bOK;
+}
+
+static void writeJSON(FILE *fp, const BenchConfig &config, const std::vector<BenchResult> &results)
+{
+    fprintf(fp, "{\n  \"config\": {\n");
+    fprintf(fp, "    \"xsize\": %d,\n    \"ysize\": %d,\n    \"bands\": %d,\n",
+                config.nXSize, config.nYSize, config.nBands);
+    fprintf(fp, "    \"type\": \"%s\",\n", GDALGetDataTypeName(config.eType));
+    fprintf(fp, "    \"entropy\": %g,\n    \"nodata_fraction\": %g,\n    \"rat_rows\": %d,\n",
+                config.dEntropy, config.dNoDataFraction, config.nRatRows);
+    fprintf(fp, "    \"latency_ms\": %g,\n    \"random_reads\": %d,\n    \"opens\": %d,\n"
+                "    \"seed\": %u\n  },\n",
+                config.dLatencyMs, config.nRandomReads, config.nOpens, config.nSeed);
+    fprintf(fp, "  \"results\": [");
+    for( size_t n = 0; n < results.size(); n++ )
+    {
+        const BenchResult &r = results[n];
+        fprintf(fp, "%s\n    {\n", (n > 0) ? "," : "");
+        fprintf(fp, "      \"codec\": \"%s\",\n      \"threads\": %d,\n      \"ok\": %s,\n",
+                    r.sCodec.c_str(), r.nThreads, r.bOK ? "true" : "false");
+        fprintf(fp, "      \"create_s\": %.6f,\n      \"rat_write_s\": %.6f,\n",
+                    r.dCreateSecs, r.dRatWriteSecs);
+        fprintf(fp, "      \"file_mb\": %.3f,\n      \"compression_ratio\": %.3f,\n",
+                    r.dFileMB, r.dRatio);
+        fprintf(fp, "      \"createcopy_s\": %.6f,\n      \"open_ms\": %.3f,\n",
+                    r.dCreateCopySecs, r.dOpenMs);
+        fprintf(fp, "      \"random_read_ms_per_tile\": %.4f,\n      \"random_read_requests\": %" PRIu64 ",\n",
+                    r.dRandomReadMs, r.nRandomReadRequests);
+        fprintf(fp, "      \"full_scan_s\": %.6f,\n      \"full_scan_mb_per_s\": %.2f,\n",
+                    r.dFullScanSecs, r.dFullScanMBs);
+        fprintf(fp, "      \"full_scan_requests\": %" PRIu64 ",\n      \"rat_read_s\": %.6f\n    }",
+                    r.nFullScanRequests, r.dRatReadSecs);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    BenchConfig config;
+    if( !parseArgs(argc, argv, config) )
+    {
+        usage();
+        return 1;
+    }
+
+    GDALRegister_EMU();
+    GDALDriver *pDriver = GetGDALDriverManager()->GetDriverByName("EMU");
+    if( pDriver == nullptr )
+    {
+        fprintf(stderr, "EMU driver not available\n");
+        return 1;
+    }
+    const char *pszCreationOptions = pDriver->GetMetadataItem(GDAL_DMD_CREATIONOPTIONLIST);
+
+    g_dLatencyMs = config.dLatencyMs;
+    if( (config.dLatencyMs > 0) && !installLatencyHandler() )
+    {
+        fprintf(stderr, "Couldn't install %s handler\n", LATENCY_PREFIX);
+        return 1;
+    }
+
+    std::vector<BenchResult> results;
+    for( const std::string &sCodec : config.codecs )
+    {
+        // only the codecs this build has are in the option list
+        if( !EQUAL(sCodec.c_str(), "NONE") && (pszCreationOptions != nullptr) &&
+            (strstr(pszCreationOptions, CPLSPrintf("<Value>%s</Value>", sCodec.c_str())) == nullptr) )
+        {
+            fprintf(stderr, "Skipping %s, not supported by this build\n", sCodec.c_str());
+            continue;
+        }
+        for( int nThreads : config.threads )
+        {
+            BenchResult result;
+            result.sCodec = sCodec;
+            result.nThreads = nThreads;
+            fprintf(stderr, "%s with %d thread(s)\n", sCodec.c_str(), nThreads);
+
+            // used for reading too
+            CPLSetConfigOption("GDAL_NUM_THREADS", CPLSPrintf("%d", nThreads));
+            char **papszOptions = nullptr;
+            papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", sCodec.c_str());
+            papszOptions = CSLSetNameValue(papszOptions, "NUM_THREADS", CPLSPrintf("%d", nThreads));
+
+            std::string sFilename = CPLFormFilename(config.sDir.c_str(),
+                    CPLSPrintf("emu_bench_%s_%d", sCodec.c_str(), nThreads), "emu");
+            std::string sCopyFilename = CPLFormFilename(config.sDir.c_str(),
+                    CPLSPrintf("emu_bench_%s_%d_copy", sCodec.c_str(), nThreads), "emu");
+            result.bOK = benchCreate(config, sFilename, papszOptions, result) &&
+                benchCreateCopy(config, sFilename, sCopyFilename, papszOptions, result) &&
+                benchRead(config, sFilename, result);
+            CSLDestroy(papszOptions);
+            CPLSetConfigOption("GDAL_NUM_THREADS", nullptr);
+
+            if( !config.bKeep )
+            {
+                VSIUnlink(sFilename.c_str());
+                VSIUnlink(sCopyFilename.c_str());
+            }
+            results.push_back(result);
+        }
+    }
+
+    FILE *fp = config.sOutput.empty() ? stdout : fopen(config.sOutput.c_str(), "w");
+    if( fp == nullptr )
+    {
+        fprintf(stderr, "Couldn't open %s\n", config.sOutput.c_str());
+        return 1;
+    }
+    writeJSON(fp, config, results);
+    if( fp != stdout )
+    {
+        fclose(fp);
+    }
+
+    for( const BenchResult &result : results )
+    {
+        if( !result.bOK )
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -36,29 +36,103 @@
 
 #include "emudataset.h"
 #include "emurat.h"
+#include "emustats.h"
+
+struct EMUCacheKey;
+struct EMUPrefetchTile;
+
+// when merging tiles into ranges for VSIFReadMultiRangeL, read
+// through gaps up to this size rather than start a new range
+const vsi_l_offset PREFETCH_MAX_GAP = 32 * 1024;
+// but don't let one range get bigger than this
+const vsi_l_offset PREFETCH_MAX_RANGE = 16 * 1024 * 1024;
 
 #define STATISTICS_MINIMUM "STATISTICS_MINIMUM"
 #define STATISTICS_MAXIMUM "STATISTICS_MAXIMUM"
 #define STATISTICS_MEAN "STATISTICS_MEAN"
 #define STATISTICS_STDDEV "STATISTICS_STDDEV"
+#define STATISTICS_HISTOMIN "STATISTICS_HISTOMIN"
+#define STATISTICS_HISTOMAX "STATISTICS_HISTOMAX"
+#define STATISTICS_HISTONUMBINS "STATISTICS_HISTONUMBINS"
+#define STATISTICS_HISTOBINVALUES "STATISTICS_HISTOBINVALUES"
 
 class EMUBaseBand: public GDALRasterBand
 {
 public:
-    EMUBaseBand(EMUDataset *, int nBandIn, GDALDataType eType, uint64_t nLevel, int nXSize, int nYSize, int nBlockSize, const std::shared_ptr<std::mutex>& other);
+    EMUBaseBand(EMUDataset *, int nBandIn, GDALDataType eType, uint64_t nLevel, int nXSize, int nYSize, 
+                int nBlockXSize, int nBlockYSize, const std::shared_ptr<std::mutex>& other);
     ~EMUBaseBand();
 
     virtual CPLErr IReadBlock( int, int, void * ) override;
     virtual CPLErr IWriteBlock( int, int, void * ) override;
+    virtual CPLErr IRasterIO( GDALRWFlag eRWFlag, int nXOff, int nYOff, int nXSize, int nYSize,
+                            void *pData, int nBufXSize, int nBufYSize, GDALDataType eBufType,
+                            GSpacing nPixelSpace, GSpacing nLineSpace, 
+                            GDALRasterIOExtraArg *psExtraArg ) override;
+    virtual CPLErr AdviseRead( int nXOff, int nYOff, int nXSize, int nYSize,
+                            int nBufXSize, int nBufYSize, GDALDataType eBufType, 
+                            char **papszOptions ) override;
 protected:
+    // number of bands stored in each tile (all of them for INTERLEAVE=PIXEL)
+    int getTileBandCount();
+    // the band (at this level) that is stored at nIndex within the tiles
+    EMUBaseBand *getTileBand(int nIndex);
+    uint64_t getTileKeyBand();
+    void lockTileBlocks(int nBlockXOff, int nBlockYOff, void *pData, 
+                    std::vector<GDALRasterBlock*> &blocks, std::vector<void*> &bandData);
+    void unlockTileBlocks(int nBlockXOff, int nBlockYOff, 
+                    std::vector<GDALRasterBlock*> &blocks, bool bOK);
+    CPLErr decodeBlock(int nBlockXOff, int nBlockYOff, const EMUTileValue &val, 
+                    const Bytef *pTileData, bool bDecompressed, 
+                    const EMUCacheKey *pCacheKey, void * const *papData);
+    // COMPRESSION_NONE. Read the tile from the file straight into pData.
+    bool isDirectReadTile(const EMUTileValue &val, void *pData);
+    CPLErr readTileDirect(int nBlockXOff, int nBlockYOff, const EMUTileValue &val, void *pData);
+    // for EMU_TILE_CONSTANT tiles and ones that were never written (offset 0)
+    void fillBlock(const EMUTileValue &val, void * const *papData);
+    // IWriteBlock without generating overviews
+    CPLErr writeBlockData(int nBlockXOff, int nBlockYOff, void *pData);
+    // reduce a full res block into the matching block of each overview
+    CPLErr writeOverviewBlocks(int nBlockXOff, int nBlockYOff, void *pData);
+    // only the full res bands collect statistics
+    virtual CPLErr addBlockStatistics(int nBlockXOff, int nBlockYOff, void *pData);
+    void prefetchBlocks(int nXOff, int nYOff, int nXSize, int nYSize);
+    // look up the tile for block x, y, and whether it is in the read ahead or the tile 
+    // cache. Returns false if it isn't in the index.
+    bool findPrefetchTile(int x, int y, EMUPrefetchTile &tile);
+    // read the tiles that weren't found in a cache with as few requests as possible. 
+    // rangeData holds the data their pTileData points to.
+    bool readPrefetchTiles(std::vector<EMUPrefetchTile> &tiles, std::vector<GByte> &rangeData);
+    int getPrefetchBlockRows(int nXOff, int nXSize, int nBandsAtOnce);
+    // TILE_STRIPS. Read a window within one tile by just decompressing the strips 
+    // it covers. Returns false (without reading anything) if it is better done 
+    // the usual way, otherwise *peErr has the result.
+    bool readTileRows(int nXOff, int nYOff, int nXSize, int nYSize, void *pData, 
+                    GDALDataType eBufType, GSpacing nPixelSpace, GSpacing nLineSpace, 
+                    CPLErr *peErr);
+    // Big reads into a buffer of another type. The tiles are decoded and converted 
+    // straight into pData without going through GDAL's block cache. Returns false if 
+    // it is better done the usual way, or if anything failed (which the usual way 
+    // will then report).
+    bool readConverted(int nXOff, int nYOff, int nXSize, int nYSize, void *pData, 
+                    GDALDataType eBufType, GSpacing nPixelSpace, GSpacing nLineSpace);
+
     std::shared_ptr<std::mutex> m_mutex;
     uint64_t m_nLevel; 
+    // the last tile readTileRows did. If it's wanted again (eg reading by 
+    // scanline) the whole block is read so the rest come from the block cache.
+    int m_nLastStripXOff = -1;
+    int m_nLastStripYOff = -1;
+
+    friend class EMUDataset;
+    friend class EMUReadAhead;
 };
 
 class EMURasterBand final: public EMUBaseBand
 {
 public:
-    EMURasterBand(EMUDataset *, int nBandIn, GDALDataType eType, int nXSize, int nYSize, int nBlockSize, const std::shared_ptr<std::mutex>& other);
+    EMURasterBand(EMUDataset *, int nBandIn, GDALDataType eType, int nXSize, int nYSize, 
+                int nBlockXSize, int nBlockYSize, const std::shared_ptr<std::mutex>& other);
     ~EMURasterBand();
 
     virtual double GetNoDataValue(int *pbSuccess = nullptr) override;
@@ -91,11 +165,17 @@ public:
 
     // non virtual function to create the objects
     CPLErr CreateOverviews(int nOverviews, const int *panOverviewList);
-    CPLErr CreateOverviews(const std::vector<std::tuple<int, int, int> > &sizes);
+    // x size, y size, block x size, block y size for each
+    CPLErr CreateOverviews(const std::vector<std::tuple<int, int, int, int> > &sizes);
+
+protected:
+    virtual CPLErr addBlockStatistics(int nBlockXOff, int nBlockYOff, void *pData) override;
 
 private:
 
     void UpdateMetadataList();
+    // use the collected stats and histogram unless they have been set
+    void finaliseStatistics();
 
 
     bool m_bNoDataSet;
@@ -106,6 +186,13 @@ private:
     double m_dMax;
     double m_dMean;
     double m_dStdDev;
+
+    // collected as the blocks are written (if the STATISTICS creation option is on)
+    EMUStatsAccumulator *m_pStats;
+    std::once_flag m_statsOnce;
+    std::vector<uint64_t> m_histogram; // empty unless collected
+    double m_dHistMin;
+    double m_dHistMax;
     
     EMURat m_rat;
     int                  m_nOverviews;
@@ -32,13 +32,128 @@
 #define EMUCOMPRESS_H
 
 #include <cstdint>
+#include <vector>
 #include "zlib.h"
  
+// stored in the file at the start of each tile and RAT chunk
 const uint8_t COMPRESSION_NONE = 0;
 const uint8_t COMPRESSION_ZLIB = 1;
+const uint8_t COMPRESSION_ZSTD = 2;
+const uint8_t COMPRESSION_LZ4 = 3;
+
+// pass as the level to use the codec's default
+const int COMPRESSION_DFLT_LEVEL = -1;
+
+// Filters applied to tiles before compression. These are stored in 
+// bits 4-6 of the compression byte of each tile (FILTER_MASK) as bit 7 is 
+// COMPRESSION_STRIPS.
+const uint8_t FILTER_NONE = 0;
+const uint8_t FILTER_PREDICTOR = 1;  // horizontal differencing, for integer types
+const uint8_t FILTER_FPREDICTOR = 2; // floating point predictor (as TIFF PREDICTOR=3)
+const uint8_t FILTER_SHUFFLE = 3;    // byte shuffle
+const uint8_t FILTER_BITSHUFFLE = 4; // bit shuffle
+
+const uint8_t FILTER_SHIFT = 4;
+const uint8_t FILTER_MASK = 0x70;
+const uint8_t COMPRESSION_MASK = 0x0f;
+
+// also in the compression byte of tiles that are split into strips of 
+// rows which can be decompressed on their own (TILE_STRIPS)
+const uint8_t COMPRESSION_STRIPS = 0x80;
+
+// Tiles with COMPRESSION_STRIPS start (after the compression byte) with a table: 
+// the rows in each strip and the number of strips (uint32 each), then where each 
+// strip ends (uint64, from the end of the table). Each strip is filtered and 
+// compressed separately.
+const size_t STRIP_TABLE_START = 2 * sizeof(uint32_t);
+
+struct EMUStripTable
+{
+    uint32_t nRowsPerStrip = 0;
+    std::vector<uint64_t> ends;
+    size_t nTableSize = 0;
+
+    // the size of the table from the first STRIP_TABLE_START bytes of it. 0 if not valid.
+    static size_t getTableSize(const Bytef *pInput, size_t inputSize);
+    // returns false unless pInput starts with a valid table for a tile of 
+    // nYSize rows that is nTileSize bytes (after the compression byte)
+    bool read(const Bytef *pInput, size_t inputSize, size_t nYSize, size_t nTileSize);
+    // from the start of the table
+    size_t getStripStart(size_t nStrip) const
+    {
+        return nTableSize + ((nStrip == 0) ? 0 : ends[nStrip - 1]);
+    }
+    size_t getStripEnd(size_t nStrip) const
+    {
+        return nTableSize + ends[nStrip];
+    }
+};
+
+// A compression method. Which ones are available depends on the 
+// libraries found when building.
+struct EMUCodec
+{
+    uint8_t type;
+    const char *pszName; // as used in the COMPRESS creation option
+    int nDefaultLevel;
+    int nMinLevel;
+    int nMaxLevel;
+    // largest possible output from compressing nInputSize bytes
+    size_t (*pfnBound)(size_t nInputSize);
+    // *pnOutputSize is the size of pOutput on input and the compressed size on output
+    bool (*pfnCompress)(int nLevel, const Bytef *pInput, size_t nInputSize, 
+                        Bytef *pOutput, size_t *pnOutputSize);
+    bool (*pfnUncompress)(const Bytef *pInput, size_t nInputSize, 
+                        Bytef *pOutput, size_t nOutputSize);
+};
+
+// per thread scratch buffers. Each user needs their own slot.
+enum EMUScratchSlot
+{
+    SCRATCH_TILEDATA = 0, // compressed tile read from the file
+    SCRATCH_PARTIAL,      // (packed) pixels of a partial tile
+    SCRATCH_FILTERED,     // filtered tile
+    SCRATCH_SHUFFLE,      // used by the bit shuffle
+    SCRATCH_COMPRESSED,   // output of doCompression
+    SCRATCH_CODEC,        // state for codecs that need it
+    SCRATCH_OVERVIEW,     // reduced block for a generated overview
+    SCRATCH_STRIPS,       // output of doTileCompression with COMPRESSION_STRIPS
+    SCRATCH_CONVERT,      // block decoded for converting into a RasterIO buffer
+    SCRATCH_FPREDICTOR,   // row being rearranged by the floating point predictor
+    SCRATCH_COUNT
+};
+
+// returns a buffer of at least nSize bytes which belongs to the calling thread. 
+// The contents are undefined and it is valid until the next call with the same slot.
+Bytef *getScratchBuffer(EMUScratchSlot slot, size_t nSize);
+
+// these return nullptr if the codec isn't available
+const EMUCodec *getCodec(uint8_t type);
+const EMUCodec *getCodecByName(const char *pszName);
+std::vector<const EMUCodec*> getAvailableCodecs();
  
-Bytef* doCompression(int type, Bytef *pInput, size_t inputSize, size_t *pnOutputSize, bool *pbFree); 
-void doUncompression(uint8_t type, Bytef *pInput, size_t inputSize, Bytef *pOutput, size_t pnOutputSize);
+// returns pInput when type is COMPRESSION_NONE, otherwise a per thread 
+// buffer (SCRATCH_COMPRESSED) so don't free the result.
+Bytef* doCompression(int type, int level, Bytef *pInput, size_t inputSize, size_t *pnOutputSize); 
+bool doUncompression(uint8_t type, const Bytef *pInput, size_t inputSize, Bytef *pOutput, size_t pnOutputSize);
+// for zlib data where the uncompressed size wasn't stored (strings in 
+// version 1 RATs). output is resized to fit.
+bool doZlibUncompressUnknownSize(const Bytef *pInput, size_t inputSize, std::vector<Bytef> &output);
+
+// as for doCompression/doUncompression, but the filter in the high bits 
+// of compression is also applied. nXSize and nYSize are the size of the 
+// (packed) tile in pixels. With COMPRESSION_STRIPS the tile is split into 
+// strips of nRowsPerStrip (otherwise ignored).
+Bytef* doTileCompression(uint8_t compression, int level, int nTypeSize, size_t nXSize, size_t nYSize, 
+                    uint32_t nRowsPerStrip, Bytef *pInput, size_t *pnOutputSize);
+bool doTileUncompression(uint8_t compression, int nTypeSize, size_t nXSize, size_t nYSize, 
+                    const Bytef *pInput, size_t inputSize, Bytef *pOutput, size_t nOutputSize);
+// just strips nFirstStrip to nLastStrip (inclusive) of a tile with COMPRESSION_STRIPS. 
+// pInput is the tile from table.getStripStart(nFirstStrip) to table.getStripEnd(nLastStrip) 
+// and pOutput gets the rows of those strips.
+bool doTileStripUncompression(uint8_t compression, int nTypeSize, size_t nXSize, size_t nYSize, 
+                    const EMUStripTable &table, size_t nFirstStrip, size_t nLastStrip, 
+                    const Bytef *pInput, Bytef *pOutput);
 
 Bytef* doCompressMetadata(int type, char **papszMetadataList, size_t *pnInputSize, size_t *pnOutputSize);
 char** doUncompressMetadata(uint8_t type, Bytef *pInput, size_t inputSize, size_t pnOutputSize);
@@ -34,12 +34,41 @@
 #include <cinttypes>
 
 #include "gdal_priv.h"
+#include "cpl_virtualmem.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
-const int EMU_VERSION = 1;
+#include "emucompress.h"
+#include "emuiostats.h"
+#include "emuoverview.h"
+#include "emuthreadpool.h"
+
+class EMUTileCache;
+class EMUReadAhead;
+
+// 1 - original
+// 2 - dense tile index, EMU_FLAG_PIXEL_INTERLEAVED, RAT chunk encodings 
+//     and uncompressed sizes, constant tiles (EMU_TILE_CONSTANT), 
+//     rectangular tiles, tiles split into strips of rows (TILE_STRIPS), 
+//     byte order mark and section directory at the start of the header 
+//     with the grid directory and RAT chunks in their own sections
+const int EMU_VERSION = 2;
+
+// bits in the flags that follow the signature
+const uint32_t EMU_FLAG_CLOUD_OPTIMISED = 1;
+const uint32_t EMU_FLAG_PIXEL_INTERLEAVED = 2; // each tile holds the block for all bands (stored under band 1)
+// HEADER_FIRST. The flags are followed by the offset and end of the header (uint64 each), 
+// which with the tile index comes before the tiles. Both are 0 if it didn't fit, in which 
+// case use the trailer. The trailer always points to the header so this can be ignored.
+const uint32_t EMU_FLAG_HEADER_FIRST = 4;
+const size_t EMU_PREFIX_OFFSET = 11; // after the signature and flags
 
 struct EMUTileKey
 {
@@ -71,15 +100,156 @@ struct std::hash<EMUTileKey>
 
 struct EMUTileValue
 {
-    uint64_t offset;
+    uint64_t offset;  // 0 if tile not written (start of file is the signature)
     uint64_t size;
     uint64_t uncompressedSize;
 };
 
+static_assert(sizeof(EMUTileValue) == 3 * sizeof(uint64_t), "EMUTileValue must not be padded");
+
+// offset for a tile where every pixel (of every band with INTERLEAVE=PIXEL) is the 
+// same value. Nothing is written to the file - size is 0 and uncompressedSize holds 
+// the bytes of the pixel. No real tile can start here as the signature is at the start.
+const uint64_t EMU_TILE_CONSTANT = 1;
+
+// true if every pixel in the nXValid by nYValid area is the same (and fits in 
+// an EMUTileValue). nLineSize is in pixels. *pnValue is set to the bytes of the pixel.
+bool isConstantTile(const GByte *pData, int nTypeSize, int nXValid, int nYValid, 
+                int nLineSize, uint64_t *pnValue);
+
+// All the tiles for one overview level of one band. Since we know 
+// the number of blocks in each direction we can just store them in a 
+// flat array, which is also how they are laid out in the file.
+// When opening a file only the size and location of each grid is read.
+// The tiles are loaded the first time they are needed, or used straight 
+// from the mapping for local files.
+struct EMUTileGrid
+{
+    uint64_t nXBlocks;
+    uint64_t nYBlocks;
+    vsi_l_offset fileOffset; // 0 if tiles are already in memory
+    std::once_flag loaded;
+    std::vector<EMUTileValue> tiles; // x + y * nXBlocks. Empty if mapped
+    const EMUTileValue *pTiles = nullptr; // tiles.data() or the mapping. nullptr until loaded
+};
+
+// Read values out of the header once it has been loaded into memory. 
+// If the buffer runs out, reads fail and isOK() returns false.
+class EMUHeaderReader
+{
+public:
+    EMUHeaderReader(GByte *pData, size_t nSize);
+
+    bool read(void *pDest, size_t nBytes);
+    template <class T> bool read(T *pVal)
+    {
+        return read(pVal, sizeof(T));
+    }
+    // returns a pointer to the next nBytes within the buffer and skips past them
+    GByte *getData(size_t nBytes);
+    // reads up to (and including) the next null byte
+    bool readString(std::string *pStr);
+    // move to an absolute position within the buffer
+    bool seek(size_t nPos);
+    bool isOK() const
+    {
+        return m_bOK;
+    }
+
+private:
+    GByte *m_pData;
+    size_t m_nSize;
+    size_t m_nPos;
+    bool m_bOK;
+};
+
+// Version 2. The header starts with "HDR\0", EMU_BYTE_ORDER_MARK (in the byte 
+// order of the machine that wrote it, which is also the order of everything 
+// else in the file), the number of sections and then an EMUHeaderSection for 
+// each. Each section starts on a multiple of 8 bytes from the start of the 
+// header, which is itself aligned. Sections that aren't known are skipped.
+const uint32_t EMU_BYTE_ORDER_MARK = 0x01020304;
+const uint64_t EMU_SECTION_INFO = 1;       // sizes, bands, geo transform, projection, metadata
+const uint64_t EMU_SECTION_GRIDS = 2;      // EMUGridEntry for each tile grid
+const uint64_t EMU_SECTION_RAT_CHUNKS = 3; // EMURatChunk of all the RAT columns
+
+struct EMUHeaderSection
+{
+    uint64_t id;
+    uint64_t offset; // from the start of the header
+    uint64_t size;
+};
+
+// where the tiles (EMUTileValue) of one band/level are
+struct EMUGridEntry
+{
+    uint64_t ovrLevel;
+    uint64_t band;
+    uint64_t nXBlocks;
+    uint64_t nYBlocks;
+    uint64_t offset;
+};
+
+static_assert(sizeof(EMUHeaderSection) == 3 * sizeof(uint64_t), "EMUHeaderSection must not be padded");
+static_assert(sizeof(EMUGridEntry) == 5 * sizeof(uint64_t), "EMUGridEntry must not be padded");
+
+// builds the header in memory so it can be written in one go
+class EMUHeaderWriter
+{
+public:
+    void write(const void *pData, size_t nBytes);
+    template <class T> void write(const T &val)
+    {
+        write(&val, sizeof(T));
+    }
+    // including the null byte
+    void writeString(const char *pszStr);
+    // pad with zeros to a multiple of HEADER_ALIGNMENT
+    void align();
+    const GByte *data() const
+    {
+        return m_data.data();
+    }
+    size_t size() const
+    {
+        return m_data.size();
+    }
+
+private:
+    std::vector<GByte> m_data;
+};
+
+// a tile that has been compressed by one of the worker threads
+// and is waiting for the writer thread to append it to the file
+struct EMUPendingTile
+{
+    uint64_t seq; // tiles are written in the order they were queued
+    uint64_t ovrLevel;
+    uint64_t band;
+    uint64_t x;
+    uint64_t y;
+    uint8_t compression;
+    GByte *pCompressed;
+    size_t compressedSize;
+    size_t uncompressedSize;
+};
+
+// INTERLEAVE=PIXEL: a block that is waiting for the rest 
+// of the bands to be written before it can be compressed
+struct EMUInterleavedTile
+{
+    GByte *pData; // one packed nXValid * nYValid plane per band
+    std::vector<bool> bandsDone;
+    int nBandsDone;
+    int nXValid;
+    int nYValid;
+};
+
 class EMUDataset final: public GDALDataset
 {
 public:
-    EMUDataset(VSILFILE *, GDALDataType eType, int nXSize, int nYSize, GDALAccess eInAccess, bool bCloudOptimised, int nTileSize);
+    EMUDataset(VSILFILE *, GDALDataType eType, int nXSize, int nYSize, GDALAccess eInAccess, bool bCloudOptimised, 
+                int nTileXSize, int nTileYSize);
     ~EMUDataset();
 
     static GDALDataset *Open( GDALOpenInfo * );
@@ -105,6 +275,11 @@ public:
     virtual char** GetMetadata(const char *pszDomain="") override;
     virtual CPLErr SetMetadata(char **papszMetadata, const char *pszDomain="") override;
 
+    virtual CPLErr IRasterIO( GDALRWFlag eRWFlag, int nXOff, int nYOff, int nXSize, int nYSize,
+                            void *pData, int nBufXSize, int nBufYSize, GDALDataType eBufType,
+                            int nBandCount, BANDMAP_TYPE panBandMap, GSpacing nPixelSpace, 
+                            GSpacing nLineSpace, GSpacing nBandSpace, 
+                            GDALRasterIOExtraArg *psExtraArg ) override;
     
 protected:
     virtual CPLErr IBuildOverviews(const char *pszResampling, int nOverviews, const int *panOverviewList, 
@@ -115,24 +290,155 @@ private:
     void setTileOffset(uint64_t o, uint64_t band, uint64_t x, 
         uint64_t y, vsi_l_offset offset, uint64_t size, uint64_t uncompressedSize);
     EMUTileValue getTileOffset(uint64_t o, uint64_t band, uint64_t x, uint64_t y);
+    EMUTileGrid *createTileGrid(uint64_t o, uint64_t band, uint64_t nXBlocks, 
+        uint64_t nYBlocks, vsi_l_offset fileOffset);
+    void loadTileGrid(EMUTileGrid *pGrid);
+    // file handles for reading tiles so readers don't need to share m_fp
+    VSILFILE *acquireReadHandle();
+    void releaseReadHandle(VSILFILE *fp);
+    // nullptr if the file isn't mapped or the range is outside it
+    const GByte *getMappedData(vsi_l_offset offset, vsi_l_offset nSize) const
+    {
+        if( (m_pMappedData == nullptr) || (offset > m_nMappedSize) || (nSize > m_nMappedSize - offset) )
+        {
+            return nullptr;
+        }
+        return m_pMappedData + offset;
+    }
+    // NUM_THREADS option (or GDAL_NUM_THREADS)
+    static int GetNumThreads(char **papszOptions);
+    // threads for decompressing tiles when prefetching. nullptr if only one thread.
+    EMUThreadPool *getReadPool();
+    // multi threaded writing
+    void startWriterThreads(int nThreads, bool bUpload);
+    CPLErr queueTile(uint64_t o, uint64_t band, uint64_t x, uint64_t y, 
+        uint8_t compression, GByte *pData, int nXValid, int nYValid, int nTypeSize);
+    CPLErr stopWriterThreads();
+    void writerLoop();
+    // compress and write a tile on this thread
+    CPLErr writeTile(uint64_t o, uint64_t band, uint64_t x, uint64_t y, 
+        uint8_t compression, const GByte *pData, int nXValid, int nYValid, int nTypeSize);
+    void addTileWriteStats(size_t compressedSize);
+    vsi_l_offset writeIndexAndHeader();
+    // HEADER_FIRST. Leave enough space after the signature for the tile index 
+    // and header. nExtra is for the metadata, projection and RATs.
+    void reserveHeaderSpace(size_t nExtra);
+    void writeIOStats();
+    // just goes in the index - see EMU_TILE_CONSTANT
+    CPLErr writeConstantTile(uint64_t o, uint64_t band, uint64_t x, uint64_t y, uint64_t nValue);
+    // INTERLEAVE=PIXEL. pData is a full block.
+    CPLErr addInterleavedBlock(uint64_t o, uint64_t band, uint64_t x, uint64_t y, 
+        const GByte *pData, int nBlockXSize, int nXValid, int nYValid);
+    CPLErr writeInterleavedTile(const EMUTileKey &key, EMUInterleavedTile &tile);
+    CPLErr flushInterleavedTiles();
+    // RAW_COPY. True if the tiles of level o (0 for full res) of pSrcDS can be 
+    // copied as they are, ie they are laid out and compressed the same as this.
+    bool canCopyTilesRaw(EMUDataset *pSrcDS, uint64_t o);
+    // copy the compressed tiles of level o of pSrcDS straight into this file
+    bool copyTilesRaw(EMUDataset *pSrcDS, uint64_t o, int &nDoneBlocks, int nTotalBlocks, 
+        GDALProgressFunc pfnProgress, void *pProgressData);
+    // read nSize bytes of tiles starting at offset (the compression byte of the first)
+    bool readRawTiles(vsi_l_offset offset, size_t nSize, GByte *pData);
+    // append tiles read by readRawTiles from pSrcDS (the first starts at srcOffset) 
+    // and put them in the index. keys and vals are the tiles in the order they are in pData.
+    CPLErr writeRawTiles(const std::vector<EMUTileKey> &keys, const std::vector<EMUTileValue> &vals, 
+        vsi_l_offset srcOffset, const GByte *pData, size_t nSize);
+    uint8_t getTileCompression() const
+    {
+        uint8_t compression = m_nCompression | ((m_nFilter << FILTER_SHIFT) & FILTER_MASK);
+        return (m_nTileStrips > 1) ? (compression | COMPRESSION_STRIPS) : compression;
+    }
+    // TILE_STRIPS. nYSize is the rows of the tile (all the bands for INTERLEAVE=PIXEL)
+    uint32_t getRowsPerStrip(int nYSize)
+    {
+        int nPlaneRows = m_bPixelInterleaved ? nYSize / GetRasterCount() : nYSize;
+        return std::max<uint32_t>(1, (nPlaneRows + m_nTileStrips - 1) / m_nTileStrips);
+    }
+
     static VSILFILE *CreateEMU(const char * pszFilename,
                                 int nXSize, int nYSize, int nBands,
-                                GDALDataType eType);
+                                GDALDataType eType, uint8_t nCompression);
 
 
     void UpdateMetadataList();
+    void UpdateCacheMetadata(const char *pszName);
+    void UpdateImageStructureMetadata();
+    void writePadding(vsi_l_offset offset);
 
     VSILFILE  *m_fp = nullptr;
+    CPLString m_osFilename;
     OGRSpatialReference m_oSRS{};
-    std::unordered_map<EMUTileKey, EMUTileValue> m_tileOffsets;
+    std::vector<std::vector<std::unique_ptr<EMUTileGrid> > > m_tileGrids; // [band - 1][ovrLevel]
     double m_padfTransform[6];
-    uint32_t m_tileSize;
+    uint32_t m_tileXSize; // of the full res bands
+    uint32_t m_tileYSize;
     std::shared_ptr<std::mutex> m_mutex;
     GDALDataType m_eType;
     bool m_bCloudOptimised;
+    int m_nVersion = EMU_VERSION; // of the file being read
     char               **m_papszMetadataList; // CPLStringList of metadata
+    // from the COMPRESS, LEVEL and FILTER creation options
+    uint8_t m_nCompression = COMPRESSION_ZLIB;
+    int m_nCompressLevel = COMPRESSION_DFLT_LEVEL;
+    uint8_t m_nFilter = FILTER_NONE; // only used for tiles
+    bool m_bPixelInterleaved = false; // EMU_FLAG_PIXEL_INTERLEAVED
+    uint32_t m_nTileStrips = 1; // TILE_STRIPS. 1 if tiles aren't split.
+    char **m_papszImageStructure = nullptr; // for the IMAGE_STRUCTURE domain
+    // OVERVIEWS or OVERVIEW_RESAMPLING creation options. Overview blocks
+    // are made as the full res blocks are written.
+    bool m_bGenerateOverviews = false;
+    EMUResampling m_eOverviewResampling = RESAMPLE_AVERAGE;
+    bool m_bFullResWritten = false; // too late to add overviews
+    bool m_bCollectStats = false; // STATISTICS creation option
+    // HEADER_FIRST space left at the start of the file. 0 if not reserved.
+    vsi_l_offset m_nHeaderSpaceStart = 0;
+    vsi_l_offset m_nHeaderSpaceSize = 0;
+
+    // INTERLEAVE=PIXEL blocks not yet written. band is always 0 in the key.
+    std::unordered_map<EMUTileKey, EMUInterleavedTile> m_interleavedTiles;
+    std::mutex m_interleavedMutex;
+
+    // only set when creating with NUM_THREADS > 1
+    EMUThreadPool *m_pCompressPool = nullptr;
+    std::thread m_writerThread;
+    std::mutex m_writerMutex;
+    std::condition_variable m_writerCond;
+    std::map<uint64_t, EMUPendingTile> m_compressedTiles; // by seq
+    uint64_t m_nNextQueueSeq = 0;
+    uint64_t m_nNextWriteSeq = 0;
+    size_t m_nTilesInFlight = 0;
+    size_t m_nMaxTilesInFlight = 0;
+    bool m_bWriterStop = false;
+    bool m_bWriteError = false;
+
+    // nullptr unless EMU_CACHE_MB is set
+    EMUTileCache *m_pTileCache = nullptr;
+    uint64_t m_nCacheFileId = 0;
+    char **m_papszCacheMetadata = nullptr; // for the EMU_CACHE domain
+
+    // counters and timers for the EMU_STATS domain
+    EMUIOStats m_ioStats;
+    char **m_papszIOStatsMetadata = nullptr;
+
+    // handles not currently in use by IReadBlock
+    std::vector<VSILFILE*> m_readHandles;
+    std::mutex m_handleMutex;
+
+    // created on first use from GDAL_NUM_THREADS
+    EMUThreadPool *m_pReadPool = nullptr;
+    std::once_flag m_readPoolOnce;
+
+    // nullptr unless EMU_READAHEAD is set (and the file isn't mapped)
+    EMUReadAhead *m_pReadAhead = nullptr;
+
+    // local files are mapped when reading unless EMU_USE_MMAP=NO
+    CPLVirtualMem *m_pMapped = nullptr;
+    const GByte *m_pMappedData = nullptr;
+    vsi_l_offset m_nMappedSize = 0;
     
     friend class EMUBaseBand;
     friend class EMURat;
+    friend class EMUReadAhead;
+    friend class EMUDrillDataset;
 };
 #endif //EMUDATASET_H
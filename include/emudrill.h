@@ -0,0 +1,123 @@
+/*
+ *  emudrill.h
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef EMUDRILL_H
+#define EMUDRILL_H
+
+#include <vector>
+
+#include "gdal_priv.h"
+
+#include "emudataset.h"
+#include "emuiostats.h"
+
+// prefix of the names opened as an EMUDrillDataset
+#define EMU_DRILL_PREFIX "EMU_DRILL:"
+
+// a pixel wanted from a tile
+struct EMUDrillPixel
+{
+    int nPoint;
+    int nCol;  // within the tile
+    int nRow;
+};
+
+// a tile of one of the files with the pixels that are wanted from it
+struct EMUDrillTile
+{
+    uint64_t keyBand; // as in the tile index (always 1 for INTERLEAVE=PIXEL)
+    int x;
+    int y;
+    EMUTileValue val;
+    int nXValid;
+    int nYValid;
+    std::vector<EMUDrillPixel> pixels;
+    const Bytef *pTileData; // compression byte then the data once read
+};
+
+// EMU_DRILL:<file list> - the values at a set of points in each of a list of 
+// EMU files (eg a time series of scenes) in one go. Every file is opened and 
+// the tiles holding the points found in its index, then they are fetched with 
+// one VSIFReadMultiRangeL call per file (merging nearby tiles) and just the 
+// wanted pixels decoded. Files are done in parallel (NUM_THREADS open option, 
+// or GDAL_NUM_THREADS). The whole lot is done in Open and the result is a 
+// raster one row per file and one column per point, with the bands and data 
+// type of the first file. Points outside a file (or that couldn't be read) 
+// get the nodata of the first file (or 0 if it doesn't have one).
+class EMUDrillDataset final: public GDALDataset
+{
+public:
+    EMUDrillDataset(int nPoints, int nFiles, int nBandsIn, GDALDataType eType);
+    ~EMUDrillDataset();
+
+    static GDALDataset *Open(GDALOpenInfo *);
+    static int Identify(GDALOpenInfo *);
+
+    virtual const char *GetMetadataItem(const char *pszName, 
+        const char *pszDomain="") override;
+    virtual char** GetMetadata(const char *pszDomain="") override;
+
+private:
+    // fills in row nFile of the result from pDS (which is closed afterwards)
+    void drillFile(int nFile, const CPLString &osFilename, EMUDataset *pSrcDS);
+    bool getPixelCoords(EMUDataset *pDS, std::vector<double> &pixelCoords);
+    GByte *getValue(int nBand, int nFile, int nPoint)
+    {
+        return &m_data[((static_cast<size_t>(nBand) * nRasterYSize + nFile) * nRasterXSize + 
+                nPoint) * m_nTypeSize];
+    }
+
+    GDALDataType m_eType;
+    int m_nTypeSize;
+    std::vector<GByte> m_data;    // [band][file][point]
+    std::vector<double> m_points; // x, y for each point
+    bool m_bPixelCoords = false;  // COORDS=PIXEL
+    EMUIOStats m_ioStats;         // all the files added together
+    char **m_papszMetadataList = nullptr;
+    char **m_papszIOStatsMetadata = nullptr;
+
+    friend class EMUDrillBand;
+};
+
+// a row of the results for each file. One block per row.
+class EMUDrillBand final: public GDALRasterBand
+{
+public:
+    EMUDrillBand(EMUDrillDataset *pDS, int nBandIn, double dNoData, bool bNoDataSet);
+
+    virtual CPLErr IReadBlock(int, int, void *) override;
+    virtual double GetNoDataValue(int *pbSuccess = nullptr) override;
+
+private:
+    double m_dNoData;
+    bool m_bNoDataSet;
+};
+
+#endif //EMUDRILL_H
@@ -0,0 +1,80 @@
+/*
+ *  emuheadercache.h
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef EMUHEADERCACHE_H
+#define EMUHEADERCACHE_H
+
+#include <string>
+#include <vector>
+
+#include "cpl_vsi.h"
+
+// A copy of the tile index and header of a file. The tile grids are written 
+// just before the header so this is one range of the file.
+struct EMUIndexCopy
+{
+    vsi_l_offset nStart = 0;        // first tile grid (or the header if none)
+    vsi_l_offset nHeaderOffset = 0;
+    vsi_l_offset nHeaderEnd = 0;
+    std::vector<GByte> data;        // bytes nStart to nHeaderEnd of the file
+};
+
+// What tells us whether a file has changed since it was last opened. The 
+// ETag for /vsis3, /vsigs, /vsiaz and /vsicurl files (which changes whenever 
+// the object is rewritten, unlike the one second modification time) and 
+// the modification time for local files. Empty if neither is available.
+std::string getFileValidator(const char *pszFilename);
+
+// On disk cache of the tile index and header of files that are opened 
+// through /vsi (/vsis3 etc) so opening the same file again doesn't need 
+// to fetch them. Set the EMU_HEADER_CACHE_DIR config option to the directory 
+// to use. Entries are keyed by the name, size, validator (getFileValidator) 
+// and header offset of the file and are ignored unless all of these match. 
+// Nothing is ever removed so the directory can be cleaned up whenever needed.
+class EMUHeaderCache
+{
+public:
+    // returns nullptr if the cache isn't enabled
+    static EMUHeaderCache *getInstance();
+
+    // false if not found (or the copy doesn't end at nHeaderEnd)
+    bool get(const char *pszFilename, vsi_l_offset nFileSize, const std::string &osValidator, 
+                vsi_l_offset nHeaderOffset, vsi_l_offset nHeaderEnd, EMUIndexCopy *pCopy);
+    void put(const char *pszFilename, vsi_l_offset nFileSize, const std::string &osValidator, 
+                const EMUIndexCopy &copy);
+
+private:
+    explicit EMUHeaderCache(const char *pszDir);
+    std::string getPath(const std::string &osKey) const;
+
+    std::string m_osDir;
+};
+
+#endif //EMUHEADERCACHE_H
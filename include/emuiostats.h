@@ -0,0 +1,158 @@
+/*
+ *  emuiostats.h
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef EMUIOSTATS_H
+#define EMUIOSTATS_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include "cpl_string.h"
+
+// what is counted for each dataset. Times are in nanoseconds and 
+// the names (see EMUIOStats::getName) are used in the EMU_STATS 
+// metadata domain.
+enum EMUIOCounter
+{
+    EMU_IO_BYTES_READ = 0,  // tiles, RAT chunks and the header (including from a mapped file)
+    EMU_IO_READ_CALLS,      // VSIFReadL/VSIFReadMultiRangeL calls
+    EMU_IO_BYTES_WRITTEN,
+    EMU_IO_WRITE_CALLS,
+    EMU_IO_TILES_READ,      // decompressed
+    EMU_IO_TILES_FILLED,    // constant or never written
+    EMU_IO_TILES_WRITTEN,
+    EMU_IO_CONSTANT_TILES_WRITTEN,
+    EMU_IO_COMPRESS_NS,
+    EMU_IO_DECOMPRESS_NS,
+    EMU_IO_MUTEX_WAIT_NS,   // waiting for the lock on the file
+    EMU_IO_WRITER_WAIT_NS,  // IWriteBlock waiting for the compression threads to catch up
+    EMU_IO_CACHE_HITS,      // EMU_CACHE_MB tile cache
+    EMU_IO_CACHE_MISSES,
+    EMU_IO_READAHEAD_TILES, // read by the EMU_READAHEAD threads
+    EMU_IO_READAHEAD_HITS,  // of those, the ones IReadBlock used
+    EMU_IO_READAHEAD_WAIT_NS, // IReadBlock waiting for a tile still being read ahead
+    EMU_IO_STRIPS_READ,     // TILE_STRIPS strips decompressed for reads of part of a tile
+    EMU_IO_TILES_COPIED,    // RAW_COPY tiles copied from another EMU file without decoding
+    EMU_IO_TILES_CONVERTED, // converted straight into a RasterIO buffer of another type
+    EMU_IO_RAT_READ_NS,
+    EMU_IO_RAT_WRITE_NS,
+    EMU_IO_OPEN_NS,
+    EMU_IO_CLOSE_NS,
+    EMU_IO_COUNTER_COUNT
+};
+
+// compressed tile sizes are counted in power of 2 buckets. Bucket 0 is 
+// empty tiles, bucket n is sizes from 2^(n-1) up to (but not including) 2^n.
+const int EMU_IO_SIZE_BUCKETS = 40;
+
+// Counters that can be updated from any thread
+class EMUIOStats
+{
+public:
+    EMUIOStats();
+
+    void add(EMUIOCounter eCounter, uint64_t nValue)
+    {
+        m_counters[eCounter].fetch_add(nValue, std::memory_order_relaxed);
+    }
+    uint64_t get(EMUIOCounter eCounter) const
+    {
+        return m_counters[eCounter].load(std::memory_order_relaxed);
+    }
+    void addCompressedSize(uint64_t nSize);
+    static const char *getName(EMUIOCounter eCounter);
+
+    // for timing
+    static uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // NAME=value for each counter plus COMPRESSED_SIZE_HISTOGRAM 
+    // (pipe separated counts up to the last bucket used). Only 
+    // updates pszName if given.
+    char **getMetadata(char **papszMetadata, const char *pszName) const;
+    // one line of JSON
+    std::string toJSON(const char *pszFilename) const;
+
+private:
+    std::string getHistogram(const char *pszSeparator) const;
+
+    std::atomic<uint64_t> m_counters[EMU_IO_COUNTER_COUNT];
+    std::atomic<uint64_t> m_sizeBuckets[EMU_IO_SIZE_BUCKETS];
+};
+
+// adds the time between construction and destruction to a counter
+class EMUIOTimer
+{
+public:
+    EMUIOTimer(EMUIOStats &stats, EMUIOCounter eCounter)
+        : m_stats(stats), m_eCounter(eCounter), m_nStart(EMUIOStats::now())
+    {
+    }
+    ~EMUIOTimer()
+    {
+        m_stats.add(m_eCounter, EMUIOStats::now() - m_nStart);
+    }
+    EMUIOTimer(const EMUIOTimer&) = delete;
+    EMUIOTimer &operator=(const EMUIOTimer&) = delete;
+
+private:
+    EMUIOStats &m_stats;
+    EMUIOCounter m_eCounter;
+    uint64_t m_nStart;
+};
+
+// like std::lock_guard but records how long it waited (EMU_IO_MUTEX_WAIT_NS)
+class EMUTimedLock
+{
+public:
+    EMUTimedLock(std::mutex &mutex, EMUIOStats &stats)
+        : m_mutex(mutex)
+    {
+        uint64_t nStart = EMUIOStats::now();
+        m_mutex.lock();
+        stats.add(EMU_IO_MUTEX_WAIT_NS, EMUIOStats::now() - nStart);
+    }
+    ~EMUTimedLock()
+    {
+        m_mutex.unlock();
+    }
+    EMUTimedLock(const EMUTimedLock&) = delete;
+    EMUTimedLock &operator=(const EMUTimedLock&) = delete;
+
+private:
+    std::mutex &m_mutex;
+};
+
+#endif //EMUIOSTATS_H
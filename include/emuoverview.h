@@ -0,0 +1,57 @@
+/*
+ *  emuoverview.h
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef EMUOVERVIEW_H
+#define EMUOVERVIEW_H
+
+#include "gdal_priv.h"
+
+// methods for generating overviews as the full res blocks are written
+enum EMUResampling
+{
+    RESAMPLE_NEAREST,
+    RESAMPLE_AVERAGE,
+    RESAMPLE_MODE
+};
+
+// returns false if pszName isn't one we support
+bool getResampling(const char *pszName, EMUResampling *peResampling);
+
+// Reduce a block by nFactor in each direction. pSrc has nSrcXSize pixels per
+// line and the result is written to pDst which has nDstXSize pixels per line.
+// Only the first nXValid x nYValid pixels of pDst are filled, and the source 
+// must have at least nXValid * nFactor x nYValid * nFactor valid pixels.
+// Pixels equal to the nodata value (if bNoData is set) or NaN are ignored 
+// for AVERAGE and MODE. Returns false if eType isn't supported.
+bool reduceBlock(EMUResampling eResampling, GDALDataType eType, int nFactor,
+            const void *pSrc, int nSrcXSize, void *pDst, int nDstXSize, 
+            int nXValid, int nYValid, bool bNoData, double dfNoData);
+
+#endif //EMUOVERVIEW_H
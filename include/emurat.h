@@ -31,6 +31,8 @@
 #ifndef EMURAT_H
 #define EMURAT_H
 
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 #include <mutex>
@@ -40,6 +42,14 @@
 #include "emudataset.h"
 
 const int MAX_RAT_CHUNK = 256 * 256;
+// how the values in each RAT chunk are stored (from EMU_VERSION 2)
+const uint8_t RAT_ENCODING_PLAIN = 0;      // int64, double or null separated strings
+const uint8_t RAT_ENCODING_FLOAT32 = 1;    // reals that fit in a float
+const uint8_t RAT_ENCODING_PACKED = 2;     // integers as offsets from the minimum, bit packed
+const uint8_t RAT_ENCODING_DICTIONARY = 3; // distinct strings then bit packed indexes into them
+
+// decoded chunks kept for each column
+const size_t RAT_CHUNK_CACHE_SIZE = 4;
 
 class EMURasterBand;
 
@@ -51,11 +61,32 @@ struct EMURatChunk
     uint64_t compressedSize;
 };
 
+// stored as they are in EMU_SECTION_RAT_CHUNKS
+static_assert(sizeof(EMURatChunk) == 4 * sizeof(uint64_t), "EMURatChunk must not be padded");
+
+struct EMURatDecodedChunk
+{
+    std::vector<GByte> data;            // uncompressed
+    std::vector<size_t> stringOffsets;  // GFT_String only - where each row starts in data
+};
+
+// part of a ValuesIO request that comes from one chunk
+struct EMURatSegment
+{
+    uint64_t nDestRow;   // from the start of the request
+    uint64_t nRows;
+    uint64_t nChunkRow;  // first row within the chunk
+    std::shared_ptr<EMURatDecodedChunk> pChunk; // nullptr for rows never written
+};
+
 struct EMURatColumn
 {
     std::string sName;
     GDALRATFieldType colType;
-    std::vector<EMURatChunk> chunks;
+    std::vector<EMURatChunk> chunks; // sorted by startIdx. Can overlap if rows are written again.
+    uint64_t nMaxChunkLength = 0;    // of any of chunks
+    // recently decoded chunks (by index into chunks). Most recently used last.
+    std::vector<std::pair<size_t, std::shared_ptr<EMURatDecodedChunk> > > cache;
 };
 
 class EMURat final: public GDALRasterAttributeTable
@@ -95,10 +126,26 @@ public:
     virtual CPLErr        CreateColumn( const char *pszFieldName, 
                                 GDALRATFieldType eFieldType, 
                                 GDALRATFieldUsage eFieldUsage ) override;
-    void ReadIndex();
-    void WriteIndex();
+    // pChunkTable is the EMU_SECTION_RAT_CHUNKS section (version 2), otherwise 
+    // the chunks are read straight after each column. False if the column 
+    // points outside pChunkTable.
+    bool ReadIndex(EMUHeaderReader &reader, const std::vector<EMURatChunk> *pChunkTable);
+    // the chunks of each column are appended to chunkTable
+    void WriteIndex(EMUHeaderWriter &writer, std::vector<EMURatChunk> &chunkTable);
 
 private:
+    bool checkRequest(int iField, int iStartRow, int *piLength, bool *pbOK) const;
+    void addChunk(int iField, const EMURatChunk &chunk);
+    CPLErr writeChunk(int iField, uint64_t nStartRow, uint64_t nLength, 
+                uint8_t nEncoding, const Bytef *pData, size_t nSize);
+    CPLErr readChunks(int iField, const std::vector<size_t> &toRead, 
+                std::map<size_t, std::shared_ptr<EMURatDecodedChunk> > &decoded);
+    CPLErr getSegments(int iField, uint64_t nStartRow, uint64_t nLength, 
+                std::vector<EMURatSegment> &segments);
+    template <class S, class T> 
+    CPLErr readValues(int iField, uint64_t nStartRow, uint64_t nLength, T *pData);
+    template <class S, class T> 
+    CPLErr writeValues(int iField, uint64_t nStartRow, uint64_t nLength, const T *pData);
 
     EMUDataset *m_pEMUDS;
     EMURasterBand *m_pEMUBand;
@@ -0,0 +1,119 @@
+/*
+ *  emureadahead.h
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef EMUREADAHEAD_H
+#define EMUREADAHEAD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "emudataset.h"
+#include "emutilecache.h"
+
+class EMUBaseBand;
+
+// most threads used for reading ahead (also limited by EMU_READAHEAD)
+const int READAHEAD_MAX_THREADS = 8;
+
+// a tile being read ahead (or that has been)
+struct EMUReadAheadTile
+{
+    bool bDone = false;
+    bool bDropped = false;                       // not wanted any more but still being read
+    std::shared_ptr<const EMUCacheEntry> pEntry; // decompressed. nullptr if it failed
+    size_t nBytes = 0;                           // counted against the budget
+};
+
+// Where the reads of one band of one level have got to. Reads are of 
+// windows of tiles (one tile for IReadBlock) working across then down.
+struct EMUReadAheadStream
+{
+    // the last window (inclusive)
+    uint64_t nXStart;
+    uint64_t nYStart;
+    uint64_t nXEnd;
+    uint64_t nYEnd;
+    // the columns of tiles being read (from where the last row of windows started and ended)
+    uint64_t nRowStart;
+    uint64_t nRowEnd;
+    bool bInOrder; // last window came straight after the one before
+};
+
+// Reads tiles ahead of IReadBlock once they are being asked for in order 
+// (as for scanline reads, gdal_translate and RIOS). The next tiles are read 
+// and decompressed on our own threads and held until IReadBlock (or 
+// prefetchBlocks) wants them, so the latency of /vsis3 etc is hidden.
+// GDAL's block cache isn't safe to use from the threads which is why 
+// the tiles are held here. Set EMU_READAHEAD=N to enable.
+class EMUReadAhead
+{
+public:
+    // read up to nTiles ahead, holding no more than nMaxBytes at once
+    EMUReadAhead(EMUDataset *pDS, int nTiles, size_t nMaxBytes);
+    // anything not finished is abandoned
+    ~EMUReadAhead();
+
+    // pBand is about to read the tiles from nXStart, nYStart to nXEnd, nYEnd 
+    // (inclusive). Queues the next ones if they are being read in order.
+    void notify(EMUBaseBand *pBand, uint64_t nXStart, uint64_t nYStart, 
+                uint64_t nXEnd, uint64_t nYEnd);
+    // returns the tile if it has been read ahead, waiting for it if it 
+    // is still being read. nullptr if it hasn't been (or the read failed).
+    std::shared_ptr<const EMUCacheEntry> take(const EMUTileKey &key);
+
+private:
+    // nYValid includes all the bands in the tile (INTERLEAVE=PIXEL)
+    bool queueTile(const EMUTileKey &key, const EMUTileValue &val, 
+                int nTypeSize, int nXValid, int nYValid);
+    void readTile(std::shared_ptr<EMUReadAheadTile> pTile, EMUTileKey key, EMUTileValue val, 
+                int nTypeSize, int nXValid, int nYValid);
+    // forget the tiles for the stream, or just those the window starting 
+    // at nXStart, nYStart and ending on row nYEnd has gone past
+    void dropTiles(uint64_t nLevel, uint64_t nBand, bool bAll, 
+                uint64_t nXStart, uint64_t nYStart, uint64_t nYEnd);
+
+    EMUDataset *m_pDS;
+    int m_nTiles;
+    size_t m_nMaxBytes;
+    EMUThreadPool *m_pPool;
+    std::atomic<bool> m_bStop;
+
+    std::mutex m_mutex;
+    std::condition_variable m_doneCond;
+    std::unordered_map<EMUTileKey, std::shared_ptr<EMUReadAheadTile> > m_tiles;
+    size_t m_nBytes = 0; // of everything in m_tiles and the dropped tiles still being read
+    std::map<std::pair<uint64_t, uint64_t>, EMUReadAheadStream> m_streams; // by (level, band)
+};
+
+#endif //EMUREADAHEAD_H
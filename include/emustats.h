@@ -0,0 +1,86 @@
+/*
+ *  emustats.h
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef EMUSTATS_H
+#define EMUSTATS_H
+
+#include <mutex>
+#include <vector>
+
+#include "gdal_priv.h"
+
+const int EMU_HISTO_BINS = 256;
+
+// Statistics and histogram collected from the blocks as they are written 
+// so there is no need for another pass over the data. Nodata, NaN and
+// infinite pixels are ignored. The histogram starts with bins of width 1 
+// (for integer types) and doubles the bin width (merging pairs of bins) 
+// whenever a value falls outside the range covered. Safe to call addBlock 
+// from more than one thread.
+class EMUStatsAccumulator
+{
+public:
+    EMUStatsAccumulator(GDALDataType eType, bool bNoData, double dfNoData);
+
+    // add the first nXValid x nYValid pixels of pData which has
+    // nLineSize pixels per line. Returns false if eType isn't supported.
+    bool addBlock(const void *pData, int nLineSize, int nXValid, int nYValid);
+
+    // false if there haven't been any valid pixels
+    bool getStatistics(double *pdfMin, double *pdfMax, double *pdfMean, double *pdfStdDev);
+    // the range and counts as GDAL's STATISTICS_HISTO* metadata expects
+    bool getHistogram(double *pdfMin, double *pdfMax, std::vector<uint64_t> &counts);
+
+private:
+    template <class T> void addTyped(const T *pData, int nLineSize, int nXValid, int nYValid);
+    void growHistogram(double dfMin, double dfMax);
+    double getBinEdge(int n) const;
+
+    std::mutex m_mutex;
+    GDALDataType m_eType;
+    bool m_bInteger;
+    bool m_bNoData;
+    double m_dfNoData;
+
+    // running values. m_dM2 is the sum of squared differences from the mean.
+    uint64_t m_nCount = 0;
+    double m_dMean = 0;
+    double m_dM2 = 0;
+    double m_dMin = 0;
+    double m_dMax = 0;
+
+    // bin n covers m_dHistOrigin + n * m_dHistWidth up to the next bin.
+    // m_dHistWidth is 0 until the first value is seen.
+    std::vector<uint64_t> m_histogram;
+    double m_dHistOrigin = 0;
+    double m_dHistWidth = 0;
+};
+
+#endif //EMUSTATS_H
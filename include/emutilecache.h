@@ -0,0 +1,139 @@
+/*
+ *  emutilecache.h
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef EMUTILECACHE_H
+#define EMUTILECACHE_H
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "emudataset.h"
+
+// identifies a tile in a particular file
+struct EMUCacheKey
+{
+    uint64_t fileId;
+    EMUTileKey tile;
+    
+    bool operator==(const EMUCacheKey &other) const
+    {
+        return (fileId == other.fileId) && (tile == other.tile);
+    }
+};
+
+template <>
+struct std::hash<EMUCacheKey>
+{
+    std::size_t operator()(const EMUCacheKey& k) const
+    {
+        return std::hash<uint64_t>{}(k.fileId) ^ (std::hash<EMUTileKey>{}(k.tile) << 1);
+    }
+};
+
+// A cached tile. Either the data as it is in the file (compression 
+// byte then the compressed data) or the decompressed (packed) pixels.
+struct EMUCacheEntry
+{
+    bool bDecompressed;
+    std::vector<GByte> data;
+};
+
+// what a file was like when its id was given out
+struct EMUCacheFile
+{
+    uint64_t nId;
+    uint64_t nFileSize;
+    std::string osValidator; // from getFileValidator
+};
+
+// Process wide LRU cache of tiles read from EMU files, so tiles that are 
+// evicted from GDAL's block cache don't have to be fetched again. 
+// Datasets opened on the same file share entries.
+// Set the EMU_CACHE_MB config option to enable and EMU_CACHE_DECOMPRESSED=YES
+// to cache the decompressed pixels rather than the compressed tiles.
+// These are read the first time the cache is needed.
+class EMUTileCache
+{
+public:
+    // returns nullptr if the cache isn't enabled
+    static EMUTileCache *getInstance();
+    
+    // returns the id to use in keys for this file. Files with the same
+    // name, size and validator (the ETag or modification time, see 
+    // getFileValidator) get the same id. An empty validator always gets 
+    // a new id as we can't tell whether the file has changed.
+    uint64_t getFileId(const std::string &osFilename, uint64_t nFileSize, const std::string &osValidator);
+    // the file is being (re)written, so the next getFileId gives a new id 
+    // even if the size and validator (eg the modification time, to the 
+    // second) are the same
+    void forgetFile(const std::string &osFilename);
+    
+    // returns nullptr if not found
+    std::shared_ptr<const EMUCacheEntry> get(const EMUCacheKey &key);
+    void put(const EMUCacheKey &key, const GByte *pData, size_t nSize, bool bDecompressed);
+    
+    bool cachesDecompressed() const
+    {
+        return m_bDecompressed;
+    }
+    uint64_t getHits() const
+    {
+        return m_nHits;
+    }
+    uint64_t getMisses() const
+    {
+        return m_nMisses;
+    }
+    size_t getUsedBytes();
+    
+private:
+    EMUTileCache(size_t nMaxBytes, bool bDecompressed);
+    void evict();
+    
+    typedef std::pair<EMUCacheKey, std::shared_ptr<const EMUCacheEntry> > EMUCacheItem;
+
+    std::mutex m_mutex;
+    std::list<EMUCacheItem> m_lru; // most recently used at the front
+    std::unordered_map<EMUCacheKey, std::list<EMUCacheItem>::iterator> m_map;
+    std::unordered_map<std::string, EMUCacheFile> m_fileIds;
+    uint64_t m_nNextFileId = 1;
+    size_t m_nUsedBytes = 0;
+    size_t m_nMaxBytes;
+    bool m_bDecompressed;
+    std::atomic<uint64_t> m_nHits;
+    std::atomic<uint64_t> m_nMisses;
+};
+
+#endif //EMUTILECACHE_H
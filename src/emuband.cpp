@@ -30,16 +30,21 @@
 
 #include <limits> 
 #include <cmath>
+#include <algorithm>
 
 #include "emuband.h"
 #include "emucompress.h"
+#include "emuoverview.h"
+#include "emutilecache.h"
+#include "emureadahead.h"
 
 EMUBaseBand::EMUBaseBand(EMUDataset *pDataset, int nBandIn, GDALDataType eType, 
-        uint64_t nLevel, int nXSize, int nYSize, int nBlockSize, const std::shared_ptr<std::mutex>& other)
+        uint64_t nLevel, int nXSize, int nYSize, int nBlockXSizeIn, int nBlockYSizeIn, 
+        const std::shared_ptr<std::mutex>& other)
 {
     poDS = pDataset;
-    nBlockXSize = nBlockSize;
-    nBlockYSize = nBlockSize;
+    nBlockXSize = nBlockXSizeIn;
+    nBlockYSize = nBlockYSizeIn;
     nBand = nBandIn;
     eDataType = eType;
     nRasterXSize = nXSize;
@@ -63,75 +68,517 @@ CPLErr EMUBaseBand::IReadBlock(int nBlockXOff, int nBlockYOff, void *pData)
         return CE_Failure;
     }
 
-    const std::lock_guard<std::mutex> lock(*m_mutex);
-
     EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
+    uint64_t nKeyBand = getTileKeyBand();
 
+    // no need to lock - the index doesn't change once the file is open
     EMUTileValue val;
     try
     {
-        val = poEMUDS->getTileOffset(m_nLevel, nBand, nBlockXOff, nBlockYOff);
+        val = poEMUDS->getTileOffset(m_nLevel, nKeyBand, nBlockXOff, nBlockYOff);
     }
     catch(const std::out_of_range& oor)
     {
         CPLError(CE_Failure, CPLE_FileIO,
                 "Couldn't find index for block %d %d.",
-                nBlockXOff, nBlockXOff);
+                nBlockXOff, nBlockYOff);
         return CE_Failure;
     }
+
+    EMUTileKey tileKey;
+    tileKey.ovrLevel = m_nLevel;
+    tileKey.band = nKeyBand;
+    tileKey.x = nBlockXOff;
+    tileKey.y = nBlockYOff;
+    EMUReadAhead *pReadAhead = poEMUDS->m_pReadAhead;
+    if( pReadAhead != nullptr )
+    {
+        // before anything else so the next tiles are on their way
+        pReadAhead->notify(this, nBlockXOff, nBlockYOff, nBlockXOff, nBlockYOff);
+    }
+
+    // with INTERLEAVE=PIXEL the tile has all the bands so fill in 
+    // the blocks for the other bands while we are at it
+    std::vector<GDALRasterBlock*> blocks;
+    std::vector<void*> bandData;
+
+    if( (val.offset == 0) || (val.offset == EMU_TILE_CONSTANT) )
+    {
+        // nothing to read
+        lockTileBlocks(nBlockXOff, nBlockYOff, pData, blocks, bandData);
+        fillBlock(val, bandData.data());
+        unlockTileBlocks(nBlockXOff, nBlockYOff, blocks, true);
+        poEMUDS->m_ioStats.add(EMU_IO_TILES_FILLED, 1);
+        return CE_None;
+    }
     
+    EMUTileCache *pCache = poEMUDS->m_pTileCache;
+    EMUCacheKey cacheKey;
+    std::shared_ptr<const EMUCacheEntry> pEntry;
+    if( pReadAhead != nullptr )
+    {
+        // tiles read ahead have already been looked for in (and added to) the cache
+        pEntry = pReadAhead->take(tileKey);
+    }
+    if( pCache != nullptr )
+    {
+        cacheKey.fileId = poEMUDS->m_nCacheFileId;
+        cacheKey.tile = tileKey;
+    }
+    if( (pCache != nullptr) && !pEntry )
+    {
+        pEntry = pCache->get(cacheKey);
+        poEMUDS->m_ioStats.add(pEntry ? EMU_IO_CACHE_HITS : EMU_IO_CACHE_MISSES, 1);
+    }
 
-    // seek to where this block starts    
-    VSIFSeekL(poEMUDS->m_fp, val.offset, SEEK_SET);
+    lockTileBlocks(nBlockXOff, nBlockYOff, pData, blocks, bandData);
+    
+    CPLErr err;
+    if( pEntry && pEntry->bDecompressed && (pEntry->data.size() == val.uncompressedSize) )
+    {
+        err = decodeBlock(nBlockXOff, nBlockYOff, val, pEntry->data.data(), true, nullptr, 
+                    bandData.data());
+        unlockTileBlocks(nBlockXOff, nBlockYOff, blocks, err == CE_None);
+        return err;
+    }
 
+    const Bytef *pSubData;
+    if( pEntry && !pEntry->bDecompressed && (pEntry->data.size() == val.size + 1) )
+    {
+        pSubData = pEntry->data.data();
+    }
+    else if( (pSubData = poEMUDS->getMappedData(val.offset, val.size + 1)) != nullptr )
+    {
+        // decompress straight out of the mapped file. Not worth
+        // caching the compressed data as it's in the page cache already.
+        poEMUDS->m_ioStats.add(EMU_IO_BYTES_READ, val.size + 1);
+    }
+    else if( (pCache == nullptr) && isDirectReadTile(val, bandData[0]) )
+    {
+        err = readTileDirect(nBlockXOff, nBlockYOff, val, bandData[0]);
+        unlockTileBlocks(nBlockXOff, nBlockYOff, blocks, err == CE_None);
+        return err;
+    }
+    else
+    {
+        // read the compression type and the data in one go using a file 
+        // handle that no other thread is using at the moment. The buffers 
+        // all belong to this thread and are re-used for the next tile.
+        Bytef *pReadData = getScratchBuffer(SCRATCH_TILEDATA, val.size + 1);
+        VSILFILE *fp = poEMUDS->acquireReadHandle();
+        if( fp == nullptr )
+        {
+            CPLError(CE_Failure, CPLE_OpenFailed,
+                    "Couldn't open file to read block %d %d.",
+                    nBlockXOff, nBlockYOff);
+            unlockTileBlocks(nBlockXOff, nBlockYOff, blocks, false);
+            return CE_Failure;
+        }
+        bool bOK = (VSIFSeekL(fp, val.offset, SEEK_SET) == 0) && 
+            (VSIFReadL(pReadData, val.size + 1, 1, fp) == 1);
+        poEMUDS->releaseReadHandle(fp);
+        poEMUDS->m_ioStats.add(EMU_IO_READ_CALLS, 1);
+        poEMUDS->m_ioStats.add(EMU_IO_BYTES_READ, val.size + 1);
+        if( !bOK )
+        {
+            CPLError(CE_Failure, CPLE_FileIO,
+                    "Failed to read block %d %d.",
+                    nBlockXOff, nBlockYOff);
+            unlockTileBlocks(nBlockXOff, nBlockYOff, blocks, false);
+            return CE_Failure;
+        }
+        if( (pCache != nullptr) && !pCache->cachesDecompressed() )
+        {
+            pCache->put(cacheKey, pReadData, val.size + 1, false);
+        }
+        pSubData = pReadData;
+    }
+
+    err = decodeBlock(nBlockXOff, nBlockYOff, val, pSubData, false, 
+                    (pCache != nullptr) ? &cacheKey : nullptr, bandData.data());
+    unlockTileBlocks(nBlockXOff, nBlockYOff, blocks, err == CE_None);
+    return err;
+}
+
+// COMPRESSION_NONE tiles of a single band that fill the whole block 
+// can be read straight into it
+bool EMUBaseBand::isDirectReadTile(const EMUTileValue &val, void *pData)
+{
+    int typeSize = GDALGetDataTypeSize(eDataType) / 8;
+    return (pData != nullptr) && (getTileBandCount() == 1) && (val.size == val.uncompressedSize) && 
+        (val.uncompressedSize == static_cast<uint64_t>(nBlockXSize) * nBlockYSize * typeSize);
+}
+
+// the compression byte and the data are read in one call, the data into pData. 
+// The size can match without the tile being plain COMPRESSION_NONE (eg a filter 
+// but no compression) in which case it is decoded as usual.
+CPLErr EMUBaseBand::readTileDirect(int nBlockXOff, int nBlockYOff, const EMUTileValue &val, void *pData)
+{
+    EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
+    VSILFILE *fp = poEMUDS->acquireReadHandle();
+    if( fp == nullptr )
+    {
+        CPLError(CE_Failure, CPLE_OpenFailed,
+                "Couldn't open file to read block %d %d.",
+                nBlockXOff, nBlockYOff);
+        return CE_Failure;
+    }
     uint8_t compression;
-    VSIFReadL(&compression, sizeof(compression), 1, poEMUDS->m_fp);
-    
+    void *rangeBufs[2] = {&compression, pData};
+    vsi_l_offset rangeStarts[2] = {val.offset, val.offset + 1};
+    size_t rangeSizes[2] = {1, static_cast<size_t>(val.size)};
+    bool bOK = VSIFReadMultiRangeL(2, rangeBufs, rangeStarts, rangeSizes, fp) == 0;
+    poEMUDS->releaseReadHandle(fp);
+    poEMUDS->m_ioStats.add(EMU_IO_READ_CALLS, 1);
+    poEMUDS->m_ioStats.add(EMU_IO_BYTES_READ, val.size + 1);
+    if( !bOK )
+    {
+        CPLError(CE_Failure, CPLE_FileIO,
+                "Failed to read block %d %d.",
+                nBlockXOff, nBlockYOff);
+        return CE_Failure;
+    }
+    if( compression == COMPRESSION_NONE )
+    {
+        poEMUDS->m_ioStats.add(EMU_IO_TILES_READ, 1);
+        return CE_None;
+    }
+
+    Bytef *pTileData = getScratchBuffer(SCRATCH_TILEDATA, val.size + 1);
+    pTileData[0] = compression;
+    memcpy(pTileData + 1, pData, val.size);
+    return decodeBlock(nBlockXOff, nBlockYOff, val, pTileData, false, nullptr, &pData);
+}
+
+int EMUBaseBand::getTileBandCount()
+{
+    EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
+    return poEMUDS->m_bPixelInterleaved ? poDS->GetRasterCount() : 1;
+}
+
+EMUBaseBand *EMUBaseBand::getTileBand(int nIndex)
+{
+    EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
+    if( !poEMUDS->m_bPixelInterleaved )
+    {
+        return (nIndex == 0) ? this : nullptr;
+    }
+
+    GDALRasterBand *pBand = poDS->GetRasterBand(nIndex + 1);
+    if( (pBand != nullptr) && (m_nLevel > 0) )
+    {
+        pBand = pBand->GetOverview(m_nLevel - 1);
+    }
+    if( pBand == nullptr )
+    {
+        return nullptr;
+    }
+    EMUBaseBand *pEMUBand = cpl::down_cast<EMUBaseBand *>(pBand);
+    // should always be the same, but be careful with what we read from the file
+    if( (pEMUBand->nRasterXSize != nRasterXSize) || (pEMUBand->nRasterYSize != nRasterYSize) ||
+        (pEMUBand->nBlockXSize != nBlockXSize) || (pEMUBand->nBlockYSize != nBlockYSize) )
+    {
+        return nullptr;
+    }
+    return pEMUBand;
+}
+
+// the band the tiles are stored under in the index
+uint64_t EMUBaseBand::getTileKeyBand()
+{
+    EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
+    return poEMUDS->m_bPixelInterleaved ? 1 : nBand;
+}
+
+// Get somewhere to put each band of the tile. If pData is given that is used for 
+// this band. Otherwise (and for the other bands with INTERLEAVE=PIXEL) blocks are 
+// created in GDAL's block cache. Bands that are already in the cache get nullptr.
+// Must be called on the thread using the dataset, not a worker.
+void EMUBaseBand::lockTileBlocks(int nBlockXOff, int nBlockYOff, void *pData, 
+                std::vector<GDALRasterBlock*> &blocks, std::vector<void*> &bandData)
+{
+    int nTileBands = getTileBandCount();
+    blocks.assign(nTileBands, nullptr);
+    bandData.assign(nTileBands, nullptr);
+
+    // only fill in the other bands if they will all fit in the cache
+    GIntBig nBlockBytes = static_cast<GIntBig>(nBlockXSize) * nBlockYSize * 
+                            (GDALGetDataTypeSize(eDataType) / 8);
+    bool bOtherBands = (pData == nullptr) || (nTileBands * nBlockBytes <= GDALGetCacheMax64() / 4);
+
+    for( int n = 0; n < nTileBands; n++ )
+    {
+        EMUBaseBand *pBand = getTileBand(n);
+        if( pBand == nullptr )
+        {
+            continue;
+        }
+        if( (pBand == this) && (pData != nullptr) )
+        {
+            bandData[n] = pData;
+            continue;
+        }
+        if( !bOtherBands )
+        {
+            continue;
+        }
+        GDALRasterBlock *pBlock = pBand->TryGetLockedBlockRef(nBlockXOff, nBlockYOff);
+        if( pBlock != nullptr )
+        {
+            // already have it
+            pBlock->DropLock();
+            continue;
+        }
+        pBlock = pBand->GetLockedBlockRef(nBlockXOff, nBlockYOff, TRUE);
+        if( pBlock != nullptr )
+        {
+            blocks[n] = pBlock;
+            bandData[n] = pBlock->GetDataRef();
+        }
+    }
+}
+
+// release the blocks from lockTileBlocks. If bOK isn't set they
+// are removed from the cache as they haven't been filled in.
+void EMUBaseBand::unlockTileBlocks(int nBlockXOff, int nBlockYOff, 
+                std::vector<GDALRasterBlock*> &blocks, bool bOK)
+{
+    for( size_t n = 0; n < blocks.size(); n++ )
+    {
+        if( blocks[n] == nullptr )
+        {
+            continue;
+        }
+        blocks[n]->DropLock();
+        if( !bOK )
+        {
+            getTileBand(n)->FlushBlock(nBlockXOff, nBlockYOff, FALSE);
+        }
+    }
+}
+
+// Set every pixel to the value of a constant tile, or for tiles that were never 
+// written, the band's nodata (0 if there isn't one). papData is as for decodeBlock.
+void EMUBaseBand::fillBlock(const EMUTileValue &val, void * const *papData)
+{
+    int typeSize = GDALGetDataTypeSize(eDataType) / 8;
+    size_t nBlockBytes = static_cast<size_t>(nBlockXSize) * nBlockYSize * typeSize;
+    for( int n = 0; n < getTileBandCount(); n++ )
+    {
+        GByte *pDstData = static_cast<GByte*>(papData[n]);
+        if( pDstData == nullptr )
+        {
+            continue;
+        }
+
+        GByte abyValue[sizeof(uint64_t)] = {0};
+        if( val.offset == EMU_TILE_CONSTANT )
+        {
+            memcpy(abyValue, &val.uncompressedSize, std::min(typeSize, 
+                    static_cast<int>(sizeof(abyValue))));
+        }
+        else
+        {
+            // the nodata is held by the full res band
+            int nNoDataSet = FALSE;
+            int64_t nNoData = poDS->GetRasterBand(getTileBand(n)->nBand)->GetNoDataValueAsInt64(&nNoDataSet);
+            if( nNoDataSet )
+            {
+                GDALCopyWords(&nNoData, GDT_Int64, 0, abyValue, eDataType, 0, 1);
+            }
+        }
+
+        bool bSameBytes = true;
+        for( int i = 1; (i < typeSize) && bSameBytes; i++ )
+        {
+            bSameBytes = (abyValue[i] == abyValue[0]);
+        }
+        if( bSameBytes || (typeSize > static_cast<int>(sizeof(abyValue))) )
+        {
+            memset(pDstData, abyValue[0], nBlockBytes);
+            continue;
+        }
+
+        // broadcast the first pixel, doubling the amount copied each time
+        memcpy(pDstData, abyValue, typeSize);
+        size_t nDone = typeSize;
+        while( nDone < nBlockBytes )
+        {
+            size_t nCopy = std::min(nDone, nBlockBytes - nDone);
+            memcpy(pDstData + nDone, pDstData, nCopy);
+            nDone += nCopy;
+        }
+    }
+}
+
+// Turn the tile data into full blocks. pTileData is either the 
+// compression byte followed by the compressed data, or if bDecompressed 
+// is set, the (packed) pixels from the cache. papData has a destination
+// for each band in the tile (see getTileBandCount()), or nullptr to skip it.
+// If pCacheKey is given the decompressed pixels are added to the cache 
+// (if it holds them). Safe to call from any thread.
+CPLErr EMUBaseBand::decodeBlock(int nBlockXOff, int nBlockYOff, const EMUTileValue &val, 
+                    const Bytef *pTileData, bool bDecompressed, 
+                    const EMUCacheKey *pCacheKey, void * const *papData)
+{
     // we need to work out whether we are partial
     int nXValid, nYValid;
     CPLErr err = GetActualBlockSize(nBlockXOff, nBlockYOff, &nXValid, &nYValid);
     if( err != CE_None)
         return err;
 
-    if( (nXValid != nBlockXSize) || (nYValid != nBlockYSize) ) 
+    int typeSize = GDALGetDataTypeSize(eDataType) / 8;
+    int nTileBands = getTileBandCount();
+    size_t nBandSize = static_cast<size_t>(nXValid) * nYValid * typeSize;
+    if( val.uncompressedSize != nBandSize * nTileBands )
     {
-        // partial. GDAL expects a full block so let's read the 
-        // partial and expand to fit full block.
-        int typeSize = GDALGetDataTypeSize(eDataType) / 8;
-        Bytef *pSubData = static_cast<Bytef*>(CPLMalloc(val.size));
-        VSIFReadL(pSubData, val.size, 1, poEMUDS->m_fp);
-        
-        Bytef *pUncompressed = static_cast<Bytef*>(CPLMalloc(val.uncompressedSize)); 
-        doUncompression(compression, pSubData, val.size, pUncompressed, val.uncompressedSize);
-        
-        char *pDstData = static_cast<char*>(pData);
-        int nSrcIdx = 0, nDstIdx = 0;
-        for( int nRow = 0; nRow < nYValid; nRow++ )
+        CPLError(CE_Failure, CPLE_FileIO,
+                "Unexpected size for block %d %d.",
+                nBlockXOff, nBlockYOff);
+        return CE_Failure;
+    }
+    bool bPartial = (nXValid != nBlockXSize) || (nYValid != nBlockYSize);
+    
+    // partial tiles are stored packed. GDAL expects a full block so 
+    // we uncompress to a buffer and expand to fit the full block.
+    // Same if the tile needs splitting into bands.
+    const Bytef *pUncompressed = pTileData;
+    if( !bDecompressed )
+    {
+        bool bDirect = !bPartial && (nTileBands == 1) && (papData[0] != nullptr);
+        uint8_t compression = pTileData[0];
+        Bytef *pOutput = bDirect ? static_cast<Bytef*>(papData[0]) :
+                                   getScratchBuffer(SCRATCH_PARTIAL, val.uncompressedSize);
+        EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
+        bool bOK;
         {
-            memcpy(&pDstData[nDstIdx], &pUncompressed[nSrcIdx], nXValid * typeSize);
-            nSrcIdx += (nXValid * typeSize);
-            nDstIdx += (nBlockXSize * typeSize);
+            EMUIOTimer timer(poEMUDS->m_ioStats, EMU_IO_DECOMPRESS_NS);
+            bOK = doTileUncompression(compression, typeSize, nXValid, nYValid * nTileBands, 
+                        pTileData + 1, val.size, pOutput, val.uncompressedSize);
         }
-        
-        CPLFree(pUncompressed);
-        CPLFree(pSubData);
+        if( !bOK )
+        {
+            return CE_Failure;
+        }
+        poEMUDS->m_ioStats.add(EMU_IO_TILES_READ, 1);
+        EMUTileCache *pCache = poEMUDS->m_pTileCache;
+        if( (pCacheKey != nullptr) && (pCache != nullptr) && pCache->cachesDecompressed() )
+        {
+            pCache->put(*pCacheKey, pOutput, val.uncompressedSize, true);
+        }
+        pUncompressed = pOutput;
     }
-    else
+
+    for( int n = 0; n < nTileBands; n++ )
     {
-        // full block. Just read.
-        Bytef *pSubData = static_cast<Bytef*>(CPLMalloc(val.size));
-        VSIFReadL(pSubData, val.size, 1, poEMUDS->m_fp);
-        // uncompress directly into GDAL's buffer
-        doUncompression(compression, pSubData, val.size, static_cast<Bytef*>(pData), val.uncompressedSize);
-        CPLFree(pSubData);        
+        char *pDstData = static_cast<char*>(papData[n]);
+        const Bytef *pSrcData = pUncompressed + n * nBandSize;
+        if( (pDstData == nullptr) || (pDstData == reinterpret_cast<const char*>(pSrcData)) )
+        {
+            continue;
+        }
+        if( bPartial ) 
+        {
+            int nSrcIdx = 0, nDstIdx = 0;
+            for( int nRow = 0; nRow < nYValid; nRow++ )
+            {
+                memcpy(&pDstData[nDstIdx], &pSrcData[nSrcIdx], nXValid * typeSize);
+                nSrcIdx += (nXValid * typeSize);
+                nDstIdx += (nBlockXSize * typeSize);
+            }
+        }
+        else
+        {
+            memcpy(pDstData, pSrcData, nBandSize);
+        }
     }
     return CE_None;
 }
 
 CPLErr EMUBaseBand::IWriteBlock(int nBlockXOff, int nBlockYOff, void *pData)
 {
-    const std::lock_guard<std::mutex> lock(*m_mutex);
+    EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
+    if( poEMUDS->m_bGenerateOverviews && (m_nLevel > 0) )
+    {
+        CPLError(CE_Failure, CPLE_NotSupported, 
+            "Overviews are generated from the full res data so can't be written to");
+        return CE_Failure;
+    }
+    if( m_nLevel == 0 )
+    {
+        poEMUDS->m_bFullResWritten = true;
+    }
+
+    CPLErr err = writeBlockData(nBlockXOff, nBlockYOff, pData);
+    if( (err == CE_None) && poEMUDS->m_bCollectStats )
+    {
+        err = addBlockStatistics(nBlockXOff, nBlockYOff, pData);
+    }
+    if( (err == CE_None) && poEMUDS->m_bGenerateOverviews )
+    {
+        err = writeOverviewBlocks(nBlockXOff, nBlockYOff, pData);
+    }
+    return err;
+}
+
+CPLErr EMUBaseBand::addBlockStatistics(int, int, void *)
+{
+    // nothing for overviews
+    return CE_None;
+}
+
+CPLErr EMUBaseBand::writeOverviewBlocks(int nBlockXOff, int nBlockYOff, void *pData)
+{
+    EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
+    int nNoDataSet = FALSE;
+    double dfNoData = GetNoDataValue(&nNoDataSet);
+    int typeSize = GDALGetDataTypeSize(eDataType) / 8;
+
+    // the overview block size is the full res block size divided by the factor
+    // so each full res block maps onto exactly one block of each overview.
+    // The whole block is reduced at once so there is nothing to keep between calls.
+    for( int nOverview = 0; nOverview < GetOverviewCount(); nOverview++ )
+    {
+        EMUBaseBand *pOvBand = cpl::down_cast<EMUBaseBand*>(GetOverview(nOverview));
+        int nOvBlockXSize = pOvBand->nBlockXSize;
+        int nOvBlockYSize = pOvBand->nBlockYSize;
+        int nFactor = nBlockXSize / nOvBlockXSize;
+        if( (nBlockXOff * nOvBlockXSize >= pOvBand->nRasterXSize) || 
+            (nBlockYOff * nOvBlockYSize >= pOvBand->nRasterYSize) )
+        {
+            // the last row/column of full res blocks has less than 
+            // nFactor pixels left over so there is no overview block
+            continue;
+        }
+
+        int nXValid, nYValid;
+        CPLErr err = pOvBand->GetActualBlockSize(nBlockXOff, nBlockYOff, &nXValid, &nYValid);
+        if( err != CE_None )
+        {
+            return err;
+        }
+
+        Bytef *pOvData = getScratchBuffer(SCRATCH_OVERVIEW, 
+                    static_cast<size_t>(nOvBlockXSize) * nOvBlockYSize * typeSize);
+        if( !reduceBlock(poEMUDS->m_eOverviewResampling, eDataType, nFactor, pData, nBlockXSize, 
+                    pOvData, nOvBlockXSize, nXValid, nYValid, nNoDataSet, dfNoData) )
+        {
+            CPLError(CE_Failure, CPLE_NotSupported, 
+                "Can't generate overviews for data type %s", GDALGetDataTypeName(eDataType));
+            return CE_Failure;
+        }
+
+        err = pOvBand->writeBlockData(nBlockXOff, nBlockYOff, pOvData);
+        if( err != CE_None )
+        {
+            return err;
+        }
+    }
+    return CE_None;
+}
 
+CPLErr EMUBaseBand::writeBlockData(int nBlockXOff, int nBlockYOff, void *pData)
+{
     EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
     
     // GDAL deals in blocks - if we are at the end of a row
@@ -142,59 +589,865 @@ CPLErr EMUBaseBand::IWriteBlock(int nBlockXOff, int nBlockYOff, void *pData)
     {
         return err;
     }
+
+    if( poEMUDS->m_bPixelInterleaved )
+    {
+        // held until all the bands for this block have been written
+        return poEMUDS->addInterleavedBlock(m_nLevel, nBand, nBlockXOff, nBlockYOff, 
+                    static_cast<GByte*>(pData), nBlockXSize, nXValid, nYValid);
+    }
     
-    vsi_l_offset tileOffset = VSIFTellL(poEMUDS->m_fp);
     int typeSize = GDALGetDataTypeSize(eDataType) / 8;
 
-    // TODO: set compression
-    uint8_t compression = COMPRESSION_ZLIB;
-    VSIFWriteL(&compression, sizeof(compression), 1, poEMUDS->m_fp);
+    // eg all nodata. Just the value goes in the index.
+    uint64_t nValue;
+    if( isConstantTile(static_cast<GByte*>(pData), typeSize, nXValid, nYValid, nBlockXSize, &nValue) )
+    {
+        return poEMUDS->writeConstantTile(m_nLevel, nBand, nBlockXOff, nBlockYOff, nValue);
+    }
+
+    uint8_t compression = poEMUDS->getTileCompression();
 
     size_t uncompressedSize = (nXValid * nYValid) * typeSize;
-    size_t compressedSize = uncompressedSize + 100;
-    
+
+    if( poEMUDS->m_pCompressPool != nullptr )
+    {
+        // multi threaded. GDAL will re-use pData once we return so take a 
+        // copy of the valid part of the block and let the compression 
+        // threads and the writer thread take care of the rest.
+        Bytef *pCopy = static_cast<Bytef*>(CPLMalloc(uncompressedSize));
+        Bytef *pSrcData = static_cast<Bytef*>(pData);
+        int nSrcIdx = 0, nDstIdx = 0;
+        for( int nRow = 0; nRow < nYValid; nRow++ )
+        {
+            memcpy(&pCopy[nDstIdx], &pSrcData[nSrcIdx], nXValid * typeSize);
+            nSrcIdx += (nBlockXSize * typeSize);
+            nDstIdx += (nXValid * typeSize);
+        }
+        return poEMUDS->queueTile(m_nLevel, nBand, nBlockXOff, nBlockYOff, 
+                    compression, pCopy, nXValid, nYValid, typeSize);
+    }
+
+    Bytef *pTileData = static_cast<Bytef*>(pData);
     if( (nXValid != nBlockXSize) || (nYValid != nBlockYSize) ) 
     {
         // a partial block. They actually give the full block so we must subset
-        Bytef *pSubData = static_cast<Bytef*>(CPLMalloc(uncompressedSize));
+        pTileData = getScratchBuffer(SCRATCH_PARTIAL, uncompressedSize);
         Bytef *pSrcData = static_cast<Bytef*>(pData);
         int nSrcIdx = 0, nDstIdx = 0;
         for( int nRow = 0; nRow < nYValid; nRow++ )
         {
-            memcpy(&pSubData[nDstIdx], &pSrcData[nSrcIdx], nXValid * typeSize);
+            memcpy(&pTileData[nDstIdx], &pSrcData[nSrcIdx], nXValid * typeSize);
             nSrcIdx += (nBlockXSize * typeSize);
             nDstIdx += (nXValid * typeSize);
         }
-        
-        bool bFree;
-        Bytef *pCompressed = doCompression(compression, pSubData, uncompressedSize, &compressedSize, &bFree);
-        VSIFWriteL(pCompressed, compressedSize, 1, poEMUDS->m_fp);
-        CPLFree(pSubData);
-        if( bFree ) 
+    }
+    
+    return poEMUDS->writeTile(m_nLevel, nBand, nBlockXOff, nBlockYOff, compression, 
+                    pTileData, nXValid, nYValid, typeSize);
+}
+
+// TILE_STRIPS. Read this much of a tile to get the strip table, which saves
+// another request when the tile is small.
+const size_t STRIP_FIRST_READ = 16 * 1024;
+
+// a tile being read by prefetchBlocks()
+struct EMUPrefetchTile
+{
+    int x;
+    int y;
+    EMUTileValue val;
+    EMUCacheKey cacheKey;
+    std::shared_ptr<const EMUCacheEntry> pEntry; // if found in the tile cache
+    const Bytef *pTileData;
+    std::vector<GDALRasterBlock*> blocks; // from lockTileBlocks()
+    std::vector<void*> bandData;
+    CPLErr err;
+};
+
+// how many rows of blocks covering the given columns we can prefetch 
+// at once. The blocks go into GDAL's block cache so we don't want to
+// use more than a fraction of it or they will be flushed before use.
+int EMUBaseBand::getPrefetchBlockRows(int nXOff, int nXSize, int nBandsAtOnce)
+{
+    int nXBlocks = (nXOff + nXSize - 1) / nBlockXSize - nXOff / nBlockXSize + 1;
+    GIntBig nRowBytes = static_cast<GIntBig>(nXBlocks) * nBlockXSize * nBlockYSize * 
+                            (GDALGetDataTypeSize(eDataType) / 8) * nBandsAtOnce;
+    GIntBig nRows = (GDALGetCacheMax64() / 4) / nRowBytes;
+    // nBlocksPerColumn isn't set until GDAL first uses the block cache
+    GIntBig nYBlocks = (nRasterYSize + nBlockYSize - 1) / nBlockYSize;
+    return static_cast<int>(std::max<GIntBig>(1, std::min(nRows, nYBlocks)));
+}
+
+// Read all the blocks needed for the given window that aren't already in
+// GDAL's block cache. The tiles are sorted by file offset and nearby ones
+// merged so there are as few requests as possible (this matters for /vsis3 etc)
+// and then decompressed in parallel straight into the block cache.
+// Any failures are ignored - IReadBlock will be called for those blocks later 
+// and will report the problem.
+void EMUBaseBand::prefetchBlocks(int nXOff, int nYOff, int nXSize, int nYSize)
+{
+    if( (poDS->GetAccess() == GA_Update) || (nXSize <= 0) || (nYSize <= 0) )
+    {
+        return;
+    }
+
+    EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
+    EMUTileCache *pCache = poEMUDS->m_pTileCache;
+    int nTileBands = getTileBandCount();
+
+    int nXStart = nXOff / nBlockXSize;
+    int nXEnd = (nXOff + nXSize - 1) / nBlockXSize;
+    int nYStart = nYOff / nBlockYSize;
+    int nYEnd = (nYOff + nYSize - 1) / nBlockYSize;
+
+    std::vector<EMUPrefetchTile> tiles;
+    for( int y = nYStart; y <= nYEnd; y++ )
+    {
+        for( int x = nXStart; x <= nXEnd; x++ )
         {
-            CPLFree(pCompressed);
+            // do we already have all the bands in this tile?
+            bool bNeeded = false;
+            for( int n = 0; (n < nTileBands) && !bNeeded; n++ )
+            {
+                EMUBaseBand *pBand = getTileBand(n);
+                if( pBand == nullptr )
+                {
+                    continue;
+                }
+                GDALRasterBlock *pBlock = pBand->TryGetLockedBlockRef(x, y);
+                if( pBlock != nullptr )
+                {
+                    pBlock->DropLock();
+                }
+                else
+                {
+                    bNeeded = true;
+                }
+            }
+            if( !bNeeded )
+            {
+                continue;
+            }
+
+            EMUPrefetchTile tile;
+            if( !findPrefetchTile(x, y, tile) || (tile.val.offset == 0) || 
+                (tile.val.offset == EMU_TILE_CONSTANT) )
+            {
+                // nothing to read, IReadBlock just fills these in
+                continue;
+            }
+            tiles.push_back(std::move(tile));
         }
     }
+
+    // start on the tiles after these (if it looks like they will be wanted)
+    if( (poEMUDS->m_pReadAhead != nullptr) && !tiles.empty() )
+    {
+        poEMUDS->m_pReadAhead->notify(this, nXStart, nYStart, nXEnd, nYEnd);
+    }
+
+    // IReadBlock is just as good for one block
+    if( tiles.size() < 2 )
+    {
+        return;
+    }
+
+    std::vector<GByte> rangeData;
+    if( !readPrefetchTiles(tiles, rangeData) )
+    {
+        return;
+    }
+
+    // GDAL's block cache isn't safe to use from the workers so create
+    // the blocks here, then fill them in, then release them here
+    for( auto &tile : tiles )
+    {
+        lockTileBlocks(tile.x, tile.y, nullptr, tile.blocks, tile.bandData);
+    }
+
+    auto decode = [this, pCache](EMUPrefetchTile *pTile)
+    {
+        // errors will be reported when IReadBlock tries again
+        CPLPushErrorHandler(CPLQuietErrorHandler);
+        bool bDecompressed = pTile->pEntry && pTile->pEntry->bDecompressed;
+        pTile->err = decodeBlock(pTile->x, pTile->y, pTile->val, pTile->pTileData, bDecompressed,
+                    (pCache != nullptr) ? &pTile->cacheKey : nullptr, pTile->bandData.data());
+        CPLPopErrorHandler();
+    };
+
+    EMUThreadPool *pPool = poEMUDS->getReadPool();
+    for( auto &tile : tiles )
+    {
+        if( std::count(tile.bandData.begin(), tile.bandData.end(), nullptr) == nTileBands )
+        {
+            // nothing to fill in
+            continue;
+        }
+        if( pPool != nullptr )
+        {
+            EMUPrefetchTile *pTile = &tile;
+            pPool->submit([decode, pTile]() { decode(pTile); });
+        }
+        else
+        {
+            decode(&tile);
+        }
+    }
+    if( pPool != nullptr )
+    {
+        pPool->waitCompletion();
+    }
+
+    for( auto &tile : tiles )
+    {
+        // don't leave garbage in the cache if it failed
+        unlockTileBlocks(tile.x, tile.y, tile.blocks, tile.err == CE_None);
+    }
+}
+
+bool EMUBaseBand::findPrefetchTile(int x, int y, EMUPrefetchTile &tile)
+{
+    EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
+    EMUTileCache *pCache = poEMUDS->m_pTileCache;
+    uint64_t nKeyBand = getTileKeyBand();
+    try
+    {
+        tile.val = poEMUDS->getTileOffset(m_nLevel, nKeyBand, x, y);
+    }
+    catch(const std::out_of_range& oor)
+    {
+        return false;
+    }
+    tile.x = x;
+    tile.y = y;
+    tile.pTileData = nullptr;
+    tile.err = CE_None;
+    if( (tile.val.offset == 0) || (tile.val.offset == EMU_TILE_CONSTANT) )
+    {
+        return true;
+    }
+    if( poEMUDS->m_pReadAhead != nullptr )
+    {
+        EMUTileKey tileKey;
+        tileKey.ovrLevel = m_nLevel;
+        tileKey.band = nKeyBand;
+        tileKey.x = x;
+        tileKey.y = y;
+        tile.pEntry = poEMUDS->m_pReadAhead->take(tileKey);
+    }
+    if( pCache != nullptr )
+    {
+        tile.cacheKey.fileId = poEMUDS->m_nCacheFileId;
+        tile.cacheKey.tile.ovrLevel = m_nLevel;
+        tile.cacheKey.tile.band = nKeyBand;
+        tile.cacheKey.tile.x = x;
+        tile.cacheKey.tile.y = y;
+    }
+    if( (pCache != nullptr) && !tile.pEntry )
+    {
+        tile.pEntry = pCache->get(tile.cacheKey);
+        poEMUDS->m_ioStats.add(tile.pEntry ? EMU_IO_CACHE_HITS : EMU_IO_CACHE_MISSES, 1);
+        if( tile.pEntry && (tile.pEntry->data.size() != 
+            (tile.pEntry->bDecompressed ? tile.val.uncompressedSize : tile.val.size + 1)) )
+        {
+            tile.pEntry.reset();
+        }
+    }
+    return true;
+}
+
+// The tiles are sorted by file offset and nearby ones merged into ranges 
+// which are all read with one VSIFReadMultiRangeL. Constant tiles and 
+// those that were never written are skipped.
+bool EMUBaseBand::readPrefetchTiles(std::vector<EMUPrefetchTile> &tiles, std::vector<GByte> &rangeData)
+{
+    EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
+    EMUTileCache *pCache = poEMUDS->m_pTileCache;
+    std::vector<EMUPrefetchTile*> toRead;
+    for( auto &tile : tiles )
+    {
+        if( (tile.val.offset == 0) || (tile.val.offset == EMU_TILE_CONSTANT) )
+        {
+            continue;
+        }
+        if( tile.pEntry )
+        {
+            tile.pTileData = tile.pEntry->data.data();
+        }
+        else if( (tile.pTileData = poEMUDS->getMappedData(tile.val.offset, tile.val.size + 1)) != nullptr )
+        {
+            poEMUDS->m_ioStats.add(EMU_IO_BYTES_READ, tile.val.size + 1);
+        }
+        else
+        {
+            toRead.push_back(&tile);
+        }
+    }
+    std::sort(toRead.begin(), toRead.end(), 
+        [](const EMUPrefetchTile *a, const EMUPrefetchTile *b) { return a->val.offset < b->val.offset; });
+
+    std::vector<vsi_l_offset> rangeStarts;
+    std::vector<vsi_l_offset> rangeEnds;
+    std::vector<size_t> tileRanges; // index into rangeStarts for each of toRead
+    for( const EMUPrefetchTile *pTile : toRead )
+    {
+        vsi_l_offset start = pTile->val.offset;
+        vsi_l_offset end = start + pTile->val.size + 1; // include compression byte
+        if( !rangeStarts.empty() && (start >= rangeEnds.back()) && 
+            (start - rangeEnds.back() <= PREFETCH_MAX_GAP) &&
+            (end - rangeStarts.back() <= PREFETCH_MAX_RANGE) )
+        {
+            rangeEnds.back() = end;
+        }
+        else
+        {
+            rangeStarts.push_back(start);
+            rangeEnds.push_back(end);
+        }
+        tileRanges.push_back(rangeStarts.size() - 1);
+    }
+
+    if( !toRead.empty() )
+    {
+        std::vector<size_t> rangeSizes(rangeStarts.size());
+        std::vector<size_t> rangeBufOffsets(rangeStarts.size());
+        size_t nTotal = 0;
+        for( size_t i = 0; i < rangeStarts.size(); i++ )
+        {
+            rangeSizes[i] = rangeEnds[i] - rangeStarts[i];
+            rangeBufOffsets[i] = nTotal;
+            nTotal += rangeSizes[i];
+        }
+        rangeData.resize(nTotal);
+        std::vector<void*> rangeBufs(rangeStarts.size());
+        for( size_t i = 0; i < rangeStarts.size(); i++ )
+        {
+            rangeBufs[i] = &rangeData[rangeBufOffsets[i]];
+        }
+
+        VSILFILE *fp = poEMUDS->acquireReadHandle();
+        if( fp == nullptr )
+        {
+            return false;
+        }
+        CPLPushErrorHandler(CPLQuietErrorHandler);
+        bool bOK = VSIFReadMultiRangeL(rangeStarts.size(), rangeBufs.data(), 
+                        rangeStarts.data(), rangeSizes.data(), fp) == 0;
+        CPLPopErrorHandler();
+        poEMUDS->releaseReadHandle(fp);
+        poEMUDS->m_ioStats.add(EMU_IO_READ_CALLS, 1);
+        poEMUDS->m_ioStats.add(EMU_IO_BYTES_READ, nTotal);
+        if( !bOK )
+        {
+            CPLDebug("EMU", "Failed to read %d ranges for prefetch", 
+                        static_cast<int>(rangeStarts.size()));
+            return false;
+        }
+
+        for( size_t i = 0; i < toRead.size(); i++ )
+        {
+            EMUPrefetchTile *pTile = toRead[i];
+            size_t nRange = tileRanges[i];
+            pTile->pTileData = static_cast<GByte*>(rangeBufs[nRange]) + 
+                                    (pTile->val.offset - rangeStarts[nRange]);
+            if( (pCache != nullptr) && !pCache->cachesDecompressed() )
+            {
+                pCache->put(pTile->cacheKey, pTile->pTileData, pTile->val.size + 1, false);
+            }
+        }
+    }
+    return true;
+}
+
+// TILE_STRIPS files. Small windows within one tile only need the strips 
+// with their rows read and decompressed. This bypasses GDAL's block cache 
+// (and EMU_CACHE_MB) so is only done the first time a tile is wanted.
+bool EMUBaseBand::readTileRows(int nXOff, int nYOff, int nXSize, int nYSize, void *pData, 
+                    GDALDataType eBufType, GSpacing nPixelSpace, GSpacing nLineSpace, 
+                    CPLErr *peErr)
+{
+    EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
+    if( (poEMUDS->m_nTileStrips < 2) || (poEMUDS->m_pReadAhead != nullptr) )
+    {
+        return false;
+    }
+    int nBlockXOff = nXOff / nBlockXSize;
+    int nBlockYOff = nYOff / nBlockYSize;
+    if( (nBlockXOff == m_nLastStripXOff) && (nBlockYOff == m_nLastStripYOff) )
+    {
+        return false;
+    }
+    GDALRasterBlock *pBlock = TryGetLockedBlockRef(nBlockXOff, nBlockYOff);
+    if( pBlock != nullptr )
+    {
+        pBlock->DropLock();
+        return false;
+    }
+
+    EMUTileValue val;
+    try
+    {
+        val = poEMUDS->getTileOffset(m_nLevel, getTileKeyBand(), nBlockXOff, nBlockYOff);
+    }
+    catch(const std::out_of_range& oor)
+    {
+        return false;
+    }
+    if( (val.offset == 0) || (val.offset == EMU_TILE_CONSTANT) )
+    {
+        return false;
+    }
+    EMUTileCache *pCache = poEMUDS->m_pTileCache;
+    EMUCacheKey cacheKey;
+    if( pCache != nullptr )
+    {
+        cacheKey.fileId = poEMUDS->m_nCacheFileId;
+        cacheKey.tile.ovrLevel = m_nLevel;
+        cacheKey.tile.band = getTileKeyBand();
+        cacheKey.tile.x = nBlockXOff;
+        cacheKey.tile.y = nBlockYOff;
+        if( pCache->get(cacheKey) )
+        {
+            return false;
+        }
+    }
+
+    int nXValid, nYValid;
+    if( GetActualBlockSize(nBlockXOff, nBlockYOff, &nXValid, &nYValid) != CE_None )
+    {
+        return false;
+    }
+    int typeSize = GDALGetDataTypeSize(eDataType) / 8;
+    int nTileBands = getTileBandCount();
+    size_t nRowBytes = static_cast<size_t>(nXValid) * typeSize;
+    size_t nTileRows = static_cast<size_t>(nYValid) * nTileBands;
+    if( val.uncompressedSize != nRowBytes * nTileRows )
+    {
+        return false;
+    }
+    // the rows we want, counting down the bands in the tile
+    size_t nFirstRow = (poEMUDS->m_bPixelInterleaved ? (nBand - 1) * nYValid : 0) + 
+                        (nYOff - nBlockYOff * nBlockYSize);
+    size_t nLastRow = nFirstRow + nYSize - 1;
+    // not worth it if they need all the strips in the band anyway
+    size_t nRowsPerStrip = poEMUDS->getRowsPerStrip(nTileRows);
+    if( nLastRow / nRowsPerStrip - nFirstRow / nRowsPerStrip + 1 >= poEMUDS->m_nTileStrips )
+    {
+        return false;
+    }
+
+    // the table (and with small tiles, all of it) in the first read 
+    // unless the file is mapped
+    const Bytef *pTileData = poEMUDS->getMappedData(val.offset, val.size + 1);
+    size_t nHave = val.size + 1;
+    size_t nBytesRead = 0;
+    if( pTileData == nullptr )
+    {
+        nHave = std::min<size_t>(val.size + 1, STRIP_FIRST_READ);
+        Bytef *pReadData = getScratchBuffer(SCRATCH_TILEDATA, nHave);
+        VSILFILE *fp = poEMUDS->acquireReadHandle();
+        if( fp == nullptr )
+        {
+            return false;
+        }
+        bool bOK = (VSIFSeekL(fp, val.offset, SEEK_SET) == 0) && 
+            (VSIFReadL(pReadData, nHave, 1, fp) == 1);
+        poEMUDS->releaseReadHandle(fp);
+        poEMUDS->m_ioStats.add(EMU_IO_READ_CALLS, 1);
+        nBytesRead += nHave;
+        pTileData = pReadData;
+        if( bOK )
+        {
+            size_t nTableSize = EMUStripTable::getTableSize(pTileData + 1, nHave - 1);
+            if( (nTableSize == 0) || (nTableSize > val.size) )
+            {
+                bOK = false;
+            }
+            else if( nTableSize + 1 > nHave )
+            {
+                // a lot of strips
+                pReadData = getScratchBuffer(SCRATCH_TILEDATA, nTableSize + 1);
+                fp = poEMUDS->acquireReadHandle();
+                bOK = (fp != nullptr) && (VSIFSeekL(fp, val.offset, SEEK_SET) == 0) && 
+                    (VSIFReadL(pReadData, nTableSize + 1, 1, fp) == 1);
+                if( fp != nullptr )
+                {
+                    poEMUDS->releaseReadHandle(fp);
+                }
+                poEMUDS->m_ioStats.add(EMU_IO_READ_CALLS, 1);
+                nBytesRead += nTableSize + 1;
+                pTileData = pReadData;
+                nHave = nTableSize + 1;
+            }
+        }
+        if( !bOK )
+        {
+            poEMUDS->m_ioStats.add(EMU_IO_BYTES_READ, nBytesRead);
+            return false;
+        }
+    }
+
+    uint8_t compression = pTileData[0];
+    EMUStripTable table;
+    if( !(compression & COMPRESSION_STRIPS) || 
+        !table.read(pTileData + 1, nHave - 1, nTileRows, val.size) )
+    {
+        poEMUDS->m_ioStats.add(EMU_IO_BYTES_READ, nBytesRead);
+        return false;
+    }
+    size_t nFirstStrip = nFirstRow / table.nRowsPerStrip;
+    size_t nLastStrip = nLastRow / table.nRowsPerStrip;
+    size_t nStart = table.getStripStart(nFirstStrip);
+    size_t nEnd = table.getStripEnd(nLastStrip);
+
+    // the strips (after the compression byte)
+    const Bytef *pStrips;
+    if( nEnd + 1 <= nHave )
+    {
+        pStrips = pTileData + 1 + nStart;
+    }
     else
     {
-        // full data
-        bool bFree;
-        void *pCompressed = doCompression(compression, static_cast<Bytef*>(pData), uncompressedSize, &compressedSize, &bFree);
-        VSIFWriteL(pCompressed, compressedSize, 1, poEMUDS->m_fp);
-        if( bFree ) 
+        Bytef *pReadData = getScratchBuffer(SCRATCH_TILEDATA, nEnd - nStart);
+        VSILFILE *fp = poEMUDS->acquireReadHandle();
+        bool bOK = (fp != nullptr) && (VSIFSeekL(fp, val.offset + 1 + nStart, SEEK_SET) == 0) && 
+            (VSIFReadL(pReadData, nEnd - nStart, 1, fp) == 1);
+        if( fp != nullptr )
         {
-            CPLFree(pCompressed);
+            poEMUDS->releaseReadHandle(fp);
+        }
+        poEMUDS->m_ioStats.add(EMU_IO_READ_CALLS, 1);
+        nBytesRead += nEnd - nStart;
+        if( !bOK )
+        {
+            poEMUDS->m_ioStats.add(EMU_IO_BYTES_READ, nBytesRead);
+            CPLError(CE_Failure, CPLE_FileIO, "Failed to read block %d %d.",
+                    nBlockXOff, nBlockYOff);
+            *peErr = CE_Failure;
+            return true;
+        }
+        pStrips = pReadData;
+    }
+    // only what was actually read (nothing if the file is mapped)
+    poEMUDS->m_ioStats.add(EMU_IO_BYTES_READ, nBytesRead);
+
+    size_t nStripRows = std::min(nTileRows, (nLastStrip + 1) * table.nRowsPerStrip) - 
+                            nFirstStrip * table.nRowsPerStrip;
+    Bytef *pOutput = getScratchBuffer(SCRATCH_PARTIAL, nStripRows * nRowBytes);
+    bool bOK;
+    {
+        EMUIOTimer timer(poEMUDS->m_ioStats, EMU_IO_DECOMPRESS_NS);
+        bOK = doTileStripUncompression(compression, typeSize, nXValid, nTileRows, table, 
+                    nFirstStrip, nLastStrip, pStrips, pOutput);
+    }
+    if( !bOK )
+    {
+        *peErr = CE_Failure;
+        return true;
+    }
+    poEMUDS->m_ioStats.add(EMU_IO_STRIPS_READ, nLastStrip - nFirstStrip + 1);
+
+    const Bytef *pSrc = pOutput + (nFirstRow - nFirstStrip * table.nRowsPerStrip) * nRowBytes + 
+                            static_cast<size_t>(nXOff - nBlockXOff * nBlockXSize) * typeSize;
+    for( int nRow = 0; nRow < nYSize; nRow++ )
+    {
+        GDALCopyWords64(pSrc + nRow * nRowBytes, eDataType, typeSize, 
+                static_cast<GByte*>(pData) + nRow * nLineSpace, eBufType, 
+                static_cast<int>(nPixelSpace), nXSize);
+    }
+    m_nLastStripXOff = nBlockXOff;
+    m_nLastStripYOff = nBlockYOff;
+    *peErr = CE_None;
+    return true;
+}
+
+// Copy nCount pixels into a buffer of another type. These are only used
+// for the conversions that are exact (so nodata stays nodata) and are plain 
+// loops the compiler can vectorise when the output is packed.
+typedef void (*EMUConvertFn)(const void *pSrc, void *pDst, GSpacing nPixelSpace, int nCount);
+
+template<typename S, typename D>
+static void convertPixels(const void *pSrc, void *pDst, GSpacing nPixelSpace, int nCount)
+{
+    const S *pIn = static_cast<const S*>(pSrc);
+    if( (nPixelSpace == static_cast<GSpacing>(sizeof(D))) && 
+        (reinterpret_cast<uintptr_t>(pDst) % sizeof(D) == 0) )
+    {
+        D *pOut = static_cast<D*>(pDst);
+        for( int i = 0; i < nCount; i++ )
+        {
+            pOut[i] = static_cast<D>(pIn[i]);
+        }
+    }
+    else
+    {
+        GByte *pOut = static_cast<GByte*>(pDst);
+        for( int i = 0; i < nCount; i++ )
+        {
+            D value = static_cast<D>(pIn[i]);
+            memcpy(pOut + i * nPixelSpace, &value, sizeof(D));
+        }
+    }
+}
+
+// bFloat32 is whether every value of S fits exactly in a float
+template<typename S>
+static EMUConvertFn getFloatConvertFn(GDALDataType eBufType, bool bFloat32)
+{
+    if( (eBufType == GDT_Float32) && bFloat32 )
+    {
+        return convertPixels<S, float>;
+    }
+    if( eBufType == GDT_Float64 )
+    {
+        return convertPixels<S, double>;
+    }
+    return nullptr;
+}
+
+// nullptr if GDALCopyWords64 should do it (so it is rounded and clamped the way GDAL does)
+static EMUConvertFn getConvertFn(GDALDataType eType, GDALDataType eBufType)
+{
+    switch( eType )
+    {
+        case GDT_Byte:
+            return getFloatConvertFn<uint8_t>(eBufType, true);
+        case GDT_Int8:
+            return getFloatConvertFn<int8_t>(eBufType, true);
+        case GDT_UInt16:
+            return getFloatConvertFn<uint16_t>(eBufType, true);
+        case GDT_Int16:
+            return getFloatConvertFn<int16_t>(eBufType, true);
+        case GDT_UInt32:
+            return getFloatConvertFn<uint32_t>(eBufType, false);
+        case GDT_Int32:
+            return getFloatConvertFn<int32_t>(eBufType, false);
+        case GDT_Float32:
+            return getFloatConvertFn<float>(eBufType, false);
+        default:
+            return nullptr;
+    }
+}
+
+// Otherwise GDAL reads each block into its cache and then GDALCopyWords 
+// them into the buffer, and with a window too big for the cache the blocks 
+// are flushed before they are wanted again anyway. Here the tiles are read 
+// a strip at a time as for prefetchBlocks, then each is decoded into a scratch 
+// block and converted into the buffer by the same thread.
+bool EMUBaseBand::readConverted(int nXOff, int nYOff, int nXSize, int nYSize, void *pData, 
+                    GDALDataType eBufType, GSpacing nPixelSpace, GSpacing nLineSpace)
+{
+    // with INTERLEAVE=PIXEL the other bands are likely to be wanted next 
+    // so it is better to have them in the cache
+    if( (eBufType == eDataType) || (getTileBandCount() > 1) )
+    {
+        return false;
+    }
+    int nYStart = nYOff / nBlockYSize;
+    int nYEnd = (nYOff + nYSize - 1) / nBlockYSize;
+    int nStripBlocks = getPrefetchBlockRows(nXOff, nXSize, 1);
+    if( nYEnd - nYStart + 1 <= nStripBlocks )
+    {
+        return false;
+    }
+
+    EMUDataset *poEMUDS = cpl::down_cast<EMUDataset *>(poDS);
+    EMUTileCache *pCache = poEMUDS->m_pTileCache;
+    EMUThreadPool *pPool = poEMUDS->getReadPool();
+    int nXStart = nXOff / nBlockXSize;
+    int nXEnd = (nXOff + nXSize - 1) / nBlockXSize;
+    int typeSize = GDALGetDataTypeSize(eDataType) / 8;
+    size_t nBlockBytes = static_cast<size_t>(nBlockXSize) * nBlockYSize * typeSize;
+    EMUConvertFn pfnConvert = getConvertFn(eDataType, eBufType);
+    GDALDataType eType = eDataType;
+    int nBlockXSizeLocal = nBlockXSize;
+    int nBlockYSizeLocal = nBlockYSize;
+
+    // the part of a (full size) block that is in the window
+    auto convert = [=](int x, int y, const GByte *pBlockData)
+    {
+        int nCol = std::max(nXOff, x * nBlockXSizeLocal);
+        int nCount = std::min(nXOff + nXSize, (x + 1) * nBlockXSizeLocal) - nCol;
+        int nRowEnd = std::min(nYOff + nYSize, (y + 1) * nBlockYSizeLocal);
+        for( int nRow = std::max(nYOff, y * nBlockYSizeLocal); nRow < nRowEnd; nRow++ )
+        {
+            const GByte *pSrc = pBlockData + (static_cast<size_t>(nRow - y * nBlockYSizeLocal) * 
+                            nBlockXSizeLocal + (nCol - x * nBlockXSizeLocal)) * typeSize;
+            GByte *pDst = static_cast<GByte*>(pData) + (nRow - nYOff) * nLineSpace + 
+                            (nCol - nXOff) * nPixelSpace;
+            if( pfnConvert != nullptr )
+            {
+                pfnConvert(pSrc, pDst, nPixelSpace, nCount);
+            }
+            else
+            {
+                GDALCopyWords64(pSrc, eType, typeSize, pDst, eBufType, 
+                        static_cast<int>(nPixelSpace), nCount);
+            }
+        }
+    };
+
+    auto decode = [this, pCache, nBlockBytes, convert](EMUPrefetchTile *pTile)
+    {
+        Bytef *pBlockData = getScratchBuffer(SCRATCH_CONVERT, nBlockBytes);
+        void *papData[1] = {pBlockData};
+        // failures are reported when the usual way tries again
+        CPLPushErrorHandler(CPLQuietErrorHandler);
+        bool bDecompressed = pTile->pEntry && pTile->pEntry->bDecompressed;
+        pTile->err = decodeBlock(pTile->x, pTile->y, pTile->val, pTile->pTileData, bDecompressed,
+                    (pCache != nullptr) ? &pTile->cacheKey : nullptr, papData);
+        CPLPopErrorHandler();
+        if( pTile->err == CE_None )
+        {
+            convert(pTile->x, pTile->y, pBlockData);
+        }
+    };
+
+    for( int nYBlock = nYStart; nYBlock <= nYEnd; nYBlock += nStripBlocks )
+    {
+        int nYBlockEnd = std::min(nYEnd, nYBlock + nStripBlocks - 1);
+        std::vector<EMUPrefetchTile> tiles;
+        for( int y = nYBlock; y <= nYBlockEnd; y++ )
+        {
+            for( int x = nXStart; x <= nXEnd; x++ )
+            {
+                // blocks that are already in the cache are used as they are
+                GDALRasterBlock *pBlock = TryGetLockedBlockRef(x, y);
+                if( pBlock != nullptr )
+                {
+                    convert(x, y, static_cast<const GByte*>(pBlock->GetDataRef()));
+                    pBlock->DropLock();
+                    continue;
+                }
+
+                EMUPrefetchTile tile;
+                if( !findPrefetchTile(x, y, tile) )
+                {
+                    return false;
+                }
+                if( (tile.val.offset == 0) || (tile.val.offset == EMU_TILE_CONSTANT) )
+                {
+                    // the band's nodata for tiles that were never written
+                    Bytef *pBlockData = getScratchBuffer(SCRATCH_CONVERT, nBlockBytes);
+                    void *papData[1] = {pBlockData};
+                    fillBlock(tile.val, papData);
+                    convert(x, y, pBlockData);
+                    poEMUDS->m_ioStats.add(EMU_IO_TILES_FILLED, 1);
+                    continue;
+                }
+                tiles.push_back(std::move(tile));
+            }
+        }
+        if( (poEMUDS->m_pReadAhead != nullptr) && !tiles.empty() )
+        {
+            poEMUDS->m_pReadAhead->notify(this, nXStart, nYBlock, nXEnd, nYBlockEnd);
+        }
+
+        std::vector<GByte> rangeData;
+        if( !readPrefetchTiles(tiles, rangeData) )
+        {
+            return false;
+        }
+        for( auto &tile : tiles )
+        {
+            if( pPool != nullptr )
+            {
+                EMUPrefetchTile *pTile = &tile;
+                pPool->submit([decode, pTile]() { decode(pTile); });
+            }
+            else
+            {
+                decode(&tile);
+            }
+        }
+        if( pPool != nullptr )
+        {
+            pPool->waitCompletion();
+        }
+        for( const auto &tile : tiles )
+        {
+            if( tile.err != CE_None )
+            {
+                return false;
+            }
+        }
+        poEMUDS->m_ioStats.add(EMU_IO_TILES_CONVERTED, tiles.size());
+    }
+    return true;
+}
+
+CPLErr EMUBaseBand::IRasterIO( GDALRWFlag eRWFlag, int nXOff, int nYOff, int nXSize, int nYSize,
+                            void *pData, int nBufXSize, int nBufYSize, GDALDataType eBufType,
+                            GSpacing nPixelSpace, GSpacing nLineSpace, 
+                            GDALRasterIOExtraArg *psExtraArg )
+{
+    // only bother for reads that don't need resampling and cover more than one block
+    // (or part of one with TILE_STRIPS). Other requests go through IReadBlock as normal.
+    bool bSimpleRead = (eRWFlag == GF_Read) && (poDS->GetAccess() != GA_Update) && 
+        (nBufXSize == nXSize) && (nBufYSize == nYSize) &&
+        ((psExtraArg == nullptr) || !psExtraArg->bFloatingPointWindowValidity);
+    bool bOneBlock = (nXOff / nBlockXSize == (nXOff + nXSize - 1) / nBlockXSize) && 
+            (nYOff / nBlockYSize == (nYOff + nYSize - 1) / nBlockYSize);
+    CPLErr err;
+    if( bSimpleRead && bOneBlock && readTileRows(nXOff, nYOff, nXSize, nYSize, pData, 
+                eBufType, nPixelSpace, nLineSpace, &err) )
+    {
+        return err;
+    }
+    if( bSimpleRead && !bOneBlock && readConverted(nXOff, nYOff, nXSize, nYSize, pData, 
+                eBufType, nPixelSpace, nLineSpace) )
+    {
+        return CE_None;
+    }
+    if( !bSimpleRead || bOneBlock )
+    {
+        return GDALRasterBand::IRasterIO(eRWFlag, nXOff, nYOff, nXSize, nYSize, pData, 
+                    nBufXSize, nBufYSize, eBufType, nPixelSpace, nLineSpace, psExtraArg);
+    }
+
+    // do it in strips of blocks that will fit in the block cache
+    int nStripBlocks = getPrefetchBlockRows(nXOff, nXSize, getTileBandCount());
+    int nYEndBlock = (nYOff + nYSize - 1) / nBlockYSize;
+    for( int nYBlock = nYOff / nBlockYSize; nYBlock <= nYEndBlock; nYBlock += nStripBlocks )
+    {
+        int nStripStart = std::max(nYOff, nYBlock * nBlockYSize);
+        int nStripEnd = std::min<GIntBig>(nYOff + nYSize, 
+                            static_cast<GIntBig>(nYBlock + nStripBlocks) * nBlockYSize);
+        int nStripSize = nStripEnd - nStripStart;
+
+        prefetchBlocks(nXOff, nStripStart, nXSize, nStripSize);
+
+        GByte *pStripData = static_cast<GByte*>(pData) + (nStripStart - nYOff) * nLineSpace;
+        err = GDALRasterBand::IRasterIO(eRWFlag, nXOff, nStripStart, nXSize, nStripSize, 
+                    pStripData, nXSize, nStripSize, eBufType, nPixelSpace, nLineSpace, psExtraArg);
+        if( err != CE_None )
+        {
+            return err;
         }
     }
-    // update map
-    poEMUDS->setTileOffset(m_nLevel, nBand, nBlockXOff, nBlockYOff, tileOffset, compressedSize, uncompressedSize);
-    
+    return CE_None;
+}
+
+CPLErr EMUBaseBand::AdviseRead( int nXOff, int nYOff, int nXSize, int nYSize,
+                            int nBufXSize, int nBufYSize, GDALDataType, 
+                            char ** )
+{
+    // only do the full res case for now, and only what will 
+    // fit in the block cache (the first part of the window)
+    if( (nBufXSize == nXSize) && (nBufYSize == nYSize) && (nXSize > 0) && (nYSize > 0) )
+    {
+        int nStripBlocks = getPrefetchBlockRows(nXOff, nXSize, getTileBandCount());
+        GIntBig nStripEnd = static_cast<GIntBig>(nYOff / nBlockYSize + nStripBlocks) * nBlockYSize;
+        int nPrefetchYSize = std::min<GIntBig>(nYSize, nStripEnd - nYOff);
+        prefetchBlocks(nXOff, nYOff, nXSize, nPrefetchYSize);
+    }
     return CE_None;
 }
 
 EMURasterBand::EMURasterBand(EMUDataset *pDataset, int nBandIn, GDALDataType eType, 
-        int nXSize, int nYSize, int nBlockSize, const std::shared_ptr<std::mutex>& other)
-    : EMUBaseBand(pDataset, nBandIn, eType, 0, nXSize, nYSize, nBlockSize, other),
+        int nXSize, int nYSize, int nBlockXSizeIn, int nBlockYSizeIn, const std::shared_ptr<std::mutex>& other)
+    : EMUBaseBand(pDataset, nBandIn, eType, 0, nXSize, nYSize, nBlockXSizeIn, nBlockYSizeIn, other),
         m_rat(pDataset, this, other)
 {
     m_bNoDataSet = false;
@@ -205,6 +1458,10 @@ EMURasterBand::EMURasterBand(EMUDataset *pDataset, int nBandIn, GDALDataType eTy
     m_dMean = std::numeric_limits<double>::quiet_NaN();
     m_dStdDev = std::numeric_limits<double>::quiet_NaN();
 
+    m_pStats = nullptr;
+    m_dHistMin = 0;
+    m_dHistMax = 0;
+
     // initialise overview variables
     m_nOverviews = 0;
     m_panOverviewBands = nullptr;
@@ -220,6 +1477,7 @@ EMURasterBand::~EMURasterBand()
         delete m_panOverviewBands[nCount];
     }
     CPLFree(m_panOverviewBands);
+    delete m_pStats;
 
     CSLDestroy(m_papszMetadataList);
     // FlushCache happens in ~EMUBaseBand
@@ -319,7 +1577,70 @@ void EMURasterBand::UpdateMetadataList()
     osWorkingResult.Printf( "%f", m_dStdDev);
     m_papszMetadataList = CSLSetNameValue(m_papszMetadataList, STATISTICS_STDDEV, osWorkingResult);
 
-    // TODO: STATISTICS_HISTO* from RAT (if set)
+    if( !m_histogram.empty() )
+    {
+        osWorkingResult.Printf( "%.17g", m_dHistMin);
+        m_papszMetadataList = CSLSetNameValue(m_papszMetadataList, STATISTICS_HISTOMIN, osWorkingResult);
+
+        osWorkingResult.Printf( "%.17g", m_dHistMax);
+        m_papszMetadataList = CSLSetNameValue(m_papszMetadataList, STATISTICS_HISTOMAX, osWorkingResult);
+
+        osWorkingResult.Printf( "%d", static_cast<int>(m_histogram.size()));
+        m_papszMetadataList = CSLSetNameValue(m_papszMetadataList, STATISTICS_HISTONUMBINS, osWorkingResult);
+
+        // same format as GDAL uses
+        osWorkingResult.clear();
+        for( uint64_t nCount : m_histogram )
+        {
+            osWorkingResult += CPLSPrintf(CPL_FRMT_GUIB "|", static_cast<GUIntBig>(nCount));
+        }
+        m_papszMetadataList = CSLSetNameValue(m_papszMetadataList, STATISTICS_HISTOBINVALUES, osWorkingResult);
+    }
+}
+
+CPLErr EMURasterBand::addBlockStatistics(int nBlockXOff, int nBlockYOff, void *pData)
+{
+    // created when the first block arrives so SetNoDataValue has been called
+    std::call_once(m_statsOnce, [this]()
+    {
+        int nNoDataSet = FALSE;
+        double dfNoData = GetNoDataValue(&nNoDataSet);
+        m_pStats = new EMUStatsAccumulator(eDataType, nNoDataSet, dfNoData);
+    });
+
+    int nXValid, nYValid;
+    CPLErr err = GetActualBlockSize(nBlockXOff, nBlockYOff, &nXValid, &nYValid);
+    if( err != CE_None )
+    {
+        return err;
+    }
+
+    if( !m_pStats->addBlock(pData, nBlockXSize, nXValid, nYValid) )
+    {
+        CPLError(CE_Failure, CPLE_NotSupported, 
+            "Can't calculate statistics for data type %s", GDALGetDataTypeName(eDataType));
+        return CE_Failure;
+    }
+    return CE_None;
+}
+
+void EMURasterBand::finaliseStatistics()
+{
+    if( m_pStats == nullptr )
+    {
+        return;
+    }
+
+    // whatever the caller has set wins
+    if( std::isnan(m_dMin) && std::isnan(m_dMax) && std::isnan(m_dMean) && std::isnan(m_dStdDev) )
+    {
+        m_pStats->getStatistics(&m_dMin, &m_dMax, &m_dMean, &m_dStdDev);
+    }
+    if( CSLFetchNameValue(m_papszMetadataList, STATISTICS_HISTOBINVALUES) == nullptr )
+    {
+        m_pStats->getHistogram(&m_dHistMin, &m_dHistMax, m_histogram);
+    }
+    UpdateMetadataList();
 }
 
 CPLErr EMURasterBand::SetMetadataItem(const char *pszName, const char *pszValue, 
@@ -443,7 +1764,7 @@ CPLErr EMURasterBand::CreateOverviews(int nOverviews, const int *panOverviewList
     m_nOverviews = nOverviews;
 
     // loop through and create the overviews
-    int nFactor, nXSize, nYSize, nBlockSize;
+    int nFactor, nXSize, nYSize, nOvBlockXSize, nOvBlockYSize;
     for( int nCount = 0; nCount < m_nOverviews; nCount++ )
     {
         nFactor = panOverviewList[nCount];
@@ -453,15 +1774,16 @@ CPLErr EMURasterBand::CreateOverviews(int nOverviews, const int *panOverviewList
         // note: different from KEA we shrink the blocksize by factor for the overviews
         // so we don't get partial overview blocks when creating a file with RIOS.
         // 
-        nBlockSize = this->nBlockXSize / nFactor;
+        nOvBlockXSize = this->nBlockXSize / nFactor;
+        nOvBlockYSize = this->nBlockYSize / nFactor;
         m_panOverviewBands[nCount] = new EMUBaseBand(cpl::down_cast<EMUDataset*>(poDS), 
-            nBand, eDataType, nCount + 1, nXSize, nYSize, nBlockSize, m_mutex);
+            nBand, eDataType, nCount + 1, nXSize, nYSize, nOvBlockXSize, nOvBlockYSize, m_mutex);
     }
     
     return CE_None;
 }
 
-CPLErr EMURasterBand::CreateOverviews(const std::vector<std::tuple<int, int, int> > &sizes)
+CPLErr EMURasterBand::CreateOverviews(const std::vector<std::tuple<int, int, int, int> > &sizes)
 {
     if( m_panOverviewBands != nullptr )
     {
@@ -479,7 +1801,7 @@ CPLErr EMURasterBand::CreateOverviews(const std::vector<std::tuple<int, int, int
     {
         m_panOverviewBands[nCount] = new EMUBaseBand(cpl::down_cast<EMUDataset*>(poDS), 
                 nBand, eDataType, nCount + 1, 
-                std::get<0>(s), std::get<1>(s), std::get<2>(s), m_mutex);
+                std::get<0>(s), std::get<1>(s), std::get<2>(s), std::get<3>(s), m_mutex);
         nCount++;
     }    
 
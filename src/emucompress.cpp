@@ -33,75 +33,1017 @@
 #include "emuband.h"
 #include "emucompress.h"
 
+#include <algorithm>
 #include <set>
 
-// https://gist.github.com/arq5x/5315739
-Bytef* doCompression(int type, Bytef *pInput, size_t inputSize, size_t *pnOutputSize, bool *pbFree) 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include "zstd.h"
+#endif
+#ifdef HAVE_LZ4
+#include "lz4.h"
+#endif
+#ifdef HAVE_LIBDEFLATE
+#include "libdeflate.h"
+#endif
+
+// Scratch buffers for the calling thread. These are kept between tiles 
+// so we aren't allocating (and freeing) every time.
+struct EMUScratchArena
 {
-    if( type == COMPRESSION_NONE )
+    Bytef *pBuffers[SCRATCH_COUNT] = {};
+    size_t nSizes[SCRATCH_COUNT] = {};
+    
+    ~EMUScratchArena()
     {
-        // do nothing
-        *pnOutputSize = inputSize;
-        *pbFree = false;
-        return pInput;
+        for( int n = 0; n < SCRATCH_COUNT; n++ )
+        {
+            CPLFree(pBuffers[n]);
+        }
     }
-    else if( type == COMPRESSION_ZLIB )
+};
+
+static thread_local EMUScratchArena g_scratch;
+
+Bytef *getScratchBuffer(EMUScratchSlot slot, size_t nSize)
+{
+    if( nSize > g_scratch.nSizes[slot] )
     {
-        Bytef *pOutput = static_cast<Bytef*>(CPLMalloc(*pnOutputSize));
+        // don't need the old contents so no point in realloc
+        CPLFree(g_scratch.pBuffers[slot]);
+        g_scratch.pBuffers[slot] = static_cast<Bytef*>(CPLMalloc(nSize));
+        g_scratch.nSizes[slot] = nSize;
+    }
+    return g_scratch.pBuffers[slot];
+}
+
+static size_t noneBound(size_t nInputSize)
+{
+    return nInputSize;
+}
+
+static bool noneCompress(int, const Bytef *pInput, size_t nInputSize, 
+                        Bytef *pOutput, size_t *pnOutputSize)
+{
+    memcpy(pOutput, pInput, nInputSize);
+    *pnOutputSize = nInputSize;
+    return true;
+}
+
+static bool noneUncompress(const Bytef *pInput, size_t nInputSize, 
+                        Bytef *pOutput, size_t nOutputSize)
+{
+    if( nInputSize != nOutputSize )
+    {
+        return false;
+    }
+    memcpy(pOutput, pInput, nInputSize);
+    return true;
+}
+
+// zlib format. Uses libdeflate if available as it is much faster 
+// (and produces a compatible stream).
+#ifdef HAVE_LIBDEFLATE
+// libdeflate (de)compressors for the calling thread
+struct EMULibdeflateState
+{
+    struct libdeflate_compressor *pCompressor = nullptr;
+    int nCompressorLevel = 0;
+    struct libdeflate_decompressor *pDecompressor = nullptr;
+
+    ~EMULibdeflateState()
+    {
+        if( pCompressor != nullptr )
+            libdeflate_free_compressor(pCompressor);
+        if( pDecompressor != nullptr )
+            libdeflate_free_decompressor(pDecompressor);
+    }
+};
+
+static thread_local EMULibdeflateState g_libdeflate;
+
+static size_t zlibBound(size_t nInputSize)
+{
+    return libdeflate_zlib_compress_bound(nullptr, nInputSize);
+}
+
+static bool zlibCompress(int nLevel, const Bytef *pInput, size_t nInputSize, 
+                        Bytef *pOutput, size_t *pnOutputSize)
+{
+    if( (g_libdeflate.pCompressor == nullptr) || (g_libdeflate.nCompressorLevel != nLevel) )
+    {
+        if( g_libdeflate.pCompressor != nullptr )
+            libdeflate_free_compressor(g_libdeflate.pCompressor);
+        g_libdeflate.pCompressor = libdeflate_alloc_compressor(nLevel);
+        g_libdeflate.nCompressorLevel = nLevel;
+        if( g_libdeflate.pCompressor == nullptr )
+        {
+            return false;
+        }
+    }
+    *pnOutputSize = libdeflate_zlib_compress(g_libdeflate.pCompressor, pInput, nInputSize, 
+                        pOutput, *pnOutputSize);
+    return *pnOutputSize != 0;
+}
+
+static bool zlibUncompress(const Bytef *pInput, size_t nInputSize, 
+                        Bytef *pOutput, size_t nOutputSize)
+{
+    if( g_libdeflate.pDecompressor == nullptr )
+    {
+        g_libdeflate.pDecompressor = libdeflate_alloc_decompressor();
+        if( g_libdeflate.pDecompressor == nullptr )
+        {
+            return false;
+        }
+    }
+    enum libdeflate_result result = libdeflate_zlib_decompress(g_libdeflate.pDecompressor, 
+                        pInput, nInputSize, pOutput, nOutputSize, nullptr);
+    return result == LIBDEFLATE_SUCCESS;
+}
+#else
+// z_streams for the calling thread. These are reset rather than 
+// set up from scratch for each tile.
+struct EMUZStreams
+{
+    z_stream defstream;
+    bool bDeflateInit = false;
+    int nDeflateLevel = 0;
+    z_stream infstream;
+    bool bInflateInit = false;
     
-        z_stream defstream;
+    ~EMUZStreams()
+    {
+        if( bDeflateInit )
+            deflateEnd(&defstream);
+        if( bInflateInit )
+            inflateEnd(&infstream);
+    }
+};
+
+static thread_local EMUZStreams g_zstreams;
+
+static size_t zlibBound(size_t nInputSize)
+{
+    return compressBound(nInputSize);
+}
+
+// https://gist.github.com/arq5x/5315739
+static bool zlibCompress(int nLevel, const Bytef *pInput, size_t nInputSize, 
+                        Bytef *pOutput, size_t *pnOutputSize)
+{
+    z_stream &defstream = g_zstreams.defstream;
+    if( g_zstreams.bDeflateInit && (g_zstreams.nDeflateLevel == nLevel) )
+    {
+        if( deflateReset(&defstream) != Z_OK )
+        {
+            return false;
+        }
+    }
+    else
+    {
+        if( g_zstreams.bDeflateInit )
+        {
+            deflateEnd(&defstream);
+            g_zstreams.bDeflateInit = false;
+        }
         defstream.zalloc = Z_NULL;
         defstream.zfree = Z_NULL;
         defstream.opaque = Z_NULL;
-        defstream.avail_in = inputSize;
-        defstream.next_in = pInput;
-        defstream.avail_out = *pnOutputSize;
-        defstream.next_out = pOutput;
-        
-        // the actual compression work.
-        deflateInit(&defstream, Z_BEST_COMPRESSION);
-        deflate(&defstream, Z_FINISH);
-        deflateEnd(&defstream);
-        
-        *pnOutputSize = defstream.total_out;
-        *pbFree = true;
-        return pOutput;
-    } 
+        if( deflateInit(&defstream, nLevel) != Z_OK )
+        {
+            return false;
+        }
+        g_zstreams.bDeflateInit = true;
+        g_zstreams.nDeflateLevel = nLevel;
+    }
+    defstream.avail_in = nInputSize;
+    defstream.next_in = const_cast<Bytef*>(pInput);
+    defstream.avail_out = *pnOutputSize;
+    defstream.next_out = pOutput;
+    
+    // the actual compression work.
+    int ret = deflate(&defstream, Z_FINISH);
+    *pnOutputSize = defstream.total_out;
+    return ret == Z_STREAM_END;
+}
+
+static bool zlibUncompress(const Bytef *pInput, size_t nInputSize, 
+                        Bytef *pOutput, size_t nOutputSize)
+{
+    z_stream &infstream = g_zstreams.infstream;
+    if( g_zstreams.bInflateInit )
+    {
+        if( inflateReset(&infstream) != Z_OK )
+        {
+            return false;
+        }
+    }
     else
     {
-        fprintf(stderr, "Unknown compression type\n");
-        return nullptr;
+        infstream.zalloc = Z_NULL;
+        infstream.zfree = Z_NULL;
+        infstream.opaque = Z_NULL;
+        infstream.avail_in = 0;
+        infstream.next_in = Z_NULL;
+        if( inflateInit(&infstream) != Z_OK )
+        {
+            return false;
+        }
+        g_zstreams.bInflateInit = true;
+    }
+    infstream.avail_in = nInputSize;
+    infstream.next_in = const_cast<Bytef*>(pInput);
+    infstream.avail_out = nOutputSize;
+    infstream.next_out = pOutput;
+     
+    // the actual DE-compression work.
+    int ret = inflate(&infstream, Z_FINISH);
+    return ret == Z_STREAM_END;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+// contexts for the calling thread
+struct EMUZstdState
+{
+    ZSTD_CCtx *pCCtx = nullptr;
+    ZSTD_DCtx *pDCtx = nullptr;
+    
+    ~EMUZstdState()
+    {
+        ZSTD_freeCCtx(pCCtx);
+        ZSTD_freeDCtx(pDCtx);
+    }
+};
+
+static thread_local EMUZstdState g_zstd;
+
+static size_t zstdBound(size_t nInputSize)
+{
+    return ZSTD_compressBound(nInputSize);
+}
+
+static bool zstdCompress(int nLevel, const Bytef *pInput, size_t nInputSize, 
+                        Bytef *pOutput, size_t *pnOutputSize)
+{
+    if( g_zstd.pCCtx == nullptr )
+    {
+        g_zstd.pCCtx = ZSTD_createCCtx();
+        if( g_zstd.pCCtx == nullptr )
+        {
+            return false;
+        }
+    }
+    size_t ret = ZSTD_compressCCtx(g_zstd.pCCtx, pOutput, *pnOutputSize, pInput, nInputSize, nLevel);
+    if( ZSTD_isError(ret) )
+    {
+        return false;
+    }
+    *pnOutputSize = ret;
+    return true;
+}
+
+static bool zstdUncompress(const Bytef *pInput, size_t nInputSize, 
+                        Bytef *pOutput, size_t nOutputSize)
+{
+    if( g_zstd.pDCtx == nullptr )
+    {
+        g_zstd.pDCtx = ZSTD_createDCtx();
+        if( g_zstd.pDCtx == nullptr )
+        {
+            return false;
+        }
     }
+    size_t ret = ZSTD_decompressDCtx(g_zstd.pDCtx, pOutput, nOutputSize, pInput, nInputSize);
+    return !ZSTD_isError(ret) && (ret == nOutputSize);
 }
+#endif
 
+#ifdef HAVE_LZ4
+static size_t lz4Bound(size_t nInputSize)
+{
+    return LZ4_compressBound(nInputSize);
+}
 
-void doUncompression(uint8_t type, Bytef *pInput, size_t inputSize, Bytef *pOutput, size_t pnOutputSize)
+// level is the LZ4 'acceleration'. Higher is faster but compresses less.
+static bool lz4Compress(int nLevel, const Bytef *pInput, size_t nInputSize, 
+                        Bytef *pOutput, size_t *pnOutputSize)
+{
+    if( nInputSize > LZ4_MAX_INPUT_SIZE )
+    {
+        return false;
+    }
+    // saves LZ4 setting up its state each time
+    void *pState = getScratchBuffer(SCRATCH_CODEC, LZ4_sizeofState());
+    int ret = LZ4_compress_fast_extState(pState, reinterpret_cast<const char*>(pInput), 
+                    reinterpret_cast<char*>(pOutput), nInputSize, *pnOutputSize, nLevel);
+    if( ret <= 0 )
+    {
+        return false;
+    }
+    *pnOutputSize = ret;
+    return true;
+}
+
+static bool lz4Uncompress(const Bytef *pInput, size_t nInputSize, 
+                        Bytef *pOutput, size_t nOutputSize)
+{
+    int ret = LZ4_decompress_safe(reinterpret_cast<const char*>(pInput), 
+                    reinterpret_cast<char*>(pOutput), nInputSize, nOutputSize);
+    return (ret >= 0) && (static_cast<size_t>(ret) == nOutputSize);
+}
+#endif
+
+static const EMUCodec g_codecs[] = {
+    {COMPRESSION_NONE, "NONE", 0, 0, 0, noneBound, noneCompress, noneUncompress},
+#ifdef HAVE_LIBDEFLATE
+    {COMPRESSION_ZLIB, "ZLIB", Z_BEST_COMPRESSION, 1, 12, zlibBound, zlibCompress, zlibUncompress},
+#else
+    {COMPRESSION_ZLIB, "ZLIB", Z_BEST_COMPRESSION, 1, 9, zlibBound, zlibCompress, zlibUncompress},
+#endif
+#ifdef HAVE_ZSTD
+    {COMPRESSION_ZSTD, "ZSTD", 3, 1, 22, zstdBound, zstdCompress, zstdUncompress},
+#endif
+#ifdef HAVE_LZ4
+    {COMPRESSION_LZ4, "LZ4", 1, 1, 65537, lz4Bound, lz4Compress, lz4Uncompress},
+#endif
+};
+
+const EMUCodec *getCodec(uint8_t type)
+{
+    for( const EMUCodec &codec : g_codecs )
+    {
+        if( codec.type == type )
+        {
+            return &codec;
+        }
+    }
+    return nullptr;
+}
+
+const EMUCodec *getCodecByName(const char *pszName)
+{
+    // DEFLATE is what GDAL uses elsewhere for zlib
+    if( EQUAL(pszName, "DEFLATE") )
+    {
+        return getCodec(COMPRESSION_ZLIB);
+    }
+    for( const EMUCodec &codec : g_codecs )
+    {
+        if( EQUAL(codec.pszName, pszName) )
+        {
+            return &codec;
+        }
+    }
+    return nullptr;
+}
+
+std::vector<const EMUCodec*> getAvailableCodecs()
+{
+    std::vector<const EMUCodec*> codecs;
+    for( const EMUCodec &codec : g_codecs )
+    {
+        codecs.push_back(&codec);
+    }
+    return codecs;
+}
+
+// returns nullptr on failure. Otherwise pInput for COMPRESSION_NONE or a 
+// per thread buffer that is valid until the next call from this thread.
+Bytef* doCompression(int type, int level, Bytef *pInput, size_t inputSize, size_t *pnOutputSize) 
 {
     if( type == COMPRESSION_NONE )
     {
-        memcpy(pOutput, pInput, inputSize);
+        // do nothing
+        *pnOutputSize = inputSize;
+        return pInput;
     }
-    else if( type == COMPRESSION_ZLIB )
+
+    const EMUCodec *pCodec = getCodec(type);
+    if( pCodec == nullptr )
     {
-        z_stream infstream;
-        infstream.zalloc = Z_NULL;
-        infstream.zfree = Z_NULL;
-        infstream.opaque = Z_NULL;
-        infstream.avail_in = inputSize;
-        infstream.next_in = pInput;
-        infstream.avail_out = pnOutputSize;
-        infstream.next_out = pOutput;
-         
-        // the actual DE-compression work.
-        inflateInit(&infstream);
-        inflate(&infstream, Z_NO_FLUSH);
-        inflateEnd(&infstream);
-    } 
+        CPLError(CE_Failure, CPLE_NotSupported, "Unknown compression type %d", type);
+        return nullptr;
+    }
+    if( level == COMPRESSION_DFLT_LEVEL )
+    {
+        level = pCodec->nDefaultLevel;
+    }
+
+    *pnOutputSize = pCodec->pfnBound(inputSize);
+    Bytef *pOutput = getScratchBuffer(SCRATCH_COMPRESSED, *pnOutputSize);
+    if( !pCodec->pfnCompress(level, pInput, inputSize, pOutput, pnOutputSize) )
+    {
+        CPLError(CE_Failure, CPLE_AppDefined, "%s compression failed", pCodec->pszName);
+        return nullptr;
+    }
+    return pOutput;
+}
+
+// returns false on failure (pOutput will be undefined)
+bool doUncompression(uint8_t type, const Bytef *pInput, size_t inputSize, Bytef *pOutput, size_t pnOutputSize)
+{
+    const EMUCodec *pCodec = getCodec(type);
+    if( pCodec == nullptr )
+    {
+        CPLError(CE_Failure, CPLE_NotSupported, 
+            "Unknown compression type %d. Perhaps this build doesn't support it?", type);
+        return false;
+    }
+    if( !pCodec->pfnUncompress(pInput, inputSize, pOutput, pnOutputSize) )
+    {
+        CPLError(CE_Failure, CPLE_AppDefined, "%s decompression failed", pCodec->pszName);
+        return false;
+    }
+    return true;
+}
+
+bool doZlibUncompressUnknownSize(const Bytef *pInput, size_t inputSize, std::vector<Bytef> &output)
+{
+    // always zlib itself - libdeflate needs to know the size
+    z_stream infstream;
+    infstream.zalloc = Z_NULL;
+    infstream.zfree = Z_NULL;
+    infstream.opaque = Z_NULL;
+    infstream.avail_in = 0;
+    infstream.next_in = Z_NULL;
+    if( inflateInit(&infstream) != Z_OK )
+    {
+        return false;
+    }
+    infstream.avail_in = inputSize;
+    infstream.next_in = const_cast<Bytef*>(pInput);
+    output.resize(std::max<size_t>(inputSize * 4, 64));
+    int ret = Z_OK;
+    while( ret == Z_OK )
+    {
+        if( infstream.total_out == output.size() )
+        {
+            output.resize(output.size() * 2);
+        }
+        infstream.next_out = output.data() + infstream.total_out;
+        infstream.avail_out = output.size() - infstream.total_out;
+        ret = inflate(&infstream, Z_NO_FLUSH);
+    }
+    output.resize(infstream.total_out);
+    inflateEnd(&infstream);
+    if( ret != Z_STREAM_END )
+    {
+        CPLError(CE_Failure, CPLE_AppDefined, "zlib decompression failed");
+        return false;
+    }
+    return true;
+}
+
+// Byte shuffle: all the first bytes of each element, then all the 
+// second bytes etc. Similar bytes end up together which compresses better.
+#ifdef __SSE2__
+// de-interleaves the even and odd bytes log2(T) times which leaves 
+// byte p of 16 elements in v[p]. Returns the number of elements done.
+template <int T>
+static size_t shuffleSSE2(const Bytef *pIn, Bytef *pOut, size_t nElements)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    size_t i = 0;
+    for( ; i + 16 <= nElements; i += 16 )
+    {
+        __m128i v[T], t[T];
+        for( int p = 0; p < T; p++ )
+        {
+            v[p] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pIn + i * T + p * 16));
+        }
+        for( int nStep = 1; nStep < T; nStep *= 2 )
+        {
+            for( int k = 0; k < T / 2; k++ )
+            {
+                t[k] = _mm_packus_epi16(_mm_and_si128(v[2 * k], mask), 
+                                _mm_and_si128(v[2 * k + 1], mask));
+                t[k + T / 2] = _mm_packus_epi16(_mm_srli_epi16(v[2 * k], 8), 
+                                _mm_srli_epi16(v[2 * k + 1], 8));
+            }
+            for( int p = 0; p < T; p++ )
+            {
+                v[p] = t[p];
+            }
+        }
+        for( int p = 0; p < T; p++ )
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + p * nElements + i), v[p]);
+        }
+    }
+    return i;
+}
+
+// the reverse of shuffleSSE2
+template <int T>
+static size_t unshuffleSSE2(const Bytef *pIn, Bytef *pOut, size_t nElements)
+{
+    size_t i = 0;
+    for( ; i + 16 <= nElements; i += 16 )
+    {
+        __m128i v[T], t[T];
+        for( int p = 0; p < T; p++ )
+        {
+            v[p] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pIn + p * nElements + i));
+        }
+        for( int nStep = 1; nStep < T; nStep *= 2 )
+        {
+            for( int k = 0; k < T / 2; k++ )
+            {
+                t[2 * k] = _mm_unpacklo_epi8(v[k], v[k + T / 2]);
+                t[2 * k + 1] = _mm_unpackhi_epi8(v[k], v[k + T / 2]);
+            }
+            for( int p = 0; p < T; p++ )
+            {
+                v[p] = t[p];
+            }
+        }
+        for( int p = 0; p < T; p++ )
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + i * T + p * 16), v[p]);
+        }
+    }
+    return i;
+}
+#endif
+
+static void shuffleBytes(const Bytef *pIn, Bytef *pOut, size_t nElements, int nTypeSize)
+{
+    size_t nDone = 0;
+#ifdef __SSE2__
+    if( nTypeSize == 2 )
+        nDone = shuffleSSE2<2>(pIn, pOut, nElements);
+    else if( nTypeSize == 4 )
+        nDone = shuffleSSE2<4>(pIn, pOut, nElements);
+    else if( nTypeSize == 8 )
+        nDone = shuffleSSE2<8>(pIn, pOut, nElements);
+#endif
+    for( int j = 0; j < nTypeSize; j++ )
+    {
+        for( size_t i = nDone; i < nElements; i++ )
+        {
+            pOut[j * nElements + i] = pIn[i * nTypeSize + j];
+        }
+    }
+}
+
+static void unshuffleBytes(const Bytef *pIn, Bytef *pOut, size_t nElements, int nTypeSize)
+{
+    size_t nDone = 0;
+#ifdef __SSE2__
+    if( nTypeSize == 2 )
+        nDone = unshuffleSSE2<2>(pIn, pOut, nElements);
+    else if( nTypeSize == 4 )
+        nDone = unshuffleSSE2<4>(pIn, pOut, nElements);
+    else if( nTypeSize == 8 )
+        nDone = unshuffleSSE2<8>(pIn, pOut, nElements);
+#endif
+    for( int j = 0; j < nTypeSize; j++ )
+    {
+        for( size_t i = nDone; i < nElements; i++ )
+        {
+            pOut[i * nTypeSize + j] = pIn[j * nElements + i];
+        }
+    }
+}
+
+// transpose an 8x8 matrix of bits (Hacker's Delight 7-3)
+static uint64_t transpose8x8(uint64_t x)
+{
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+// Bit shuffle of one plane of nBytes bytes (a multiple of 8). 
+// Output is 8 runs of nBytes / 8 bytes, the first is bit 0 of each input byte etc.
+static void bitTransposeForward(const Bytef *pIn, Bytef *pOut, size_t nBytes)
+{
+    size_t nStride = nBytes / 8;
+    size_t e = 0;
+#ifdef __SSE2__
+    for( ; e + 16 <= nBytes; e += 16 )
+    {
+        // movemask takes the top bit of each byte, so start with bit 7
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pIn + e));
+        for( int nBit = 7; nBit >= 0; nBit-- )
+        {
+            uint16_t nMask = static_cast<uint16_t>(_mm_movemask_epi8(v));
+            memcpy(pOut + nBit * nStride + e / 8, &nMask, sizeof(nMask));
+            v = _mm_slli_epi16(v, 1);
+        }
+    }
+#endif
+    for( ; e < nBytes; e += 8 )
+    {
+        uint64_t x = 0;
+        for( int k = 0; k < 8; k++ )
+        {
+            x |= static_cast<uint64_t>(pIn[e + k]) << (k * 8);
+        }
+        x = transpose8x8(x);
+        for( int nBit = 0; nBit < 8; nBit++ )
+        {
+            pOut[nBit * nStride + e / 8] = static_cast<Bytef>(x >> (nBit * 8));
+        }
+    }
+}
+
+static void bitTransposeReverse(const Bytef *pIn, Bytef *pOut, size_t nBytes)
+{
+    size_t nStride = nBytes / 8;
+    size_t e = 0;
+#ifdef __SSE2__
+    for( ; e + 16 <= nBytes; e += 16 )
+    {
+        // byte r is byte (r / 8) of bit plane (r % 8) so the 
+        // movemask gives us output bytes k and k + 8
+        alignas(16) Bytef gathered[16];
+        for( int nBit = 0; nBit < 8; nBit++ )
+        {
+            gathered[nBit] = pIn[nBit * nStride + e / 8];
+            gathered[nBit + 8] = pIn[nBit * nStride + e / 8 + 1];
+        }
+        __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(gathered));
+        for( int k = 7; k >= 0; k-- )
+        {
+            int nMask = _mm_movemask_epi8(v);
+            pOut[e + k] = static_cast<Bytef>(nMask);
+            pOut[e + k + 8] = static_cast<Bytef>(nMask >> 8);
+            v = _mm_slli_epi16(v, 1);
+        }
+    }
+#endif
+    for( ; e < nBytes; e += 8 )
+    {
+        uint64_t x = 0;
+        for( int nBit = 0; nBit < 8; nBit++ )
+        {
+            x |= static_cast<uint64_t>(pIn[nBit * nStride + e / 8]) << (nBit * 8);
+        }
+        x = transpose8x8(x);
+        for( int k = 0; k < 8; k++ )
+        {
+            pOut[e + k] = static_cast<Bytef>(x >> (k * 8));
+        }
+    }
+}
+
+// horizontal differencing along each row
+template <typename T>
+static void predictorForward(const Bytef *pIn, Bytef *pOut, size_t nXSize, size_t nYSize)
+{
+    const T *pSrc = reinterpret_cast<const T*>(pIn);
+    T *pDst = reinterpret_cast<T*>(pOut);
+    for( size_t y = 0; y < nYSize; y++ )
+    {
+        size_t nRowStart = y * nXSize;
+        pDst[nRowStart] = pSrc[nRowStart];
+        for( size_t x = 1; x < nXSize; x++ )
+        {
+            pDst[nRowStart + x] = static_cast<T>(pSrc[nRowStart + x] - pSrc[nRowStart + x - 1]);
+        }
+    }
+}
+
+template <typename T>
+static void predictorReverse(const Bytef *pIn, Bytef *pOut, size_t nXSize, size_t nYSize)
+{
+    const T *pSrc = reinterpret_cast<const T*>(pIn);
+    T *pDst = reinterpret_cast<T*>(pOut);
+    for( size_t y = 0; y < nYSize; y++ )
+    {
+        size_t nRowStart = y * nXSize;
+        pDst[nRowStart] = pSrc[nRowStart];
+        for( size_t x = 1; x < nXSize; x++ )
+        {
+            pDst[nRowStart + x] = static_cast<T>(pDst[nRowStart + x - 1] + pSrc[nRowStart + x]);
+        }
+    }
+}
+
+// byte of significance b (0 = most significant) within an element
+static int significantByte(int b, int nTypeSize)
+{
+    return CPL_IS_LSB ? (nTypeSize - 1 - b) : b;
+}
+
+// Floating point predictor. Each row is rearranged so the most significant 
+// bytes come first and then byte differencing is applied.
+static void fpPredictorForward(const Bytef *pIn, Bytef *pOut, int nTypeSize, size_t nXSize, size_t nYSize)
+{
+    size_t nRowBytes = nXSize * nTypeSize;
+    for( size_t y = 0; y < nYSize; y++ )
+    {
+        const Bytef *pSrcRow = pIn + y * nRowBytes;
+        Bytef *pDstRow = pOut + y * nRowBytes;
+        for( int b = 0; b < nTypeSize; b++ )
+        {
+            int nSrcByte = significantByte(b, nTypeSize);
+            for( size_t x = 0; x < nXSize; x++ )
+            {
+                pDstRow[b * nXSize + x] = pSrcRow[x * nTypeSize + nSrcByte];
+            }
+        }
+        for( size_t k = nRowBytes - 1; k > 0; k-- )
+        {
+            pDstRow[k] -= pDstRow[k - 1];
+        }
+    }
+}
+
+static void fpPredictorReverse(const Bytef *pIn, Bytef *pOut, int nTypeSize, size_t nXSize, size_t nYSize)
+{
+    size_t nRowBytes = nXSize * nTypeSize;
+    Bytef *row = getScratchBuffer(SCRATCH_FPREDICTOR, nRowBytes);
+    for( size_t y = 0; y < nYSize; y++ )
+    {
+        const Bytef *pSrcRow = pIn + y * nRowBytes;
+        Bytef *pDstRow = pOut + y * nRowBytes;
+        row[0] = pSrcRow[0];
+        for( size_t k = 1; k < nRowBytes; k++ )
+        {
+            row[k] = row[k - 1] + pSrcRow[k];
+        }
+        for( int b = 0; b < nTypeSize; b++ )
+        {
+            int nDstByte = significantByte(b, nTypeSize);
+            for( size_t x = 0; x < nXSize; x++ )
+            {
+                pDstRow[x * nTypeSize + nDstByte] = row[b * nXSize + x];
+            }
+        }
+    }
+}
+
+// filter pIn into pOut (both nXSize * nYSize * nTypeSize bytes)
+static bool applyFilter(uint8_t filter, int nTypeSize, size_t nXSize, size_t nYSize, 
+                    const Bytef *pIn, Bytef *pOut)
+{
+    size_t nElements = nXSize * nYSize;
+    if( filter == FILTER_PREDICTOR )
+    {
+        switch( nTypeSize )
+        {
+            case 1: predictorForward<uint8_t>(pIn, pOut, nXSize, nYSize); break;
+            case 2: predictorForward<uint16_t>(pIn, pOut, nXSize, nYSize); break;
+            case 4: predictorForward<uint32_t>(pIn, pOut, nXSize, nYSize); break;
+            case 8: predictorForward<uint64_t>(pIn, pOut, nXSize, nYSize); break;
+            default: return false;
+        }
+    }
+    else if( filter == FILTER_FPREDICTOR )
+    {
+        fpPredictorForward(pIn, pOut, nTypeSize, nXSize, nYSize);
+    }
+    else if( filter == FILTER_SHUFFLE )
+    {
+        shuffleBytes(pIn, pOut, nElements, nTypeSize);
+    }
+    else if( filter == FILTER_BITSHUFFLE )
+    {
+        // byte shuffle then bit shuffle each byte plane. Any left over 
+        // bytes at the end of each plane are left as they are.
+        Bytef *pShuffled = getScratchBuffer(SCRATCH_SHUFFLE, nElements * nTypeSize);
+        shuffleBytes(pIn, pShuffled, nElements, nTypeSize);
+        size_t nBitBytes = nElements & ~static_cast<size_t>(7);
+        for( int j = 0; j < nTypeSize; j++ )
+        {
+            bitTransposeForward(pShuffled + j * nElements, pOut + j * nElements, nBitBytes);
+            memcpy(pOut + j * nElements + nBitBytes, pShuffled + j * nElements + nBitBytes, 
+                    nElements - nBitBytes);
+        }
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+static bool reverseFilter(uint8_t filter, int nTypeSize, size_t nXSize, size_t nYSize, 
+                    const Bytef *pIn, Bytef *pOut)
+{
+    size_t nElements = nXSize * nYSize;
+    if( filter == FILTER_PREDICTOR )
+    {
+        switch( nTypeSize )
+        {
+            case 1: predictorReverse<uint8_t>(pIn, pOut, nXSize, nYSize); break;
+            case 2: predictorReverse<uint16_t>(pIn, pOut, nXSize, nYSize); break;
+            case 4: predictorReverse<uint32_t>(pIn, pOut, nXSize, nYSize); break;
+            case 8: predictorReverse<uint64_t>(pIn, pOut, nXSize, nYSize); break;
+            default: return false;
+        }
+    }
+    else if( filter == FILTER_FPREDICTOR )
+    {
+        fpPredictorReverse(pIn, pOut, nTypeSize, nXSize, nYSize);
+    }
+    else if( filter == FILTER_SHUFFLE )
+    {
+        unshuffleBytes(pIn, pOut, nElements, nTypeSize);
+    }
+    else if( filter == FILTER_BITSHUFFLE )
+    {
+        Bytef *pShuffled = getScratchBuffer(SCRATCH_SHUFFLE, nElements * nTypeSize);
+        size_t nBitBytes = nElements & ~static_cast<size_t>(7);
+        for( int j = 0; j < nTypeSize; j++ )
+        {
+            bitTransposeReverse(pIn + j * nElements, pShuffled + j * nElements, nBitBytes);
+            memcpy(pShuffled + j * nElements + nBitBytes, pIn + j * nElements + nBitBytes, 
+                    nElements - nBitBytes);
+        }
+        unshuffleBytes(pShuffled, pOut, nElements, nTypeSize);
+    }
     else
     {
-        fprintf(stderr, "Unknown compression type\n");
+        return false;
+    }
+    return true;
+}
+
+static Bytef* compressTile(uint8_t compression, int level, int nTypeSize, size_t nXSize, size_t nYSize, 
+                    Bytef *pInput, size_t *pnOutputSize)
+{
+    uint8_t codec = compression & COMPRESSION_MASK;
+    uint8_t filter = (compression & FILTER_MASK) >> FILTER_SHIFT;
+    size_t inputSize = nXSize * nYSize * nTypeSize;
+    if( filter == FILTER_NONE )
+    {
+        return doCompression(codec, level, pInput, inputSize, pnOutputSize);
+    }
+    
+    Bytef *pFiltered = getScratchBuffer(SCRATCH_FILTERED, inputSize);
+    if( !applyFilter(filter, nTypeSize, nXSize, nYSize, pInput, pFiltered) )
+    {
+        CPLError(CE_Failure, CPLE_AppDefined, "Failed to apply filter %d", filter);
+        return nullptr;
+    }
+    
+    return doCompression(codec, level, pFiltered, inputSize, pnOutputSize);
+}
+
+static bool uncompressTile(uint8_t compression, int nTypeSize, size_t nXSize, size_t nYSize, 
+                    const Bytef *pInput, size_t inputSize, Bytef *pOutput, size_t nOutputSize)
+{
+    uint8_t codec = compression & COMPRESSION_MASK;
+    uint8_t filter = (compression & FILTER_MASK) >> FILTER_SHIFT;
+    if( filter == FILTER_NONE )
+    {
+        return doUncompression(codec, pInput, inputSize, pOutput, nOutputSize);
+    }
+    
+    if( nOutputSize != nXSize * nYSize * nTypeSize )
+    {
+        CPLError(CE_Failure, CPLE_AppDefined, "Tile is an unexpected size");
+        return false;
+    }
+    Bytef *pFiltered = getScratchBuffer(SCRATCH_FILTERED, nOutputSize);
+    if( !doUncompression(codec, pInput, inputSize, pFiltered, nOutputSize) )
+    {
+        return false;
+    }
+    if( !reverseFilter(filter, nTypeSize, nXSize, nYSize, pFiltered, pOutput) )
+    {
+        CPLError(CE_Failure, CPLE_NotSupported, 
+            "Unknown filter %d. Perhaps this build doesn't support it?", filter);
+        return false;
+    }
+    return true;
+}
+
+Bytef* doTileCompression(uint8_t compression, int level, int nTypeSize, size_t nXSize, size_t nYSize, 
+                    uint32_t nRowsPerStrip, Bytef *pInput, size_t *pnOutputSize)
+{
+    if( !(compression & COMPRESSION_STRIPS) )
+    {
+        return compressTile(compression, level, nTypeSize, nXSize, nYSize, pInput, pnOutputSize);
+    }
+    compression &= ~COMPRESSION_STRIPS;
+    const EMUCodec *pCodec = getCodec(compression & COMPRESSION_MASK);
+    if( (pCodec == nullptr) || (nRowsPerStrip == 0) || (nYSize == 0) )
+    {
+        CPLError(CE_Failure, CPLE_AppDefined, "Can't split tile into strips");
+        return nullptr;
+    }
+
+    uint32_t nStrips = (nYSize + nRowsPerStrip - 1) / nRowsPerStrip;
+    size_t nTableSize = STRIP_TABLE_START + nStrips * sizeof(uint64_t);
+    size_t nRowBytes = nXSize * nTypeSize;
+    size_t nMaxSize = nTableSize;
+    for( uint32_t n = 0; n < nStrips; n++ )
+    {
+        size_t nRows = std::min<size_t>(nRowsPerStrip, nYSize - n * nRowsPerStrip);
+        nMaxSize += pCodec->pfnBound(nRows * nRowBytes);
+    }
+
+    Bytef *pOutput = getScratchBuffer(SCRATCH_STRIPS, nMaxSize);
+    memcpy(pOutput, &nRowsPerStrip, sizeof(nRowsPerStrip));
+    memcpy(pOutput + sizeof(nRowsPerStrip), &nStrips, sizeof(nStrips));
+    uint64_t nEnd = 0;
+    for( uint32_t n = 0; n < nStrips; n++ )
+    {
+        size_t nRows = std::min<size_t>(nRowsPerStrip, nYSize - n * nRowsPerStrip);
+        size_t nStripSize;
+        Bytef *pStrip = compressTile(compression, level, nTypeSize, nXSize, nRows, 
+                            pInput + n * nRowsPerStrip * nRowBytes, &nStripSize);
+        if( (pStrip == nullptr) || (nTableSize + nEnd + nStripSize > nMaxSize) )
+        {
+            return nullptr;
+        }
+        memcpy(pOutput + nTableSize + nEnd, pStrip, nStripSize);
+        nEnd += nStripSize;
+        memcpy(pOutput + STRIP_TABLE_START + n * sizeof(uint64_t), &nEnd, sizeof(nEnd));
+    }
+    *pnOutputSize = nTableSize + nEnd;
+    return pOutput;
+}
+
+bool doTileUncompression(uint8_t compression, int nTypeSize, size_t nXSize, size_t nYSize, 
+                    const Bytef *pInput, size_t inputSize, Bytef *pOutput, size_t nOutputSize)
+{
+    if( !(compression & COMPRESSION_STRIPS) )
+    {
+        return uncompressTile(compression, nTypeSize, nXSize, nYSize, pInput, inputSize, 
+                    pOutput, nOutputSize);
+    }
+
+    EMUStripTable table;
+    if( (nOutputSize != nXSize * nYSize * nTypeSize) || 
+        !table.read(pInput, inputSize, nYSize, inputSize) )
+    {
+        CPLError(CE_Failure, CPLE_AppDefined, "Invalid strips in tile");
+        return false;
+    }
+    return doTileStripUncompression(compression, nTypeSize, nXSize, nYSize, table, 0, 
+                table.ends.size() - 1, pInput + table.nTableSize, pOutput);
+}
+
+bool doTileStripUncompression(uint8_t compression, int nTypeSize, size_t nXSize, size_t nYSize, 
+                    const EMUStripTable &table, size_t nFirstStrip, size_t nLastStrip, 
+                    const Bytef *pInput, Bytef *pOutput)
+{
+    compression &= ~COMPRESSION_STRIPS;
+    size_t nRowBytes = nXSize * nTypeSize;
+    size_t nStart = table.getStripStart(nFirstStrip);
+    for( size_t n = nFirstStrip; n <= nLastStrip; n++ )
+    {
+        size_t nRows = std::min<size_t>(table.nRowsPerStrip, nYSize - n * table.nRowsPerStrip);
+        size_t nStripStart = table.getStripStart(n);
+        if( !uncompressTile(compression, nTypeSize, nXSize, nRows, pInput + (nStripStart - nStart), 
+                    table.getStripEnd(n) - nStripStart, pOutput, nRows * nRowBytes) )
+        {
+            return false;
+        }
+        pOutput += nRows * nRowBytes;
+    }
+    return true;
+}
+
+size_t EMUStripTable::getTableSize(const Bytef *pInput, size_t inputSize)
+{
+    uint32_t nStrips;
+    if( inputSize < STRIP_TABLE_START )
+    {
+        return 0;
     }
+    memcpy(&nStrips, pInput + sizeof(uint32_t), sizeof(nStrips));
+    return (nStrips == 0) ? 0 : STRIP_TABLE_START + static_cast<size_t>(nStrips) * sizeof(uint64_t);
+}
 
+bool EMUStripTable::read(const Bytef *pInput, size_t inputSize, size_t nYSize, size_t nTileSize)
+{
+    nTableSize = getTableSize(pInput, inputSize);
+    if( (nTableSize == 0) || (nTableSize > inputSize) || (nTableSize > nTileSize) )
+    {
+        return false;
+    }
+    memcpy(&nRowsPerStrip, pInput, sizeof(nRowsPerStrip));
+    size_t nStrips = (nTableSize - STRIP_TABLE_START) / sizeof(uint64_t);
+    if( (nRowsPerStrip == 0) || (nStrips != (nYSize + nRowsPerStrip - 1) / nRowsPerStrip) )
+    {
+        return false;
+    }
+    ends.resize(nStrips);
+    memcpy(ends.data(), pInput + STRIP_TABLE_START, nStrips * sizeof(uint64_t));
+    for( size_t n = 1; n < nStrips; n++ )
+    {
+        if( ends[n] < ends[n - 1] )
+        {
+            return false;
+        }
+    }
+    return (ends.back() == nTileSize - nTableSize);
 }
 
 bool isSpecialKey(char *psz, std::set<std::string> &specialKeys)
@@ -177,13 +1119,23 @@ Bytef* doCompressMetadata(int type, char **papszMetadataList, size_t *pnInputSiz
     }
     *pPos = '\0';  // so we have a double null at the end
     
-    bool bFree;
-    *pnOutputSize = nInputSize + 100;
-    Bytef *pResult = doCompression(type, reinterpret_cast<Bytef*>(pData), nInputSize, pnOutputSize, &bFree);
+    Bytef *pCompressed = doCompression(type, COMPRESSION_DFLT_LEVEL, reinterpret_cast<Bytef*>(pData), 
+                        nInputSize, pnOutputSize);
     *pnInputSize = nInputSize;
     
-    if( bFree )
+    // the caller owns the result
+    Bytef *pResult = nullptr;
+    if( pCompressed == reinterpret_cast<Bytef*>(pData) )
+    {
+        pResult = pCompressed;
+    }
+    else
     {
+        if( pCompressed != nullptr )
+        {
+            pResult = static_cast<Bytef*>(CPLMalloc(*pnOutputSize));
+            memcpy(pResult, pCompressed, *pnOutputSize);
+        }
         CPLFree(pData);
     }
     return pResult;
@@ -195,7 +1147,14 @@ char** doUncompressMetadata(uint8_t type, Bytef *pInput, size_t inputSize, size_
     
     // first uncompress into a buffer
     char *pData = static_cast<char*>(CPLMalloc(nOutputSize));
-    doUncompression(type, pInput, inputSize, reinterpret_cast<Bytef*>(pData), nOutputSize);
+    if( (nOutputSize == 0) || 
+        !doUncompression(type, pInput, inputSize, reinterpret_cast<Bytef*>(pData), nOutputSize) )
+    {
+        CPLFree(pData);
+        return nullptr;
+    }
+    // make sure the string list is terminated
+    pData[nOutputSize - 1] = '\0';
 
     // convert into a string array
     char *pPos = pData;
@@ -28,18 +28,55 @@
  *
  */
 
+#include <algorithm>
+#include <cmath>
+
 #include "emudataset.h"
 #include "emuband.h"
 #include "emucompress.h"
+#include "emutilecache.h"
+#include "emuheadercache.h"
+#include "emureadahead.h"
+#include "emudrill.h"
 
-const int DFLT_TILESIZE = 512; // TODO: allow adjust
-const int S3_MAX_PARTS = 1000;
-const int S3_MIN_PART_SIZE = 50;  // MB - is actually 5, but let's not let it go down that far
-const int S3_MAX_PART_SIZE = 5000;  // MB
-// I have no idea here, but we need to guess the file size so we can work out 
-// the size of each chunk of the multi part upload
+const int DFLT_TILESIZE = 512; // unless BLOCKXSIZE/BLOCKYSIZE are given
+// limits for BLOCKXSIZE/BLOCKYSIZE
+const int MIN_TILESIZE = 16;
+const int MAX_TILESIZE = 16384;
+// object stores that are written with a multi part (or block) upload. 
+// Sizes are in MB. The prefixes include the "/" so /vsis3_streaming/ 
+// etc (which upload differently) don't match.
+struct EMUUploadTarget
+{
+    const char *pszPrefix;
+    int nMaxParts;
+    int nMinPartSize;
+    int nMaxPartSize;
+};
+static const EMUUploadTarget UPLOAD_TARGETS[] = {
+    {"/vsis3/", 10000, 5, 5000},
+    {"/vsigs/", 10000, 5, 5000},
+    {"/vsiaz/", 50000, 1, 4000}
+};
+// used unless the file looks like it will be smaller than this (GDAL's default)
+const int DFLT_PART_SIZE = 50; // MB
+// a guess at the typical file size, so small files don't buffer a full part. 
+// The part count limit is worked out from the uncompressed size instead 
+// as it's an upper bound.
 const double AVG_COMPRESSION_RATIO = 0.5;
+// HEADER_FIRST. Allowance for the fixed part of the header and for the nodata, 
+// stats and histogram metadata of each band.
+const size_t HEADER_SPACE_FIXED = 4096;
+const size_t HEADER_SPACE_PER_BAND = 4096;
+// overviews (halving each time) add up to another third. We don't know yet
+// whether there will be any so assume there are.
+const double OVERVIEW_SIZE_RATIO = 4.0 / 3.0;
 const int ONE_MB = 1048576; 
+// number of tiles per compression thread that can be waiting to be
+// written before IWriteBlock blocks. Keeps memory use bounded.
+const int TILES_IN_FLIGHT_PER_THREAD = 4;
+// more when uploading so compression can carry on while a part is sent
+const int TILES_IN_FLIGHT_PER_THREAD_UPLOAD = 12;
 
 //#define EMU_DEBUG
 #ifdef EMU_DEBUG
@@ -62,7 +99,69 @@ const int ONE_MB = 1048576;
 
 
 
-EMUDataset::EMUDataset(VSILFILE *fp, GDALDataType eType, int nXSize, int nYSize, GDALAccess eInAccess, bool bCloudOptimised, int nTileSize)
+EMUHeaderReader::EMUHeaderReader(GByte *pData, size_t nSize)
+{
+    m_pData = pData;
+    m_nSize = nSize;
+    m_nPos = 0;
+    m_bOK = true;
+}
+
+bool EMUHeaderReader::read(void *pDest, size_t nBytes)
+{
+    GByte *pSrc = getData(nBytes);
+    if( pSrc == nullptr )
+    {
+        return false;
+    }
+    memcpy(pDest, pSrc, nBytes);
+    return true;
+}
+
+GByte *EMUHeaderReader::getData(size_t nBytes)
+{
+    if( !m_bOK || (nBytes > (m_nSize - m_nPos)) )
+    {
+        m_bOK = false;
+        return nullptr;
+    }
+    GByte *pData = m_pData + m_nPos;
+    m_nPos += nBytes;
+    return pData;
+}
+
+bool EMUHeaderReader::readString(std::string *pStr)
+{
+    if( !m_bOK )
+    {
+        return false;
+    }
+    const char *pszStart = reinterpret_cast<const char*>(m_pData + m_nPos);
+    const void *pNull = memchr(pszStart, '\0', m_nSize - m_nPos);
+    if( pNull == nullptr )
+    {
+        m_bOK = false;
+        return false;
+    }
+    size_t nLen = static_cast<const char*>(pNull) - pszStart;
+    pStr->assign(pszStart, nLen);
+    m_nPos += nLen + 1;
+    return true;
+}
+
+bool EMUHeaderReader::seek(size_t nPos)
+{
+    if( !m_bOK || (nPos > m_nSize) )
+    {
+        m_bOK = false;
+        return false;
+    }
+    m_nPos = nPos;
+    return true;
+}
+
+EMUDataset::EMUDataset(VSILFILE *fp, GDALDataType eType, int nXSize, int nYSize, GDALAccess eInAccess, bool bCloudOptimised, 
+                int nTileXSize, int nTileYSize)
 {
     m_fp = fp;
     for( int i = 0; i < 6; i++ )
@@ -76,7 +175,8 @@ EMUDataset::EMUDataset(VSILFILE *fp, GDALDataType eType, int nXSize, int nYSize,
     eAccess = eInAccess;
     m_bCloudOptimised = bCloudOptimised;
     
-    m_tileSize = nTileSize;
+    m_tileXSize = nTileXSize;
+    m_tileYSize = nTileYSize;
 
     m_papszMetadataList = nullptr;
     UpdateMetadataList();
@@ -87,12 +187,59 @@ EMUDataset::EMUDataset(VSILFILE *fp, GDALDataType eType, int nXSize, int nYSize,
 EMUDataset::~EMUDataset()
 {
     Close();
+    // in case Close() bailed out early
+    stopWriterThreads();
+    for( auto &tile : m_interleavedTiles )
+    {
+        CPLFree(tile.second.pData);
+    }
+    delete m_pReadPool;
+    CSLDestroy(m_papszCacheMetadata);
+    CSLDestroy(m_papszIOStatsMetadata);
+    CSLDestroy(m_papszImageStructure);
+}
+
+// arrays in the header are aligned to this so they can be mapped directly
+const vsi_l_offset HEADER_ALIGNMENT = 8;
+
+static vsi_l_offset alignOffset(vsi_l_offset offset)
+{
+    return (offset + HEADER_ALIGNMENT - 1) & ~(HEADER_ALIGNMENT - 1);
+}
+
+void EMUHeaderWriter::write(const void *pData, size_t nBytes)
+{
+    const GByte *pBytes = static_cast<const GByte*>(pData);
+    m_data.insert(m_data.end(), pBytes, pBytes + nBytes);
+}
+
+void EMUHeaderWriter::writeString(const char *pszStr)
+{
+    write(pszStr, strlen(pszStr) + 1);
+}
+
+void EMUHeaderWriter::align()
+{
+    m_data.resize(alignOffset(m_data.size()), 0);
+}
+
+// write zeros to the file until we get to offset
+void EMUDataset::writePadding(vsi_l_offset offset)
+{
+    const GByte zeros[HEADER_ALIGNMENT] = {0};
+    vsi_l_offset current = VSIFTellL(m_fp);
+    if( offset > current )
+    {
+        VSIFWriteL(zeros, offset - current, 1, m_fp);
+    }
 }
 
 CPLErr EMUDataset::Close()
 {
     // don't lock here as the IWriteBlock function when called will try to lock again...
 
+    uint64_t nCloseStart = EMUIOStats::now();
+    bool bWasOpen = (m_fp != nullptr);
     CPLErr eErr = CE_None;
     if( 
         (nOpenFlags != OPEN_FLAGS_CLOSED ) && 
@@ -100,7 +247,9 @@ CPLErr EMUDataset::Close()
     {
         if( m_fp )  
         {
-            // ensure all bands written their data now
+            // ensure all bands written their data now. Carry on after a 
+            // failure so the threads are still stopped and the file closed 
+            // (the header isn't written though).
             for( int n = 0; n < GetRasterCount(); n++)
             {
                 GDALRasterBand *pband = GetRasterBand(n + 1);
@@ -109,190 +258,1189 @@ CPLErr EMUDataset::Close()
                 for( int o = 0; o < pband->GetOverviewCount(); o++)
                 {
                     GDALRasterBand *pOverview = pband->GetOverview(o);
-                    eErr = pOverview->FlushCache(true);
-                    if( eErr != CE_None )
+                    if( pOverview->FlushCache(true) != CE_None )
                     {
-                        return eErr;
+                        eErr = CE_Failure;
                     }
                 }
 
-                eErr = pband->FlushCache(true);
-                if( eErr != CE_None )
+                if( pband->FlushCache(true) != CE_None )
                 {
-                    return eErr;
+                    eErr = CE_Failure;
                 }
                 
             }
 
-            eErr = FlushCache(true);
-            if( eErr != CE_None )
+            if( FlushCache(true) != CE_None )
             {
-                return eErr;
+                eErr = CE_Failure;
+            }
+
+            // INTERLEAVE=PIXEL blocks that didn't get all their bands
+            if( flushInterleavedTiles() != CE_None )
+            {
+                eErr = CE_Failure;
             }
-            // now write header
-            vsi_l_offset headerOffset = VSIFTellL(m_fp);
-            VSIFWriteL("HDR", 4, 1, m_fp);
-            
-            // TODO: endianness
-            uint64_t val = m_eType;
-            VSIFWriteL(&val, sizeof(val), 1, m_fp);
-            
-            val = GetRasterCount();
-            VSIFWriteL(&val, sizeof(val), 1, m_fp);
-            
-            val = GetRasterXSize();
-            VSIFWriteL(&val, sizeof(val), 1, m_fp);
-            
-            val = GetRasterYSize();
-            VSIFWriteL(&val, sizeof(val), 1, m_fp);
             
-            VSIFWriteL(&m_tileSize, sizeof(m_tileSize), 1, m_fp);
+            // wait for any tiles still being compressed/written
+            if( stopWriterThreads() != CE_None )
+            {
+                eErr = CE_Failure;
+            }
+        }
 
-            // nodata and stats for each band. 
+        if( m_fp && (eErr == CE_None) )
+        {
+            // all the blocks have been seen now
             for( int n = 0; n < GetRasterCount(); n++ )
             {
-                EMURasterBand *pBand = cpl::down_cast<EMURasterBand*>(GetRasterBand(n + 1));
-                int nNoDataSet;
-                int64_t nodata = pBand->GetNoDataValueAsInt64(&nNoDataSet);
-                // coerce so we know the size
-                uint8_t n8NoDataSet = nNoDataSet;
-                VSIFWriteL(&n8NoDataSet, sizeof(n8NoDataSet), 1, m_fp);
-                VSIFWriteL(&nodata, sizeof(nodata), 1, m_fp);
-                
-                VSIFWriteL(&pBand->m_dMin, sizeof(pBand->m_dMin), 1, m_fp);
-                VSIFWriteL(&pBand->m_dMax, sizeof(pBand->m_dMax), 1, m_fp);
-                VSIFWriteL(&pBand->m_dMean, sizeof(pBand->m_dMean), 1, m_fp);
-                VSIFWriteL(&pBand->m_dStdDev, sizeof(pBand->m_dStdDev), 1, m_fp);
-                
-                // overviews
-                uint32_t noverviews = pBand->GetOverviewCount();
-                VSIFWriteL(&noverviews, sizeof(noverviews), 1, m_fp);
-                for( uint32_t n = 0; n < noverviews; n++)
-                {
-                    GDALRasterBand *pOv = pBand->GetOverview(n);
-                    val = pOv->GetXSize();
-                    VSIFWriteL(&val, sizeof(val), 1, m_fp);
-                    val = pOv->GetYSize();
-                    VSIFWriteL(&val, sizeof(val), 1, m_fp);
-                    int nXSize, nYSize;
-                    pOv->GetBlockSize(&nXSize, &nYSize);
-                    uint16_t val16 = nXSize;
-                    VSIFWriteL(&val16, sizeof(val16), 1, m_fp);
-                }
-                
-                // RAT
-                pBand->m_rat.WriteIndex();
-
-                // metadata
-                char **ppszMetadata = pBand->GetMetadata();
-                if(ppszMetadata != nullptr)
+                cpl::down_cast<EMURasterBand*>(GetRasterBand(n + 1))->finaliseStatistics();
+            }
+            
+            vsi_l_offset indexStart = VSIFTellL(m_fp);
+            vsi_l_offset headerOffset = writeIndexAndHeader();
+            vsi_l_offset headerEnd = VSIFTellL(m_fp);
+            m_ioStats.add(EMU_IO_BYTES_WRITTEN, headerEnd - indexStart);
+            if( m_nHeaderSpaceStart != 0 )
+            {
+                // HEADER_FIRST. Now we know how big it is write it again in 
+                // the space left at the start (if it fits) and drop the copy 
+                // at the end. Grids and the header may need a bit more padding.
+                if( (headerEnd - indexStart) + 2 * HEADER_ALIGNMENT <= m_nHeaderSpaceSize )
                 {
-                    size_t nOutputSize, nInputSize;
-                    Bytef *pCompressed = doCompressMetadata(COMPRESSION_ZLIB, ppszMetadata, &nInputSize, &nOutputSize);
-                    val = nInputSize;
-                    VSIFWriteL(&val, sizeof(val), 1, m_fp);
-                    if( nInputSize > 0 )
-                    {
-                        val = nOutputSize;
-                        VSIFWriteL(&val, sizeof(val), 1, m_fp);
-                        VSIFWriteL(pCompressed, nOutputSize, 1, m_fp);
-                        CPLFree(pCompressed);
-                    }
+                    VSIFSeekL(m_fp, m_nHeaderSpaceStart, SEEK_SET);
+                    headerOffset = writeIndexAndHeader();
+                    uint64_t prefix[2] = {headerOffset, VSIFTellL(m_fp)};
+                    m_ioStats.add(EMU_IO_BYTES_WRITTEN, prefix[1] - m_nHeaderSpaceStart + sizeof(prefix));
+                    VSIFSeekL(m_fp, EMU_PREFIX_OFFSET, SEEK_SET);
+                    VSIFWriteL(prefix, sizeof(prefix), 1, m_fp);
+                    VSIFTruncateL(m_fp, indexStart);
+                    VSIFSeekL(m_fp, indexStart, SEEK_SET);
                 }
                 else
                 {
-                    val = 0;
-                    VSIFWriteL(&val, sizeof(val), 1, m_fp);
+                    CPLError(CE_Warning, CPLE_AppDefined, 
+                        "Header (%d bytes) didn't fit in the space left for it, written at the end instead", 
+                        static_cast<int>(headerEnd - indexStart));
                 }
-                
+            }
+
+            // now the offset of the start of the header
+            VSIFWriteL(&headerOffset, sizeof(headerOffset), 1, m_fp);
+            m_ioStats.add(EMU_IO_BYTES_WRITTEN, sizeof(headerOffset));
+        }
 
+        if( m_fp )
+        {
+            VSIFCloseL(m_fp);
+            m_fp = nullptr;
+        }
+    }
+    else if( m_fp )
+    {
+        // the mapping needs the file to still be open
+        if( m_pMapped != nullptr )
+        {
+            // the grids can point into the mapping
+            m_tileGrids.clear();
+            CPLVirtualMemFree(m_pMapped);
+            m_pMapped = nullptr;
+            m_pMappedData = nullptr;
+        }
+        VSIFCloseL(m_fp);
+        m_fp = nullptr;
+    }
+    
+    // stop it reading before the handles go
+    delete m_pReadAhead;
+    m_pReadAhead = nullptr;
+
+    for( VSILFILE *fp : m_readHandles )
+    {
+        VSIFCloseL(fp);
+    }
+    m_readHandles.clear();
+
+    if( bWasOpen )
+    {
+        m_ioStats.add(EMU_IO_CLOSE_NS, EMUIOStats::now() - nCloseStart);
+        writeIOStats();
+    }
+    return eErr;
+}
+
+// write the tiles of each grid then the header at the current position. 
+// Returns the offset of the header.
+vsi_l_offset EMUDataset::writeIndexAndHeader()
+{
+    // write the tiles for each grid before the header so they 
+    // can be read when needed rather than all at once on open.
+    // Aligned so they can be mapped directly.
+    std::vector<vsi_l_offset> gridOffsets;
+    for( const auto &bandGrids : m_tileGrids )
+    {
+        for( const auto &pGrid : bandGrids )
+        {
+            if( pGrid == nullptr )
+            {
+                continue;
             }
-            
-            
-            // geo transform
-            VSIFWriteL(m_padfTransform, sizeof(m_padfTransform), 1, m_fp);
-            
-            // projection
-            char *pszWKT = const_cast<char*>("");
-            bool bFree = false;
-            if( m_oSRS.exportToWkt(&pszWKT) == OGRERR_NONE )
+            vsi_l_offset gridOffset = alignOffset(VSIFTellL(m_fp));
+            writePadding(gridOffset);
+            gridOffsets.push_back(gridOffset);
+            VSIFWriteL(pGrid->tiles.data(), sizeof(EMUTileValue), pGrid->tiles.size(), m_fp);
+        }
+    }
+
+    // the rest of the header goes in sections which are put together in memory
+    EMUHeaderWriter info;
+    std::vector<EMURatChunk> ratChunks;
+    uint64_t val = m_eType;
+    info.write(val);
+    val = GetRasterCount();
+    info.write(val);
+    val = GetRasterXSize();
+    info.write(val);
+    val = GetRasterYSize();
+    info.write(val);
+    info.write(m_tileXSize);
+    info.write(m_tileYSize);
+    info.write(m_nTileStrips);
+
+    // nodata and stats for each band. 
+    for( int n = 0; n < GetRasterCount(); n++ )
+    {
+        EMURasterBand *pBand = cpl::down_cast<EMURasterBand*>(GetRasterBand(n + 1));
+        int nNoDataSet;
+        int64_t nodata = pBand->GetNoDataValueAsInt64(&nNoDataSet);
+        // coerce so we know the size
+        uint8_t n8NoDataSet = nNoDataSet;
+        info.write(n8NoDataSet);
+        info.write(nodata);
+        
+        info.write(pBand->m_dMin);
+        info.write(pBand->m_dMax);
+        info.write(pBand->m_dMean);
+        info.write(pBand->m_dStdDev);
+        
+        // overviews
+        uint32_t noverviews = pBand->GetOverviewCount();
+        info.write(noverviews);
+        for( uint32_t n = 0; n < noverviews; n++)
+        {
+            GDALRasterBand *pOv = pBand->GetOverview(n);
+            val = pOv->GetXSize();
+            info.write(val);
+            val = pOv->GetYSize();
+            info.write(val);
+            int nXSize, nYSize;
+            pOv->GetBlockSize(&nXSize, &nYSize);
+            uint32_t val32 = nXSize;
+            info.write(val32);
+            val32 = nYSize;
+            info.write(val32);
+        }
+        
+        // RAT
+        pBand->m_rat.WriteIndex(info, ratChunks);
+
+        // metadata
+        char **ppszMetadata = pBand->GetMetadata();
+        if(ppszMetadata != nullptr)
+        {
+            size_t nOutputSize, nInputSize;
+            Bytef *pCompressed = doCompressMetadata(COMPRESSION_ZLIB, ppszMetadata, &nInputSize, &nOutputSize);
+            val = nInputSize;
+            info.write(val);
+            if( nInputSize > 0 )
             {
-                bFree = true;
-            } 
-            val = strlen(pszWKT) + 1;
-            VSIFWriteL(&val, sizeof(val), 1, m_fp);
-            VSIFWriteL(pszWKT, val, 1, m_fp);
-            if( bFree )
+                val = nOutputSize;
+                info.write(val);
+                info.write(pCompressed, nOutputSize);
+                CPLFree(pCompressed);
+            }
+        }
+        else
+        {
+            val = 0;
+            info.write(val);
+        }
+    }
+    
+    // geo transform
+    info.write(m_padfTransform, sizeof(m_padfTransform));
+    
+    // projection
+    char *pszWKT = const_cast<char*>("");
+    bool bFree = false;
+    if( m_oSRS.exportToWkt(&pszWKT) == OGRERR_NONE )
+    {
+        bFree = true;
+    } 
+    val = strlen(pszWKT) + 1;
+    info.write(val);
+    info.write(pszWKT, val);
+    if( bFree )
+    {
+        CPLFree(pszWKT);
+    }
+    
+    // metadata (dataset)
+    char **ppszMetadata = GetMetadata();
+    if(ppszMetadata != nullptr)
+    {
+        size_t nOutputSize, nInputSize;
+        Bytef *pCompressed = doCompressMetadata(COMPRESSION_ZLIB, ppszMetadata, &nInputSize, &nOutputSize);
+        val = nInputSize;
+        info.write(val);
+        if( nInputSize > 0 )
+        {   
+            val = nOutputSize;
+            info.write(val);
+            info.write(pCompressed, nOutputSize);
+            CPLFree(pCompressed);
+        }
+    }
+    else
+    {
+        val = 0;
+        info.write(val);
+    }
+    
+    // tile index. The tiles for each grid are already written so 
+    // just need a directory of where they all are
+    std::vector<EMUGridEntry> grids;
+    size_t nGrid = 0;
+    for( size_t nBand = 0; nBand < m_tileGrids.size(); nBand++ )
+    {
+        for( size_t nLevel = 0; nLevel < m_tileGrids[nBand].size(); nLevel++ )
+        {
+            const EMUTileGrid *pGrid = m_tileGrids[nBand][nLevel].get();
+            if( pGrid == nullptr )
             {
-                CPLFree(pszWKT);
+                continue;
             }
-            
-            // metadata (dataset)
-            char **ppszMetadata = GetMetadata();
-            if(ppszMetadata != nullptr)
-            {
-                size_t nOutputSize, nInputSize;
-                Bytef *pCompressed = doCompressMetadata(COMPRESSION_ZLIB, ppszMetadata, &nInputSize, &nOutputSize);
-                val = nInputSize;
-                VSIFWriteL(&val, sizeof(val), 1, m_fp);
-                if( nInputSize > 0 )
-                {   
-                    val = nOutputSize;
-                    VSIFWriteL(&val, sizeof(val), 1, m_fp);
-                    VSIFWriteL(pCompressed, nOutputSize, 1, m_fp);
-                    CPLFree(pCompressed);
+            EMUGridEntry entry = {nLevel, nBand + 1, pGrid->nXBlocks, pGrid->nYBlocks, gridOffsets[nGrid]};
+            grids.push_back(entry);
+            nGrid++;
+        }
+    }
+
+    // now the directory and then the sections after it
+    const uint64_t nSections = 3;
+    EMUHeaderSection sections[nSections] = {
+        {EMU_SECTION_INFO, 0, info.size()},
+        {EMU_SECTION_GRIDS, 0, grids.size() * sizeof(EMUGridEntry)},
+        {EMU_SECTION_RAT_CHUNKS, 0, ratChunks.size() * sizeof(EMURatChunk)}
+    };
+    const void *sectionData[nSections] = {info.data(), grids.data(), ratChunks.data()};
+    EMUHeaderWriter header;
+    header.write("HDR", 4);
+    header.write(EMU_BYTE_ORDER_MARK);
+    header.write(nSections);
+    vsi_l_offset sectionOffset = alignOffset(header.size() + sizeof(sections));
+    for( EMUHeaderSection &section : sections )
+    {
+        section.offset = sectionOffset;
+        sectionOffset = alignOffset(sectionOffset + section.size);
+    }
+    header.write(sections, sizeof(sections));
+    for( uint64_t n = 0; n < nSections; n++ )
+    {
+        header.align();
+        header.write(sectionData[n], sections[n].size);
+    }
+
+    vsi_l_offset headerOffset = alignOffset(VSIFTellL(m_fp));
+    writePadding(headerOffset);
+    VSIFWriteL(header.data(), header.size(), 1, m_fp);
+
+    return headerOffset;
+}
+
+void EMUDataset::reserveHeaderSpace(size_t nExtra)
+{
+    vsi_l_offset nSize = HEADER_SPACE_FIXED + nExtra;
+    // with INTERLEAVE=PIXEL the tiles are all under band 1
+    int nTileBands = m_bPixelInterleaved ? 1 : GetRasterCount();
+    for( int n = 0; n < GetRasterCount(); n++ )
+    {
+        GDALRasterBand *pBand = GetRasterBand(n + 1);
+        nSize += HEADER_SPACE_PER_BAND + pBand->GetOverviewCount() * 3 * sizeof(uint64_t);
+        for( int o = 0; (n < nTileBands) && (o <= pBand->GetOverviewCount()); o++ )
+        {
+            GDALRasterBand *pLevel = (o == 0) ? pBand : pBand->GetOverview(o - 1);
+            int nBlockXSize, nBlockYSize;
+            pLevel->GetBlockSize(&nBlockXSize, &nBlockYSize);
+            uint64_t nXBlocks = (pLevel->GetXSize() + nBlockXSize - 1) / nBlockXSize;
+            uint64_t nYBlocks = (pLevel->GetYSize() + nBlockYSize - 1) / nBlockYSize;
+            // the tiles, padding and the entry in the directory
+            nSize += nXBlocks * nYBlocks * sizeof(EMUTileValue) + HEADER_ALIGNMENT + 
+                        5 * sizeof(uint64_t);
+        }
+    }
+
+    m_nHeaderSpaceStart = alignOffset(VSIFTellL(m_fp));
+    m_nHeaderSpaceSize = nSize;
+    std::vector<GByte> zeros(m_nHeaderSpaceStart + nSize - VSIFTellL(m_fp), 0);
+    VSIFWriteL(zeros.data(), zeros.size(), 1, m_fp);
+}
+
+// append the EMU_STATS counters as a line of JSON to the file 
+// given by the EMU_STATS_JSON config option (if set)
+void EMUDataset::writeIOStats()
+{
+    const char *pszStatsFile = CPLGetConfigOption("EMU_STATS_JSON", nullptr);
+    if( pszStatsFile == nullptr )
+    {
+        return;
+    }
+    std::string osJSON = m_ioStats.toJSON(m_osFilename) + "\n";
+    VSILFILE *fp = VSIFOpenL(pszStatsFile, "a");
+    if( fp == nullptr )
+    {
+        CPLError(CE_Warning, CPLE_FileIO, "Couldn't open %s to write EMU_STATS", pszStatsFile);
+        return;
+    }
+    VSIFWriteL(osJSON.c_str(), osJSON.size(), 1, fp);
+    VSIFCloseL(fp);
+}
+
+// caller must hold m_mutex when writing
+void EMUDataset::setTileOffset(uint64_t o, uint64_t band, uint64_t x, 
+    uint64_t y, vsi_l_offset offset, uint64_t size, uint64_t uncompressedSize)
+{
+    EMUTileGrid *pGrid = nullptr;
+    if( (band > 0) && (band <= m_tileGrids.size()) && (o < m_tileGrids[band - 1].size()) )
+    {
+        pGrid = m_tileGrids[band - 1][o].get();
+    }
+    
+    if( pGrid == nullptr )
+    {
+        // first tile for this band/level. Work out the size of the grid
+        GDALRasterBand *pBand = GetRasterBand(band);
+        if( (pBand != nullptr) && (o > 0) )
+        {
+            pBand = pBand->GetOverview(o - 1);
+        }
+        if( pBand == nullptr )
+        {
+            CPLError(CE_Failure, CPLE_AppDefined,
+                "No band %" PRIu64 " for overview level %" PRIu64, band, o);
+            return;
+        }
+        int nBlockXSize, nBlockYSize;
+        pBand->GetBlockSize(&nBlockXSize, &nBlockYSize);
+        uint64_t nXBlocks = (pBand->GetXSize() + nBlockXSize - 1) / nBlockXSize;
+        uint64_t nYBlocks = (pBand->GetYSize() + nBlockYSize - 1) / nBlockYSize;
+        pGrid = createTileGrid(o, band, nXBlocks, nYBlocks, 0);
+    }
+    
+    if( (x >= pGrid->nXBlocks) || (y >= pGrid->nYBlocks) )
+    {
+        CPLError(CE_Failure, CPLE_AppDefined,
+            "Tile %" PRIu64 " %" PRIu64 " outside of grid", x, y);
+        return;
+    }
+    EMUTileValue &val = pGrid->tiles[x + y * pGrid->nXBlocks];
+    val.offset = offset;
+    val.size = size;
+    val.uncompressedSize = uncompressedSize;
+}
+
+// Note: throws std::out_of_range if the tile is outside the grid. Tiles 
+// that were never written (including when nothing was written for the 
+// band/level) have an offset of 0.
+// Apart from each grid being loaded once, the index isn't changed 
+// after the file is opened so this is safe to call from multiple 
+// threads without locking.
+EMUTileValue EMUDataset::getTileOffset(uint64_t o, uint64_t band, uint64_t x, uint64_t y)
+{
+    const EMUTileValue notWritten = {0, 0, 0};
+    if( (band == 0) || (band > m_tileGrids.size()) || (o >= m_tileGrids[band - 1].size()) )
+    {
+        return notWritten;
+    }
+    EMUTileGrid *pGrid = m_tileGrids[band - 1][o].get();
+    if( pGrid == nullptr )
+    {
+        return notWritten;
+    }
+    if( pGrid->fileOffset != 0 )
+    {
+        std::call_once(pGrid->loaded, &EMUDataset::loadTileGrid, this, pGrid);
+    }
+    if( pGrid->pTiles == nullptr )
+    {
+        // failed to load
+        throw std::out_of_range("tile grid not loaded");
+    }
+    if( (x >= pGrid->nXBlocks) || (y >= pGrid->nYBlocks) )
+    {
+        throw std::out_of_range("tile outside of grid");
+    }
+    return pGrid->pTiles[x + y * pGrid->nXBlocks];
+}
+
+// fileOffset is 0 when the grid is being created in memory
+EMUTileGrid *EMUDataset::createTileGrid(uint64_t o, uint64_t band, uint64_t nXBlocks, 
+        uint64_t nYBlocks, vsi_l_offset fileOffset)
+{
+    if( m_tileGrids.size() < band )
+    {
+        m_tileGrids.resize(band);
+    }
+    auto &bandGrids = m_tileGrids[band - 1];
+    if( bandGrids.size() <= o )
+    {
+        bandGrids.resize(o + 1);
+    }
+    EMUTileGrid *pGrid = new EMUTileGrid();
+    pGrid->nXBlocks = nXBlocks;
+    pGrid->nYBlocks = nYBlocks;
+    pGrid->fileOffset = fileOffset;
+    if( fileOffset == 0 )
+    {
+        pGrid->tiles.assign(nXBlocks * nYBlocks, {0, 0, 0});
+        pGrid->pTiles = pGrid->tiles.data();
+    }
+    bandGrids[o].reset(pGrid);
+    return pGrid;
+}
+
+// called (once) the first time a tile is needed from this grid
+void EMUDataset::loadTileGrid(EMUTileGrid *pGrid)
+{
+    size_t nTiles = pGrid->nXBlocks * pGrid->nYBlocks;
+    const GByte *pMappedData = getMappedData(pGrid->fileOffset, nTiles * sizeof(EMUTileValue));
+    m_ioStats.add(EMU_IO_BYTES_READ, nTiles * sizeof(EMUTileValue));
+    // grids are written 8 byte aligned so normally can be used where they are
+    if( (pMappedData != nullptr) && 
+            ((reinterpret_cast<uintptr_t>(pMappedData) % alignof(EMUTileValue)) == 0) )
+    {
+        pGrid->pTiles = reinterpret_cast<const EMUTileValue*>(pMappedData);
+        return;
+    }
+
+    std::vector<EMUTileValue> tiles(nTiles);
+    if( pMappedData != nullptr )
+    {
+        memcpy(tiles.data(), pMappedData, nTiles * sizeof(EMUTileValue));
+        pGrid->tiles.swap(tiles);
+        pGrid->pTiles = pGrid->tiles.data();
+        return;
+    }
+
+    VSILFILE *fp = acquireReadHandle();
+    if( fp == nullptr )
+    {
+        CPLError(CE_Failure, CPLE_OpenFailed, "Couldn't open file to read tile index");
+        return;
+    }
+    m_ioStats.add(EMU_IO_READ_CALLS, 1);
+    bool bOK = (VSIFSeekL(fp, pGrid->fileOffset, SEEK_SET) == 0) && 
+        (VSIFReadL(tiles.data(), sizeof(EMUTileValue), tiles.size(), fp) == tiles.size());
+    releaseReadHandle(fp);
+    if( !bOK )
+    {
+        CPLError(CE_Failure, CPLE_FileIO, "Failed to read tile index");
+        return;
+    }
+    pGrid->tiles.swap(tiles);
+    pGrid->pTiles = pGrid->tiles.data();
+}
+
+VSILFILE *EMUDataset::acquireReadHandle()
+{
+    {
+        const std::lock_guard<std::mutex> lock(m_handleMutex);
+        if( !m_readHandles.empty() )
+        {
+            VSILFILE *fp = m_readHandles.back();
+            m_readHandles.pop_back();
+            return fp;
+        }
+    }
+    // none spare, open another one (outside the lock as this could be slow)
+    return VSIFOpenL(m_osFilename, "rb");
+}
+
+void EMUDataset::releaseReadHandle(VSILFILE *fp)
+{
+    const std::lock_guard<std::mutex> lock(m_handleMutex);
+    m_readHandles.push_back(fp);
+}
+
+// get the number of threads to use from the creation options, 
+// falling back to the GDAL_NUM_THREADS config option
+int EMUDataset::GetNumThreads(char **papszOptions)
+{
+    const char *pszThreads = CSLFetchNameValueDef(papszOptions, "NUM_THREADS", 
+                    CPLGetConfigOption("GDAL_NUM_THREADS", "1"));
+    int nThreads;
+    if( EQUAL(pszThreads, "ALL_CPUS") )
+    {
+        nThreads = CPLGetNumCPUs();
+    }
+    else
+    {
+        nThreads = atoi(pszThreads);
+    }
+    return nThreads;
+}
+
+EMUThreadPool *EMUDataset::getReadPool()
+{
+    std::call_once(m_readPoolOnce, [this]() {
+        int nThreads = GetNumThreads(nullptr);
+        if( nThreads > 1 )
+        {
+            m_pReadPool = new EMUThreadPool(nThreads);
+        }
+    });
+    return m_pReadPool;
+}
+
+void EMUDataset::startWriterThreads(int nThreads, bool bUpload)
+{
+    m_pCompressPool = new EMUThreadPool(nThreads);
+    m_nMaxTilesInFlight = nThreads * (bUpload ? TILES_IN_FLIGHT_PER_THREAD_UPLOAD : 
+                                                TILES_IN_FLIGHT_PER_THREAD);
+    m_writerThread = std::thread(&EMUDataset::writerLoop, this);
+}
+
+// takes ownership of pData (which must have been allocated with CPLMalloc
+// and hold nXValid * nYValid pixels). Tiles are compressed in parallel
+// but written to the file in the order they are queued.
+CPLErr EMUDataset::queueTile(uint64_t o, uint64_t band, uint64_t x, uint64_t y, 
+        uint8_t compression, GByte *pData, int nXValid, int nYValid, int nTypeSize)
+{
+    size_t uncompressedSize = static_cast<size_t>(nXValid) * nYValid * nTypeSize;
+    uint64_t seq;
+    {
+        // don't let too many tiles build up in memory
+        EMUIOTimer timer(m_ioStats, EMU_IO_WRITER_WAIT_NS);
+        std::unique_lock<std::mutex> lock(m_writerMutex);
+        m_writerCond.wait(lock, [this]{ return m_nTilesInFlight < m_nMaxTilesInFlight; });
+        if( m_bWriteError )
+        {
+            CPLFree(pData);
+            CPLError(CE_Failure, CPLE_FileIO, "Failed writing tile to file");
+            return CE_Failure;
+        }
+        m_nTilesInFlight++;
+        seq = m_nNextQueueSeq++;
+    }
+
+    m_pCompressPool->submit([=]() {
+        EMUPendingTile tile;
+        tile.seq = seq;
+        tile.ovrLevel = o;
+        tile.band = band;
+        tile.x = x;
+        tile.y = y;
+        tile.compression = compression;
+        tile.uncompressedSize = uncompressedSize;
+        Bytef *pCompressed;
+        {
+            EMUIOTimer timer(m_ioStats, EMU_IO_COMPRESS_NS);
+            pCompressed = doTileCompression(compression, m_nCompressLevel, nTypeSize, 
+                            nXValid, nYValid, getRowsPerStrip(nYValid), pData, &tile.compressedSize);
+        }
+        if( pCompressed == nullptr )
+        {
+            CPLFree(pData);
+            tile.pCompressed = nullptr;
+        }
+        else
+        {
+            // the compressed data is in a buffer that belongs to this 
+            // thread so copy it back into pData for the writer thread. 
+            tile.pCompressed = pData;
+            if( pCompressed != pData )
+            {
+                if( tile.compressedSize > uncompressedSize )
+                {
+                    tile.pCompressed = static_cast<GByte*>(CPLRealloc(pData, tile.compressedSize));
                 }
+                memcpy(tile.pCompressed, pCompressed, tile.compressedSize);
             }
-            else
+        }
+        
+        {
+            const std::lock_guard<std::mutex> lock(m_writerMutex);
+            m_compressedTiles[tile.seq] = tile;
+        }
+        m_writerCond.notify_all();
+    });
+    
+    return CE_None;
+}
+
+// compress and write a tile (nXValid * nYValid pixels) on the calling thread
+CPLErr EMUDataset::writeTile(uint64_t o, uint64_t band, uint64_t x, uint64_t y, 
+        uint8_t compression, const GByte *pData, int nXValid, int nYValid, int nTypeSize)
+{
+    size_t uncompressedSize = static_cast<size_t>(nXValid) * nYValid * nTypeSize;
+
+    // result is owned by this thread so no need to free
+    size_t compressedSize;
+    Bytef *pCompressed;
+    {
+        EMUIOTimer timer(m_ioStats, EMU_IO_COMPRESS_NS);
+        pCompressed = doTileCompression(compression, m_nCompressLevel, nTypeSize, 
+                    nXValid, nYValid, getRowsPerStrip(nYValid), const_cast<GByte*>(pData), 
+                    &compressedSize);
+    }
+    if( pCompressed == nullptr )
+    {
+        return CE_Failure;
+    }
+
+    EMUTimedLock lock(*m_mutex, m_ioStats);
+
+    vsi_l_offset tileOffset = VSIFTellL(m_fp);
+    if( (VSIFWriteL(&compression, sizeof(compression), 1, m_fp) != 1) ||
+        (VSIFWriteL(pCompressed, compressedSize, 1, m_fp) != 1) )
+    {
+        CPLError(CE_Failure, CPLE_FileIO,
+                "Failed to write block %d %d.",
+                static_cast<int>(x), static_cast<int>(y));
+        return CE_Failure;
+    }
+    // update map
+    setTileOffset(o, band, x, y, tileOffset, compressedSize, uncompressedSize);
+    addTileWriteStats(compressedSize);
+    
+    return CE_None;
+}
+
+void EMUDataset::addTileWriteStats(size_t compressedSize)
+{
+    m_ioStats.add(EMU_IO_TILES_WRITTEN, 1);
+    m_ioStats.add(EMU_IO_WRITE_CALLS, 2);
+    m_ioStats.add(EMU_IO_BYTES_WRITTEN, compressedSize + 1);
+    m_ioStats.addCompressedSize(compressedSize);
+}
+
+CPLErr EMUDataset::writeConstantTile(uint64_t o, uint64_t band, uint64_t x, uint64_t y, uint64_t nValue)
+{
+    // the writer thread updates the index too
+    EMUTimedLock lock(*m_mutex, m_ioStats);
+    setTileOffset(o, band, x, y, EMU_TILE_CONSTANT, 0, nValue);
+    m_ioStats.add(EMU_IO_CONSTANT_TILES_WRITTEN, 1);
+    m_ioStats.addCompressedSize(0);
+    return CE_None;
+}
+
+// memcmp is vectorised so use that rather than looping over the pixels. 
+// The first row is all the same if it matches itself shifted by one 
+// pixel, and then all the other rows must match the first.
+// Most tiles that aren't constant fail within the first few bytes.
+bool isConstantTile(const GByte *pData, int nTypeSize, int nXValid, int nYValid, 
+                int nLineSize, uint64_t *pnValue)
+{
+    if( (nTypeSize > static_cast<int>(sizeof(uint64_t))) || (nXValid <= 0) || (nYValid <= 0) )
+    {
+        return false;
+    }
+    size_t nRowBytes = static_cast<size_t>(nXValid) * nTypeSize;
+    size_t nLineBytes = static_cast<size_t>(nLineSize) * nTypeSize;
+    if( memcmp(pData, pData + nTypeSize, nRowBytes - nTypeSize) != 0 )
+    {
+        return false;
+    }
+    for( int nRow = 1; nRow < nYValid; nRow++ )
+    {
+        if( memcmp(pData, pData + nRow * nLineBytes, nRowBytes) != 0 )
+        {
+            return false;
+        }
+    }
+    *pnValue = 0;
+    memcpy(pnValue, pData, nTypeSize);
+    return true;
+}
+
+// INTERLEAVE=PIXEL. Copy the valid part of the block for this band and once
+// all the bands are there write them as one tile (under band 1). The bands
+// are stored one after the other within the tile.
+CPLErr EMUDataset::addInterleavedBlock(uint64_t o, uint64_t band, uint64_t x, uint64_t y, 
+        const GByte *pData, int nBlockXSize, int nXValid, int nYValid)
+{
+    int nTypeSize = GDALGetDataTypeSizeBytes(m_eType);
+    size_t nBandSize = static_cast<size_t>(nXValid) * nYValid * nTypeSize;
+    EMUTileKey key = {o, 0, x, y};
+    EMUInterleavedTile tile;
+    {
+        const std::lock_guard<std::mutex> lock(m_interleavedMutex);
+        auto itr = m_interleavedTiles.find(key);
+        if( itr == m_interleavedTiles.end() )
+        {
+            // zeroed in case some bands never get written
+            EMUInterleavedTile newTile;
+            newTile.pData = static_cast<GByte*>(VSI_CALLOC_VERBOSE(GetRasterCount(), nBandSize));
+            if( newTile.pData == nullptr )
             {
-                val = 0;
-                VSIFWriteL(&val, sizeof(val), 1, m_fp);
+                return CE_Failure;
             }
-            
-            // number of tile offsets
-            val = m_tileOffsets.size();
-            VSIFWriteL(&val, sizeof(val), 1, m_fp);
-            
-            // now all the tile offsets
-            for( const std::pair<const EMUTileKey, EMUTileValue>& n: m_tileOffsets)
+            newTile.bandsDone.assign(GetRasterCount(), false);
+            newTile.nBandsDone = 0;
+            newTile.nXValid = nXValid;
+            newTile.nYValid = nYValid;
+            itr = m_interleavedTiles.insert(std::make_pair(key, newTile)).first;
+        }
+        
+        EMUInterleavedTile &current = itr->second;
+        GByte *pDstData = current.pData + (band - 1) * nBandSize;
+        int nSrcIdx = 0, nDstIdx = 0;
+        for( int nRow = 0; nRow < nYValid; nRow++ )
+        {
+            memcpy(&pDstData[nDstIdx], &pData[nSrcIdx], nXValid * nTypeSize);
+            nSrcIdx += (nBlockXSize * nTypeSize);
+            nDstIdx += (nXValid * nTypeSize);
+        }
+        if( !current.bandsDone[band - 1] )
+        {
+            current.bandsDone[band - 1] = true;
+            current.nBandsDone++;
+        }
+        if( current.nBandsDone < GetRasterCount() )
+        {
+            return CE_None;
+        }
+        tile = current;
+        m_interleavedTiles.erase(itr);
+    }
+    
+    return writeInterleavedTile(key, tile);
+}
+
+// frees tile.pData
+CPLErr EMUDataset::writeInterleavedTile(const EMUTileKey &key, EMUInterleavedTile &tile)
+{
+    int nTypeSize = GDALGetDataTypeSizeBytes(m_eType);
+    // treat as one image with the bands stacked vertically
+    int nYValid = tile.nYValid * GetRasterCount();
+    uint64_t nValue;
+    if( isConstantTile(tile.pData, nTypeSize, tile.nXValid, nYValid, tile.nXValid, &nValue) )
+    {
+        CPLFree(tile.pData);
+        return writeConstantTile(key.ovrLevel, 1, key.x, key.y, nValue);
+    }
+    if( m_pCompressPool != nullptr )
+    {
+        return queueTile(key.ovrLevel, 1, key.x, key.y, getTileCompression(), 
+                    tile.pData, tile.nXValid, nYValid, nTypeSize);
+    }
+    CPLErr err = writeTile(key.ovrLevel, 1, key.x, key.y, getTileCompression(),
+                    tile.pData, tile.nXValid, nYValid, nTypeSize);
+    CPLFree(tile.pData);
+    return err;
+}
+
+// INTERLEAVE=PIXEL. Write out any blocks where not all the bands were written
+// (the missing ones will be zero).
+CPLErr EMUDataset::flushInterleavedTiles()
+{
+    std::unordered_map<EMUTileKey, EMUInterleavedTile> tiles;
+    {
+        const std::lock_guard<std::mutex> lock(m_interleavedMutex);
+        tiles.swap(m_interleavedTiles);
+    }
+    CPLErr eErr = CE_None;
+    for( auto &tile : tiles )
+    {
+        if( eErr == CE_None )
+        {
+            eErr = writeInterleavedTile(tile.first, tile.second);
+        }
+        else
+        {
+            CPLFree(tile.second.pData);
+        }
+    }
+    return eErr;
+}
+
+bool EMUDataset::canCopyTilesRaw(EMUDataset *pSrcDS, uint64_t o)
+{
+    // generated overviews need the decoded full res blocks
+    if( (pSrcDS == nullptr) || (pSrcDS->GetAccess() != GA_ReadOnly) || m_bGenerateOverviews || 
+        (pSrcDS->m_eType != m_eType) || (pSrcDS->GetRasterCount() != GetRasterCount()) ||
+        (pSrcDS->m_nTileStrips != m_nTileStrips) ||
+        (pSrcDS->m_bPixelInterleaved != m_bPixelInterleaved) )
+    {
+        return false;
+    }
+    for( int n = 1; n <= GetRasterCount(); n++ )
+    {
+        GDALRasterBand *pSrcBand = pSrcDS->GetRasterBand(n);
+        GDALRasterBand *pDestBand = GetRasterBand(n);
+        if( o > 0 )
+        {
+            pSrcBand = pSrcBand->GetOverview(o - 1);
+            pDestBand = pDestBand->GetOverview(o - 1);
+        }
+        if( (pSrcBand == nullptr) || (pDestBand == nullptr) )
+        {
+            return false;
+        }
+        int nSrcBlockXSize, nSrcBlockYSize, nDestBlockXSize, nDestBlockYSize;
+        pSrcBand->GetBlockSize(&nSrcBlockXSize, &nSrcBlockYSize);
+        pDestBand->GetBlockSize(&nDestBlockXSize, &nDestBlockYSize);
+        if( (pSrcBand->GetXSize() != pDestBand->GetXSize()) || 
+            (pSrcBand->GetYSize() != pDestBand->GetYSize()) ||
+            (nSrcBlockXSize != nDestBlockXSize) || (nSrcBlockYSize != nDestBlockYSize) )
+        {
+            return false;
+        }
+        // the statistics are collected from the decoded blocks. Fine if 
+        // the source has them as they are copied with the metadata.
+        if( (o == 0) && m_bCollectStats )
+        {
+            const char *pszMean = pSrcBand->GetMetadataItem(STATISTICS_MEAN);
+            if( (pszMean == nullptr) || std::isnan(CPLAtof(pszMean)) || 
+                (pSrcBand->GetMetadataItem(STATISTICS_HISTOBINVALUES) == nullptr) )
             {
-                VSIFWriteL(&n.second.offset, sizeof(n.second.offset), 1, m_fp);
-                VSIFWriteL(&n.second.size, sizeof(n.second.size), 1, m_fp);
-                VSIFWriteL(&n.second.uncompressedSize, sizeof(n.second.uncompressedSize), 1, m_fp);
-                VSIFWriteL(&n.first.ovrLevel, sizeof(n.first.ovrLevel), 1, m_fp);
-                VSIFWriteL(&n.first.band, sizeof(n.first.band), 1, m_fp);
-                VSIFWriteL(&n.first.x, sizeof(n.first.x), 1, m_fp);
-                VSIFWriteL(&n.first.y, sizeof(n.first.y), 1, m_fp);
+                return false;
             }
-            
-            // now the offset of the start of the header
-            VSIFWriteL(&headerOffset, sizeof(headerOffset), 1, m_fp);
-                   
-            VSIFCloseL(m_fp);
-            m_fp = nullptr;
         }
     }
-    return eErr;
+
+    // the compression isn't in the header, but all the tiles of a file are done 
+    // the same way so look at the first one that has data
+    int nKeyBands = m_bPixelInterleaved ? 1 : GetRasterCount();
+    for( int nBand = 1; nBand <= nKeyBands; nBand++ )
+    {
+        if( (nBand > static_cast<int>(pSrcDS->m_tileGrids.size())) || 
+            (o >= pSrcDS->m_tileGrids[nBand - 1].size()) || 
+            !pSrcDS->m_tileGrids[nBand - 1][o] )
+        {
+            continue;
+        }
+        EMUTileGrid *pGrid = pSrcDS->m_tileGrids[nBand - 1][o].get();
+        for( uint64_t y = 0; y < pGrid->nYBlocks; y++ )
+        {
+            for( uint64_t x = 0; x < pGrid->nXBlocks; x++ )
+            {
+                EMUTileValue val;
+                try
+                {
+                    val = pSrcDS->getTileOffset(o, nBand, x, y);
+                }
+                catch(const std::out_of_range& oor)
+                {
+                    return false;
+                }
+                if( (val.offset == 0) || (val.offset == EMU_TILE_CONSTANT) )
+                {
+                    continue;
+                }
+                uint8_t compression;
+                return pSrcDS->readRawTiles(val.offset, sizeof(compression), &compression) && 
+                    (compression == getTileCompression());
+            }
+        }
+    }
+    // nothing but constant tiles
+    return true;
 }
 
-void EMUDataset::setTileOffset(uint64_t o, uint64_t band, uint64_t x, 
-    uint64_t y, vsi_l_offset offset, uint64_t size, uint64_t uncompressedSize)
+// tiles that follow each other in the source are read and written in one 
+// go (up to PREFETCH_MAX_RANGE). Constant tiles just go in the index.
+bool EMUDataset::copyTilesRaw(EMUDataset *pSrcDS, uint64_t o, int &nDoneBlocks, int nTotalBlocks, 
+        GDALProgressFunc pfnProgress, void *pProgressData)
 {
-    m_tileOffsets.insert({{o, band, x, y}, {offset, size, uncompressedSize}});
+    if( o == 0 )
+    {
+        m_bFullResWritten = true;
+    }
+    GDALRasterBand *pBand = GetRasterBand(1);
+    if( o > 0 )
+    {
+        pBand = pBand->GetOverview(o - 1);
+    }
+    int nBlockXSize, nBlockYSize;
+    pBand->GetBlockSize(&nBlockXSize, &nBlockYSize);
+    uint64_t nXBlocks = (pBand->GetXSize() + nBlockXSize - 1) / nBlockXSize;
+    uint64_t nYBlocks = (pBand->GetYSize() + nBlockYSize - 1) / nBlockYSize;
+    // with INTERLEAVE=PIXEL all the bands are in the tile under band 1
+    int nKeyBands = m_bPixelInterleaved ? 1 : GetRasterCount();
+    int nBlocksPerTile = m_bPixelInterleaved ? GetRasterCount() : 1;
+
+    std::vector<EMUTileKey> keys;
+    std::vector<EMUTileValue> vals;
+    vsi_l_offset runStart = 0, runEnd = 0;
+    std::vector<GByte> buffer;
+    auto flush = [&]() -> bool {
+        if( keys.empty() )
+        {
+            return true;
+        }
+        size_t nSize = runEnd - runStart;
+        buffer.resize(nSize);
+        bool bOK = pSrcDS->readRawTiles(runStart, nSize, buffer.data()) && 
+            (writeRawTiles(keys, vals, runStart, buffer.data(), nSize) == CE_None);
+        keys.clear();
+        vals.clear();
+        return bOK;
+    };
+
+    double dLastFraction = -1;
+    for( uint64_t y = 0; y < nYBlocks; y++ )
+    {
+        for( uint64_t x = 0; x < nXBlocks; x++ )
+        {
+            for( int nBand = 1; nBand <= nKeyBands; nBand++ )
+            {
+                EMUTileValue val;
+                try
+                {
+                    val = pSrcDS->getTileOffset(o, nBand, x, y);
+                }
+                catch(const std::out_of_range& oor)
+                {
+                    CPLError(CE_Failure, CPLE_FileIO,
+                            "Couldn't find index for block %d %d.",
+                            static_cast<int>(x), static_cast<int>(y));
+                    return false;
+                }
+
+                EMUTileKey key = {o, static_cast<uint64_t>(nBand), x, y};
+                if( val.offset == EMU_TILE_CONSTANT )
+                {
+                    writeConstantTile(o, nBand, x, y, val.uncompressedSize);
+                }
+                else if( val.offset != 0 )
+                {
+                    vsi_l_offset tileEnd = val.offset + val.size + 1;
+                    if( !keys.empty() && ((val.offset != runEnd) || 
+                                (tileEnd - runStart > PREFETCH_MAX_RANGE)) )
+                    {
+                        if( !flush() )
+                        {
+                            return false;
+                        }
+                    }
+                    if( keys.empty() )
+                    {
+                        runStart = val.offset;
+                    }
+                    keys.push_back(key);
+                    vals.push_back(val);
+                    runEnd = tileEnd;
+                }
+
+                nDoneBlocks += nBlocksPerTile;
+                double dFraction = (double)nDoneBlocks / (double)nTotalBlocks;
+                if( dFraction != dLastFraction )
+                {
+                    if( !pfnProgress( dFraction, nullptr, pProgressData ) )
+                    {
+                        return false;
+                    }
+                    dLastFraction = dFraction;
+                }
+            }
+        }
+    }
+    return flush();
 }
 
-EMUTileValue EMUDataset::getTileOffset(uint64_t o, uint64_t band, uint64_t x, uint64_t y)
+bool EMUDataset::readRawTiles(vsi_l_offset offset, size_t nSize, GByte *pData)
+{
+    const GByte *pMappedData = getMappedData(offset, nSize);
+    m_ioStats.add(EMU_IO_BYTES_READ, nSize);
+    if( pMappedData != nullptr )
+    {
+        memcpy(pData, pMappedData, nSize);
+        return true;
+    }
+
+    VSILFILE *fp = acquireReadHandle();
+    if( fp == nullptr )
+    {
+        CPLError(CE_Failure, CPLE_OpenFailed, "Couldn't open file to read tiles");
+        return false;
+    }
+    m_ioStats.add(EMU_IO_READ_CALLS, 1);
+    bool bOK = (VSIFSeekL(fp, offset, SEEK_SET) == 0) && 
+        (VSIFReadL(pData, nSize, 1, fp) == 1);
+    releaseReadHandle(fp);
+    if( !bOK )
+    {
+        CPLError(CE_Failure, CPLE_FileIO, "Failed to read tiles");
+    }
+    return bOK;
+}
+
+CPLErr EMUDataset::writeRawTiles(const std::vector<EMUTileKey> &keys, const std::vector<EMUTileValue> &vals, 
+        vsi_l_offset srcOffset, const GByte *pData, size_t nSize)
+{
+    // the writer thread may still be writing tiles from the other levels
+    EMUTimedLock lock(*m_mutex, m_ioStats);
+
+    vsi_l_offset runOffset = VSIFTellL(m_fp);
+    if( VSIFWriteL(pData, nSize, 1, m_fp) != 1 )
+    {
+        CPLError(CE_Failure, CPLE_FileIO,
+                "Failed to write block %d %d.",
+                static_cast<int>(keys[0].x), static_cast<int>(keys[0].y));
+        return CE_Failure;
+    }
+    m_ioStats.add(EMU_IO_WRITE_CALLS, 1);
+    m_ioStats.add(EMU_IO_BYTES_WRITTEN, nSize);
+    for( size_t n = 0; n < keys.size(); n++ )
+    {
+        const EMUTileKey &key = keys[n];
+        const EMUTileValue &val = vals[n];
+        setTileOffset(key.ovrLevel, key.band, key.x, key.y, runOffset + (val.offset - srcOffset), 
+            val.size, val.uncompressedSize);
+        m_ioStats.add(EMU_IO_TILES_WRITTEN, 1);
+        m_ioStats.add(EMU_IO_TILES_COPIED, 1);
+        m_ioStats.addCompressedSize(val.size);
+    }
+    return CE_None;
+}
+
+CPLErr EMUDataset::stopWriterThreads()
+{
+    if( m_pCompressPool == nullptr )
+    {
+        return CE_None;
+    }
+    
+    // wait for the compression to finish then tell the writer 
+    // to exit once it has emptied the queue
+    m_pCompressPool->waitCompletion();
+    {
+        const std::lock_guard<std::mutex> lock(m_writerMutex);
+        m_bWriterStop = true;
+    }
+    m_writerCond.notify_all();
+    m_writerThread.join();
+    
+    delete m_pCompressPool;
+    m_pCompressPool = nullptr;
+    
+    if( m_bWriteError )
+    {
+        CPLError(CE_Failure, CPLE_FileIO, "Failed writing tile to file");
+        return CE_Failure;
+    }
+    return CE_None;
+}
+
+// the single thread that appends the compressed tiles to the file. 
+// The location of each tile is recorded in the index so order doesn't
+// matter for reading, but writing them in the order they were queued
+// keeps the file layout the same as the single threaded case.
+void EMUDataset::writerLoop()
 {
-    return m_tileOffsets[{o, band, x, y}];
+    while( true )
+    {
+        EMUPendingTile tile;
+        {
+            std::unique_lock<std::mutex> lock(m_writerMutex);
+            m_writerCond.wait(lock, [this]{ return m_bWriterStop || 
+                (m_compressedTiles.count(m_nNextWriteSeq) > 0); });
+            auto itr = m_compressedTiles.find(m_nNextWriteSeq);
+            if( itr == m_compressedTiles.end() )
+            {
+                // must be stopping. Everything has been compressed by now.
+                return;
+            }
+            tile = itr->second;
+            m_compressedTiles.erase(itr);
+            m_nNextWriteSeq++;
+        }
+        
+        // compression failed
+        bool bOK = (tile.pCompressed != nullptr);
+        if( bOK )
+        {
+            // other things (ie the RAT) write to the file too
+            EMUTimedLock lock(*m_mutex, m_ioStats);
+            vsi_l_offset tileOffset = VSIFTellL(m_fp);
+            bOK = (VSIFWriteL(&tile.compression, sizeof(tile.compression), 1, m_fp) == 1) &&
+                (VSIFWriteL(tile.pCompressed, tile.compressedSize, 1, m_fp) == 1);
+            setTileOffset(tile.ovrLevel, tile.band, tile.x, tile.y, tileOffset, 
+                tile.compressedSize, tile.uncompressedSize);
+            addTileWriteStats(tile.compressedSize);
+        }
+        CPLFree(tile.pCompressed);
+        
+        {
+            const std::lock_guard<std::mutex> lock(m_writerMutex);
+            m_nTilesInFlight--;
+            if( !bOK )
+            {
+                m_bWriteError = true;
+            }
+        }
+        m_writerCond.notify_all();
+    }
+}
+
+
+// when generating overviews each overview block must come from exactly
+// one full res block so the factors must divide the block size (both ways)
+static bool CheckOverviewFactors(int nOverviews, const int *panOverviewList, 
+                                int nXSize, int nYSize, int nBlockXSize, int nBlockYSize)
+{
+    for( int n = 0; n < nOverviews; n++ )
+    {
+        int nFactor = panOverviewList[n];
+        if( (nFactor < 2) || (nFactor > nBlockXSize) || (nFactor > nBlockYSize) || 
+            ((nBlockXSize % nFactor) != 0) || ((nBlockYSize % nFactor) != 0) )
+        {
+            CPLError(CE_Failure, CPLE_NotSupported, 
+                "Overview factor %d must be more than 1 and divide the block size (%dx%d)", 
+                nFactor, nBlockXSize, nBlockYSize);
+            return false;
+        }
+        if( ((nXSize / nFactor) == 0) || ((nYSize / nFactor) == 0) )
+        {
+            CPLError(CE_Failure, CPLE_NotSupported, 
+                "Overview factor %d is too large for a %dx%d raster", nFactor, nXSize, nYSize);
+            return false;
+        }
+    }
+    return true;
 }
 
-
 CPLErr EMUDataset::IBuildOverviews(const char *pszResampling, int nOverviews, const int *panOverviewList, 
                                     int nListBands, const int *panBandList, GDALProgressFunc pfnProgress, 
                                     void *pProgressData, CSLConstList papszOptions)
 {
     // this is a bit of a fake since we always expect this to be only called when 
     // nothing has been written to the file (yet)
+    if( m_bGenerateOverviews )
+    {
+        // the overviews are made as the full res data is written rather than
+        // written by the caller (as RIOS does)
+        if( m_bFullResWritten )
+        {
+            CPLError(CE_Failure, CPLE_NotSupported, 
+                "Overviews must be requested before any data is written");
+            return CE_Failure;
+        }
+        if( (pszResampling != nullptr) && !EQUAL(pszResampling, "") &&
+            !getResampling(pszResampling, &m_eOverviewResampling) )
+        {
+            CPLError(CE_Failure, CPLE_NotSupported, 
+                "Resampling %s not supported. Must be NEAREST, AVERAGE or MODE", pszResampling);
+            return CE_Failure;
+        }
+        if( !CheckOverviewFactors(nOverviews, panOverviewList, nRasterXSize, nRasterYSize, 
+                    m_tileXSize, m_tileYSize) )
+        {
+            return CE_Failure;
+        }
+    }
+
     // go through the list of bands that have been passed in
     int nCurrentBand;
     for( int nBandCount = 0; nBandCount < nListBands; nBandCount++ )
@@ -312,10 +1460,90 @@ CPLErr EMUDataset::IBuildOverviews(const char *pszResampling, int nOverviews, co
 }
 
 
+// version 2. pReader is just past "HDR". Checks the byte order and finds the 
+// sections, leaving pReader reading EMU_SECTION_INFO.
+static bool ReadHeaderSections(GByte *pHeader, size_t nHeaderSize, EMUHeaderReader *pReader,
+        std::vector<EMUGridEntry> &gridEntries, std::vector<EMURatChunk> &ratChunks)
+{
+    uint32_t nByteOrder = 0;
+    uint64_t nSections = 0;
+    pReader->read(&nByteOrder);
+    EMU_U32(nByteOrder)
+    if( pReader->isOK() && (nByteOrder != EMU_BYTE_ORDER_MARK) )
+    {
+        if( nByteOrder == CPL_SWAP32(EMU_BYTE_ORDER_MARK) )
+        {
+            CPLError(CE_Failure, CPLE_NotSupported,
+                     "File was written on a machine with the opposite byte order, "
+                     "which isn't supported");
+        }
+        else
+        {
+            CPLError(CE_Failure, CPLE_OpenFailed, "Invalid byte order mark");
+        }
+        return false;
+    }
+    pReader->read(&nSections);
+    EMU_U64(nSections)
+    if( !pReader->isOK() || (nSections > nHeaderSize / sizeof(EMUHeaderSection)) )
+    {
+        CPLError(CE_Failure, CPLE_OpenFailed, "Invalid header section directory");
+        return false;
+    }
+    std::vector<EMUHeaderSection> sections(nSections);
+    if( !pReader->read(sections.data(), nSections * sizeof(EMUHeaderSection)) )
+    {
+        CPLError(CE_Failure, CPLE_OpenFailed, "Invalid header section directory");
+        return false;
+    }
+
+    bool bHaveInfo = false;
+    for( const EMUHeaderSection &section : sections )
+    {
+        EMU_U64(section.id)
+        EMU_U64(section.offset)
+        EMU_U64(section.size)
+        if( (section.offset > nHeaderSize) || (section.size > nHeaderSize - section.offset) ||
+            ((section.id == EMU_SECTION_GRIDS) && (section.size % sizeof(EMUGridEntry) != 0)) ||
+            ((section.id == EMU_SECTION_RAT_CHUNKS) && (section.size % sizeof(EMURatChunk) != 0)) )
+        {
+            CPLError(CE_Failure, CPLE_OpenFailed, "Invalid header section");
+            return false;
+        }
+        const GByte *pData = pHeader + section.offset;
+        if( section.id == EMU_SECTION_INFO )
+        {
+            *pReader = EMUHeaderReader(pHeader + section.offset, section.size);
+            bHaveInfo = true;
+        }
+        else if( (section.id == EMU_SECTION_GRIDS) && (section.size > 0) )
+        {
+            gridEntries.resize(section.size / sizeof(EMUGridEntry));
+            memcpy(gridEntries.data(), pData, section.size);
+        }
+        else if( (section.id == EMU_SECTION_RAT_CHUNKS) && (section.size > 0) )
+        {
+            ratChunks.resize(section.size / sizeof(EMURatChunk));
+            memcpy(ratChunks.data(), pData, section.size);
+        }
+        // anything else was added later than this version, so skip it
+    }
+    if( !bHaveInfo )
+    {
+        CPLError(CE_Failure, CPLE_OpenFailed, "Header has no info section");
+    }
+    return bHaveInfo;
+}
+
 GDALDataset *EMUDataset::Open(GDALOpenInfo *poOpenInfo)
 {
     if (!Identify(poOpenInfo))
         return nullptr;
+
+    if( EMUDrillDataset::Identify(poOpenInfo) )
+        return EMUDrillDataset::Open(poOpenInfo);
+
+    uint64_t nOpenStart = EMUIOStats::now();
         
      // Confirm the requested access is supported.
     if( poOpenInfo->eAccess == GA_Update )
@@ -333,12 +1561,22 @@ GDALDataset *EMUDataset::Open(GDALOpenInfo *poOpenInfo)
         return nullptr;
     }
     
+    char szVersion[5] = {0};
+    memcpy(szVersion, &poOpenInfo->pabyHeader[3], 4);
+    int nVersion = atoi(szVersion);
+    if( (nVersion < 1) || (nVersion > EMU_VERSION) )
+    {
+        CPLError(CE_Failure, CPLE_OpenFailed,
+                 "Unsupported EMU version %d", nVersion);
+        return nullptr;
+    }
+
     // flags
-    // skip version info
     uint32_t nFlags;
     memcpy(&nFlags, &poOpenInfo->pabyHeader[7], sizeof(nFlags));
     EMU_U32(nFlags)
-    bool bCloudOptimised = nFlags & 1; // TODO
+    bool bCloudOptimised = nFlags & EMU_FLAG_CLOUD_OPTIMISED; // TODO
+    bool bPixelInterleaved = nFlags & EMU_FLAG_PIXEL_INTERLEAVED;
     
     // Check that the file pointer from GDALOpenInfo* is available.
     if( poOpenInfo->fpL == nullptr )
@@ -351,223 +1589,746 @@ GDALDataset *EMUDataset::Open(GDALOpenInfo *poOpenInfo)
     VSIFSeekL(poOpenInfo->fpL, 0 , SEEK_END);
     vsi_l_offset fsize = VSIFTellL(poOpenInfo->fpL);
     
-    // seek to the size of the header offset
-    // hopefully these accesses are cached?
-    uint64_t headerOffset; 
-    VSIFSeekL(poOpenInfo->fpL, fsize - sizeof(headerOffset), SEEK_SET);
-    VSIFReadL(&headerOffset, sizeof(headerOffset), 1, poOpenInfo->fpL);
-    EMU_U64(headerOffset)
-    VSIFSeekL(poOpenInfo->fpL, headerOffset, SEEK_SET);
+    // HEADER_FIRST files say where the header is straight after the flags
+    // (unless it didn't fit at the front when written)
+    uint64_t headerOffset = 0;
+    uint64_t headerEnd = 0;
+    bool bHeaderFirst = false;
+    if( (nFlags & EMU_FLAG_HEADER_FIRST) && 
+        (poOpenInfo->nHeaderBytes >= static_cast<int>(EMU_PREFIX_OFFSET + 2 * sizeof(uint64_t))) )
+    {
+        memcpy(&headerOffset, &poOpenInfo->pabyHeader[EMU_PREFIX_OFFSET], sizeof(headerOffset));
+        EMU_U64(headerOffset)
+        memcpy(&headerEnd, &poOpenInfo->pabyHeader[EMU_PREFIX_OFFSET + sizeof(headerOffset)], 
+                sizeof(headerEnd));
+        EMU_U64(headerEnd)
+        bHeaderFirst = (headerOffset != 0);
+    }
+    vsi_l_offset nHeaderReadBytes = 0; // not counting the initial read by GDAL
+    if( !bHeaderFirst )
+    {
+        // seek to the size of the header offset
+        VSIFSeekL(poOpenInfo->fpL, fsize - sizeof(headerOffset), SEEK_SET);
+        VSIFReadL(&headerOffset, sizeof(headerOffset), 1, poOpenInfo->fpL);
+        EMU_U64(headerOffset)
+        headerEnd = fsize - sizeof(headerOffset);
+        nHeaderReadBytes = sizeof(headerOffset);
+    }
+    if( (headerOffset == 0) || (headerOffset >= headerEnd) || (headerEnd > fsize) )
+    {
+        CPLError(CE_Failure, CPLE_OpenFailed,
+                 "Invalid header offset");
+        return nullptr;
+    }
+
+    // EMU_HEADER_CACHE_DIR. Only /vsi files as others are mapped (or 
+    // are local anyway). Not used if we can't tell when the file changes.
+    EMUHeaderCache *pHeaderCache = nullptr;
+    if( STARTS_WITH(poOpenInfo->pszFilename, "/vsi") )
+    {
+        pHeaderCache = EMUHeaderCache::getInstance();
+    }
+    // the tile cache uses this too
+    std::string osValidator;
+    if( (pHeaderCache != nullptr) || (EMUTileCache::getInstance() != nullptr) )
+    {
+        osValidator = getFileValidator(poOpenInfo->pszFilename);
+    }
+    if( osValidator.empty() )
+    {
+        pHeaderCache = nullptr;
+    }
+    EMUIndexCopy indexCopy;
+    bool bCached = (pHeaderCache != nullptr) && 
+        pHeaderCache->get(poOpenInfo->pszFilename, fsize, osValidator, headerOffset, headerEnd, 
+                &indexCopy);
+    
+    // local files are mapped so the tiles can be decompressed straight
+    // out of the page cache. Only works for real files (not /vsimem etc).
+    CPLVirtualMem *pMapped = nullptr;
+    if( CPLTestBool(CPLGetConfigOption("EMU_USE_MMAP", "YES")) && 
+        !STARTS_WITH(poOpenInfo->pszFilename, "/vsi") && CPLIsVirtualMemFileMapAvailable() )
+    {
+        pMapped = CPLVirtualMemFileMapNew(poOpenInfo->fpL, 0, fsize, VIRTUALMEM_READONLY, 
+                            nullptr, nullptr);
+        if( pMapped == nullptr )
+        {
+            CPLDebug("EMU", "Couldn't map %s, reading instead", poOpenInfo->pszFilename);
+        }
+    }
+
+    // read the whole header in one go (one request for /vsis3 etc) 
+    // and parse it from memory (or straight from the mapping)
+    // HEADER_FIRST files are read as part of the first fetch instead.
+    size_t nHeaderSize = headerEnd - headerOffset;
+    GByte *pHeader = nullptr;
+    GByte *pHeaderToFree = nullptr;
+    // when we already have the tile grids - bytes from nIndexStart to headerEnd 
+    // of the file (poOpenInfo->pabyHeader for HEADER_FIRST or the cached copy)
+    const GByte *pIndexData = nullptr;
+    vsi_l_offset nIndexStart = 0;
+    if( pMapped != nullptr )
+    {
+        pHeader = static_cast<GByte*>(CPLVirtualMemGetAddr(pMapped)) + headerOffset;
+    }
+    else if( bCached )
+    {
+        pIndexData = indexCopy.data.data();
+        nIndexStart = indexCopy.nStart;
+        pHeader = indexCopy.data.data() + (headerOffset - nIndexStart);
+    }
+    else if( bHeaderFirst && (headerEnd <= INT_MAX) && 
+            poOpenInfo->TryToIngest(static_cast<int>(headerEnd)) && 
+            (static_cast<uint64_t>(poOpenInfo->nHeaderBytes) >= headerEnd) )
+    {
+        pIndexData = poOpenInfo->pabyHeader;
+        pHeader = poOpenInfo->pabyHeader + headerOffset;
+        nHeaderReadBytes += nHeaderSize;
+    }
+    else
+    {
+        pHeader = static_cast<GByte*>(VSI_MALLOC_VERBOSE(nHeaderSize));
+        if( pHeader == nullptr )
+        {
+            return nullptr;
+        }
+        pHeaderToFree = pHeader;
+        VSIFSeekL(poOpenInfo->fpL, headerOffset, SEEK_SET);
+        if( VSIFReadL(pHeader, nHeaderSize, 1, poOpenInfo->fpL) != 1 )
+        {
+            CPLError(CE_Failure, CPLE_OpenFailed,
+                     "Failed to read header");
+            VSIFree(pHeader);
+            return nullptr;
+        }
+        nHeaderReadBytes += nHeaderSize;
+    }
+    EMUHeaderReader reader(pHeader, nHeaderSize);
     
-    char headerChars[4];
-    VSIFReadL(headerChars, 4, 1, poOpenInfo->fpL);
+    char headerChars[4] = {0};
+    reader.read(headerChars, 4);
     if( strcmp(headerChars, "HDR") != 0 )
     {
          CPLError(CE_Failure, CPLE_OpenFailed,
                  "Failed to read header");
+        if( pMapped != nullptr )
+            CPLVirtualMemFree(pMapped);
+        VSIFree(pHeaderToFree);
+        return nullptr;       
+    }
+
+    // from version 2 the grid directory and RAT chunks are in their own 
+    // sections and the rest is read from EMU_SECTION_INFO
+    std::vector<EMUGridEntry> gridEntries;
+    std::vector<EMURatChunk> ratChunks;
+    if( (nVersion >= 2) && !ReadHeaderSections(pHeader, nHeaderSize, &reader, gridEntries, ratChunks) )
+    {
+        if( pMapped != nullptr )
+            CPLVirtualMemFree(pMapped);
+        VSIFree(pHeaderToFree);
         return nullptr;       
     }
     
-    uint64_t ftype;
-    VSIFReadL(&ftype, sizeof(ftype), 1, poOpenInfo->fpL);
+    uint64_t ftype = 0;
+    reader.read(&ftype);
     EMU_U64(ftype)
     
-    uint64_t bandcount;
-    VSIFReadL(&bandcount, sizeof(bandcount), 1, poOpenInfo->fpL);
+    uint64_t bandcount = 0;
+    reader.read(&bandcount);
     EMU_U64(bandcount)
     
-    uint64_t xsize;
-    VSIFReadL(&xsize, sizeof(xsize), 1, poOpenInfo->fpL);
+    uint64_t xsize = 0;
+    reader.read(&xsize);
     EMU_U64(xsize)
 
-    uint64_t ysize;
-    VSIFReadL(&ysize, sizeof(ysize), 1, poOpenInfo->fpL);
+    uint64_t ysize = 0;
+    reader.read(&ysize);
     EMU_U64(ysize)
 
-    uint32_t ntilesize;
-    VSIFReadL(&ntilesize, sizeof(ntilesize), 1, poOpenInfo->fpL);
-    EMU_U32(ntilesize)
+    uint32_t ntilexsize = 0;
+    reader.read(&ntilexsize);
+    EMU_U32(ntilexsize)
+    // version 1 tiles were square and not split into strips
+    uint32_t ntileysize = ntilexsize;
+    uint32_t ntilestrips = 1;
+    if( nVersion >= 2 )
+    {
+        reader.read(&ntileysize);
+        EMU_U32(ntileysize)
+        reader.read(&ntilestrips);
+        EMU_U32(ntilestrips)
+    }
+    if( !reader.isOK() || (ntilexsize == 0) || (ntileysize == 0) || (ntilestrips == 0) )
+    {
+        CPLError(CE_Failure, CPLE_OpenFailed,
+                 "Invalid tile size");
+        if( pMapped != nullptr )
+            CPLVirtualMemFree(pMapped);
+        VSIFree(pHeaderToFree);
+        return nullptr;
+    }
     
     // grap ownership of poOpenInfo->fpL
     VSILFILE *fp = nullptr;
     std::swap(fp, poOpenInfo->fpL);
 
     GDALDataType eType = (GDALDataType)ftype;
-    EMUDataset *pDS = new EMUDataset(fp, eType, xsize, ysize, GA_ReadOnly, bCloudOptimised, ntilesize);
+    EMUDataset *pDS = new EMUDataset(fp, eType, xsize, ysize, GA_ReadOnly, bCloudOptimised, 
+                            ntilexsize, ntileysize);
+    pDS->m_osFilename = poOpenInfo->pszFilename;
+    pDS->m_bPixelInterleaved = bPixelInterleaved;
+    pDS->m_nTileStrips = ntilestrips;
+    pDS->m_nVersion = nVersion;
+    // the header offset and the header
+    if( pMapped != nullptr )
+    {
+        // read out of the mapping
+        nHeaderReadBytes += nHeaderSize;
+    }
+    pDS->m_ioStats.add(EMU_IO_BYTES_READ, nHeaderReadBytes);
+    if( !bHeaderFirst )
+    {
+        // the cached copy still needs the trailer read for the header offset
+        pDS->m_ioStats.add(EMU_IO_READ_CALLS, ((pMapped != nullptr) || bCached) ? 1 : 2);
+    }
+    if( pMapped != nullptr )
+    {
+        // freed in Close()
+        pDS->m_pMapped = pMapped;
+        pDS->m_pMappedData = static_cast<const GByte*>(CPLVirtualMemGetAddr(pMapped));
+        pDS->m_nMappedSize = fsize;
+    }
+    pDS->m_pTileCache = EMUTileCache::getInstance();
+    if( pDS->m_pTileCache != nullptr )
+    {
+        pDS->m_nCacheFileId = pDS->m_pTileCache->getFileId(pDS->m_osFilename, fsize, osValidator);
+    }
+    // not much point for mapped files as the reads are just page faults
+    int nReadAheadTiles = atoi(CPLGetConfigOption("EMU_READAHEAD", "0"));
+    if( (nReadAheadTiles > 0) && (pMapped == nullptr) && (poOpenInfo->eAccess == GA_ReadOnly) )
+    {
+        size_t nReadAheadMB = std::max(1, atoi(CPLGetConfigOption("EMU_READAHEAD_MB", "64")));
+        pDS->m_pReadAhead = new EMUReadAhead(pDS, nReadAheadTiles, nReadAheadMB * 1024 * 1024);
+    }
 
     // nodata and stats for each band. 
-    for( int n = 0; n < bandcount; n++ )
+    for( int n = 0; (n < bandcount) && reader.isOK(); n++ )
     {
-        uint8_t n8NoDataSet;
-        VSIFReadL(&n8NoDataSet, sizeof(n8NoDataSet), 1, fp);
+        uint8_t n8NoDataSet = 0;
+        reader.read(&n8NoDataSet);
         EMU_U8(n8NoDataSet)
-        int64_t nodata;
-        VSIFReadL(&nodata, sizeof(nodata), 1, fp);
+        int64_t nodata = 0;
+        reader.read(&nodata);
         EMU_64(nodata)
 
-        EMURasterBand *pBand = new EMURasterBand(pDS, n + 1, eType, xsize, ysize, ntilesize, pDS->m_mutex);
+        EMURasterBand *pBand = new EMURasterBand(pDS, n + 1, eType, xsize, ysize, 
+                                    ntilexsize, ntileysize, pDS->m_mutex);
         if(n8NoDataSet)
             pBand->SetNoDataValueAsInt64(nodata);
             
-        VSIFReadL(&pBand->m_dMin, sizeof(pBand->m_dMin), 1, fp);
+        reader.read(&pBand->m_dMin);
         EMU_F64(pBand->m_dMin)
-        VSIFReadL(&pBand->m_dMax, sizeof(pBand->m_dMax), 1, fp);
+        reader.read(&pBand->m_dMax);
         EMU_F64(pBand->m_dMax)
-        VSIFReadL(&pBand->m_dMean, sizeof(pBand->m_dMean), 1, fp);
+        reader.read(&pBand->m_dMean);
         EMU_F64(pBand->m_dMean)
-        VSIFReadL(&pBand->m_dStdDev, sizeof(pBand->m_dStdDev), 1, fp);
+        reader.read(&pBand->m_dStdDev);
         EMU_F64(pBand->m_dStdDev)
         
         pDS->SetBand(n + 1, pBand);
         
-        uint32_t nOverviews;
-        VSIFReadL(&nOverviews, sizeof(nOverviews), 1, fp);
+        uint32_t nOverviews = 0;
+        reader.read(&nOverviews);
         EMU_U32(nOverviews)
-        std::vector<std::tuple<int, int, int> > sizes;
-        for( uint32_t n = 0; n < nOverviews; n++)
+        std::vector<std::tuple<int, int, int, int> > sizes;
+        for( uint32_t n = 0; (n < nOverviews) && reader.isOK(); n++)
         {
-            uint64_t oxsize;
-            VSIFReadL(&oxsize, sizeof(oxsize), 1, fp);
+            uint64_t oxsize = 0;
+            reader.read(&oxsize);
             EMU_U64(oxsize)
-            uint64_t oysize;
-            VSIFReadL(&oysize, sizeof(oysize), 1, fp);
+            uint64_t oysize = 0;
+            reader.read(&oysize);
             EMU_U64(oysize)
-            uint16_t oblocksize;
-            VSIFReadL(&oblocksize, sizeof(oblocksize), 1, fp);
-            EMU_U16(oblocksize)
-            sizes.push_back(std::tuple<int, int, int>(oxsize, oysize, oblocksize));
+            uint32_t oblockxsize = 0, oblockysize = 0;
+            if( nVersion >= 2 )
+            {
+                reader.read(&oblockxsize);
+                EMU_U32(oblockxsize)
+                reader.read(&oblockysize);
+                EMU_U32(oblockysize)
+            }
+            else
+            {
+                uint16_t oblocksize = 0;
+                reader.read(&oblocksize);
+                EMU_U16(oblocksize)
+                oblockxsize = oblocksize;
+                oblockysize = oblocksize;
+            }
+            // the block can be bigger than the overview itself (small rasters
+            // with the default tile size) but never more than the limit
+            if( !reader.isOK() || (oxsize == 0) || (oysize == 0) || (oxsize > xsize) ||
+                (oysize > ysize) || (oblockxsize == 0) || (oblockysize == 0) ||
+                (oblockxsize > MAX_TILESIZE) || (oblockysize > MAX_TILESIZE) )
+            {
+                CPLError(CE_Failure, CPLE_OpenFailed,
+                         "Invalid overview or overview tile size");
+                VSIFree(pHeaderToFree);
+                delete pDS;
+                return nullptr;
+            }
+            sizes.push_back(std::tuple<int, int, int, int>(oxsize, oysize, oblockxsize, oblockysize));
         }
         pBand->CreateOverviews(sizes);
 
         // RAT
-        pBand->m_rat.ReadIndex();
+        if( !pBand->m_rat.ReadIndex(reader, (nVersion >= 2) ? &ratChunks : nullptr) )
+        {
+            CPLError(CE_Failure, CPLE_OpenFailed,
+                     "Invalid RAT index");
+            VSIFree(pHeaderToFree);
+            delete pDS;
+            return nullptr;
+        }
         
         // metadata - note sizes opposite order from writing
-        uint64_t nOutputSize;
-        VSIFReadL(&nOutputSize, sizeof(nOutputSize), 1, fp);
+        uint64_t nOutputSize = 0;
+        reader.read(&nOutputSize);
         EMU_U64(nOutputSize)
         if( nOutputSize >  0)
         {
-            uint64_t nInputSize;
-            VSIFReadL(&nInputSize, sizeof(nInputSize), 1, fp);
+            uint64_t nInputSize = 0;
+            reader.read(&nInputSize);
             EMU_U64(nInputSize)
-            Byte *pBuf = static_cast<Bytef*>(CPLMalloc(nInputSize));
-            VSIFReadL(pBuf, nInputSize, 1, fp);
-            
-            char **ppszMetadata = doUncompressMetadata(COMPRESSION_ZLIB, pBuf, nInputSize, nOutputSize);
-            pBand->SetMetadata(ppszMetadata);
-            CSLDestroy(ppszMetadata);
-            CPLFree(pBuf);
-            
-            // ensure all in sync
-            pBand->UpdateMetadataList();
+            Bytef *pBuf = reader.getData(nInputSize);
+            if( pBuf != nullptr )
+            {
+                char **ppszMetadata = doUncompressMetadata(COMPRESSION_ZLIB, pBuf, nInputSize, nOutputSize);
+                pBand->SetMetadata(ppszMetadata);
+                CSLDestroy(ppszMetadata);
+            }
         }
+        // ensure all in sync (version 1 files may have stats but no metadata)
+        pBand->UpdateMetadataList();
     }
 
-    double transform[6];
-    VSIFReadL(transform, sizeof(transform), 1, fp);
+    double transform[6] = {0, 1, 0, 0, 0, -1};
+    reader.read(transform, sizeof(transform));
     for( int i = 0; i < 6; i++)
     {
         EMU_F64(transform[i])
     }
     pDS->SetGeoTransform(transform);
 
-    uint64_t wktSize;
-    VSIFReadL(&wktSize, sizeof(wktSize), 1, fp);
+    uint64_t wktSize = 0;
+    reader.read(&wktSize);
     EMU_U64(wktSize)
     
-    char *pszWKT = new char[wktSize];
-    VSIFReadL(pszWKT, wktSize, 1, fp);
-    EMU_S(pszWKT)
-    OGRSpatialReference sr(pszWKT);
-    pDS->SetSpatialRef(&sr);
-    delete[] pszWKT;
+    const char *pszWKT = reinterpret_cast<const char*>(reader.getData(wktSize));
+    if( (pszWKT != nullptr) && (wktSize > 0) && (pszWKT[wktSize - 1] == '\0') )
+    {
+        EMU_S(pszWKT)
+        OGRSpatialReference sr(pszWKT);
+        pDS->SetSpatialRef(&sr);
+    }
     
     // metadata - note sizes opposite order from writing
-    uint64_t val;
-    VSIFReadL(&val, sizeof(val), 1, fp);
+    uint64_t val = 0;
+    reader.read(&val);
     if( val >  0)
     {
         size_t nOutputSize = val, nInputSize;
-        VSIFReadL(&val, sizeof(val), 1, fp);
+        val = 0;
+        reader.read(&val);
         nInputSize = val;
-        Byte *pBuf = static_cast<Bytef*>(CPLMalloc(nInputSize));
-        VSIFReadL(pBuf, nInputSize, 1, fp);
+        Bytef *pBuf = reader.getData(nInputSize);
+        if( pBuf != nullptr )
+        {
+            char **ppszMetadata = doUncompressMetadata(COMPRESSION_ZLIB, pBuf, nInputSize, nOutputSize);
+            pDS->SetMetadata(ppszMetadata);
+            CSLDestroy(ppszMetadata);
         
-        char **ppszMetadata = doUncompressMetadata(COMPRESSION_ZLIB, pBuf, nInputSize, nOutputSize);
-        pDS->SetMetadata(ppszMetadata);
-        CSLDestroy(ppszMetadata);
-        CPLFree(pBuf);
+            // ensure all in sync
+            pDS->UpdateMetadataList();
+        }
+    }
+    
+    if( nVersion == 1 )
+    {
+        // old style - a list of tiles
+        uint64_t ntiles = 0;
+        reader.read(&ntiles);
+        EMU_U64(ntiles)
         
-        // ensure all in sync
-        pDS->UpdateMetadataList();
+        for( uint64_t n = 0; (n < ntiles) && reader.isOK(); n++ )
+        {
+            uint64_t offset = 0;
+            reader.read(&offset);
+            EMU_U64(offset)
+            uint64_t size = 0;
+            reader.read(&size);
+            EMU_U64(size)
+            uint64_t uncompressedSize = 0;
+            reader.read(&uncompressedSize);
+            EMU_U64(uncompressedSize)
+            uint64_t ovrLevel = 0;
+            reader.read(&ovrLevel);
+            EMU_U64(ovrLevel)
+            uint64_t band = 0;
+            reader.read(&band);
+            EMU_U64(band)
+            uint64_t x = 0;
+            reader.read(&x);
+            EMU_U64(x)
+            uint64_t y = 0;
+            reader.read(&y);
+            EMU_U64(y)
+            
+            pDS->setTileOffset(ovrLevel, band, x, y, offset, size, uncompressedSize);
+        }
+    }
+    else
+    {
+        // directory of grids, then the tiles for each grid
+        std::vector<std::tuple<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t> > grids;
+        for( const EMUGridEntry &entry : gridEntries )
+        {
+            grids.push_back(std::make_tuple(entry.ovrLevel, entry.band, entry.nXBlocks, 
+                                entry.nYBlocks, entry.offset));
+        }
+
+        // EMU_HEADER_CACHE_DIR. The grids are just before the header so 
+        // read them all at once and keep a copy for next time.
+        if( (pHeaderCache != nullptr) && !bCached && reader.isOK() )
+        {
+            indexCopy.nStart = headerOffset;
+            for( const auto &grid : grids )
+            {
+                if( (std::get<4>(grid) != 0) && (std::get<4>(grid) < indexCopy.nStart) )
+                {
+                    indexCopy.nStart = std::get<4>(grid);
+                }
+            }
+            indexCopy.nHeaderOffset = headerOffset;
+            indexCopy.nHeaderEnd = headerEnd;
+            if( (pIndexData != nullptr) && (indexCopy.nStart >= nIndexStart) )
+            {
+                indexCopy.data.assign(pIndexData + (indexCopy.nStart - nIndexStart), 
+                                pIndexData + (headerEnd - nIndexStart));
+            }
+            else
+            {
+                size_t nGridBytes = headerOffset - indexCopy.nStart;
+                indexCopy.data.resize(nGridBytes + nHeaderSize);
+                memcpy(indexCopy.data.data() + nGridBytes, pHeader, nHeaderSize);
+                if( (nGridBytes > 0) && ((VSIFSeekL(fp, indexCopy.nStart, SEEK_SET) != 0) || 
+                        (VSIFReadL(indexCopy.data.data(), nGridBytes, 1, fp) != 1)) )
+                {
+                    indexCopy.data.clear();
+                }
+                else
+                {
+                    pIndexData = indexCopy.data.data();
+                    nIndexStart = indexCopy.nStart;
+                }
+                pDS->m_ioStats.add(EMU_IO_BYTES_READ, nGridBytes);
+                pDS->m_ioStats.add(EMU_IO_READ_CALLS, 1);
+            }
+        }
+        
+        for( size_t n = 0; (n < grids.size()) && reader.isOK(); n++ )
+        {
+            // just record where they are. Tiles are loaded when needed.
+            uint64_t ovrLevel, band, nXBlocks, nYBlocks, offset;
+            std::tie(ovrLevel, band, nXBlocks, nYBlocks, offset) = grids[n];
+            if( (band == 0) || (band > bandcount) || 
+                (ovrLevel > static_cast<uint64_t>(pDS->GetRasterBand(band)->GetOverviewCount())) ||
+                (offset == 0) || (nXBlocks == 0) || (nYBlocks == 0) ||
+                (nXBlocks > fsize) || (nYBlocks > (fsize / nXBlocks)) ||
+                (offset > fsize) || 
+                ((nXBlocks * nYBlocks * sizeof(EMUTileValue)) > (fsize - offset)) )
+            {
+                CPLError(CE_Failure, CPLE_OpenFailed,
+                         "Invalid tile index");
+                VSIFree(pHeaderToFree);
+                delete pDS;
+                return nullptr;
+            }
+            EMUTileGrid *pGrid = pDS->createTileGrid(ovrLevel, band, nXBlocks, nYBlocks, offset);
+            if( (pIndexData != nullptr) && (offset >= nIndexStart) && 
+                    (offset + nXBlocks * nYBlocks * sizeof(EMUTileValue) <= headerEnd) )
+            {
+                // already have the tiles so no need to wait
+                pGrid->tiles.resize(nXBlocks * nYBlocks);
+                memcpy(pGrid->tiles.data(), pIndexData + (offset - nIndexStart), 
+                        nXBlocks * nYBlocks * sizeof(EMUTileValue));
+                pGrid->pTiles = pGrid->tiles.data();
+                pGrid->fileOffset = 0;
+            }
+        }
+    }
+    
+    VSIFree(pHeaderToFree);
+    if( !reader.isOK() )
+    {
+        CPLError(CE_Failure, CPLE_OpenFailed,
+                 "Header is truncated");
+        delete pDS;
+        return nullptr;
+    }
+
+    // only save it once we know it was all good
+    if( (pHeaderCache != nullptr) && !bCached && !indexCopy.data.empty() )
+    {
+        pHeaderCache->put(poOpenInfo->pszFilename, fsize, osValidator, indexCopy);
+    }
+
+    pDS->m_ioStats.add(EMU_IO_OPEN_NS, EMUIOStats::now() - nOpenStart);
+    return pDS;
+}
+
+// get the compression method, level and filter from the creation options. 
+// Returns false if these aren't valid.
+static bool GetCompression(char **papszOptions, GDALDataType eType, 
+                        uint8_t *pnCompression, int *pnLevel, uint8_t *pnFilter)
+{
+    const char *pszCompress = CSLFetchNameValueDef(papszOptions, "COMPRESS", "ZLIB");
+    const EMUCodec *pCodec = getCodecByName(pszCompress);
+    if( pCodec == nullptr )
+    {
+        CPLError(CE_Failure, CPLE_NotSupported, 
+            "COMPRESS=%s is not supported by this build of the EMU driver", pszCompress);
+        return false;
+    }
+    
+    int nLevel = COMPRESSION_DFLT_LEVEL;
+    const char *pszLevel = CSLFetchNameValue(papszOptions, "LEVEL");
+    if( pszLevel != nullptr )
+    {
+        nLevel = atoi(pszLevel);
+        if( (nLevel < pCodec->nMinLevel) || (nLevel > pCodec->nMaxLevel) )
+        {
+            CPLError(CE_Failure, CPLE_IllegalArg, 
+                "LEVEL must be between %d and %d for COMPRESS=%s", 
+                pCodec->nMinLevel, pCodec->nMaxLevel, pCodec->pszName);
+            return false;
+        }
+    }
+    
+    uint8_t nFilter = FILTER_NONE;
+    const char *pszFilter = CSLFetchNameValueDef(papszOptions, "FILTER", "NONE");
+    if( EQUAL(pszFilter, "PREDICTOR") )
+    {
+        if( !GDALDataTypeIsInteger(eType) )
+        {
+            CPLError(CE_Failure, CPLE_IllegalArg, 
+                "FILTER=PREDICTOR is only supported for integer types. Try FPREDICTOR");
+            return false;
+        }
+        nFilter = FILTER_PREDICTOR;
+    }
+    else if( EQUAL(pszFilter, "FPREDICTOR") )
+    {
+        if( !GDALDataTypeIsFloating(eType) )
+        {
+            CPLError(CE_Failure, CPLE_IllegalArg, 
+                "FILTER=FPREDICTOR is only supported for floating point types. Try PREDICTOR");
+            return false;
+        }
+        nFilter = FILTER_FPREDICTOR;
+    }
+    else if( EQUAL(pszFilter, "SHUFFLE") )
+    {
+        nFilter = FILTER_SHUFFLE;
+    }
+    else if( EQUAL(pszFilter, "BITSHUFFLE") )
+    {
+        nFilter = FILTER_BITSHUFFLE;
+    }
+    else if( !EQUAL(pszFilter, "NONE") )
+    {
+        CPLError(CE_Failure, CPLE_IllegalArg, "Unknown FILTER=%s", pszFilter);
+        return false;
+    }
+    
+    *pnCompression = pCodec->type;
+    *pnLevel = nLevel;
+    *pnFilter = nFilter;
+    return true;
+}
+
+int EMUDataset::Identify(GDALOpenInfo *poOpenInfo)
+{
+    if( EMUDrillDataset::Identify(poOpenInfo) )
+        return TRUE;
+
+    if( !EQUAL(CPLGetExtension(poOpenInfo->pszFilename), "EMU") )
+        return FALSE;
+        
+    if (poOpenInfo->pabyHeader == nullptr ||
+        memcmp(poOpenInfo->pabyHeader, "EMU", 3) != 0)
+    {
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+// get the INTERLEAVE creation option. Returns false if not valid.
+static bool GetInterleave(char **papszOptions, bool *pbPixelInterleaved)
+{
+    const char *pszInterleave = CSLFetchNameValueDef(papszOptions, "INTERLEAVE", "BAND");
+    if( EQUAL(pszInterleave, "BAND") )
+    {
+        *pbPixelInterleaved = false;
+    }
+    else if( EQUAL(pszInterleave, "PIXEL") )
+    {
+        *pbPixelInterleaved = true;
+    }
+    else
+    {
+        CPLError(CE_Failure, CPLE_NotSupported, 
+            "INTERLEAVE=%s is not supported. Must be BAND or PIXEL", pszInterleave);
+        return false;
+    }
+    return true;
+}
+
+// get the OVERVIEWS and OVERVIEW_RESAMPLING creation options. If either is set
+// the overviews are generated as the data is written. Returns false if not valid.
+static bool GetOverviews(char **papszOptions, int nXSize, int nYSize, int nBlockXSize, int nBlockYSize,
+                        bool *pbGenerate, EMUResampling *peResampling, std::vector<int> &factors)
+{
+    const char *pszResampling = CSLFetchNameValue(papszOptions, "OVERVIEW_RESAMPLING");
+    const char *pszOverviews = CSLFetchNameValue(papszOptions, "OVERVIEWS");
+    *pbGenerate = (pszResampling != nullptr) || (pszOverviews != nullptr);
+    *peResampling = RESAMPLE_AVERAGE;
+
+    if( (pszResampling != nullptr) && !getResampling(pszResampling, peResampling) )
+    {
+        CPLError(CE_Failure, CPLE_NotSupported, 
+            "OVERVIEW_RESAMPLING=%s is not supported. Must be NEAREST, AVERAGE or MODE", pszResampling);
+        return false;
+    }
+
+    factors.clear();
+    if( pszOverviews == nullptr )
+    {
+        // OVERVIEW_RESAMPLING on its own means they will come from BuildOverviews
+        return true;
+    }
+    
+    if( EQUAL(pszOverviews, "AUTO") )
+    {
+        // keep halving until the last level fits in one block
+        for( int nFactor = 2; (nFactor <= nBlockXSize) && (nFactor <= nBlockYSize) && 
+                (((nXSize / (nFactor / 2)) > nBlockXSize) || ((nYSize / (nFactor / 2)) > nBlockYSize)) && 
+                ((nXSize / nFactor) > 0) && ((nYSize / nFactor) > 0) && 
+                ((nBlockXSize % nFactor) == 0) && ((nBlockYSize % nFactor) == 0); nFactor *= 2 )
+        {
+            factors.push_back(nFactor);
+        }
+        return true;
+    }
+
+    char **papszFactors = CSLTokenizeString2(pszOverviews, ",", 0);
+    for( int n = 0; papszFactors[n] != nullptr; n++ )
+    {
+        factors.push_back(atoi(papszFactors[n]));
+    }
+    CSLDestroy(papszFactors);
+    std::sort(factors.begin(), factors.end());
+    return CheckOverviewFactors(factors.size(), factors.data(), nXSize, nYSize, nBlockXSize, nBlockYSize);
+}
+
+// BLOCKXSIZE and BLOCKYSIZE creation options. BLOCKYSIZE defaults to BLOCKXSIZE 
+// and both are set to 0 if neither is given. Returns false if not valid.
+static bool GetBlockSize(char **papszOptions, int *pnBlockXSize, int *pnBlockYSize)
+{
+    const char *pszXSize = CSLFetchNameValue(papszOptions, "BLOCKXSIZE");
+    const char *pszYSize = CSLFetchNameValue(papszOptions, "BLOCKYSIZE");
+    *pnBlockXSize = (pszXSize != nullptr) ? atoi(pszXSize) : 0;
+    *pnBlockYSize = (pszYSize != nullptr) ? atoi(pszYSize) : *pnBlockXSize;
+    if( (pszXSize == nullptr) && (pszYSize != nullptr) )
+    {
+        *pnBlockXSize = DFLT_TILESIZE;
+    }
+    if( (pszXSize == nullptr) && (pszYSize == nullptr) )
+    {
+        return true;
     }
-    
-    uint64_t ntiles;
-    VSIFReadL(&ntiles, sizeof(ntiles), 1, fp);
-    EMU_U64(ntiles)
-    
-    for( uint64_t n = 0; n < ntiles; n++ )
-    {
-        uint64_t offset;
-        VSIFReadL(&offset, sizeof(offset), 1, fp);
-        EMU_U64(offset)
-        uint64_t size;
-        VSIFReadL(&size, sizeof(size), 1, fp);
-        EMU_U64(size)
-        uint64_t uncompressedSize;
-        VSIFReadL(&uncompressedSize, sizeof(uncompressedSize), 1, fp);
-        EMU_U64(uncompressedSize)
-        uint64_t ovrLevel;
-        VSIFReadL(&ovrLevel, sizeof(ovrLevel), 1, fp);
-        EMU_U64(ovrLevel)
-        uint64_t band;
-        VSIFReadL(&band, sizeof(band), 1, fp);
-        EMU_U64(band)
-        uint64_t x;
-        VSIFReadL(&x, sizeof(x), 1, fp);
-        EMU_U64(x)
-        uint64_t y;
-        VSIFReadL(&y, sizeof(y), 1, fp);
-        EMU_U64(y)
-        
-        pDS->setTileOffset(ovrLevel, band, x, y, offset, size, uncompressedSize);
+    if( (*pnBlockXSize < MIN_TILESIZE) || (*pnBlockXSize > MAX_TILESIZE) || 
+        (*pnBlockYSize < MIN_TILESIZE) || (*pnBlockYSize > MAX_TILESIZE) )
+    {
+        CPLError(CE_Failure, CPLE_NotSupported, 
+            "BLOCKXSIZE and BLOCKYSIZE must be between %d and %d", MIN_TILESIZE, MAX_TILESIZE);
+        return false;
     }
+    return true;
+}
 
-    return pDS;
+// TILE_STRIPS creation option. Must be between 1 (tiles not split) and the 
+// block height. Returns false if not valid.
+static bool GetTileStrips(char **papszOptions, int nBlockYSize, uint32_t *pnTileStrips)
+{
+    const char *pszStrips = CSLFetchNameValue(papszOptions, "TILE_STRIPS");
+    int nStrips = (pszStrips != nullptr) ? atoi(pszStrips) : 1;
+    if( (nStrips < 1) || (nStrips > nBlockYSize) )
+    {
+        CPLError(CE_Failure, CPLE_NotSupported, 
+            "TILE_STRIPS must be between 1 and the block height (%d)", nBlockYSize);
+        return false;
+    }
+    *pnTileStrips = nStrips;
+    return true;
 }
 
-int EMUDataset::Identify(GDALOpenInfo *poOpenInfo)
+// nullptr if the file isn't going to an object store
+static const EMUUploadTarget *GetUploadTarget(const char *pszFilename)
 {
-    if( !EQUAL(CPLGetExtension(poOpenInfo->pszFilename), "EMU") )
-        return FALSE;
-        
-    if (poOpenInfo->pabyHeader == nullptr ||
-        memcmp(poOpenInfo->pabyHeader, "EMU", 3) != 0)
+    for( const EMUUploadTarget &target : UPLOAD_TARGETS )
     {
-        return FALSE;
+        if( STARTS_WITH(pszFilename, target.pszPrefix) )
+        {
+            return &target;
+        }
     }
-    
-    return TRUE;
+    return nullptr;
+}
+
+// /vsis3_streaming/ etc. Also written in order, but not as a multi part upload.
+static bool IsStreamingTarget(const char *pszFilename)
+{
+    const char *pszSlash = strchr(pszFilename + 1, '/');
+    const char *pszSuffix = "_streaming";
+    size_t nSuffixLen = strlen(pszSuffix);
+    return STARTS_WITH(pszFilename, "/vsi") && (pszSlash != nullptr) && 
+        (static_cast<size_t>(pszSlash - pszFilename) > nSuffixLen) && 
+        (strncmp(pszSlash - nSuffixLen, pszSuffix, nSuffixLen) == 0);
 }
 
 VSILFILE *EMUDataset::CreateEMU(const char * pszFilename,
                                 int nXSize, int nYSize, int nBands,
-                                GDALDataType eType)
+                                GDALDataType eType, uint8_t nCompression)
 {
     char **papszOptions = nullptr;
-    if( STARTS_WITH(pszFilename, "/vsis3") )
+    const EMUUploadTarget *pTarget = GetUploadTarget(pszFilename);
+    if( pTarget != nullptr )
     {
-        // try and determine a sensible chunk size in MB
-        double dApproxFileSize = ((nXSize * nYSize * nBands * 
-            GDALGetDataTypeSizeBytes(eType)) / ONE_MB) * AVG_COMPRESSION_RATIO;
-        int nChunkSize = ceil(dApproxFileSize / S3_MAX_PARTS);
-        if( nChunkSize < S3_MIN_PART_SIZE )
-        {
-            nChunkSize = S3_MIN_PART_SIZE;
-        }
-        
-        if( (nChunkSize * S3_MAX_PARTS) > (S3_MAX_PART_SIZE * S3_MAX_PARTS) )
+        // The part size can't be changed once the file is open so work it out
+        // from the largest the file could be (no compression, with overviews)
+        // so we don't run out of parts, but don't buffer more than the file 
+        // is likely to need.
+        double dMaxFileSize = (static_cast<double>(nXSize) * nYSize * nBands * 
+            GDALGetDataTypeSizeBytes(eType)) / ONE_MB * OVERVIEW_SIZE_RATIO;
+        double dApproxFileSize = (nCompression == COMPRESSION_NONE) ? dMaxFileSize : 
+                                    dMaxFileSize * AVG_COMPRESSION_RATIO;
+
+        double dChunkSize = std::min<double>(DFLT_PART_SIZE, ceil(dApproxFileSize));
+        dChunkSize = std::max(dChunkSize, ceil(dMaxFileSize / pTarget->nMaxParts));
+        dChunkSize = std::max<double>(dChunkSize, pTarget->nMinPartSize);
+        if( dChunkSize > pTarget->nMaxPartSize )
         {
             CPLError(CE_Failure, CPLE_OpenFailed,
                     "Attempt to create file `%s' failed. Too big for multi part upload",
@@ -575,13 +2336,22 @@ VSILFILE *EMUDataset::CreateEMU(const char * pszFilename,
             return NULL;
         }
         
+        int nChunkSize = static_cast<int>(dChunkSize);
         papszOptions = CSLAppendPrintf(papszOptions, "CHUNK_SIZE=%d", nChunkSize);
-        printf("CHUNK_SIZE=%d dApproxFileSize=%f\n", nChunkSize, dApproxFileSize);
+        CPLDebug("EMU", "CHUNK_SIZE=%d approx file size=%.1fMB (at most %.1fMB)", 
+                    nChunkSize, dApproxFileSize, dMaxFileSize);
     }
 
     // Try to create the file.
     VSILFILE *fp = VSIFOpenEx2L(pszFilename, "w", FALSE, papszOptions);
     CSLDestroy(papszOptions);
+
+    // don't let tiles cached from whatever was there before be used
+    EMUTileCache *pTileCache = EMUTileCache::getInstance();
+    if( (fp != nullptr) && (pTileCache != nullptr) )
+    {
+        pTileCache->forgetFile(pszFilename);
+    }
     
     return fp;    
 }
@@ -589,9 +2359,44 @@ VSILFILE *EMUDataset::CreateEMU(const char * pszFilename,
 GDALDataset *EMUDataset::Create(const char * pszFilename,
                                 int nXSize, int nYSize, int nBands,
                                 GDALDataType eType,
-                                char ** /* papszParamList */)
+                                char ** papszParamList)
 {
-    VSILFILE *fp = CreateEMU(pszFilename, nXSize, nYSize, nBands, eType);
+    uint8_t nCompression, nFilter;
+    int nCompressLevel;
+    if( !GetCompression(papszParamList, eType, &nCompression, &nCompressLevel, &nFilter) )
+    {
+        return NULL;
+    }
+    bool bPixelInterleaved;
+    if( !GetInterleave(papszParamList, &bPixelInterleaved) )
+    {
+        return NULL;
+    }
+    int nBlockXSize, nBlockYSize;
+    if( !GetBlockSize(papszParamList, &nBlockXSize, &nBlockYSize) )
+    {
+        return NULL;
+    }
+    if( nBlockXSize == 0 )
+    {
+        nBlockXSize = DFLT_TILESIZE;
+        nBlockYSize = DFLT_TILESIZE;
+    }
+    uint32_t nTileStrips;
+    if( !GetTileStrips(papszParamList, nBlockYSize, &nTileStrips) )
+    {
+        return NULL;
+    }
+    bool bGenerateOverviews;
+    EMUResampling eResampling;
+    std::vector<int> factors;
+    if( !GetOverviews(papszParamList, nXSize, nYSize, nBlockXSize, nBlockYSize, &bGenerateOverviews, 
+                &eResampling, factors) )
+    {
+        return NULL;
+    }
+
+    VSILFILE *fp = CreateEMU(pszFilename, nXSize, nYSize, nBands, eType, nCompression);
     if( fp == NULL )
     {
         CPLError(CE_Failure, CPLE_OpenFailed,
@@ -602,87 +2407,278 @@ GDALDataset *EMUDataset::Create(const char * pszFilename,
     
     VSIFPrintfL(fp, "EMU%04d", EMU_VERSION);
     uint32_t nFlags = 0;  // No COG
+    if( bPixelInterleaved )
+    {
+        nFlags |= EMU_FLAG_PIXEL_INTERLEAVED;
+    }
     VSIFWriteL(&nFlags, sizeof(nFlags), 1, fp);
     
-    EMUDataset *pDS = new EMUDataset(fp, eType, nXSize, nYSize, GA_Update, false, DFLT_TILESIZE);
+    EMUDataset *pDS = new EMUDataset(fp, eType, nXSize, nYSize, GA_Update, false, nBlockXSize, nBlockYSize);
+    pDS->m_osFilename = pszFilename;
+    pDS->m_nCompression = nCompression;
+    pDS->m_nCompressLevel = nCompressLevel;
+    pDS->m_nFilter = nFilter;
+    pDS->m_bPixelInterleaved = bPixelInterleaved;
+    pDS->m_nTileStrips = nTileStrips;
+    int nThreads = GetNumThreads(papszParamList);
+    // when uploading always compress in the background so the 
+    // next tiles are ready while a part is being sent
+    bool bUpload = (GetUploadTarget(pszFilename) != nullptr);
+    if( (nThreads > 1) || bUpload )
+    {
+        pDS->startWriterThreads(std::max(nThreads, 1), bUpload);
+    }
+    pDS->m_bGenerateOverviews = bGenerateOverviews;
+    pDS->m_eOverviewResampling = eResampling;
+    pDS->m_bCollectStats = CPLFetchBool(papszParamList, "STATISTICS", true);
     for( int n = 0; n < nBands; n++ )
     {
-        pDS->SetBand(n + 1, new EMURasterBand(pDS, n + 1, eType, nXSize, nYSize, DFLT_TILESIZE, pDS->m_mutex));
+        EMURasterBand *pBand = new EMURasterBand(pDS, n + 1, eType, nXSize, nYSize, 
+                                    nBlockXSize, nBlockYSize, pDS->m_mutex);
+        pDS->SetBand(n + 1, pBand);
+        if( !factors.empty() )
+        {
+            pBand->CreateOverviews(factors.size(), factors.data());
+        }
     }
     
     return pDS;
 }
 
-bool CopyBand(GDALRasterBand *pSrc, GDALRasterBand *pDst, int &nDoneBlocks, int nTotalBlocks, GDALProgressFunc pfnProgress, void *pProgressData)
+// Copy a set of bands that are all the same size (and block size) a block
+// at a time, doing all the bands for a block before moving onto the next
+// so tiles end up (y, x, band) ordered in the file. With NUM_THREADS the 
+// tiles are compressed by the worker threads and appended (in order) by 
+// the writer thread while this thread carries on reading the source.
+// If pSrcDs is given the bands are the full res bands of it and all the 
+// bands of a block are read with one call. The source is read a destination 
+// block at a time so its own block size doesn't matter (GDAL re-blocks it).
+bool CopyBands(GDALDataset *pSrcDs, const std::vector<GDALRasterBand*> &srcBands, 
+        const std::vector<GDALRasterBand*> &destBands, int &nDoneBlocks, int nTotalBlocks, 
+        GDALProgressFunc pfnProgress, void *pProgressData)
 {
-    int nXSize = pSrc->GetXSize();
-    int nYSize = pSrc->GetYSize();
-    GDALDataType eGDALType = pSrc->GetRasterDataType();
+    GDALRasterBand *pFirst = srcBands[0];
+    int nXSize = pFirst->GetXSize();
+    int nYSize = pFirst->GetYSize();
+    GDALDataType eGDALType = pFirst->GetRasterDataType();
+    int nBands = srcBands.size();
+    std::vector<int> bandMap;
+    for( auto pBand : srcBands )
+    {
+        bandMap.push_back(pBand->GetBand());
+    }
     
-    int nBlockSize;
-    pDst->GetBlockSize(&nBlockSize, &nBlockSize);
+    int nBlockXSize, nBlockYSize;
+    destBands[0]->GetBlockSize(&nBlockXSize, &nBlockYSize);
 
-    // allocate some space
+    // allocate some space for a block of each band
     int nPixelSize = GDALGetDataTypeSize( eGDALType ) / 8;
-    void *pData = CPLMalloc( nPixelSize * nBlockSize * nBlockSize);
+    size_t nBlockBytes = static_cast<size_t>(nPixelSize) * nBlockXSize * nBlockYSize;
+    GByte *pData = static_cast<GByte*>(VSI_MALLOC_VERBOSE(nBlockBytes * nBands));
+    if( pData == nullptr )
+    {
+        return false;
+    }
     double dLastFraction = -1;
     
     // go through the image
-    for( unsigned int nY = 0; nY < nYSize; nY += nBlockSize )
+    for( unsigned int nY = 0; nY < nYSize; nY += nBlockYSize )
     {
         // adjust for edge blocks
-        unsigned int nysize = nBlockSize;
-        unsigned int nytotalsize = nY + nBlockSize;
+        unsigned int nysize = nBlockYSize;
+        unsigned int nytotalsize = nY + nBlockYSize;
         if( nytotalsize > nYSize )
             nysize -= (nytotalsize - nYSize);
-        for( unsigned int nX = 0; nX < nXSize; nX += nBlockSize )
+
+        // let the source know what is coming (helps for /vsis3 etc)
+        if( pSrcDs != nullptr )
+        {
+            pSrcDs->AdviseRead(0, nY, nXSize, nysize, nXSize, nysize, eGDALType, 
+                        nBands, bandMap.data(), nullptr);
+        }
+        else
+        {
+            for( auto pBand : srcBands )
+            {
+                pBand->AdviseRead(0, nY, nXSize, nysize, nXSize, nysize, eGDALType, nullptr);
+            }
+        }
+
+        for( unsigned int nX = 0; nX < nXSize; nX += nBlockXSize )
         {
             // adjust for edge blocks
-            unsigned int nxsize = nBlockSize;
-            unsigned int nxtotalsize = nX + nBlockSize;
+            unsigned int nxsize = nBlockXSize;
+            unsigned int nxtotalsize = nX + nBlockXSize;
             if( nxtotalsize > nXSize )
                 nxsize -= (nxtotalsize - nXSize);
                 
-            // read in from In Band 
-            if( pSrc->RasterIO( GF_Read, nX, nY, nxsize, nysize, pData, nxsize, nysize, eGDALType, nPixelSize, nPixelSize * nBlockSize) != CE_None )
+            // read in from In Bands 
+            CPLErr eErr = CE_None;
+            if( pSrcDs != nullptr )
             {
-                CPLError( CE_Failure, CPLE_AppDefined, "Unable to read block at %d %d\n", nX, nY );
-                return false;
+                eErr = pSrcDs->RasterIO( GF_Read, nX, nY, nxsize, nysize, pData, nxsize, nysize, eGDALType, 
+                            nBands, bandMap.data(), nPixelSize, nPixelSize * nBlockXSize, nBlockBytes, nullptr);
+            }
+            else
+            {
+                for( int nBand = 0; (nBand < nBands) && (eErr == CE_None); nBand++ )
+                {
+                    eErr = srcBands[nBand]->RasterIO( GF_Read, nX, nY, nxsize, nysize, pData + nBand * nBlockBytes, 
+                            nxsize, nysize, eGDALType, nPixelSize, nPixelSize * nBlockXSize);
+                }
             }
-            // write out
-            if( pDst->WriteBlock(nX / nBlockSize, nY / nBlockSize, pData) != CE_None )
+            if( eErr != CE_None )
             {
-                CPLError( CE_Failure, CPLE_AppDefined, "Unable to write block at %d %d\n", nX, nY );
+                CPLError( CE_Failure, CPLE_AppDefined, "Unable to read block at %d %d\n", nX, nY );
+                CPLFree( pData );
                 return false;
             }
 
-            // progress
-            nDoneBlocks++;
-            double dFraction = (double)nDoneBlocks / (double)nTotalBlocks;
-            if( dFraction != dLastFraction )
+            for( int nBand = 0; nBand < nBands; nBand++ )
             {
-                if( !pfnProgress( dFraction, nullptr, pProgressData ) )
+                // write out
+                if( destBands[nBand]->WriteBlock(nX / nBlockXSize, nY / nBlockYSize, pData + nBand * nBlockBytes) != CE_None )
                 {
+                    CPLError( CE_Failure, CPLE_AppDefined, "Unable to write block at %d %d\n", nX, nY );
                     CPLFree( pData );
                     return false;
                 }
-                dLastFraction = dFraction;
+
+                // progress
+                nDoneBlocks++;
+                double dFraction = (double)nDoneBlocks / (double)nTotalBlocks;
+                if( dFraction != dLastFraction )
+                {
+                    if( !pfnProgress( dFraction, nullptr, pProgressData ) )
+                    {
+                        CPLFree( pData );
+                        return false;
+                    }
+                    dLastFraction = dFraction;
+                }
             }
         }
     }
 
-    
     CPLFree(pData);
     return true;
 }
 
-int GetBandTotalTiles(GDALRasterBand *pSrc, int nBlockSize)
+// Copy all the bands at one level via CopyBands(). Normally all the bands
+// are the same size but if not, do them one at a time.
+bool CopyLevel(GDALDataset *pSrcDs, const std::vector<GDALRasterBand*> &srcBands, 
+        const std::vector<GDALRasterBand*> &destBands, int &nDoneBlocks, int nTotalBlocks, 
+        GDALProgressFunc pfnProgress, void *pProgressData)
+{
+    bool bSameSize = true;
+    int nBlockXSize, nBlockYSize, nOtherBlockXSize, nOtherBlockYSize;
+    destBands[0]->GetBlockSize(&nBlockXSize, &nBlockYSize);
+    for( size_t n = 1; n < srcBands.size(); n++ )
+    {
+        destBands[n]->GetBlockSize(&nOtherBlockXSize, &nOtherBlockYSize);
+        if( (srcBands[n]->GetXSize() != srcBands[0]->GetXSize()) || 
+            (srcBands[n]->GetYSize() != srcBands[0]->GetYSize()) ||
+            (nOtherBlockXSize != nBlockXSize) || (nOtherBlockYSize != nBlockYSize) )
+        {
+            bSameSize = false;
+        }
+    }
+    
+    if( bSameSize )
+    {
+        return CopyBands(pSrcDs, srcBands, destBands, nDoneBlocks, nTotalBlocks, 
+                    pfnProgress, pProgressData);
+    }
+    
+    for( size_t n = 0; n < srcBands.size(); n++ )
+    {
+        std::vector<GDALRasterBand*> src = {srcBands[n]};
+        std::vector<GDALRasterBand*> dest = {destBands[n]};
+        if( !CopyBands(nullptr, src, dest, nDoneBlocks, nTotalBlocks, 
+                    pfnProgress, pProgressData) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int GetBandTotalTiles(GDALRasterBand *pSrc, int nBlockXSize, int nBlockYSize)
 {
-    int nXTiles = std::ceil(pSrc->GetXSize() / double(nBlockSize));
-    int nYTiles = std::ceil(pSrc->GetYSize() / double(nBlockSize));
+    int nXTiles = std::ceil(pSrc->GetXSize() / double(nBlockXSize));
+    int nYTiles = std::ceil(pSrc->GetYSize() / double(nBlockYSize));
     return nXTiles * nYTiles; 
 }
 
+static size_t GetMetadataSize(char **papszMetadata)
+{
+    size_t nSize = 0;
+    for( int n = 0; (papszMetadata != nullptr) && (papszMetadata[n] != nullptr); n++ )
+    {
+        nSize += strlen(papszMetadata[n]) + 1;
+    }
+    return nSize;
+}
+
+// HEADER_FIRST. More than the bytes the metadata, projection and RATs copied 
+// from pSrcDs will need in the header. Metadata is compressed so will take less.
+static size_t EstimateHeaderSize(GDALDataset *pSrcDs)
+{
+    size_t nSize = GetMetadataSize(pSrcDs->GetMetadata());
+    const OGRSpatialReference *pSr = pSrcDs->GetSpatialRef();
+    char *pszWKT = nullptr;
+    if( (pSr != nullptr) && (pSr->exportToWkt(&pszWKT) == OGRERR_NONE) )
+    {
+        nSize += strlen(pszWKT) + 1;
+    }
+    CPLFree(pszWKT);
+    for( int n = 0; n < pSrcDs->GetRasterCount(); n++ )
+    {
+        GDALRasterBand *pSrcBand = pSrcDs->GetRasterBand(n + 1);
+        nSize += GetMetadataSize(pSrcBand->GetMetadata());
+        GDALRasterAttributeTable *pRAT = pSrcBand->GetDefaultRAT();
+        if( pRAT == nullptr )
+        {
+            continue;
+        }
+        // allow for each ValuesIO being split into 2 chunks
+        size_t nChunks = 2 * (pRAT->GetRowCount() / MAX_RAT_CHUNK + 1);
+        for( int nCol = 0; nCol < pRAT->GetColumnCount(); nCol++ )
+        {
+            nSize += strlen(pRAT->GetNameOfCol(nCol)) + 1 + 2 * sizeof(uint64_t) + 
+                        nChunks * sizeof(EMURatChunk);
+        }
+    }
+    return nSize;
+}
+
+// block size to copy pSrc with. BLOCKXSIZE/BLOCKYSIZE win (nOptBlockXSize is 0 if not
+// given), otherwise keep the tiles of the source unless they aren't square (strips etc) 
+// or are out of range, in which case it is re-blocked into the default size.
+static void ChooseBlockSize(GDALRasterBand *pSrc, int nOptBlockXSize, int nOptBlockYSize, 
+                int *pnBlockXSize, int *pnBlockYSize)
+{
+    if( nOptBlockXSize != 0 )
+    {
+        *pnBlockXSize = nOptBlockXSize;
+        *pnBlockYSize = nOptBlockYSize;
+        return;
+    }
+    int nSrcBlockXSize, nSrcBlockYSize;
+    pSrc->GetBlockSize(&nSrcBlockXSize, &nSrcBlockYSize);
+    if( (nSrcBlockXSize == nSrcBlockYSize) && (nSrcBlockXSize >= MIN_TILESIZE) && 
+        (nSrcBlockXSize <= MAX_TILESIZE) )
+    {
+        *pnBlockXSize = nSrcBlockXSize;
+        *pnBlockYSize = nSrcBlockYSize;
+    }
+    else
+    {
+        *pnBlockXSize = DFLT_TILESIZE;
+        *pnBlockYSize = DFLT_TILESIZE;
+    }
+}
+
 GDALDataset *EMUDataset::CreateCopy( const char * pszFilename, GDALDataset *pSrcDs,
                                 int bStrict, char **  papszParmList, 
                                 GDALProgressFunc pfnProgress, void *pProgressData )
@@ -692,15 +2688,50 @@ GDALDataset *EMUDataset::CreateCopy( const char * pszFilename, GDALDataset *pSrc
     int nBands = pSrcDs->GetRasterCount();
     GDALRasterBand *pFirstBand = pSrcDs->GetRasterBand(1);
     GDALDataType eType = pFirstBand->GetRasterDataType();
+    int nOptBlockXsize, nOptBlockYsize;
+    if( !GetBlockSize(papszParmList, &nOptBlockXsize, &nOptBlockYsize) )
+    {
+        return nullptr;
+    }
     int nBlockXsize, nBlockYsize;
-    pFirstBand->GetBlockSize(&nBlockXsize, &nBlockYsize);
-    if( nBlockXsize != nBlockYsize)
+    ChooseBlockSize(pFirstBand, nOptBlockXsize, nOptBlockYsize, &nBlockXsize, &nBlockYsize);
+    uint32_t nTileStrips;
+    if( !GetTileStrips(papszParmList, nBlockYsize, &nTileStrips) )
+    {
+        return nullptr;
+    }
+
+    uint8_t nCompression, nFilter;
+    int nCompressLevel;
+    if( !GetCompression(papszParmList, eType, &nCompression, &nCompressLevel, &nFilter) )
+    {
+        return nullptr;
+    }
+    bool bPixelInterleaved;
+    if( !GetInterleave(papszParmList, &bPixelInterleaved) )
+    {
+        return nullptr;
+    }
+    bool bGenerateOverviews;
+    EMUResampling eResampling;
+    std::vector<int> factors;
+    if( !GetOverviews(papszParmList, nXSize, nYSize, nBlockXsize, nBlockYsize, &bGenerateOverviews, 
+                &eResampling, factors) )
     {
-        CPLError( CE_Failure, CPLE_AppDefined, "Block sizes must be square\n");
         return nullptr;
     }
 
-    VSILFILE *fp = CreateEMU(pszFilename, nXSize, nYSize, nBands, eType);
+    // the header is written again at the start once we know where the tiles 
+    // are, which needs to seek back
+    bool bHeaderFirst = CPLFetchBool(papszParmList, "HEADER_FIRST", false);
+    if( bHeaderFirst && ((GetUploadTarget(pszFilename) != nullptr) || IsStreamingTarget(pszFilename)) )
+    {
+        CPLError(CE_Warning, CPLE_NotSupported, 
+            "HEADER_FIRST isn't supported when uploading to %s. Ignored.", pszFilename);
+        bHeaderFirst = false;
+    }
+
+    VSILFILE *fp = CreateEMU(pszFilename, nXSize, nYSize, nBands, eType, nCompression);
     if( fp == NULL )
     {
         CPLError(CE_Failure, CPLE_OpenFailed,
@@ -710,90 +2741,182 @@ GDALDataset *EMUDataset::CreateCopy( const char * pszFilename, GDALDataset *pSrc
     }
     
     VSIFPrintfL(fp, "EMU%04d", EMU_VERSION);
-    uint32_t nFlags = 1;  // COG
+    uint32_t nFlags = EMU_FLAG_CLOUD_OPTIMISED;
+    if( bPixelInterleaved )
+    {
+        nFlags |= EMU_FLAG_PIXEL_INTERLEAVED;
+    }
+    if( bHeaderFirst )
+    {
+        nFlags |= EMU_FLAG_HEADER_FIRST;
+    }
     VSIFWriteL(&nFlags, sizeof(nFlags), 1, fp);
+    if( bHeaderFirst )
+    {
+        // where the header is. Filled in by Close()
+        uint64_t prefix[2] = {0, 0};
+        VSIFWriteL(prefix, sizeof(prefix), 1, fp);
+    }
     
-    EMUDataset *pDS = new EMUDataset(fp, eType, nXSize, nYSize, GA_Update, true, nBlockXsize);
+    EMUDataset *pDS = new EMUDataset(fp, eType, nXSize, nYSize, GA_Update, true, nBlockXsize, nBlockYsize);
+    pDS->m_osFilename = pszFilename;
+    pDS->m_nCompression = nCompression;
+    pDS->m_nCompressLevel = nCompressLevel;
+    pDS->m_nFilter = nFilter;
+    pDS->m_bPixelInterleaved = bPixelInterleaved;
+    pDS->m_nTileStrips = nTileStrips;
+    int nThreads = GetNumThreads(papszParmList);
+    // when uploading always compress in the background so the 
+    // next tiles are ready while a part is being sent
+    bool bUpload = (GetUploadTarget(pszFilename) != nullptr);
+    if( (nThreads > 1) || bUpload )
+    {
+        pDS->startWriterThreads(std::max(nThreads, 1), bUpload);
+    }
+    pDS->m_bGenerateOverviews = bGenerateOverviews;
+    pDS->m_eOverviewResampling = eResampling;
+    pDS->m_bCollectStats = CPLFetchBool(papszParmList, "STATISTICS", true);
     for( int n = 0; n < nBands; n++ )
     {
-        pDS->SetBand(n + 1, new EMURasterBand(pDS, n + 1, eType, nXSize, nYSize, nBlockXsize, pDS->m_mutex));
+        EMURasterBand *pBand = new EMURasterBand(pDS, n + 1, eType, nXSize, nYSize, 
+                                    nBlockXsize, nBlockYsize, pDS->m_mutex);
+        pDS->SetBand(n + 1, pBand);
+
+        // needed before the data is written if we are making the overviews
+        GDALRasterBand *pSrcBand = pSrcDs->GetRasterBand(n + 1);
+        int nNoDataSet = FALSE;
+        double dfNoData = pSrcBand->GetNoDataValue(&nNoDataSet);
+        if( nNoDataSet )
+        {
+            pBand->SetNoDataValue(dfNoData);
+        }
+        if( !factors.empty() )
+        {
+            pBand->CreateOverviews(factors.size(), factors.data());
+        }
     }
     
     // find the highest overview level
     int nMaxOverview = 0;
     int nTotalBlocks = 0;
+    std::vector<std::tuple<int, int, int, int> > firstBandSizes;
     for( int n = 0; n < nBands; n++ )
     {
         GDALRasterBand *pSrcBand = pSrcDs->GetRasterBand(n + 1);
+        if( bGenerateOverviews )
+        {
+            // the overviews are made from the full res blocks as they are written
+            // instead of being copied
+            nTotalBlocks += GetBandTotalTiles(pSrcBand, nBlockXsize, nBlockYsize);
+            continue;
+        }
         int nOverviews = pSrcBand->GetOverviewCount();
         if( nOverviews > nMaxOverview )
         {
             nMaxOverview = nOverviews;
         }
-        int nBandBlockXsize, nBandBlockYsize;
-        pSrcBand->GetBlockSize(&nBandBlockXsize, &nBandBlockYsize);
-        if( (nBandBlockXsize != nBlockXsize) || (nBandBlockYsize != nBlockYsize) )
-        {
-            CPLError( CE_Failure, CPLE_AppDefined, "Bands must have all the same block sizes\n");
-            return nullptr;
-        }
-        
-        nTotalBlocks += GetBandTotalTiles(pSrcBand, nBlockXsize);
+        nTotalBlocks += GetBandTotalTiles(pSrcBand, nBlockXsize, nBlockYsize);
         
         // create the overviews same as the input (could be different lengths for each band, but unlikely)
-        std::vector<std::tuple<int, int, int> > sizes;
+        std::vector<std::tuple<int, int, int, int> > sizes;
         for( int nOvCount = 0; nOvCount < nOverviews; nOvCount++)
         {
             GDALRasterBand *pOv = pSrcBand->GetOverview(nOvCount);
 
             int nOvBlockXsize, nOvBlockYsize;
-            pOv->GetBlockSize(&nOvBlockXsize, &nOvBlockYsize);
-            if( nOvBlockXsize != nOvBlockYsize)
-            {
-                CPLError( CE_Failure, CPLE_AppDefined, "Block sizes must be square\n");
-                return nullptr;
-            }
+            ChooseBlockSize(pOv, nOptBlockXsize, nOptBlockYsize, &nOvBlockXsize, &nOvBlockYsize);
+
+            sizes.push_back(std::tuple<int, int, int, int>(pOv->GetXSize(), pOv->GetYSize(), 
+                                nOvBlockXsize, nOvBlockYsize));
+            nTotalBlocks += GetBandTotalTiles(pOv, nOvBlockXsize, nOvBlockYsize);
+        }
 
-            sizes.push_back(std::tuple<int, int, int>(pOv->GetXSize(), pOv->GetYSize(), nOvBlockXsize));
-            nTotalBlocks += GetBandTotalTiles(pOv, nOvBlockXsize);
+        // each tile holds all the bands so the overviews must match
+        if( n == 0 )
+        {
+            firstBandSizes = sizes;
+        }
+        else if( bPixelInterleaved && (sizes != firstBandSizes) )
+        {
+            CPLError( CE_Failure, CPLE_AppDefined, "INTERLEAVE=PIXEL needs all bands to have the same overviews\n");
+            delete pDS;
+            return nullptr;
         }
         
         EMURasterBand *pDestBand = cpl::down_cast<EMURasterBand*>(pDS->GetRasterBand(n + 1));
         pDestBand->CreateOverviews(sizes);
     }
-    // now go through each level,  and then do each band
-    
+    // all the bands and overviews are known now
+    if( bHeaderFirst )
+    {
+        pDS->reserveHeaderSpace(EstimateHeaderSize(pSrcDs));
+    }
+
+    // EMU to EMU with the same layout and compression. An explicit LEVEL means 
+    // the tiles are wanted recompressed.
+    EMUDataset *pSrcEMU = nullptr;
+    if( CPLFetchBool(papszParmList, "RAW_COPY", true) && 
+        (CSLFetchNameValue(papszParmList, "LEVEL") == nullptr) )
+    {
+        pSrcEMU = dynamic_cast<EMUDataset*>(pSrcDs);
+    }
+
+    // now go through each level, and then each block for all the bands
     int nDoneBlocks = 0;
     for( int nOverviewLevel = nMaxOverview - 1; nOverviewLevel >= 0; nOverviewLevel--)
     {
-        // TODO: should we be doing the first tile here, for all bands, then second tile for all bands??
+        std::vector<GDALRasterBand*> srcBands, destBands;
         for( int nBand = 0; nBand < nBands; nBand++ )
         {
             GDALRasterBand *pSrcBand = pSrcDs->GetRasterBand(nBand + 1);
-            if( pSrcBand->GetOverviewCount() >= nOverviewLevel)
+            if( pSrcBand->GetOverviewCount() > nOverviewLevel )
             {
-                GDALRasterBand *pDestBand = pDS->GetRasterBand(nBand + 1);
-                GDALRasterBand *DestOv = pDestBand->GetOverview(nOverviewLevel);
-                GDALRasterBand *SrcOv = pSrcBand->GetOverview(nOverviewLevel);
-                if(! CopyBand(SrcOv, DestOv, nDoneBlocks, nTotalBlocks, pfnProgress, pProgressData) )
-                {
-                    delete pDS;
-                    return nullptr;
-                }
+                srcBands.push_back(pSrcBand->GetOverview(nOverviewLevel));
+                destBands.push_back(pDS->GetRasterBand(nBand + 1)->GetOverview(nOverviewLevel));
+            }
+        }
+        if( pDS->canCopyTilesRaw(pSrcEMU, nOverviewLevel + 1) )
+        {
+            if( !pDS->copyTilesRaw(pSrcEMU, nOverviewLevel + 1, nDoneBlocks, nTotalBlocks, 
+                        pfnProgress, pProgressData) )
+            {
+                delete pDS;
+                return nullptr;
             }
         }
+        else if( !srcBands.empty() && 
+            !CopyLevel(nullptr, srcBands, destBands, nDoneBlocks, nTotalBlocks, pfnProgress, pProgressData) )
+        {
+            delete pDS;
+            return nullptr;
+        }
     }
     
     // now just do the band data last
+    std::vector<GDALRasterBand*> srcBands, destBands;
     for( int nBand = 0; nBand < nBands; nBand++ )
     {
-        GDALRasterBand *pSrcBand = pSrcDs->GetRasterBand(nBand + 1);
-        EMURasterBand *pDestBand = cpl::down_cast<EMURasterBand*>(pDS->GetRasterBand(nBand + 1));
-        if(! CopyBand(pSrcBand, pDestBand, nDoneBlocks, nTotalBlocks, pfnProgress, pProgressData) )
+        srcBands.push_back(pSrcDs->GetRasterBand(nBand + 1));
+        destBands.push_back(pDS->GetRasterBand(nBand + 1));
+    }
+    if( pDS->canCopyTilesRaw(pSrcEMU, 0) )
+    {
+        if( !pDS->copyTilesRaw(pSrcEMU, 0, nDoneBlocks, nTotalBlocks, pfnProgress, pProgressData) )
         {
             delete pDS;
             return nullptr;
         }
+    }
+    else if( !CopyLevel(pSrcDs, srcBands, destBands, nDoneBlocks, nTotalBlocks, pfnProgress, pProgressData) )
+    {
+        delete pDS;
+        return nullptr;
+    }
+
+    for( int nBand = 0; nBand < nBands; nBand++ )
+    {
+        GDALRasterBand *pSrcBand = pSrcDs->GetRasterBand(nBand + 1);
+        EMURasterBand *pDestBand = cpl::down_cast<EMURasterBand*>(pDS->GetRasterBand(nBand + 1));
         
         // metadata
         char **ppsz = pSrcBand->GetMetadata();
@@ -957,6 +3080,23 @@ CPLErr EMUDataset::SetMetadataItem(const char *pszName, const char *pszValue,
 
 const char *EMUDataset::GetMetadataItem(const char *pszName, const char *pszDomain)
 {
+    if( ( pszDomain != nullptr ) && EQUAL(pszDomain, "EMU_CACHE") )
+    {
+        // only update the one asked for so earlier results stay valid
+        UpdateCacheMetadata(pszName);
+        return CSLFetchNameValue(m_papszCacheMetadata, pszName);
+    }
+    if( ( pszDomain != nullptr ) && EQUAL(pszDomain, "EMU_STATS") )
+    {
+        // as for EMU_CACHE
+        m_papszIOStatsMetadata = m_ioStats.getMetadata(m_papszIOStatsMetadata, pszName);
+        return CSLFetchNameValue(m_papszIOStatsMetadata, pszName);
+    }
+    if( ( pszDomain != nullptr ) && EQUAL(pszDomain, "IMAGE_STRUCTURE") )
+    {
+        UpdateImageStructureMetadata();
+        return CSLFetchNameValue(m_papszImageStructure, pszName);
+    }
     // only deal with 'default' domain - no geolocation etc
     if( ( pszDomain != nullptr ) && ( *pszDomain != '\0' ) )
         return nullptr;
@@ -967,6 +3107,21 @@ const char *EMUDataset::GetMetadataItem(const char *pszName, const char *pszDoma
 // get all the metadata as a CSLStringList - not thread safe
 char **EMUDataset::GetMetadata(const char *pszDomain)
 {
+    if( ( pszDomain != nullptr ) && EQUAL(pszDomain, "EMU_CACHE") )
+    {
+        UpdateCacheMetadata(nullptr);
+        return m_papszCacheMetadata;
+    }
+    if( ( pszDomain != nullptr ) && EQUAL(pszDomain, "EMU_STATS") )
+    {
+        m_papszIOStatsMetadata = m_ioStats.getMetadata(m_papszIOStatsMetadata, nullptr);
+        return m_papszIOStatsMetadata;
+    }
+    if( ( pszDomain != nullptr ) && EQUAL(pszDomain, "IMAGE_STRUCTURE") )
+    {
+        UpdateImageStructureMetadata();
+        return m_papszImageStructure;
+    }
     // only deal with 'default' domain - no geolocation etc
     if( ( pszDomain != nullptr ) && ( *pszDomain != '\0' ) )
         return nullptr;
@@ -975,6 +3130,106 @@ char **EMUDataset::GetMetadata(const char *pszDomain)
     return m_papszMetadataList; 
 }
 
+// refresh the counters for the tile cache (shared by all open files) in 
+// the EMU_CACHE domain. pszName is the item to update or nullptr for all.
+void EMUDataset::UpdateCacheMetadata(const char *pszName)
+{
+    EMUTileCache *pCache = EMUTileCache::getInstance();
+    if( pCache == nullptr )
+    {
+        return;
+    }
+    
+    if( (pszName == nullptr) || EQUAL(pszName, "HITS") )
+    {
+        m_papszCacheMetadata = CSLSetNameValue(m_papszCacheMetadata, "HITS", 
+            CPLSPrintf(CPL_FRMT_GUIB, static_cast<GUIntBig>(pCache->getHits())));
+    }
+    if( (pszName == nullptr) || EQUAL(pszName, "MISSES") )
+    {
+        m_papszCacheMetadata = CSLSetNameValue(m_papszCacheMetadata, "MISSES", 
+            CPLSPrintf(CPL_FRMT_GUIB, static_cast<GUIntBig>(pCache->getMisses())));
+    }
+    if( (pszName == nullptr) || EQUAL(pszName, "USED_BYTES") )
+    {
+        m_papszCacheMetadata = CSLSetNameValue(m_papszCacheMetadata, "USED_BYTES", 
+            CPLSPrintf(CPL_FRMT_GUIB, static_cast<GUIntBig>(pCache->getUsedBytes())));
+    }
+}
+
+// the IMAGE_STRUCTURE domain. Only needs creating once.
+void EMUDataset::UpdateImageStructureMetadata()
+{
+    if( m_papszImageStructure == nullptr )
+    {
+        m_papszImageStructure = CSLSetNameValue(m_papszImageStructure, "INTERLEAVE", 
+            m_bPixelInterleaved ? "PIXEL" : "BAND");
+        if( m_nTileStrips > 1 )
+        {
+            m_papszImageStructure = CSLSetNameValue(m_papszImageStructure, "TILE_STRIPS", 
+                CPLSPrintf("%u", m_nTileStrips));
+        }
+    }
+}
+
+// Reads of more than one band. Do the window in strips that fit in the 
+// block cache, prefetching all the bands for the strip first (see 
+// EMUBaseBand::prefetchBlocks()). For INTERLEAVE=PIXEL the tiles are 
+// only read and decompressed once for all the bands.
+CPLErr EMUDataset::IRasterIO( GDALRWFlag eRWFlag, int nXOff, int nYOff, int nXSize, int nYSize,
+                            void *pData, int nBufXSize, int nBufYSize, GDALDataType eBufType,
+                            int nBandCount, BANDMAP_TYPE panBandMap, GSpacing nPixelSpace, 
+                            GSpacing nLineSpace, GSpacing nBandSpace, 
+                            GDALRasterIOExtraArg *psExtraArg )
+{
+    int nBlockXSize = m_tileXSize;
+    int nBlockYSize = m_tileYSize;
+    if( (eRWFlag != GF_Read) || (eAccess == GA_Update) || (nBandCount < 1) ||
+        (nBufXSize != nXSize) || (nBufYSize != nYSize) || 
+        ((psExtraArg != nullptr) && psExtraArg->bFloatingPointWindowValidity) ||
+        ((nXOff / nBlockXSize == (nXOff + nXSize - 1) / nBlockXSize) && 
+            (nYOff / nBlockYSize == (nYOff + nYSize - 1) / nBlockYSize)) )
+    {
+        return GDALDataset::IRasterIO(eRWFlag, nXOff, nYOff, nXSize, nYSize, pData, 
+                    nBufXSize, nBufYSize, eBufType, nBandCount, panBandMap, 
+                    nPixelSpace, nLineSpace, nBandSpace, psExtraArg);
+    }
+    
+    std::vector<EMUBaseBand*> bands;
+    for( int n = 0; n < nBandCount; n++ )
+    {
+        bands.push_back(cpl::down_cast<EMUBaseBand*>(GetRasterBand(panBandMap[n])));
+    }
+    // with INTERLEAVE=PIXEL we get all of them anyway
+    int nBandsAtOnce = m_bPixelInterleaved ? GetRasterCount() : nBandCount;
+    int nStripBlocks = bands[0]->getPrefetchBlockRows(nXOff, nXSize, nBandsAtOnce);
+    
+    int nYEndBlock = (nYOff + nYSize - 1) / nBlockYSize;
+    for( int nYBlock = nYOff / nBlockYSize; nYBlock <= nYEndBlock; nYBlock += nStripBlocks )
+    {
+        int nStripStart = std::max(nYOff, nYBlock * nBlockYSize);
+        int nStripEnd = std::min<GIntBig>(nYOff + nYSize, 
+                            static_cast<GIntBig>(nYBlock + nStripBlocks) * nBlockYSize);
+        int nStripSize = nStripEnd - nStripStart;
+
+        // for INTERLEAVE=PIXEL only the first one does anything
+        for( EMUBaseBand *pBand : bands )
+        {
+            pBand->prefetchBlocks(nXOff, nStripStart, nXSize, nStripSize);
+        }
+
+        GByte *pStripData = static_cast<GByte*>(pData) + (nStripStart - nYOff) * nLineSpace;
+        CPLErr err = GDALDataset::IRasterIO(eRWFlag, nXOff, nStripStart, nXSize, nStripSize, 
+                    pStripData, nXSize, nStripSize, eBufType, nBandCount, panBandMap, 
+                    nPixelSpace, nLineSpace, nBandSpace, psExtraArg);
+        if( err != CE_None )
+        {
+            return err;
+        }
+    }
+    return CE_None;
+}
+
 // set the metadata as a CSLStringList
 CPLErr EMUDataset::SetMetadata(char **papszMetadata, const char *pszDomain)
 {
@@ -0,0 +1,536 @@
+/*
+ *  emudrill.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include <climits>
+#include <map>
+
+#include "emudrill.h"
+#include "emuband.h"
+#include "emuthreadpool.h"
+
+EMUDrillDataset::EMUDrillDataset(int nPoints, int nFiles, int nBandsIn, GDALDataType eType)
+{
+    nRasterXSize = nPoints;
+    nRasterYSize = nFiles;
+    eAccess = GA_ReadOnly;
+    m_eType = eType;
+    m_nTypeSize = GDALGetDataTypeSize(eType) / 8;
+    m_data.resize(static_cast<size_t>(nPoints) * nFiles * nBandsIn * m_nTypeSize);
+}
+
+EMUDrillDataset::~EMUDrillDataset()
+{
+    CSLDestroy(m_papszMetadataList);
+    CSLDestroy(m_papszIOStatsMetadata);
+}
+
+int EMUDrillDataset::Identify(GDALOpenInfo *poOpenInfo)
+{
+    return STARTS_WITH_CI(poOpenInfo->pszFilename, EMU_DRILL_PREFIX);
+}
+
+// x and y pairs separated by commas or spaces. Returns false if not valid.
+static bool ReadPoints(const char *pszPoints, std::vector<double> &points)
+{
+    char **papszTokens = CSLTokenizeString2(pszPoints, ", \t", 0);
+    int nTokens = CSLCount(papszTokens);
+    for( int n = 0; n < nTokens; n++ )
+    {
+        points.push_back(CPLAtof(papszTokens[n]));
+    }
+    CSLDestroy(papszTokens);
+    return (nTokens % 2) == 0;
+}
+
+// nullptr (without an error) if it isn't an EMU file
+static EMUDataset *OpenEMUFile(const char *pszFilename)
+{
+    if( STARTS_WITH_CI(pszFilename, EMU_DRILL_PREFIX) )
+    {
+        return nullptr;
+    }
+    GDALOpenInfo oOpenInfo(pszFilename, GDAL_OF_RASTER | GDAL_OF_READONLY);
+    GDALDataset *pDS = EMUDataset::Open(&oOpenInfo);
+    return (pDS == nullptr) ? nullptr : cpl::down_cast<EMUDataset*>(pDS);
+}
+
+GDALDataset *EMUDrillDataset::Open(GDALOpenInfo *poOpenInfo)
+{
+    if( !Identify(poOpenInfo) )
+        return nullptr;
+
+    if( poOpenInfo->eAccess == GA_Update )
+    {
+        CPLError(CE_Failure, CPLE_NotSupported, "EMU_DRILL datasets are read only");
+        return nullptr;
+    }
+
+    // one EMU file per line. Blank lines and ones starting with # are ignored.
+    const char *pszList = poOpenInfo->pszFilename + strlen(EMU_DRILL_PREFIX);
+    char **papszLines = CSLLoad(pszList);
+    std::vector<CPLString> files;
+    for( char **ppszLine = papszLines; (ppszLine != nullptr) && (*ppszLine != nullptr); ppszLine++ )
+    {
+        CPLString osLine(*ppszLine);
+        osLine.Trim();
+        if( !osLine.empty() && (osLine[0] != '#') )
+        {
+            files.push_back(osLine);
+        }
+    }
+    CSLDestroy(papszLines);
+    if( files.empty() )
+    {
+        CPLError(CE_Failure, CPLE_OpenFailed, "No files listed in %s", pszList);
+        return nullptr;
+    }
+
+    // POINTS and/or POINTS_FILE (a pair on each line)
+    std::vector<double> points;
+    const char *pszPoints = CSLFetchNameValue(poOpenInfo->papszOpenOptions, "POINTS");
+    if( (pszPoints != nullptr) && !ReadPoints(pszPoints, points) )
+    {
+        CPLError(CE_Failure, CPLE_IllegalArg, "POINTS must be pairs of x and y");
+        return nullptr;
+    }
+    const char *pszPointsFile = CSLFetchNameValue(poOpenInfo->papszOpenOptions, "POINTS_FILE");
+    if( pszPointsFile != nullptr )
+    {
+        papszLines = CSLLoad(pszPointsFile);
+        if( papszLines == nullptr )
+        {
+            return nullptr;
+        }
+        bool bOK = true;
+        for( char **ppszLine = papszLines; (*ppszLine != nullptr) && bOK; ppszLine++ )
+        {
+            if( (*ppszLine)[0] != '#' )
+            {
+                bOK = ReadPoints(*ppszLine, points);
+            }
+        }
+        CSLDestroy(papszLines);
+        if( !bOK )
+        {
+            CPLError(CE_Failure, CPLE_IllegalArg, 
+                "Each line of %s must be an x and y", pszPointsFile);
+            return nullptr;
+        }
+    }
+    if( points.empty() || (points.size() / 2 > INT_MAX) || (files.size() > INT_MAX) )
+    {
+        CPLError(CE_Failure, CPLE_IllegalArg, "EMU_DRILL needs POINTS or POINTS_FILE");
+        return nullptr;
+    }
+    const char *pszCoords = CSLFetchNameValueDef(poOpenInfo->papszOpenOptions, "COORDS", "GEO");
+    if( !EQUAL(pszCoords, "GEO") && !EQUAL(pszCoords, "PIXEL") )
+    {
+        CPLError(CE_Failure, CPLE_NotSupported, 
+            "COORDS=%s is not supported. Must be GEO or PIXEL", pszCoords);
+        return nullptr;
+    }
+
+    // the first file decides the bands and type of the result
+    EMUDataset *pFirstDS = OpenEMUFile(files[0]);
+    if( (pFirstDS == nullptr) || (pFirstDS->GetRasterCount() < 1) )
+    {
+        CPLError(CE_Failure, CPLE_OpenFailed, "Couldn't open %s", files[0].c_str());
+        delete pFirstDS;
+        return nullptr;
+    }
+    int nPoints = points.size() / 2;
+    int nFiles = files.size();
+    EMUDrillDataset *pDS = new EMUDrillDataset(nPoints, nFiles, pFirstDS->GetRasterCount(), 
+                    pFirstDS->GetRasterBand(1)->GetRasterDataType());
+    pDS->m_points = std::move(points);
+    pDS->m_bPixelCoords = EQUAL(pszCoords, "PIXEL");
+    for( int n = 0; n < pFirstDS->GetRasterCount(); n++ )
+    {
+        int nNoDataSet = FALSE;
+        double dNoData = pFirstDS->GetRasterBand(n + 1)->GetNoDataValue(&nNoDataSet);
+        if( !nNoDataSet )
+        {
+            dNoData = 0;
+        }
+        pDS->SetBand(n + 1, new EMUDrillBand(pDS, n + 1, dNoData, nNoDataSet));
+        GDALCopyWords64(&dNoData, GDT_Float64, 0, pDS->getValue(n, 0, 0), pDS->m_eType, 
+                pDS->m_nTypeSize, static_cast<GSpacing>(nFiles) * nPoints);
+    }
+    for( int n = 0; n < nFiles; n++ )
+    {
+        pDS->m_papszMetadataList = CSLSetNameValue(pDS->m_papszMetadataList, 
+                    CPLSPrintf("FILE_%d", n), files[n].c_str());
+    }
+
+    int nThreads = std::min(EMUDataset::GetNumThreads(poOpenInfo->papszOpenOptions), nFiles);
+    if( nThreads > 1 )
+    {
+        // most of the time is waiting for the opens and reads so do 
+        // a file on each thread
+        EMUThreadPool pool(nThreads);
+        pool.submit([pDS, pFirstDS, &files]() { pDS->drillFile(0, files[0], pFirstDS); });
+        for( int n = 1; n < nFiles; n++ )
+        {
+            pool.submit([pDS, n, &files]() { pDS->drillFile(n, files[n], OpenEMUFile(files[n])); });
+        }
+        pool.waitCompletion();
+    }
+    else
+    {
+        pDS->drillFile(0, files[0], pFirstDS);
+        for( int n = 1; n < nFiles; n++ )
+        {
+            pDS->drillFile(n, files[n], OpenEMUFile(files[n]));
+        }
+    }
+    return pDS;
+}
+
+// the points as pixel coordinates of pSrcDS
+bool EMUDrillDataset::getPixelCoords(EMUDataset *pSrcDS, std::vector<double> &pixelCoords)
+{
+    if( m_bPixelCoords )
+    {
+        pixelCoords = m_points;
+        return true;
+    }
+    double adfTransform[6], adfInvTransform[6];
+    if( (pSrcDS->GetGeoTransform(adfTransform) != CE_None) || 
+        !GDALInvGeoTransform(adfTransform, adfInvTransform) )
+    {
+        return false;
+    }
+    pixelCoords.resize(m_points.size());
+    for( size_t n = 0; n < m_points.size(); n += 2 )
+    {
+        double dX = m_points[n], dY = m_points[n + 1];
+        pixelCoords[n] = adfInvTransform[0] + dX * adfInvTransform[1] + dY * adfInvTransform[2];
+        pixelCoords[n + 1] = adfInvTransform[3] + dX * adfInvTransform[4] + dY * adfInvTransform[5];
+    }
+    return true;
+}
+
+// Safe to call from any thread (each does a different row).
+void EMUDrillDataset::drillFile(int nFile, const CPLString &osFilename, EMUDataset *pSrcDS)
+{
+    if( pSrcDS == nullptr )
+    {
+        CPLError(CE_Warning, CPLE_OpenFailed, 
+            "Couldn't open %s. Its values are left as nodata.", osFilename.c_str());
+        return;
+    }
+    std::vector<double> pixelCoords;
+    if( !getPixelCoords(pSrcDS, pixelCoords) )
+    {
+        CPLError(CE_Warning, CPLE_AppDefined, 
+            "%s has no geotransform. Its values are left as nodata.", osFilename.c_str());
+        delete pSrcDS;
+        return;
+    }
+
+    // which tiles hold the points
+    GDALRasterBand *pSrcBand = pSrcDS->GetRasterBand(1);
+    GDALDataType eSrcType = pSrcBand->GetRasterDataType();
+    int nSrcTypeSize = GDALGetDataTypeSize(eSrcType) / 8;
+    int nSrcBands = std::min(pSrcDS->GetRasterCount(), GetRasterCount());
+    int nTileBands = pSrcDS->m_bPixelInterleaved ? pSrcDS->GetRasterCount() : 1;
+    int nKeyBands = pSrcDS->m_bPixelInterleaved ? 1 : nSrcBands;
+    int nBlockXSize, nBlockYSize;
+    pSrcBand->GetBlockSize(&nBlockXSize, &nBlockYSize);
+    uint64_t nXBlocks = (pSrcDS->GetRasterXSize() + nBlockXSize - 1) / nBlockXSize;
+    uint64_t nYBlocks = (pSrcDS->GetRasterYSize() + nBlockYSize - 1) / nBlockYSize;
+    std::map<uint64_t, size_t> tileIndex; // by band then block number
+    std::vector<EMUDrillTile> tiles;
+    for( int nPoint = 0; nPoint < nRasterXSize; nPoint++ )
+    {
+        double dX = pixelCoords[nPoint * 2], dY = pixelCoords[nPoint * 2 + 1];
+        // careful of NaN
+        if( !(dX >= 0) || !(dY >= 0) || (dX >= pSrcDS->GetRasterXSize()) || 
+            (dY >= pSrcDS->GetRasterYSize()) )
+        {
+            continue;
+        }
+        int nCol = static_cast<int>(dX);
+        int nRow = static_cast<int>(dY);
+        int x = nCol / nBlockXSize;
+        int y = nRow / nBlockYSize;
+        for( int nKeyBand = 1; nKeyBand <= nKeyBands; nKeyBand++ )
+        {
+            uint64_t nKey = ((nKeyBand - 1) * nYBlocks + y) * nXBlocks + x;
+            auto itr = tileIndex.find(nKey);
+            if( itr == tileIndex.end() )
+            {
+                EMUDrillTile tile;
+                tile.keyBand = nKeyBand;
+                tile.x = x;
+                tile.y = y;
+                tile.pTileData = nullptr;
+                try
+                {
+                    tile.val = pSrcDS->getTileOffset(0, nKeyBand, x, y);
+                }
+                catch(const std::out_of_range& oor)
+                {
+                    continue;
+                }
+                if( pSrcBand->GetActualBlockSize(x, y, &tile.nXValid, &tile.nYValid) != CE_None )
+                {
+                    continue;
+                }
+                itr = tileIndex.emplace(nKey, tiles.size()).first;
+                tiles.push_back(std::move(tile));
+            }
+            EMUDrillPixel pixel;
+            pixel.nPoint = nPoint;
+            pixel.nCol = nCol - x * nBlockXSize;
+            pixel.nRow = nRow - y * nBlockYSize;
+            tiles[itr->second].pixels.push_back(pixel);
+        }
+    }
+
+    // copy the pixels of a decompressed tile, or if bConstant pData is 
+    // just the value for each band in the tile
+    int nBandsInTile = pSrcDS->m_bPixelInterleaved ? nSrcBands : 1;
+    auto extract = [&](const EMUDrillTile &tile, const GByte *pData, bool bConstant)
+    {
+        for( const EMUDrillPixel &pixel : tile.pixels )
+        {
+            for( int n = 0; n < nBandsInTile; n++ )
+            {
+                int nBand = pSrcDS->m_bPixelInterleaved ? n : (tile.keyBand - 1);
+                const GByte *pSrc = pData + n * nSrcTypeSize;
+                if( !bConstant )
+                {
+                    pSrc = pData + ((static_cast<size_t>(n) * tile.nYValid + pixel.nRow) * 
+                                tile.nXValid + pixel.nCol) * nSrcTypeSize;
+                }
+                GDALCopyWords(pSrc, eSrcType, 0, getValue(nBand, nFile, pixel.nPoint), m_eType, 0, 1);
+            }
+        }
+    };
+
+    // constant and empty tiles need no reading
+    std::vector<EMUDrillTile*> toRead;
+    for( auto &tile : tiles )
+    {
+        if( (tile.val.offset == 0) || (tile.val.offset == EMU_TILE_CONSTANT) )
+        {
+            // as EMUBaseBand::fillBlock()
+            std::vector<GByte> values(nBandsInTile * nSrcTypeSize, 0);
+            for( int n = 0; n < nBandsInTile; n++ )
+            {
+                GByte *pValue = &values[n * nSrcTypeSize];
+                if( tile.val.offset == EMU_TILE_CONSTANT )
+                {
+                    memcpy(pValue, &tile.val.uncompressedSize, std::min(nSrcTypeSize, 
+                            static_cast<int>(sizeof(uint64_t))));
+                    continue;
+                }
+                int nBand = pSrcDS->m_bPixelInterleaved ? (n + 1) : tile.keyBand;
+                int nNoDataSet = FALSE;
+                int64_t nNoData = pSrcDS->GetRasterBand(nBand)->GetNoDataValueAsInt64(&nNoDataSet);
+                if( nNoDataSet )
+                {
+                    GDALCopyWords(&nNoData, GDT_Int64, 0, pValue, eSrcType, 0, 1);
+                }
+            }
+            extract(tile, values.data(), true);
+            pSrcDS->m_ioStats.add(EMU_IO_TILES_FILLED, 1);
+        }
+        else if( (tile.pTileData = pSrcDS->getMappedData(tile.val.offset, tile.val.size + 1)) != nullptr )
+        {
+            pSrcDS->m_ioStats.add(EMU_IO_BYTES_READ, tile.val.size + 1);
+        }
+        else
+        {
+            toRead.push_back(&tile);
+        }
+    }
+
+    // the rest in one request, merging tiles that are close together 
+    // (as EMUBaseBand::prefetchBlocks())
+    std::sort(toRead.begin(), toRead.end(), 
+        [](const EMUDrillTile *a, const EMUDrillTile *b) { return a->val.offset < b->val.offset; });
+    std::vector<vsi_l_offset> rangeStarts;
+    std::vector<size_t> rangeSizes;
+    std::vector<size_t> tileRanges; // index into rangeStarts for each of toRead
+    for( const EMUDrillTile *pTile : toRead )
+    {
+        vsi_l_offset start = pTile->val.offset;
+        vsi_l_offset end = start + pTile->val.size + 1; // include compression byte
+        if( !rangeStarts.empty() && (start >= rangeStarts.back() + rangeSizes.back()) && 
+            (start - (rangeStarts.back() + rangeSizes.back()) <= PREFETCH_MAX_GAP) &&
+            (end - rangeStarts.back() <= PREFETCH_MAX_RANGE) )
+        {
+            rangeSizes.back() = end - rangeStarts.back();
+        }
+        else
+        {
+            rangeStarts.push_back(start);
+            rangeSizes.push_back(end - start);
+        }
+        tileRanges.push_back(rangeStarts.size() - 1);
+    }
+
+    std::vector<GByte> rangeData;
+    bool bOK = true;
+    if( !toRead.empty() )
+    {
+        size_t nTotal = 0;
+        for( size_t nSize : rangeSizes )
+        {
+            nTotal += nSize;
+        }
+        rangeData.resize(nTotal);
+        std::vector<void*> rangeBufs(rangeStarts.size());
+        nTotal = 0;
+        for( size_t i = 0; i < rangeStarts.size(); i++ )
+        {
+            rangeBufs[i] = &rangeData[nTotal];
+            nTotal += rangeSizes[i];
+        }
+
+        VSILFILE *fp = pSrcDS->acquireReadHandle();
+        bOK = (fp != nullptr) && (VSIFReadMultiRangeL(rangeStarts.size(), rangeBufs.data(), 
+                        rangeStarts.data(), rangeSizes.data(), fp) == 0);
+        if( fp != nullptr )
+        {
+            pSrcDS->releaseReadHandle(fp);
+        }
+        pSrcDS->m_ioStats.add(EMU_IO_READ_CALLS, 1);
+        pSrcDS->m_ioStats.add(EMU_IO_BYTES_READ, nTotal);
+        if( bOK )
+        {
+            for( size_t i = 0; i < toRead.size(); i++ )
+            {
+                size_t nRange = tileRanges[i];
+                toRead[i]->pTileData = static_cast<GByte*>(rangeBufs[nRange]) + 
+                                        (toRead[i]->val.offset - rangeStarts[nRange]);
+            }
+        }
+        else
+        {
+            CPLError(CE_Warning, CPLE_FileIO, 
+                "Failed to read the tiles of %s. Its values are left as nodata.", osFilename.c_str());
+        }
+    }
+
+    for( const auto &tile : tiles )
+    {
+        if( tile.pTileData == nullptr )
+        {
+            continue;
+        }
+        size_t nTileSize = static_cast<size_t>(tile.nXValid) * tile.nYValid * nSrcTypeSize * nTileBands;
+        if( tile.val.uncompressedSize != nTileSize )
+        {
+            CPLError(CE_Warning, CPLE_FileIO, "Unexpected size for block %d %d of %s.",
+                    tile.x, tile.y, osFilename.c_str());
+            continue;
+        }
+        Bytef *pUncompressed = getScratchBuffer(SCRATCH_PARTIAL, nTileSize);
+        bool bDecompressed;
+        {
+            EMUIOTimer timer(pSrcDS->m_ioStats, EMU_IO_DECOMPRESS_NS);
+            bDecompressed = doTileUncompression(tile.pTileData[0], nSrcTypeSize, tile.nXValid, 
+                        tile.nYValid * nTileBands, tile.pTileData + 1, tile.val.size, 
+                        pUncompressed, nTileSize);
+        }
+        if( !bDecompressed )
+        {
+            continue;
+        }
+        pSrcDS->m_ioStats.add(EMU_IO_TILES_READ, 1);
+        extract(tile, pUncompressed, false);
+    }
+
+    pSrcDS->Close();
+    for( int n = 0; n < EMU_IO_COUNTER_COUNT; n++ )
+    {
+        EMUIOCounter eCounter = static_cast<EMUIOCounter>(n);
+        m_ioStats.add(eCounter, pSrcDS->m_ioStats.get(eCounter));
+    }
+    delete pSrcDS;
+}
+
+const char *EMUDrillDataset::GetMetadataItem(const char *pszName, const char *pszDomain)
+{
+    if( ( pszDomain != nullptr ) && EQUAL(pszDomain, "EMU_STATS") )
+    {
+        m_papszIOStatsMetadata = m_ioStats.getMetadata(m_papszIOStatsMetadata, pszName);
+        return CSLFetchNameValue(m_papszIOStatsMetadata, pszName);
+    }
+    if( ( pszDomain != nullptr ) && ( *pszDomain != '\0' ) )
+        return nullptr;
+    return CSLFetchNameValue(m_papszMetadataList, pszName);
+}
+
+char **EMUDrillDataset::GetMetadata(const char *pszDomain)
+{
+    if( ( pszDomain != nullptr ) && EQUAL(pszDomain, "EMU_STATS") )
+    {
+        m_papszIOStatsMetadata = m_ioStats.getMetadata(m_papszIOStatsMetadata, nullptr);
+        return m_papszIOStatsMetadata;
+    }
+    if( ( pszDomain != nullptr ) && ( *pszDomain != '\0' ) )
+        return nullptr;
+    return m_papszMetadataList;
+}
+
+EMUDrillBand::EMUDrillBand(EMUDrillDataset *pDS, int nBandIn, double dNoData, bool bNoDataSet)
+    : m_dNoData(dNoData), m_bNoDataSet(bNoDataSet)
+{
+    poDS = pDS;
+    nBand = nBandIn;
+    eDataType = pDS->m_eType;
+    eAccess = GA_ReadOnly;
+    nRasterXSize = pDS->GetRasterXSize();
+    nRasterYSize = pDS->GetRasterYSize();
+    nBlockXSize = nRasterXSize;
+    nBlockYSize = 1;
+}
+
+CPLErr EMUDrillBand::IReadBlock(int, int nBlockYOff, void *pData)
+{
+    EMUDrillDataset *pDS = cpl::down_cast<EMUDrillDataset*>(poDS);
+    memcpy(pData, pDS->getValue(nBand - 1, nBlockYOff, 0), 
+            static_cast<size_t>(nBlockXSize) * pDS->m_nTypeSize);
+    return CE_None;
+}
+
+double EMUDrillBand::GetNoDataValue(int *pbSuccess)
+{
+    if( pbSuccess != nullptr )
+    {
+        *pbSuccess = m_bNoDataSet;
+    }
+    return m_dNoData;
+}
@@ -56,6 +56,73 @@ void GDALRegister_EMU()
     poDriver->SetMetadataItem(GDAL_DCAP_CREATECOPY, "YES");
     poDriver->SetMetadataItem(GDAL_DMD_CREATIONDATATYPES, 
             "Byte Int8 Int16 UInt16 Int32 UInt32 Int64 UInt64 Float32 Float64");
+    // only list the compression methods this build supports
+    CPLString osCompressValues;
+    for( const EMUCodec *pCodec : getAvailableCodecs() )
+    {
+        osCompressValues += CPLSPrintf("       <Value>%s</Value>", pCodec->pszName);
+    }
+    CPLString osOptions;
+    osOptions.Printf(
+"<CreationOptionList>"
+"   <Option name='NUM_THREADS' type='string' description='Number of worker "
+"threads for compression. Can be set to ALL_CPUS' default='1'/>"
+"   <Option name='COMPRESS' type='string-select' default='ZLIB'>"
+"%s"
+"   </Option>"
+"   <Option name='LEVEL' type='int' description='Compression level. "
+"Meaning and range depends on COMPRESS'/>"
+"   <Option name='FILTER' type='string-select' description='Filter applied "
+"to tiles before compression' default='NONE'>"
+"       <Value>NONE</Value>"
+"       <Value>PREDICTOR</Value>"
+"       <Value>FPREDICTOR</Value>"
+"       <Value>SHUFFLE</Value>"
+"       <Value>BITSHUFFLE</Value>"
+"   </Option>"
+"   <Option name='BLOCKXSIZE' type='int' description='Tile width' default='512'/>"
+"   <Option name='BLOCKYSIZE' type='int' description='Tile height. "
+"Defaults to BLOCKXSIZE'/>"
+"   <Option name='TILE_STRIPS' type='int' description='Split each tile "
+"into this many strips of rows so small windows only decompress the rows "
+"they need' default='1'/>"
+"   <Option name='INTERLEAVE' type='string-select' description='PIXEL stores "
+"all the bands of a block in one tile' default='BAND'>"
+"       <Value>BAND</Value>"
+"       <Value>PIXEL</Value>"
+"   </Option>"
+"   <Option name='OVERVIEWS' type='string' description='Comma separated "
+"list of overview factors to generate as the data is written, or AUTO'/>"
+"   <Option name='OVERVIEW_RESAMPLING' type='string-select' description='"
+"Resampling for generated overviews' default='AVERAGE'>"
+"       <Value>NEAREST</Value>"
+"       <Value>AVERAGE</Value>"
+"       <Value>MODE</Value>"
+"   </Option>"
+"   <Option name='HEADER_FIRST' type='boolean' description='CreateCopy only. "
+"Write the header and tile index at the start of the file' default='NO'/>"
+"   <Option name='RAW_COPY' type='boolean' description='CreateCopy only. "
+"Copy the compressed tiles of an EMU source as they are when the layout and "
+"compression match' default='YES'/>"
+"   <Option name='STATISTICS' type='boolean' description='Calculate "
+"statistics and a histogram as the data is written' default='YES'/>"
+"</CreationOptionList>", osCompressValues.c_str());
+    poDriver->SetMetadataItem(GDAL_DMD_CREATIONOPTIONLIST, osOptions);
+    // for EMU_DRILL:<file list>
+    poDriver->SetMetadataItem(GDAL_DMD_OPENOPTIONLIST, 
+"<OpenOptionList>"
+"   <Option name='POINTS' type='string' description='EMU_DRILL only. "
+"x,y pairs of the points to get the values of'/>"
+"   <Option name='POINTS_FILE' type='string' description='EMU_DRILL only. "
+"File with an x and y on each line'/>"
+"   <Option name='COORDS' type='string-select' description='EMU_DRILL only. "
+"Whether the points are georeferenced or pixel coordinates' default='GEO'>"
+"       <Value>GEO</Value>"
+"       <Value>PIXEL</Value>"
+"   </Option>"
+"   <Option name='NUM_THREADS' type='string' description='EMU_DRILL only. "
+"Number of files to do at once (or ALL_CPUS). Defaults to GDAL_NUM_THREADS'/>"
+"</OpenOptionList>");
 
     poDriver->pfnOpen = EMUDataset::Open;
     poDriver->pfnIdentify = EMUDataset::Identify;
@@ -0,0 +1,179 @@
+/*
+ *  emuheadercache.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <atomic>
+#include <cinttypes>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "cpl_conv.h"
+#include "cpl_multiproc.h"
+#include "cpl_string.h"
+
+#include "emuheadercache.h"
+
+const char CACHE_SIGNATURE[8] = {'E', 'M', 'U', 'I', 'D', 'X', '0', '1'};
+// makes the temporary names unique within this process
+static std::atomic<unsigned int> s_nTempFiles(0);
+// these return the HTTP headers (with the ETag) as the HEADERS metadata
+static const char *const ETAG_PREFIXES[] = {"/vsis3/", "/vsigs/", "/vsiaz/", "/vsicurl/"};
+
+std::string getFileValidator(const char *pszFilename)
+{
+    for( const char *pszPrefix : ETAG_PREFIXES )
+    {
+        if( STARTS_WITH(pszFilename, pszPrefix) )
+        {
+            char **papszHeaders = VSIGetFileMetadata(pszFilename, "HEADERS", nullptr);
+            const char *pszETag = CSLFetchNameValue(papszHeaders, "ETag");
+            std::string osValidator;
+            if( (pszETag != nullptr) && (*pszETag != '\0') )
+            {
+                osValidator = std::string("etag:") + pszETag;
+            }
+            CSLDestroy(papszHeaders);
+            return osValidator;
+        }
+    }
+
+    VSIStatBufL sStat;
+    if( VSIStatL(pszFilename, &sStat) != 0 )
+    {
+        return "";
+    }
+    return CPLSPrintf("mtime:" CPL_FRMT_GIB, static_cast<GIntBig>(sStat.st_mtime));
+}
+
+EMUHeaderCache *EMUHeaderCache::getInstance()
+{
+    static std::unique_ptr<EMUHeaderCache> pInstance;
+    static std::once_flag created;
+    std::call_once(created, []() {
+        const char *pszDir = CPLGetConfigOption("EMU_HEADER_CACHE_DIR", nullptr);
+        if( (pszDir != nullptr) && (*pszDir != '\0') )
+        {
+            pInstance.reset(new EMUHeaderCache(pszDir));
+        }
+    });
+    return pInstance.get();
+}
+
+EMUHeaderCache::EMUHeaderCache(const char *pszDir)
+{
+    m_osDir = pszDir;
+}
+
+static std::string getKey(const char *pszFilename, vsi_l_offset nFileSize, 
+                const std::string &osValidator, vsi_l_offset nHeaderOffset)
+{
+    return CPLSPrintf("%s\n" CPL_FRMT_GUIB "\n%s\n" CPL_FRMT_GUIB, pszFilename, 
+                static_cast<GUIntBig>(nFileSize), osValidator.c_str(), 
+                static_cast<GUIntBig>(nHeaderOffset));
+}
+
+// the full key is stored in the file (and checked) in case of hash collisions
+std::string EMUHeaderCache::getPath(const std::string &osKey) const
+{
+    uint64_t nHash = std::hash<std::string>{}(osKey);
+    return CPLFormFilename(m_osDir.c_str(), CPLSPrintf("%016" PRIx64, nHash), "emuidx");
+}
+
+// The file is the signature, the length of the key, the key, the offsets in
+// EMUIndexCopy and then the data.
+bool EMUHeaderCache::get(const char *pszFilename, vsi_l_offset nFileSize, const std::string &osValidator, 
+                vsi_l_offset nHeaderOffset, vsi_l_offset nHeaderEnd, EMUIndexCopy *pCopy)
+{
+    std::string osKey = getKey(pszFilename, nFileSize, osValidator, nHeaderOffset);
+    std::string osPath = getPath(osKey);
+    VSILFILE *fp = VSIFOpenL(osPath.c_str(), "rb");
+    if( fp == nullptr )
+    {
+        return false;
+    }
+
+    char signature[sizeof(CACHE_SIGNATURE)];
+    uint64_t nKeySize = 0;
+    bool bOK = (VSIFReadL(signature, sizeof(signature), 1, fp) == 1) && 
+        (memcmp(signature, CACHE_SIGNATURE, sizeof(signature)) == 0) &&
+        (VSIFReadL(&nKeySize, sizeof(nKeySize), 1, fp) == 1) && (nKeySize == osKey.size());
+    std::string osFileKey(osKey.size(), '\0');
+    uint64_t offsets[3] = {0, 0, 0};
+    bOK = bOK && (VSIFReadL(&osFileKey[0], osFileKey.size(), 1, fp) == 1) && (osFileKey == osKey) &&
+        (VSIFReadL(offsets, sizeof(offsets), 1, fp) == 1) && 
+        (offsets[0] <= offsets[1]) && (offsets[1] < offsets[2]) && (offsets[1] == nHeaderOffset) && 
+        (offsets[2] == nHeaderEnd) && (offsets[2] <= nFileSize);
+    if( bOK )
+    {
+        pCopy->nStart = offsets[0];
+        pCopy->nHeaderOffset = offsets[1];
+        pCopy->nHeaderEnd = offsets[2];
+        pCopy->data.resize(pCopy->nHeaderEnd - pCopy->nStart);
+        bOK = (VSIFReadL(pCopy->data.data(), pCopy->data.size(), 1, fp) == 1);
+    }
+    VSIFCloseL(fp);
+    if( !bOK )
+    {
+        CPLDebug("EMU", "Ignoring invalid header cache file %s", osPath.c_str());
+        pCopy->data.clear();
+    }
+    return bOK;
+}
+
+void EMUHeaderCache::put(const char *pszFilename, vsi_l_offset nFileSize, const std::string &osValidator, 
+                const EMUIndexCopy &copy)
+{
+    std::string osKey = getKey(pszFilename, nFileSize, osValidator, copy.nHeaderOffset);
+    std::string osPath = getPath(osKey);
+    // written under another name and renamed so other processes 
+    // never see part of a file. CPLGetPID() is the thread, which 
+    // can be the same in different processes.
+    std::string osTempPath = osPath + CPLSPrintf(".%d." CPL_FRMT_GIB ".%u.tmp", 
+                CPLGetCurrentProcessID(), CPLGetPID(), s_nTempFiles++);
+    VSILFILE *fp = VSIFOpenL(osTempPath.c_str(), "wb");
+    if( fp == nullptr )
+    {
+        CPLDebug("EMU", "Couldn't create header cache file %s", osTempPath.c_str());
+        return;
+    }
+    uint64_t nKeySize = osKey.size();
+    uint64_t offsets[3] = {copy.nStart, copy.nHeaderOffset, copy.nHeaderEnd};
+    bool bOK = (VSIFWriteL(CACHE_SIGNATURE, sizeof(CACHE_SIGNATURE), 1, fp) == 1) &&
+        (VSIFWriteL(&nKeySize, sizeof(nKeySize), 1, fp) == 1) &&
+        (VSIFWriteL(osKey.c_str(), osKey.size(), 1, fp) == 1) &&
+        (VSIFWriteL(offsets, sizeof(offsets), 1, fp) == 1) &&
+        (VSIFWriteL(copy.data.data(), copy.data.size(), 1, fp) == 1);
+    bOK = (VSIFCloseL(fp) == 0) && bOK;
+    if( !bOK || (VSIRename(osTempPath.c_str(), osPath.c_str()) != 0) )
+    {
+        CPLDebug("EMU", "Couldn't write header cache file %s", osPath.c_str());
+        VSIUnlink(osTempPath.c_str());
+    }
+}
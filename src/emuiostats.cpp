@@ -0,0 +1,146 @@
+/*
+ *  emuiostats.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "emuiostats.h"
+
+static const char * const COUNTER_NAMES[EMU_IO_COUNTER_COUNT] = {
+    "BYTES_READ",
+    "READ_CALLS",
+    "BYTES_WRITTEN",
+    "WRITE_CALLS",
+    "TILES_READ",
+    "TILES_FILLED",
+    "TILES_WRITTEN",
+    "CONSTANT_TILES_WRITTEN",
+    "COMPRESS_NS",
+    "DECOMPRESS_NS",
+    "MUTEX_WAIT_NS",
+    "WRITER_WAIT_NS",
+    "CACHE_HITS",
+    "CACHE_MISSES",
+    "READAHEAD_TILES",
+    "READAHEAD_HITS",
+    "READAHEAD_WAIT_NS",
+    "STRIPS_READ",
+    "TILES_COPIED",
+    "TILES_CONVERTED",
+    "RAT_READ_NS",
+    "RAT_WRITE_NS",
+    "OPEN_NS",
+    "CLOSE_NS"
+};
+
+EMUIOStats::EMUIOStats()
+{
+    for( auto &counter : m_counters )
+    {
+        counter.store(0);
+    }
+    for( auto &bucket : m_sizeBuckets )
+    {
+        bucket.store(0);
+    }
+}
+
+void EMUIOStats::addCompressedSize(uint64_t nSize)
+{
+    int nBucket = 0;
+    while( (nSize > 0) && (nBucket < EMU_IO_SIZE_BUCKETS - 1) )
+    {
+        nSize >>= 1;
+        nBucket++;
+    }
+    m_sizeBuckets[nBucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+const char *EMUIOStats::getName(EMUIOCounter eCounter)
+{
+    return COUNTER_NAMES[eCounter];
+}
+
+std::string EMUIOStats::getHistogram(const char *pszSeparator) const
+{
+    int nLast = EMU_IO_SIZE_BUCKETS - 1;
+    while( (nLast > 0) && (m_sizeBuckets[nLast].load(std::memory_order_relaxed) == 0) )
+    {
+        nLast--;
+    }
+    std::string osHistogram;
+    for( int n = 0; n <= nLast; n++ )
+    {
+        if( n > 0 )
+        {
+            osHistogram += pszSeparator;
+        }
+        osHistogram += CPLSPrintf(CPL_FRMT_GUIB, 
+                static_cast<GUIntBig>(m_sizeBuckets[n].load(std::memory_order_relaxed)));
+    }
+    return osHistogram;
+}
+
+char **EMUIOStats::getMetadata(char **papszMetadata, const char *pszName) const
+{
+    for( int n = 0; n < EMU_IO_COUNTER_COUNT; n++ )
+    {
+        if( (pszName == nullptr) || EQUAL(pszName, COUNTER_NAMES[n]) )
+        {
+            papszMetadata = CSLSetNameValue(papszMetadata, COUNTER_NAMES[n], 
+                CPLSPrintf(CPL_FRMT_GUIB, static_cast<GUIntBig>(get(static_cast<EMUIOCounter>(n)))));
+        }
+    }
+    if( (pszName == nullptr) || EQUAL(pszName, "COMPRESSED_SIZE_HISTOGRAM") )
+    {
+        papszMetadata = CSLSetNameValue(papszMetadata, "COMPRESSED_SIZE_HISTOGRAM", 
+                            getHistogram("|").c_str());
+    }
+    return papszMetadata;
+}
+
+std::string EMUIOStats::toJSON(const char *pszFilename) const
+{
+    std::string osJSON = "{\"file\": \"";
+    for( const char *p = pszFilename; *p != '\0'; p++ )
+    {
+        if( (*p == '\\') || (*p == '"') )
+        {
+            osJSON += '\\';
+        }
+        osJSON += *p;
+    }
+    osJSON += "\"";
+    for( int n = 0; n < EMU_IO_COUNTER_COUNT; n++ )
+    {
+        osJSON += CPLSPrintf(", \"%s\": " CPL_FRMT_GUIB, COUNTER_NAMES[n], 
+            static_cast<GUIntBig>(get(static_cast<EMUIOCounter>(n))));
+    }
+    std::string osHistogram = getHistogram(", ");
+    osJSON += CPLSPrintf(", \"COMPRESSED_SIZE_HISTOGRAM\": [%s]}", osHistogram.c_str());
+    return osJSON;
+}
@@ -0,0 +1,274 @@
+/*
+ *  emuoverview.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+#include "emuoverview.h"
+
+bool getResampling(const char *pszName, EMUResampling *peResampling)
+{
+    if( EQUAL(pszName, "NEAREST") )
+    {
+        *peResampling = RESAMPLE_NEAREST;
+    }
+    else if( EQUAL(pszName, "AVERAGE") )
+    {
+        *peResampling = RESAMPLE_AVERAGE;
+    }
+    else if( EQUAL(pszName, "MODE") )
+    {
+        *peResampling = RESAMPLE_MODE;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+template <class T>
+static bool isIgnored(T val, bool bNoData, T noData)
+{
+    if( std::is_floating_point<T>::value && std::isnan(static_cast<double>(val)) )
+    {
+        return true;
+    }
+    return bNoData && (val == noData);
+}
+
+// take the pixel nearest the centre of each window (as GDAL does)
+template <class T>
+static void reduceNearest(int nFactor, const T *pSrc, int nSrcXSize, T *pDst, int nDstXSize, 
+            int nXValid, int nYValid)
+{
+    int nOffset = nFactor / 2;
+    for( int y = 0; y < nYValid; y++ )
+    {
+        const T *pSrcRow = pSrc + static_cast<size_t>(y * nFactor + nOffset) * nSrcXSize + nOffset;
+        T *pDstRow = pDst + static_cast<size_t>(y) * nDstXSize;
+        for( int x = 0; x < nXValid; x++ )
+        {
+            pDstRow[x] = pSrcRow[x * nFactor];
+        }
+    }
+}
+
+// Sum each window a row at a time so the inner loops are simple enough  
+// for the compiler to vectorise. The sums and counts for a row of the
+// output are kept in pSums/pCounts.
+template <class T>
+static void reduceAverage(int nFactor, const T *pSrc, int nSrcXSize, T *pDst, int nDstXSize, 
+            int nXValid, int nYValid, bool bNoData, T noData)
+{
+    std::vector<double> sums(nXValid);
+    std::vector<int> counts(nXValid);
+    bool bCheck = bNoData || std::is_floating_point<T>::value;
+    for( int y = 0; y < nYValid; y++ )
+    {
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::fill(counts.begin(), counts.end(), 0);
+        for( int nRow = 0; nRow < nFactor; nRow++ )
+        {
+            const T *pSrcRow = pSrc + static_cast<size_t>(y * nFactor + nRow) * nSrcXSize;
+            if( !bCheck )
+            {
+                // fast path - nothing to ignore
+                for( int x = 0; x < nXValid; x++ )
+                {
+                    const T *pWindow = pSrcRow + x * nFactor;
+                    double dSum = 0;
+                    for( int n = 0; n < nFactor; n++ )
+                    {
+                        dSum += pWindow[n];
+                    }
+                    sums[x] += dSum;
+                }
+            }
+            else
+            {
+                for( int x = 0; x < nXValid; x++ )
+                {
+                    const T *pWindow = pSrcRow + x * nFactor;
+                    for( int n = 0; n < nFactor; n++ )
+                    {
+                        if( !isIgnored(pWindow[n], bNoData, noData) )
+                        {
+                            sums[x] += pWindow[n];
+                            counts[x]++;
+                        }
+                    }
+                }
+            }
+        }
+
+        T *pDstRow = pDst + static_cast<size_t>(y) * nDstXSize;
+        int nFullCount = nFactor * nFactor;
+        for( int x = 0; x < nXValid; x++ )
+        {
+            int nCount = bCheck ? counts[x] : nFullCount;
+            if( nCount == 0 )
+            {
+                // all ignored
+                pDstRow[x] = bNoData ? noData : pSrc[static_cast<size_t>(y * nFactor) * nSrcXSize + x * nFactor];
+            }
+            else if( std::is_floating_point<T>::value )
+            {
+                pDstRow[x] = static_cast<T>(sums[x] / nCount);
+            }
+            else
+            {
+                // round to nearest
+                pDstRow[x] = static_cast<T>(std::floor(sums[x] / nCount + 0.5));
+            }
+        }
+    }
+}
+
+// the most common value in each window. Ties go to the smallest value.
+template <class T>
+static void reduceMode(int nFactor, const T *pSrc, int nSrcXSize, T *pDst, int nDstXSize, 
+            int nXValid, int nYValid, bool bNoData, T noData)
+{
+    std::vector<T> window;
+    window.reserve(nFactor * nFactor);
+    for( int y = 0; y < nYValid; y++ )
+    {
+        T *pDstRow = pDst + static_cast<size_t>(y) * nDstXSize;
+        for( int x = 0; x < nXValid; x++ )
+        {
+            window.clear();
+            for( int nRow = 0; nRow < nFactor; nRow++ )
+            {
+                const T *pWindow = pSrc + static_cast<size_t>(y * nFactor + nRow) * nSrcXSize + x * nFactor;
+                for( int n = 0; n < nFactor; n++ )
+                {
+                    if( !isIgnored(pWindow[n], bNoData, noData) )
+                    {
+                        window.push_back(pWindow[n]);
+                    }
+                }
+            }
+            if( window.empty() )
+            {
+                pDstRow[x] = bNoData ? noData : pSrc[static_cast<size_t>(y * nFactor) * nSrcXSize + x * nFactor];
+                continue;
+            }
+            std::sort(window.begin(), window.end());
+            T best = window[0];
+            size_t nBestCount = 0;
+            for( size_t nStart = 0; nStart < window.size(); )
+            {
+                size_t nEnd = nStart + 1;
+                while( (nEnd < window.size()) && (window[nEnd] == window[nStart]) )
+                {
+                    nEnd++;
+                }
+                if( (nEnd - nStart) > nBestCount )
+                {
+                    nBestCount = nEnd - nStart;
+                    best = window[nStart];
+                }
+                nStart = nEnd;
+            }
+            pDstRow[x] = best;
+        }
+    }
+}
+
+template <class T>
+static void reduceTyped(EMUResampling eResampling, int nFactor, const void *pSrc, int nSrcXSize, 
+            void *pDst, int nDstXSize, int nXValid, int nYValid, bool bNoData, double dfNoData)
+{
+    const T *pSrcT = static_cast<const T*>(pSrc);
+    T *pDstT = static_cast<T*>(pDst);
+    // a nodata value that can't be represented can't be in the data either
+    T noData = static_cast<T>(dfNoData);
+    if( bNoData && (static_cast<double>(noData) != dfNoData) )
+    {
+        bNoData = false;
+    }
+    switch( eResampling )
+    {
+        case RESAMPLE_NEAREST:
+            reduceNearest(nFactor, pSrcT, nSrcXSize, pDstT, nDstXSize, nXValid, nYValid);
+            break;
+        case RESAMPLE_AVERAGE:
+            reduceAverage(nFactor, pSrcT, nSrcXSize, pDstT, nDstXSize, nXValid, nYValid, bNoData, noData);
+            break;
+        case RESAMPLE_MODE:
+            reduceMode(nFactor, pSrcT, nSrcXSize, pDstT, nDstXSize, nXValid, nYValid, bNoData, noData);
+            break;
+    }
+}
+
+bool reduceBlock(EMUResampling eResampling, GDALDataType eType, int nFactor,
+            const void *pSrc, int nSrcXSize, void *pDst, int nDstXSize, 
+            int nXValid, int nYValid, bool bNoData, double dfNoData)
+{
+    switch( eType )
+    {
+        case GDT_Byte:
+            reduceTyped<uint8_t>(eResampling, nFactor, pSrc, nSrcXSize, pDst, nDstXSize, nXValid, nYValid, bNoData, dfNoData);
+            break;
+        case GDT_Int8:
+            reduceTyped<int8_t>(eResampling, nFactor, pSrc, nSrcXSize, pDst, nDstXSize, nXValid, nYValid, bNoData, dfNoData);
+            break;
+        case GDT_UInt16:
+            reduceTyped<uint16_t>(eResampling, nFactor, pSrc, nSrcXSize, pDst, nDstXSize, nXValid, nYValid, bNoData, dfNoData);
+            break;
+        case GDT_Int16:
+            reduceTyped<int16_t>(eResampling, nFactor, pSrc, nSrcXSize, pDst, nDstXSize, nXValid, nYValid, bNoData, dfNoData);
+            break;
+        case GDT_UInt32:
+            reduceTyped<uint32_t>(eResampling, nFactor, pSrc, nSrcXSize, pDst, nDstXSize, nXValid, nYValid, bNoData, dfNoData);
+            break;
+        case GDT_Int32:
+            reduceTyped<int32_t>(eResampling, nFactor, pSrc, nSrcXSize, pDst, nDstXSize, nXValid, nYValid, bNoData, dfNoData);
+            break;
+        case GDT_UInt64:
+            reduceTyped<uint64_t>(eResampling, nFactor, pSrc, nSrcXSize, pDst, nDstXSize, nXValid, nYValid, bNoData, dfNoData);
+            break;
+        case GDT_Int64:
+            reduceTyped<int64_t>(eResampling, nFactor, pSrc, nSrcXSize, pDst, nDstXSize, nXValid, nYValid, bNoData, dfNoData);
+            break;
+        case GDT_Float32:
+            reduceTyped<float>(eResampling, nFactor, pSrc, nSrcXSize, pDst, nDstXSize, nXValid, nYValid, bNoData, dfNoData);
+            break;
+        case GDT_Float64:
+            reduceTyped<double>(eResampling, nFactor, pSrc, nSrcXSize, pDst, nDstXSize, nXValid, nYValid, bNoData, dfNoData);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
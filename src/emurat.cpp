@@ -33,6 +33,15 @@
 #include "emucompress.h"
 
 #include <algorithm> 
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <unordered_map>
+
+static bool chunkSortFunction(const EMURatChunk &a, const EMURatChunk &b)
+{
+    return a.startIdx < b.startIdx;
+}
 
 
 EMURat::EMURat(EMUDataset *pDS, EMURasterBand *pBand, const std::shared_ptr<std::mutex>& other)
@@ -62,7 +71,7 @@ int EMURat::GetColumnCount() const
 
 const char* EMURat::GetNameOfCol( int nCol) const
 {
-    if( (nCol < 0) || (nCol > m_cols.size()))
+    if( (nCol < 0) || (nCol >= static_cast<int>(m_cols.size())) )
     {
         return nullptr;
     }
@@ -71,7 +80,7 @@ const char* EMURat::GetNameOfCol( int nCol) const
 
 GDALRATFieldUsage EMURat::GetUsageOfCol( int nCol ) const
 {
-    if( (nCol < 0) || (nCol > m_cols.size()))
+    if( (nCol < 0) || (nCol >= static_cast<int>(m_cols.size())) )
     {
         return GFU_Generic;
     }
@@ -106,7 +115,7 @@ GDALRATFieldUsage EMURat::GetUsageOfCol( int nCol ) const
 
 GDALRATFieldType EMURat::GetTypeOfCol( int nCol ) const
 {
-    if( (nCol < 0) || (nCol > m_cols.size()))
+    if( (nCol < 0) || (nCol >= static_cast<int>(m_cols.size())) )
     {
         return GFT_Integer;
     }
@@ -160,7 +169,7 @@ const char *EMURat::GetValueAsString( int iRow, int iField ) const
     // Get ValuesIO do do the work
     char *apszStrList[1];
     if( (const_cast<EMURat*>(this))->
-                ValuesIO(GF_Read, iField, iRow, 1, apszStrList ) != CPLE_None )
+                ValuesIO(GF_Read, iField, iRow, 1, apszStrList ) != CE_None )
     {
         return "";
     }
@@ -216,227 +225,712 @@ void EMURat::SetValue( int iRow, int iField, int nValue )
 }
 
 
-CPLErr EMURat::ValuesIO(GDALRWFlag eRWFlag, int iField, int iStartRow, int iLength, double *pdfData)
+// check iField is valid and trim the rows to those in the table. 
+// Returns false (with *pbOK set) if there is nothing to do.
+bool EMURat::checkRequest(int iField, int iStartRow, int *piLength, bool *pbOK) const
 {
-    if( (iField < 0) || (iField > m_cols.size()))
+    if( (iField < 0) || (iField >= static_cast<int>(m_cols.size())) )
     {
         CPLError(CE_Failure, CPLE_FileIO,
                 "Couldn't find column %d.",
                 iField);
+        *pbOK = false;
+        return false;
+    }
+    *pbOK = true;
+    if( (iStartRow < 0) || (*piLength <= 0) || (static_cast<uint64_t>(iStartRow) >= m_nRowCount) )
+    {
+        return false;
+    }
+    else if( (iStartRow + static_cast<uint64_t>(*piLength)) > m_nRowCount )
+    {
+        *piLength = m_nRowCount - iStartRow;
+    }
+    return true;
+}
+
+// keep the chunks sorted by startIdx so they can be found with a binary search.
+// If a range of rows is written again the last one written wins (see getSegments).
+// Older chunks that are now entirely covered by this one are dropped.
+void EMURat::addChunk(int iField, const EMURatChunk &chunk)
+{
+    EMURatColumn &col = m_cols[iField];
+    std::vector<EMURatChunk> &chunks = col.chunks;
+    chunks.erase(std::remove_if(chunks.begin(), chunks.end(), [&chunk](const EMURatChunk &old)
+        { return (old.startIdx >= chunk.startIdx) && 
+                 (old.startIdx + old.length <= chunk.startIdx + chunk.length); }), chunks.end());
+    auto itr = std::upper_bound(chunks.begin(), chunks.end(), chunk, chunkSortFunction);
+    chunks.insert(itr, chunk);
+    col.nMaxChunkLength = std::max(col.nMaxChunkLength, chunk.length);
+    col.cache.clear();
+}
+
+// append the low nBits of each value to out, least significant bit first
+static void packBits(const std::vector<uint64_t> &values, int nBits, std::vector<GByte> &out)
+{
+    size_t nStart = out.size();
+    out.resize(nStart + ((values.size() * nBits) + 7) / 8, 0);
+    GByte *pOut = out.data() + nStart;
+    uint64_t nBitPos = 0;
+    for( uint64_t nValue : values )
+    {
+        size_t nByte = nBitPos / 8;
+        int nShift = nBitPos % 8;
+        int nLeft = nBits;
+        while( nLeft > 0 )
+        {
+            pOut[nByte] |= static_cast<GByte>(nValue << nShift);
+            int nDone = 8 - nShift;
+            nValue = (nDone < 64) ? (nValue >> nDone) : 0;
+            nLeft -= nDone;
+            nShift = 0;
+            nByte++;
+        }
+        nBitPos += nBits;
+    }
+}
+
+static uint64_t unpackBits(const GByte *pIn, uint64_t nBitPos, int nBits)
+{
+    size_t nByte = nBitPos / 8;
+    int nShift = nBitPos % 8;
+    uint64_t nValue = 0;
+    int nGot = 0;
+    while( nGot < nBits )
+    {
+        nValue |= static_cast<uint64_t>(pIn[nByte] >> nShift) << nGot;
+        nGot += 8 - nShift;
+        nShift = 0;
+        nByte++;
+    }
+    if( nBits < 64 )
+    {
+        nValue &= (static_cast<uint64_t>(1) << nBits) - 1;
+    }
+    return nValue;
+}
+
+static size_t packedSize(uint64_t nValues, int nBits)
+{
+    return ((nValues * nBits) + 7) / 8;
+}
+
+// number of bits needed for values 0..nMax
+static int bitsNeeded(uint64_t nMax)
+{
+    int nBits = 0;
+    while( (nBits < 64) && ((nMax >> nBits) != 0) )
+    {
+        nBits++;
+    }
+    return nBits;
+}
+
+// Integers are stored as the difference from the smallest value using as 
+// few bits as the range needs, so boolean columns take 1 bit a row and 
+// a column that is all the same value none.
+static uint8_t encodeValues(const int64_t *pData, size_t nLength, std::vector<GByte> &out)
+{
+    int64_t nMin = *std::min_element(pData, pData + nLength);
+    int64_t nMax = *std::max_element(pData, pData + nLength);
+    int nBits = bitsNeeded(static_cast<uint64_t>(nMax) - static_cast<uint64_t>(nMin));
+    if( nBits == 64 )
+    {
+        const GByte *pBytes = reinterpret_cast<const GByte*>(pData);
+        out.assign(pBytes, pBytes + (nLength * sizeof(int64_t)));
+        return RAT_ENCODING_PLAIN;
+    }
+
+    out.resize(sizeof(nMin) + 1);
+    memcpy(out.data(), &nMin, sizeof(nMin));
+    out[sizeof(nMin)] = nBits;
+    std::vector<uint64_t> values(nLength);
+    for( size_t n = 0; n < nLength; n++ )
+    {
+        values[n] = static_cast<uint64_t>(pData[n]) - static_cast<uint64_t>(nMin);
+    }
+    packBits(values, nBits, out);
+    return RAT_ENCODING_PACKED;
+}
+
+// reals are stored as float if that doesn't lose anything
+static uint8_t encodeValues(const double *pData, size_t nLength, std::vector<GByte> &out)
+{
+    bool bFloat = true;
+    for( size_t n = 0; bFloat && (n < nLength); n++ )
+    {
+        bFloat = std::isnan(pData[n]) || (static_cast<double>(static_cast<float>(pData[n])) == pData[n]);
+    }
+
+    if( !bFloat )
+    {
+        const GByte *pBytes = reinterpret_cast<const GByte*>(pData);
+        out.assign(pBytes, pBytes + (nLength * sizeof(double)));
+        return RAT_ENCODING_PLAIN;
+    }
+
+    out.resize(nLength * sizeof(float));
+    float *pFloats = reinterpret_cast<float*>(out.data());
+    for( size_t n = 0; n < nLength; n++ )
+    {
+        pFloats[n] = static_cast<float>(pData[n]);
+    }
+    return RAT_ENCODING_FLOAT32;
+}
+
+// Strings are either null separated or, if it is smaller, a dictionary of 
+// the distinct values followed by the (bit packed) index of each row's value.
+static uint8_t encodeValues(char * const *papszStrList, size_t nLength, std::vector<GByte> &out)
+{
+    std::unordered_map<std::string, uint32_t> dictionary;
+    std::vector<const char*> entries;
+    std::vector<uint64_t> codes(nLength);
+    size_t nPlainSize = 0, nDictSize = 0;
+    for( size_t n = 0; n < nLength; n++ )
+    {
+        size_t nLen = strlen(papszStrList[n]) + 1;
+        nPlainSize += nLen;
+        auto result = dictionary.insert(std::make_pair(std::string(papszStrList[n]), 
+                                static_cast<uint32_t>(entries.size())));
+        if( result.second )
+        {
+            entries.push_back(papszStrList[n]);
+            nDictSize += nLen;
+        }
+        codes[n] = result.first->second;
+    }
+
+    int nBits = bitsNeeded(entries.size() - 1);
+    if( (sizeof(uint32_t) + 1 + nDictSize + packedSize(nLength, nBits)) >= nPlainSize )
+    {
+        out.clear();
+        out.reserve(nPlainSize);
+        for( size_t n = 0; n < nLength; n++ )
+        {
+            out.insert(out.end(), papszStrList[n], papszStrList[n] + strlen(papszStrList[n]) + 1);
+        }
+        return RAT_ENCODING_PLAIN;
+    }
+
+    uint32_t nEntries = entries.size();
+    out.resize(sizeof(nEntries) + 1);
+    memcpy(out.data(), &nEntries, sizeof(nEntries));
+    out[sizeof(nEntries)] = nBits;
+    for( const char *pszEntry : entries )
+    {
+        out.insert(out.end(), pszEntry, pszEntry + strlen(pszEntry) + 1);
+    }
+    packBits(codes, nBits, out);
+    return RAT_ENCODING_DICTIONARY;
+}
+
+// compress and append nSize bytes of pData as the chunk for nStartRow..nStartRow+nLength
+CPLErr EMURat::writeChunk(int iField, uint64_t nStartRow, uint64_t nLength, 
+                uint8_t nEncoding, const Bytef *pData, size_t nSize)
+{
+    uint8_t compression = m_pEMUDS->m_nCompression;
+    vsi_l_offset chunkOffset = VSIFTellL(m_pEMUDS->m_fp);
+
+    // can't be worked out from the number of rows
+    uint64_t nUncompressedSize = nSize;
+    bool bOK = (VSIFWriteL(&compression, sizeof(compression), 1, m_pEMUDS->m_fp) == 1) &&
+        (VSIFWriteL(&nEncoding, sizeof(nEncoding), 1, m_pEMUDS->m_fp) == 1) &&
+        (VSIFWriteL(&nUncompressedSize, sizeof(nUncompressedSize), 1, m_pEMUDS->m_fp) == 1);
+
+    // belongs to this thread so no need to free
+    size_t compressedSize;
+    Bytef *pCompressed = doCompression(compression, m_pEMUDS->m_nCompressLevel, 
+                const_cast<Bytef*>(pData), nSize, &compressedSize);
+    if( pCompressed == nullptr )
+    {
+        return CE_Failure;
+    }
+    bOK = bOK && (VSIFWriteL(pCompressed, compressedSize, 1, m_pEMUDS->m_fp) == 1);
+    if( !bOK )
+    {
+        CPLError(CE_Failure, CPLE_FileIO, "Failed to write RAT chunk");
         return CE_Failure;
     }
+    m_pEMUDS->m_ioStats.add(EMU_IO_WRITE_CALLS, 4);
+    m_pEMUDS->m_ioStats.add(EMU_IO_BYTES_WRITTEN, 
+        sizeof(compression) + sizeof(nEncoding) + sizeof(nUncompressedSize) + compressedSize);
+
+    EMURatChunk chunk;
+    chunk.startIdx = nStartRow;
+    chunk.length = nLength;
+    chunk.offset = chunkOffset;
+    chunk.compressedSize = compressedSize;
+    addChunk(iField, chunk);
+    return CE_None;
+}
+
+// bytes before the compressed data of each chunk
+static size_t chunkHeaderSize(int nVersion)
+{
+    if( nVersion >= 2 )
+    {
+        // compression, encoding and uncompressed size
+        return 2 + sizeof(uint64_t);
+    }
+    return 1;
+}
 
-    // do simple conversions of type
-    if( m_cols[iField].colType == GFT_Integer )
+// find where each of the null separated strings start
+static bool findStrings(const std::vector<GByte> &data, size_t nStart, uint64_t nStrings, 
+                std::vector<size_t> &offsets)
+{
+    const char *pszData = reinterpret_cast<const char*>(data.data());
+    size_t nPos = nStart;
+    offsets.resize(nStrings);
+    for( uint64_t n = 0; n < nStrings; n++ )
     {
-        if(eRWFlag == GF_Write)
+        if( nPos >= data.size() )
         {
-            int *pnData = (int*)CPLMalloc(iLength * sizeof(int));
-            for( int n = 0; n < iLength; n++)
+            return false;
+        }
+        offsets[n] = nPos;
+        const void *pNull = memchr(pszData + nPos, '\0', data.size() - nPos);
+        if( pNull == nullptr )
+        {
+            return false;
+        }
+        nPos = (static_cast<const char*>(pNull) - pszData) + 1;
+    }
+    return true;
+}
+
+// pRaw is the chunk as it is in the file (starting with the compression byte). 
+// The result is always plain (int64, double or null separated strings).
+static bool decodeChunk(GDALRATFieldType eType, int nVersion, const EMURatChunk &chunk, 
+                const Bytef *pRaw, EMURatDecodedChunk *pDecoded)
+{
+    uint8_t compression = pRaw[0];
+    uint8_t nEncoding = RAT_ENCODING_PLAIN;
+    uint64_t uncompressedSize;
+    const Bytef *pCompressed = pRaw + chunkHeaderSize(nVersion);
+    if( nVersion >= 2 )
+    {
+        nEncoding = pRaw[1];
+        memcpy(&uncompressedSize, pRaw + 2, sizeof(uncompressedSize));
+    }
+    else if( eType != GFT_String )
+    {
+        // both double and int64
+        uncompressedSize = chunk.length * sizeof(double);
+    }
+    else if( compression == COMPRESSION_NONE )
+    {
+        uncompressedSize = chunk.compressedSize;
+    }
+    else if( compression == COMPRESSION_ZLIB )
+    {
+        // version 1 didn't store the size of the strings
+        return doZlibUncompressUnknownSize(pCompressed, chunk.compressedSize, pDecoded->data) &&
+            findStrings(pDecoded->data, 0, chunk.length, pDecoded->stringOffsets);
+    }
+    else
+    {
+        return false;
+    }
+
+    std::vector<GByte> encoded;
+    std::vector<GByte> &uncompressed = (nEncoding == RAT_ENCODING_PLAIN) ? pDecoded->data : encoded;
+    uncompressed.resize(uncompressedSize);
+    if( !doUncompression(compression, pCompressed, chunk.compressedSize, 
+                uncompressed.data(), uncompressedSize) )
+    {
+        return false;
+    }
+
+    if( nEncoding == RAT_ENCODING_PLAIN )
+    {
+        if( eType == GFT_String )
+        {
+            return findStrings(pDecoded->data, 0, chunk.length, pDecoded->stringOffsets);
+        }
+        return uncompressedSize == (chunk.length * sizeof(double));
+    }
+    else if( (nEncoding == RAT_ENCODING_FLOAT32) && (eType == GFT_Real) )
+    {
+        if( uncompressedSize != (chunk.length * sizeof(float)) )
+        {
+            return false;
+        }
+        const float *pFloats = reinterpret_cast<const float*>(encoded.data());
+        pDecoded->data.resize(chunk.length * sizeof(double));
+        double *pValues = reinterpret_cast<double*>(pDecoded->data.data());
+        for( uint64_t n = 0; n < chunk.length; n++ )
+        {
+            pValues[n] = pFloats[n];
+        }
+        return true;
+    }
+    else if( (nEncoding == RAT_ENCODING_PACKED) && (eType == GFT_Integer) )
+    {
+        int64_t nMin;
+        if( uncompressedSize < sizeof(nMin) + 1 )
+        {
+            return false;
+        }
+        memcpy(&nMin, encoded.data(), sizeof(nMin));
+        int nBits = encoded[sizeof(nMin)];
+        if( (nBits > 64) || 
+            (uncompressedSize != sizeof(nMin) + 1 + packedSize(chunk.length, nBits)) )
+        {
+            return false;
+        }
+        const GByte *pPacked = encoded.data() + sizeof(nMin) + 1;
+        pDecoded->data.resize(chunk.length * sizeof(int64_t));
+        int64_t *pValues = reinterpret_cast<int64_t*>(pDecoded->data.data());
+        for( uint64_t n = 0; n < chunk.length; n++ )
+        {
+            uint64_t nValue = (nBits == 0) ? 0 : unpackBits(pPacked, n * nBits, nBits);
+            pValues[n] = static_cast<int64_t>(static_cast<uint64_t>(nMin) + nValue);
+        }
+        return true;
+    }
+    else if( (nEncoding == RAT_ENCODING_DICTIONARY) && (eType == GFT_String) )
+    {
+        // keep the dictionary and point each row at its entry
+        uint32_t nEntries;
+        if( uncompressedSize < sizeof(nEntries) + 1 )
+        {
+            return false;
+        }
+        memcpy(&nEntries, encoded.data(), sizeof(nEntries));
+        int nBits = encoded[sizeof(nEntries)];
+        size_t nPackedSize = packedSize(chunk.length, nBits);
+        if( (nBits > 32) || (uncompressedSize < sizeof(nEntries) + 1 + nPackedSize) )
+        {
+            return false;
+        }
+        size_t nDictEnd = uncompressedSize - nPackedSize;
+        pDecoded->data.assign(encoded.begin() + sizeof(nEntries) + 1, encoded.begin() + nDictEnd);
+        std::vector<size_t> entryOffsets;
+        if( !findStrings(pDecoded->data, 0, nEntries, entryOffsets) )
+        {
+            return false;
+        }
+        const GByte *pPacked = encoded.data() + nDictEnd;
+        pDecoded->stringOffsets.resize(chunk.length);
+        for( uint64_t n = 0; n < chunk.length; n++ )
+        {
+            uint64_t nCode = (nBits == 0) ? 0 : unpackBits(pPacked, n * nBits, nBits);
+            if( nCode >= nEntries )
             {
-                pnData[n] = pdfData[n];
+                return false;
             }
-            CPLErr err = ValuesIO(eRWFlag, iField, iStartRow, iLength, pnData);
-            CPLFree(pnData);
-            return err;
+            pDecoded->stringOffsets[n] = entryOffsets[nCode];
+        }
+        return true;
+    }
+    return false;
+}
+
+// when reading more than one chunk, read through gaps up to this size
+// rather than starting a new range
+const vsi_l_offset RAT_MAX_GAP = 32 * 1024;
+
+// read and decode the given chunks. Ones next to each other in the file
+// are read in one request and they are decoded in parallel if GDAL_NUM_THREADS is set.
+CPLErr EMURat::readChunks(int iField, const std::vector<size_t> &toRead, 
+                std::map<size_t, std::shared_ptr<EMURatDecodedChunk> > &decoded)
+{
+    const EMURatColumn &col = m_cols[iField];
+    int nVersion = m_pEMUDS->m_nVersion;
+    size_t nHeaderSize = chunkHeaderSize(nVersion);
+
+    // in file order
+    std::vector<size_t> order(toRead);
+    std::sort(order.begin(), order.end(), [&col](size_t a, size_t b)
+        { return col.chunks[a].offset < col.chunks[b].offset; });
+
+    std::vector<vsi_l_offset> rangeStarts;
+    std::vector<size_t> rangeSizes;
+    std::vector<size_t> chunkRanges(order.size());
+    for( size_t i = 0; i < order.size(); i++ )
+    {
+        const EMURatChunk &chunk = col.chunks[order[i]];
+        vsi_l_offset nEnd = chunk.offset + nHeaderSize + chunk.compressedSize;
+        if( !rangeStarts.empty() && (chunk.offset >= rangeStarts.back()) &&
+            (chunk.offset <= rangeStarts.back() + rangeSizes.back() + RAT_MAX_GAP) )
+        {
+            rangeSizes.back() = std::max<vsi_l_offset>(rangeSizes.back(), nEnd - rangeStarts.back());
         }
         else
         {
-            int *pnData = (int*)CPLMalloc(iLength * sizeof(int));
-            CPLErr err = ValuesIO(eRWFlag, iField, iStartRow, iLength, pnData);
-            if( err != CE_None)
-            {
-                for( int n = 0; n < iLength; n++)
-                {
-                    pdfData[n] = pnData[n];
-                }
-            }
-            CPLFree(pnData);
-            return err;
+            rangeStarts.push_back(chunk.offset);
+            rangeSizes.push_back(nEnd - chunk.offset);
         }
-    }    
-    else if( m_cols[iField].colType == GFT_String ) 
+        chunkRanges[i] = rangeStarts.size() - 1;
+    }
+
+    // if the file is mapped the chunks can be decoded from there
+    std::vector<void*> rangeBufs(rangeStarts.size());
+    bool bMapped = true;
+    for( size_t i = 0; (i < rangeStarts.size()) && bMapped; i++ )
     {
-        CPLError(CE_Failure, CPLE_FileIO,
-                "Wrong type for column %d, expected number, got string.",
-                iField);
-        return CE_Failure;
+        rangeBufs[i] = const_cast<GByte*>(m_pEMUDS->getMappedData(rangeStarts[i], rangeSizes[i]));
+        bMapped = (rangeBufs[i] != nullptr);
     }
-    
-    if( iStartRow >= m_nRowCount )
+
+    for( size_t nSize : rangeSizes )
+    {
+        m_pEMUDS->m_ioStats.add(EMU_IO_BYTES_READ, nSize);
+    }
+
+    std::vector<std::vector<GByte> > rangeData;
+    if( !bMapped )
+    {
+        rangeData.resize(rangeStarts.size());
+        for( size_t i = 0; i < rangeStarts.size(); i++ )
+        {
+            rangeData[i].resize(rangeSizes[i]);
+            rangeBufs[i] = rangeData[i].data();
+        }
+
+        // when creating m_fp is also being written to so put it back after
+        VSILFILE *fp = m_pEMUDS->m_fp;
+        vsi_l_offset nWritePos = VSIFTellL(fp);
+        bool bOK;
+        if( rangeStarts.size() == 1 )
+        {
+            bOK = (VSIFSeekL(fp, rangeStarts[0], SEEK_SET) == 0) &&
+                (VSIFReadL(rangeBufs[0], rangeSizes[0], 1, fp) == 1);
+        }
+        else
+        {
+            bOK = VSIFReadMultiRangeL(rangeStarts.size(), rangeBufs.data(), 
+                            rangeStarts.data(), rangeSizes.data(), fp) == 0;
+        }
+        VSIFSeekL(fp, nWritePos, SEEK_SET);
+        m_pEMUDS->m_ioStats.add(EMU_IO_READ_CALLS, 1);
+        if( !bOK )
+        {
+            CPLError(CE_Failure, CPLE_FileIO, "Failed to read RAT chunks for column %d", iField);
+            return CE_Failure;
+        }
+    }
+
+    std::vector<std::shared_ptr<EMURatDecodedChunk> > results(order.size());
+    std::vector<char> resultOK(order.size(), 0);
+    auto decode = [&](size_t i)
     {
-        return CE_None;   
+        const EMURatChunk &chunk = col.chunks[order[i]];
+        const Bytef *pRaw = static_cast<const Bytef*>(rangeBufs[chunkRanges[i]]) + 
+                                (chunk.offset - rangeStarts[chunkRanges[i]]);
+        results[i] = std::make_shared<EMURatDecodedChunk>();
+        resultOK[i] = decodeChunk(col.colType, nVersion, chunk, pRaw, results[i].get());
+    };
+
+    EMUThreadPool *pPool = (order.size() > 1) ? m_pEMUDS->getReadPool() : nullptr;
+    for( size_t i = 0; i < order.size(); i++ )
+    {
+        if( pPool != nullptr )
+        {
+            pPool->submit([decode, i]() { decode(i); });
+        }
+        else
+        {
+            decode(i);
+        }
     }
-    else if( (iStartRow + iLength) > m_nRowCount )
+    if( pPool != nullptr )
     {
-        iLength = m_nRowCount - iStartRow;
+        pPool->waitCompletion();
     }
 
-    
-    const std::lock_guard<std::mutex> lock(*m_mutex);
-    if( eRWFlag == GF_Write) 
+    for( size_t i = 0; i < order.size(); i++ )
     {
-        if(m_pEMUDS->GetAccess() != GA_Update)
+        if( !resultOK[i] )
         {
-            CPLError(CE_Failure, CPLE_NotSupported,
-            "The EMU driver only supports writing when creating");
+            CPLError(CE_Failure, CPLE_AppDefined, "Failed to decode RAT chunk for column %d", iField);
             return CE_Failure;
         }
+        decoded[order[i]] = results[i];
+    }
+    return CE_None;
+}
 
-        // TODO: set compression
-        uint8_t compression = COMPRESSION_ZLIB;
-        int iThisBlockLength;
-        
-        while(iLength > 0)
+// split nStartRow..nStartRow+nLength into the parts that come from each chunk
+// and make sure those chunks are decoded. The most recently used chunks 
+// for each column are kept so reading a row at a time is fast.
+CPLErr EMURat::getSegments(int iField, uint64_t nStartRow, uint64_t nLength, 
+                std::vector<EMURatSegment> &segments)
+{
+    EMURatColumn &col = m_cols[iField];
+    const std::vector<EMURatChunk> &chunks = col.chunks;
+    const size_t NO_CHUNK = std::numeric_limits<size_t>::max();
+
+    std::vector<size_t> segmentChunks;
+    uint64_t nRow = nStartRow;
+    uint64_t nEnd = nStartRow + nLength;
+    while( nRow < nEnd )
+    {
+        // the chunks after this one start after nRow
+        EMURatChunk key;
+        key.startIdx = nRow;
+        auto itr = std::upper_bound(chunks.begin(), chunks.end(), key, chunkSortFunction);
+        uint64_t nSegEnd = (itr == chunks.end()) ? nEnd : std::min(nEnd, itr->startIdx);
+
+        // Rows can be written more than once, so look back for the newest chunk 
+        // that has nRow. Chunks are appended to the file so that is the one with 
+        // the biggest offset. Only chunks that start within nMaxChunkLength can reach it.
+        size_t nChunk = NO_CHUNK;
+        for( auto back = itr; back != chunks.begin(); )
         {
-            if( iLength > MAX_RAT_CHUNK)
-            {
-                iThisBlockLength = MAX_RAT_CHUNK;
-            }
-            else
+            --back;
+            if( back->startIdx + col.nMaxChunkLength <= nRow )
             {
-                iThisBlockLength = iLength;
+                break;
             }
-            vsi_l_offset chunkOffset = VSIFTellL(m_pEMUDS->m_fp);
-            
-            VSIFWriteL(&compression, sizeof(compression), 1, m_pEMUDS->m_fp);
-            size_t uncompressedSize = iThisBlockLength * sizeof(double);
-            size_t compressedSize = uncompressedSize + 100;
-
-            bool bFree;
-            Bytef *pCompressed = doCompression(compression, reinterpret_cast<Bytef*>(pdfData), uncompressedSize, &compressedSize, &bFree);
-                    
-            VSIFWriteL(pCompressed, compressedSize, 1, m_pEMUDS->m_fp);
-            
-            if( bFree ) 
+            if( (nRow < back->startIdx + back->length) && 
+                ((nChunk == NO_CHUNK) || (back->offset > chunks[nChunk].offset)) )
             {
-                CPLFree(pCompressed);
+                nChunk = back - chunks.begin();
             }
-            
-            EMURatChunk chunk;
-            chunk.startIdx = iStartRow;
-            chunk.length = iThisBlockLength;
-            chunk.offset = chunkOffset;
-            chunk.compressedSize = compressedSize;
-            m_cols[iField].chunks.push_back(chunk);
-            
-            pdfData += iThisBlockLength;
-            iLength -= iThisBlockLength;
-            iStartRow += iThisBlockLength;
         }
+
+        EMURatSegment seg;
+        seg.nDestRow = nRow - nStartRow;
+        seg.nChunkRow = 0;
+        if( nChunk != NO_CHUNK )
+        {
+            // the older chunks that start before nRow can only take over where it ends
+            const EMURatChunk &chunk = chunks[nChunk];
+            seg.nChunkRow = nRow - chunk.startIdx;
+            nSegEnd = std::min(nSegEnd, chunk.startIdx + chunk.length);
+        }
+        seg.nRows = nSegEnd - nRow;
+        segments.push_back(seg);
+        segmentChunks.push_back(nChunk);
+        nRow = nSegEnd;
     }
-    else
+
+    // which do we already have?
+    std::map<size_t, std::shared_ptr<EMURatDecodedChunk> > decoded;
+    std::vector<size_t> toRead;
+    for( size_t nChunk : segmentChunks )
     {
-        bool bFound = false;
-        size_t startChunk = 0;
-        uint64_t nElsToSkipAtStart = 0;
-        uint64_t nCopiedRows = 0;
-        for( size_t n = 0; n < m_cols[iField].chunks.size(); n++)
+        if( (nChunk == NO_CHUNK) || (decoded.find(nChunk) != decoded.end()) ||
+            (std::find(toRead.begin(), toRead.end(), nChunk) != toRead.end()) )
         {
-            if(m_cols[iField].chunks[n].startIdx <= iStartRow )
-            {
-                startChunk = n;
-                nElsToSkipAtStart = iStartRow - m_cols[iField].chunks[n].startIdx;
-                bFound = true;
-                break;
-            }
+            continue;
         }
-        
-        if( bFound )
+        auto itr = std::find_if(col.cache.begin(), col.cache.end(), 
+            [nChunk](const std::pair<size_t, std::shared_ptr<EMURatDecodedChunk> > &entry)
+            { return entry.first == nChunk; });
+        if( itr != col.cache.end() )
         {
-            while( (nCopiedRows <  iLength) && (startChunk < m_cols[iField].chunks.size()) )
-            {
-                // seek to where this block starts    
-                VSIFSeekL(m_pEMUDS->m_fp, m_cols[iField].chunks[startChunk].offset, SEEK_SET);
-    
-                // read compression type
-                uint8_t compression;
-                VSIFReadL(&compression, sizeof(compression), 1, m_pEMUDS->m_fp);
-    
-                // read the uncompressed data
-                Bytef *pSubData = static_cast<Bytef*>(CPLMalloc(m_cols[iField].chunks[startChunk].compressedSize));
-                VSIFReadL(pSubData, m_cols[iField].chunks[startChunk].compressedSize, 1, m_pEMUDS->m_fp);
-                
-                uint64_t uncompressedSize =  m_cols[iField].chunks[startChunk].length * sizeof(double); 
-                Bytef *pUncompressed = static_cast<Bytef*>(CPLMalloc(uncompressedSize)); 
-                doUncompression(compression, pSubData, m_cols[iField].chunks[startChunk].compressedSize,
-                    pUncompressed, uncompressedSize);
-                double *pData = reinterpret_cast<double*>(pUncompressed);
-                
-                // copy out
-                uint64_t count = 0;
-                while( (nCopiedRows < iLength) && (count < m_cols[iField].chunks[startChunk].length) ) 
-                {
-                    pdfData[nCopiedRows] = pData[nElsToSkipAtStart];
-                    nCopiedRows++;
-                    nElsToSkipAtStart++;
-                    count++;
-                }
-                
-                CPLFree(pSubData);
-                CPLFree(pUncompressed);
-                startChunk++;
-                nElsToSkipAtStart = 0;
-            }
-            
-            while( nCopiedRows < iLength )
-            {
-                // we haven't been able to copy all the data they have requested 
-                // because that much data was never written. Pad with zeros.
-                pdfData[nCopiedRows] = 0;
-                nCopiedRows++;
-            }
-            
+            decoded[nChunk] = itr->second;
+            // now the most recently used
+            std::rotate(itr, itr + 1, col.cache.end());
+        }
+        else
+        {
+            toRead.push_back(nChunk);
+        }
+    }
+
+    if( !toRead.empty() )
+    {
+        CPLErr err = readChunks(iField, toRead, decoded);
+        if( err != CE_None )
+        {
+            return err;
+        }
+        for( size_t nChunk : toRead )
+        {
+            col.cache.push_back(std::make_pair(nChunk, decoded[nChunk]));
+        }
+        if( col.cache.size() > RAT_CHUNK_CACHE_SIZE )
+        {
+            col.cache.erase(col.cache.begin(), col.cache.end() - RAT_CHUNK_CACHE_SIZE);
+        }
+    }
+
+    for( size_t n = 0; n < segments.size(); n++ )
+    {
+        if( segmentChunks[n] != NO_CHUNK )
+        {
+            segments[n].pChunk = decoded[segmentChunks[n]];
         }
-        
-        
-    
     }
-    
-    
     return CE_None;
 }
 
-CPLErr EMURat::ValuesIO(GDALRWFlag eRWFlag, int iField, int iStartRow, int iLength, int *pnData)
+// S is the type stored in the file, T the type the caller has
+template <class S, class T>
+CPLErr EMURat::readValues(int iField, uint64_t nStartRow, uint64_t nLength, T *pData)
 {
-    if( (iField < 0) || (iField > m_cols.size()))
+    std::vector<EMURatSegment> segments;
+    CPLErr err = getSegments(iField, nStartRow, nLength, segments);
+    if( err != CE_None )
     {
-        CPLError(CE_Failure, CPLE_FileIO,
-                "Couldn't find column %d.",
-                iField);
-        return CE_Failure;
+        return err;
     }
-    
-    // do simple conversions of type
-    if( m_cols[iField].colType == GFT_Real )
+
+    for( const EMURatSegment &seg : segments )
     {
-        if(eRWFlag == GF_Write)
+        T *pDest = pData + seg.nDestRow;
+        if( seg.pChunk == nullptr )
         {
-            double *pfdData = (double*)CPLMalloc(iLength * sizeof(double));
-            for( int n = 0; n < iLength; n++)
-            {
-                pfdData[n] = pnData[n];
-            }
-            CPLErr err = ValuesIO(eRWFlag, iField, iStartRow, iLength, pfdData);
-            CPLFree(pfdData);
-            return err;
+            // that much data was never written. Pad with zeros.
+            std::fill(pDest, pDest + seg.nRows, static_cast<T>(0));
+            continue;
+        }
+        const S *pSrc = reinterpret_cast<const S*>(seg.pChunk->data.data()) + seg.nChunkRow;
+        if( std::is_same<S, T>::value )
+        {
+            memcpy(pDest, pSrc, seg.nRows * sizeof(T));
         }
         else
         {
-            double *pfdData = (double*)CPLMalloc(iLength * sizeof(double));
-            CPLErr err = ValuesIO(eRWFlag, iField, iStartRow, iLength, pfdData);
-            if( err != CE_None)
+            for( uint64_t n = 0; n < seg.nRows; n++ )
             {
-                for( int n = 0; n < iLength; n++)
-                {
-                    pnData[n] = pfdData[n];
-                }
+                pDest[n] = static_cast<T>(pSrc[n]);
             }
-            CPLFree(pfdData);
+        }
+    }
+    return CE_None;
+}
+
+template <class S, class T>
+CPLErr EMURat::writeValues(int iField, uint64_t nStartRow, uint64_t nLength, const T *pData)
+{
+    std::vector<S> buffer(std::min<uint64_t>(nLength, MAX_RAT_CHUNK));
+    std::vector<GByte> encoded;
+    while( nLength > 0 )
+    {
+        uint64_t nThisChunkLength = std::min<uint64_t>(nLength, MAX_RAT_CHUNK);
+        for( uint64_t n = 0; n < nThisChunkLength; n++ )
+        {
+            buffer[n] = static_cast<S>(pData[n]);
+        }
+        uint8_t nEncoding = encodeValues(buffer.data(), nThisChunkLength, encoded);
+        CPLErr err = writeChunk(iField, nStartRow, nThisChunkLength, nEncoding, 
+                        encoded.data(), encoded.size());
+        if( err != CE_None )
+        {
             return err;
         }
-    }    
-    else if( m_cols[iField].colType == GFT_String ) 
+        pData += nThisChunkLength;
+        nLength -= nThisChunkLength;
+        nStartRow += nThisChunkLength;
+    }
+    return CE_None;
+}
+
+CPLErr EMURat::ValuesIO(GDALRWFlag eRWFlag, int iField, int iStartRow, int iLength, double *pdfData)
+{
+    bool bOK;
+    if( !checkRequest(iField, iStartRow, &iLength, &bOK) )
+    {
+        return bOK ? CE_None : CE_Failure;
+    }
+
+    GDALRATFieldType eType = m_cols[iField].colType;
+    if( eType == GFT_String ) 
     {
         CPLError(CE_Failure, CPLE_FileIO,
                 "Wrong type for column %d, expected number, got string.",
@@ -444,20 +938,8 @@ CPLErr EMURat::ValuesIO(GDALRWFlag eRWFlag, int iField, int iStartRow, int iLeng
         return CE_Failure;
     }
 
-    
-    if( iStartRow >= m_nRowCount )
-    {
-        return CE_None;   
-    }
-    else if( (iStartRow + iLength) > m_nRowCount )
-    {
-        iLength = m_nRowCount - iStartRow;
-    }    
-    
-    // we store as int64 internally
-    int64_t *pn64Tmp = new int64_t[MAX_RAT_CHUNK];
-
-    const std::lock_guard<std::mutex> lock(*m_mutex);
+    EMUTimedLock lock(*m_mutex, m_pEMUDS->m_ioStats);
+    EMUIOTimer timer(m_pEMUDS->m_ioStats, (eRWFlag == GF_Write) ? EMU_IO_RAT_WRITE_NS : EMU_IO_RAT_READ_NS);
     if( eRWFlag == GF_Write) 
     {
         if(m_pEMUDS->GetAccess() != GA_Update)
@@ -466,140 +948,69 @@ CPLErr EMURat::ValuesIO(GDALRWFlag eRWFlag, int iField, int iStartRow, int iLeng
             "The EMU driver only supports writing when creating");
             return CE_Failure;
         }
-
-        // TODO: set compression
-        uint8_t compression = COMPRESSION_ZLIB;
-        int iThisBlockLength;
-        
-        while(iLength > 0)
+        // integers are stored as int64
+        if( eType == GFT_Integer )
         {
-            if( iLength > MAX_RAT_CHUNK)
-            {
-                iThisBlockLength = MAX_RAT_CHUNK;
-            }
-            else
-            {
-                iThisBlockLength = iLength;
-            }
-
-            vsi_l_offset chunkOffset = VSIFTellL(m_pEMUDS->m_fp);
-            // convert
-            for( int i = 0; i < iThisBlockLength; i++ ) 
-            {
-                pn64Tmp[i] = pnData[i];
-            }
-
-            VSIFWriteL(&compression, sizeof(compression), 1, m_pEMUDS->m_fp);
-            size_t uncompressedSize = iThisBlockLength * sizeof(int64_t);
-            size_t compressedSize = uncompressedSize + 100;
-
-            bool bFree;
-            Bytef *pCompressed = doCompression(compression, reinterpret_cast<Bytef*>(pn64Tmp), uncompressedSize, &compressedSize, &bFree);
-                    
-            VSIFWriteL(pCompressed, compressedSize, 1, m_pEMUDS->m_fp);
-            
-            if( bFree ) 
-            {
-                CPLFree(pCompressed);
-            }
+            return writeValues<int64_t>(iField, iStartRow, iLength, pdfData);
+        }
+        return writeValues<double>(iField, iStartRow, iLength, pdfData);
+    }
+    
+    if( eType == GFT_Integer )
+    {
+        return readValues<int64_t>(iField, iStartRow, iLength, pdfData);
+    }
+    return readValues<double>(iField, iStartRow, iLength, pdfData);
+}
 
-            EMURatChunk chunk;
-            chunk.startIdx = iStartRow;
-            chunk.length = iThisBlockLength;
-            chunk.offset = chunkOffset;
-            chunk.compressedSize = compressedSize;
-            m_cols[iField].chunks.push_back(chunk);
+CPLErr EMURat::ValuesIO(GDALRWFlag eRWFlag, int iField, int iStartRow, int iLength, int *pnData)
+{
+    bool bOK;
+    if( !checkRequest(iField, iStartRow, &iLength, &bOK) )
+    {
+        return bOK ? CE_None : CE_Failure;
+    }
 
-            pnData += iThisBlockLength;
-            iLength -= iThisBlockLength;
-            iStartRow += iThisBlockLength;
-        }
+    GDALRATFieldType eType = m_cols[iField].colType;
+    if( eType == GFT_String ) 
+    {
+        CPLError(CE_Failure, CPLE_FileIO,
+                "Wrong type for column %d, expected number, got string.",
+                iField);
+        return CE_Failure;
     }
-    else
+
+    EMUTimedLock lock(*m_mutex, m_pEMUDS->m_ioStats);
+    EMUIOTimer timer(m_pEMUDS->m_ioStats, (eRWFlag == GF_Write) ? EMU_IO_RAT_WRITE_NS : EMU_IO_RAT_READ_NS);
+    if( eRWFlag == GF_Write) 
     {
-        bool bFound = false;
-        size_t startChunk = 0;
-        uint64_t nElsToSkipAtStart = 0;
-        uint64_t nCopiedRows = 0;
-        for( size_t n = 0; n < m_cols[iField].chunks.size(); n++)
+        if(m_pEMUDS->GetAccess() != GA_Update)
         {
-            if(m_cols[iField].chunks[n].startIdx <= iStartRow )
-            {
-                startChunk = n;
-                nElsToSkipAtStart = iStartRow - m_cols[iField].chunks[n].startIdx;
-                bFound = true;
-                break;
-            }
+            CPLError(CE_Failure, CPLE_NotSupported,
+            "The EMU driver only supports writing when creating");
+            return CE_Failure;
         }
-        
-        if( bFound )
+        // integers are stored as int64
+        if( eType == GFT_Integer )
         {
-            while( (nCopiedRows <  iLength) && (startChunk < m_cols[iField].chunks.size()) )
-            {
-                // seek to where this block starts    
-                VSIFSeekL(m_pEMUDS->m_fp, m_cols[iField].chunks[startChunk].offset, SEEK_SET);
-    
-                // read compression type
-                uint8_t compression;
-                VSIFReadL(&compression, sizeof(compression), 1, m_pEMUDS->m_fp);
-    
-                // read the uncompressed data
-                Bytef *pSubData = static_cast<Bytef*>(CPLMalloc(m_cols[iField].chunks[startChunk].compressedSize));
-                VSIFReadL(pSubData, m_cols[iField].chunks[startChunk].compressedSize, 1, m_pEMUDS->m_fp);
-                
-                uint64_t uncompressedSize =  m_cols[iField].chunks[startChunk].length * sizeof(int); 
-                Bytef *pUncompressed = static_cast<Bytef*>(CPLMalloc(uncompressedSize)); 
-                doUncompression(compression, pSubData, m_cols[iField].chunks[startChunk].compressedSize,
-                    pUncompressed, uncompressedSize);
-                // stored as int64 internally
-                int64_t *pData = reinterpret_cast<int64_t*>(pUncompressed);
-                
-                // copy out
-                uint64_t count = 0;
-                while( (nCopiedRows < iLength) && (count < m_cols[iField].chunks[startChunk].length) ) 
-                {
-                    pnData[nCopiedRows] = pData[nElsToSkipAtStart];
-                    nCopiedRows++;
-                    nElsToSkipAtStart++;
-                    count++;
-                }
-                
-                CPLFree(pSubData);
-                CPLFree(pUncompressed);
-                startChunk++;
-                nElsToSkipAtStart = 0;
-            }
-            
-            while( nCopiedRows < iLength )
-            {
-                // we haven't been able to copy all the data they have requested 
-                // because that much data was never written. Pad with zeros.
-                pnData[nCopiedRows] = 0;
-                nCopiedRows++;
-            }
-            
+            return writeValues<int64_t>(iField, iStartRow, iLength, pnData);
         }
-        
-        
-    
+        return writeValues<double>(iField, iStartRow, iLength, pnData);
     }
-
-    
-    delete[] pn64Tmp;
-    
-    return CE_None;
     
+    if( eType == GFT_Integer )
+    {
+        return readValues<int64_t>(iField, iStartRow, iLength, pnData);
+    }
+    return readValues<double>(iField, iStartRow, iLength, pnData);
 }
 
-
 CPLErr EMURat::ValuesIO(GDALRWFlag eRWFlag, int iField, int iStartRow, int iLength, char **papszStrList)
 {
-    if( (iField < 0) || (iField > m_cols.size()))
+    bool bOK;
+    if( !checkRequest(iField, iStartRow, &iLength, &bOK) )
     {
-        CPLError(CE_Failure, CPLE_FileIO,
-                "Couldn't find column %d.",
-                iField);
-        return CE_Failure;
+        return bOK ? CE_None : CE_Failure;
     }
     
     // just do this for now, rather than complex conversions that KEA does
@@ -610,17 +1021,9 @@ CPLErr EMURat::ValuesIO(GDALRWFlag eRWFlag, int iField, int iStartRow, int iLeng
                 iField);
         return CE_Failure;
     }
-    
-    if( iStartRow >= m_nRowCount )
-    {
-        return CE_None;   
-    }
-    else if( (iStartRow + iLength) > m_nRowCount )
-    {
-        iLength = m_nRowCount - iStartRow;
-    }
 
-    const std::lock_guard<std::mutex> lock(*m_mutex);
+    EMUTimedLock lock(*m_mutex, m_pEMUDS->m_ioStats);
+    EMUIOTimer timer(m_pEMUDS->m_ioStats, (eRWFlag == GF_Write) ? EMU_IO_RAT_WRITE_NS : EMU_IO_RAT_READ_NS);
     if( eRWFlag == GF_Write) 
     {
         if(m_pEMUDS->GetAccess() != GA_Update)
@@ -630,139 +1033,52 @@ CPLErr EMURat::ValuesIO(GDALRWFlag eRWFlag, int iField, int iStartRow, int iLeng
             return CE_Failure;
         }
 
-        // TODO: set compression
-        uint8_t compression = COMPRESSION_ZLIB;
-        int iThisBlockLength;
-
+        std::vector<GByte> encoded;
         while(iLength > 0)
         {
-            if( iLength > MAX_RAT_CHUNK)
-            {
-                iThisBlockLength = MAX_RAT_CHUNK;
-            }
-            else
-            {
-                iThisBlockLength = iLength;
-            }
+            int iThisChunkLength = std::min(iLength, MAX_RAT_CHUNK);
         
-            vsi_l_offset chunkOffset = VSIFTellL(m_pEMUDS->m_fp);
-            
-            // work out the total size of all the strings (including null byte)
-            // so we can compress them all in one go
-            size_t totalStringSize = 0;
-            for( int i = 0; i < iThisBlockLength; i++ )
-            {
-                totalStringSize += strlen(papszStrList[i]) + 1;
-            }
-            
-            char *pszStringData = new char[totalStringSize];
-            char *pszCurrentDest = pszStringData;
-            for( int i = 0; i < iThisBlockLength; i++ )
-            {
-                pszCurrentDest = stpcpy(pszCurrentDest, papszStrList[i]) + 1;
-            }
-            
-            VSIFWriteL(&compression, sizeof(compression), 1, m_pEMUDS->m_fp);
-            size_t uncompressedSize = totalStringSize;
-            size_t compressedSize = uncompressedSize + 100;
-
-            bool bFree;
-            Bytef *pCompressed = doCompression(compression, reinterpret_cast<Bytef*>(pszStringData), uncompressedSize, &compressedSize, &bFree);
-                    
-            VSIFWriteL(pCompressed, compressedSize, 1, m_pEMUDS->m_fp);
-            
-            if( bFree ) 
+            // all the strings in one go so they can be compressed together
+            uint8_t nEncoding = encodeValues(papszStrList, iThisChunkLength, encoded);
+            CPLErr err = writeChunk(iField, iStartRow, iThisChunkLength, nEncoding,
+                        encoded.data(), encoded.size());
+            if( err != CE_None )
             {
-                CPLFree(pCompressed);
+                return err;
             }
-            
-            delete[] pszStringData;
-            
-            EMURatChunk chunk;
-            chunk.startIdx = iStartRow;
-            chunk.length = iThisBlockLength;
-            chunk.offset = chunkOffset;
-            chunk.compressedSize = compressedSize;
-            m_cols[iField].chunks.push_back(chunk);
 
-            papszStrList += iThisBlockLength;
-            iLength -= iThisBlockLength;
-            iStartRow += iThisBlockLength;
+            papszStrList += iThisChunkLength;
+            iLength -= iThisChunkLength;
+            iStartRow += iThisChunkLength;
         }
+        return CE_None;
     }
-    else
+
+    std::vector<EMURatSegment> segments;
+    CPLErr err = getSegments(iField, iStartRow, iLength, segments);
+    if( err != CE_None )
     {
-        bool bFound = false;
-        size_t startChunk = 0;
-        uint64_t nElsToSkipAtStart = 0;
-        uint64_t nCopiedRows = 0;
-        for( size_t n = 0; n < m_cols[iField].chunks.size(); n++)
-        {
-            if(m_cols[iField].chunks[n].startIdx <= iStartRow )
-            {
-                startChunk = n;
-                nElsToSkipAtStart = iStartRow - m_cols[iField].chunks[n].startIdx;
-                bFound = true;
-                break;
-            }
-        }
-        
-        if( bFound )
+        return err;
+    }
+
+    for( const EMURatSegment &seg : segments )
+    {
+        char **papszDest = papszStrList + seg.nDestRow;
+        for( uint64_t n = 0; n < seg.nRows; n++ )
         {
-            while( (nCopiedRows <  iLength) && (startChunk < m_cols[iField].chunks.size()) )
+            if( seg.pChunk == nullptr )
             {
-                // seek to where this block starts    
-                VSIFSeekL(m_pEMUDS->m_fp, m_cols[iField].chunks[startChunk].offset, SEEK_SET);
-    
-                // read compression type
-                uint8_t compression;
-                VSIFReadL(&compression, sizeof(compression), 1, m_pEMUDS->m_fp);
-    
-                // read the uncompressed data
-                Bytef *pSubData = static_cast<Bytef*>(CPLMalloc(m_cols[iField].chunks[startChunk].compressedSize));
-                VSIFReadL(pSubData, m_cols[iField].chunks[startChunk].compressedSize, 1, m_pEMUDS->m_fp);
-                
-                uint64_t uncompressedSize =  m_cols[iField].chunks[startChunk].length * sizeof(int); 
-                Bytef *pUncompressed = static_cast<Bytef*>(CPLMalloc(uncompressedSize)); 
-                doUncompression(compression, pSubData, m_cols[iField].chunks[startChunk].compressedSize,
-                    pUncompressed, uncompressedSize);
-                char *pszStringData = reinterpret_cast<char*>(pUncompressed);
-                char *pszCurrentSrc = pszStringData;
-                while( nElsToSkipAtStart > 0 )
-                {
-                    // go to next string
-                    pszCurrentSrc += (strlen(pszCurrentSrc) + 1);
-                    nElsToSkipAtStart--;
-                }
-                
-                // copy out
-                uint64_t count = 0;
-                while( (nCopiedRows < iLength) && (count < m_cols[iField].chunks[startChunk].length) ) 
-                {
-                    papszStrList[nCopiedRows] = CPLStrdup(pszCurrentSrc);
-                    // go to next string
-                    pszCurrentSrc += (strlen(pszCurrentSrc) + 1);
-                    nCopiedRows++;
-                    count++;
-                }
-                
-                CPLFree(pSubData);
-                CPLFree(pUncompressed);
-                startChunk++;
+                // that much data was never written. Pad with empty string.
+                papszDest[n] = CPLStrdup("");
             }
-            
-            while( nCopiedRows < iLength )
+            else
             {
-                // we haven't been able to copy all the data they have requested 
-                // because that much data was never written. Pad with empty string.
-                papszStrList[nCopiedRows] = CPLStrdup("");
-                nCopiedRows++;
+                const GByte *pString = seg.pChunk->data.data() + 
+                                seg.pChunk->stringOffsets[seg.nChunkRow + n];
+                papszDest[n] = CPLStrdup(reinterpret_cast<const char*>(pString));
             }
-            
         }
     }
-    
-    
     return CE_None;
 }
 
@@ -814,87 +1130,78 @@ CPLErr EMURat::CreateColumn( const char *pszFieldName,
     return CE_None;
 }
 
-bool chunkSortFunction(const EMURatChunk &a, const EMURatChunk &b)
-{
-    return a.startIdx < b.startIdx;
-}
-
-void EMURat::ReadIndex()
+bool EMURat::ReadIndex(EMUHeaderReader &reader, const std::vector<EMURatChunk> *pChunkTable)
 {
-    uint64_t nCols;
-    VSIFReadL(&nCols, sizeof(nCols), 1, m_pEMUDS->m_fp);
-    VSIFReadL(&m_nRowCount, sizeof(m_nRowCount), 1, m_pEMUDS->m_fp);
+    uint64_t nCols = 0;
+    reader.read(&nCols);
+    reader.read(&m_nRowCount);
 
     m_cols.clear();
-    for( int i = 0; i < nCols; i++ )
+    for( int i = 0; (i < nCols) && reader.isOK(); i++ )
     {
         EMURatColumn col;
         uint64_t nType;
-        VSIFReadL(&nType, sizeof(nType), 1, m_pEMUDS->m_fp);
+        reader.read(&nType);
         col.colType = static_cast<GDALRATFieldType>(nType);
         
-        std::string name;
-        char ch;
-        while(true)
+        reader.readString(&col.sName);
+        
+        if( pChunkTable != nullptr )
         {
-            VSIFReadL(&ch, sizeof(ch), 1, m_pEMUDS->m_fp);
-            if( ch == '\0')
+            // where this column's chunks are in the table
+            uint64_t nFirstChunk = 0, nChunks = 0;
+            reader.read(&nFirstChunk);
+            reader.read(&nChunks);
+            if( (nFirstChunk > pChunkTable->size()) || (nChunks > pChunkTable->size() - nFirstChunk) )
             {
-                break;
+                return false;
             }
-            else
+            col.chunks.assign(pChunkTable->begin() + nFirstChunk, 
+                            pChunkTable->begin() + nFirstChunk + nChunks);
+        }
+        else
+        {
+            uint64_t nChunks = 0;
+            reader.read(&nChunks);
+            for( int n = 0; (n < nChunks) && reader.isOK(); n++)
             {
-                name += ch;
+                EMURatChunk chunk;
+                reader.read(&chunk.startIdx);
+                reader.read(&chunk.length);
+                reader.read(&chunk.offset);
+                reader.read(&chunk.compressedSize);
+                col.chunks.push_back(chunk);
             }
         }
-        col.sName = name;
-        
-        uint64_t nChunks;
-        VSIFReadL(&nChunks, sizeof(nChunks), 1, m_pEMUDS->m_fp);
-        for( int n = 0; n < nChunks; n++)
+        // should already be sorted but make sure as we do a binary search
+        std::stable_sort(col.chunks.begin(), col.chunks.end(), chunkSortFunction);
+        for( const EMURatChunk &chunk : col.chunks )
         {
-            EMURatChunk chunk;
-            VSIFReadL(&chunk.startIdx, sizeof(chunk.startIdx), 1, m_pEMUDS->m_fp);
-            VSIFReadL(&chunk.length, sizeof(chunk.length), 1, m_pEMUDS->m_fp);
-            VSIFReadL(&chunk.offset, sizeof(chunk.offset), 1, m_pEMUDS->m_fp);
-            VSIFReadL(&chunk.compressedSize, sizeof(chunk.compressedSize), 1, m_pEMUDS->m_fp);
-            col.chunks.push_back(chunk);
+            col.nMaxChunkLength = std::max(col.nMaxChunkLength, chunk.length);
         }
         
         m_cols.push_back(col);
     }
+    return true;
 }
 
-void EMURat::WriteIndex()
+void EMURat::WriteIndex(EMUHeaderWriter &writer, std::vector<EMURatChunk> &chunkTable)
 {
     uint64_t nCols = m_cols.size();
-    VSIFWriteL(&nCols, sizeof(nCols), 1, m_pEMUDS->m_fp);
-    VSIFWriteL(&m_nRowCount, sizeof(m_nRowCount), 1, m_pEMUDS->m_fp);
+    writer.write(nCols);
+    writer.write(m_nRowCount);
      
     for( int i = 0; i < m_cols.size(); i++ )
     {
-        // sort first
-        std::sort(m_cols[i].chunks.begin(), m_cols[i].chunks.end(), chunkSortFunction);
+        // already sorted by addChunk
         uint64_t nType = m_cols[i].colType;
-        VSIFWriteL(&nType, sizeof(nType), 1, m_pEMUDS->m_fp);
-        
-        const char *pszName = m_cols[i].sName.c_str();
-        while( *pszName != '\0' )
-        {
-            VSIFWriteL(pszName, sizeof(char), 1, m_pEMUDS->m_fp);
-            pszName++;
-        }
-        VSIFWriteL(pszName, sizeof(char), 1, m_pEMUDS->m_fp); // null byte
+        writer.write(nType);
+        writer.writeString(m_cols[i].sName.c_str());
         
+        uint64_t nFirstChunk = chunkTable.size();
         uint64_t nChunks = m_cols[i].chunks.size();
-        VSIFWriteL(&nChunks, sizeof(nChunks), 1, m_pEMUDS->m_fp);
-        
-        for( auto itr = m_cols[i].chunks.begin(); itr != m_cols[i].chunks.end(); itr++ )
-        {
-            VSIFWriteL(&(*itr).startIdx, sizeof((*itr).startIdx), 1, m_pEMUDS->m_fp);
-            VSIFWriteL(&(*itr).length, sizeof((*itr).length), 1, m_pEMUDS->m_fp);
-            VSIFWriteL(&(*itr).offset, sizeof((*itr).offset), 1, m_pEMUDS->m_fp);
-            VSIFWriteL(&(*itr).compressedSize, sizeof((*itr).compressedSize), 1, m_pEMUDS->m_fp);
-        }
+        writer.write(nFirstChunk);
+        writer.write(nChunks);
+        chunkTable.insert(chunkTable.end(), m_cols[i].chunks.begin(), m_cols[i].chunks.end());
     }
 }
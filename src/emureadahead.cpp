@@ -0,0 +1,384 @@
+/*
+ *  emureadahead.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "cpl_error.h"
+
+#include "emureadahead.h"
+#include "emuband.h"
+
+EMUReadAhead::EMUReadAhead(EMUDataset *pDS, int nTiles, size_t nMaxBytes)
+{
+    m_pDS = pDS;
+    m_nTiles = nTiles;
+    m_nMaxBytes = nMaxBytes;
+    m_bStop = false;
+    m_pPool = new EMUThreadPool(std::min(nTiles, READAHEAD_MAX_THREADS));
+}
+
+EMUReadAhead::~EMUReadAhead()
+{
+    // jobs still queued see this and return straight away
+    m_bStop = true;
+    delete m_pPool;
+}
+
+void EMUReadAhead::notify(EMUBaseBand *pBand, uint64_t nXStart, uint64_t nYStart, 
+                uint64_t nXEnd, uint64_t nYEnd)
+{
+    uint64_t nLevel = pBand->m_nLevel;
+    uint64_t nKeyBand = pBand->getTileKeyBand();
+    uint64_t nXBlocks = (pBand->nRasterXSize + pBand->nBlockXSize - 1) / pBand->nBlockXSize;
+    uint64_t nYBlocks = (pBand->nRasterYSize + pBand->nBlockYSize - 1) / pBand->nBlockYSize;
+
+    // work out which tiles come next (if any) while we have the lock,
+    // but don't hold it while finding them in the index
+    std::vector<EMUTileKey> next;
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        auto itr = m_streams.find(std::make_pair(nLevel, nKeyBand));
+        if( itr == m_streams.end() )
+        {
+            EMUReadAheadStream stream;
+            stream.nXStart = nXStart;
+            stream.nYStart = nYStart;
+            stream.nXEnd = nXEnd;
+            stream.nYEnd = nYEnd;
+            stream.nRowStart = nXStart;
+            stream.nRowEnd = nXBlocks - 1;
+            stream.bInOrder = false;
+            m_streams[std::make_pair(nLevel, nKeyBand)] = stream;
+            return;
+        }
+
+        EMUReadAheadStream &stream = itr->second;
+        if( (nXStart >= stream.nXStart) && (nXEnd <= stream.nXEnd) && 
+            (nYStart >= stream.nYStart) && (nYEnd <= stream.nYEnd) )
+        {
+            // part of the last window (IReadBlock for the constant tiles in 
+            // a prefetch for instance). Nothing new.
+            return;
+        }
+        else if( (nYStart == stream.nYStart) && (nYEnd == stream.nYEnd) && 
+            (nXStart == stream.nXEnd + 1) )
+        {
+            // next window along
+            stream.nRowEnd = std::max(stream.nRowEnd, nXEnd);
+            stream.bInOrder = true;
+        }
+        else if( (nYStart == stream.nYEnd + 1) && (nXStart <= stream.nXStart) )
+        {
+            // start of the next row of windows
+            stream.nRowStart = nXStart;
+            stream.nRowEnd = std::max(nXEnd, stream.nXEnd);
+            stream.bInOrder = true;
+        }
+        else
+        {
+            stream.nRowStart = nXStart;
+            stream.nRowEnd = nXBlocks - 1;
+            stream.bInOrder = false;
+        }
+        stream.nXStart = nXStart;
+        stream.nYStart = nYStart;
+        stream.nXEnd = nXEnd;
+        stream.nYEnd = nYEnd;
+
+        // anything we read ahead for this stream that has been skipped
+        // over (or everything if it isn't in order any more) won't be wanted
+        dropTiles(nLevel, nKeyBand, !stream.bInOrder, nXStart, nYStart, nYEnd);
+        if( !stream.bInOrder )
+        {
+            return;
+        }
+
+        // assume the next windows are the same size as this one
+        uint64_t nWidth = nXEnd - nXStart + 1;
+        uint64_t nHeight = nYEnd - nYStart + 1;
+        uint64_t nNextXStart = nXStart, nNextXEnd = nXEnd;
+        uint64_t nNextYStart = nYStart, nNextYEnd = nYEnd;
+        while( next.size() < static_cast<size_t>(m_nTiles) )
+        {
+            if( nNextXEnd < stream.nRowEnd )
+            {
+                nNextXStart = nNextXEnd + 1;
+                nNextXEnd = std::min(nNextXEnd + nWidth, stream.nRowEnd);
+            }
+            else
+            {
+                nNextXStart = stream.nRowStart;
+                nNextXEnd = std::min(stream.nRowStart + nWidth - 1, stream.nRowEnd);
+                nNextYStart = nNextYEnd + 1;
+                nNextYEnd = nNextYEnd + nHeight;
+            }
+            if( nNextYStart >= nYBlocks )
+            {
+                break;
+            }
+
+            EMUTileKey nextKey;
+            nextKey.ovrLevel = nLevel;
+            nextKey.band = nKeyBand;
+            for( nextKey.y = nNextYStart; (nextKey.y <= std::min(nNextYEnd, nYBlocks - 1)) && 
+                    (next.size() < static_cast<size_t>(m_nTiles)); nextKey.y++ )
+            {
+                for( nextKey.x = nNextXStart; (nextKey.x <= nNextXEnd) && (nextKey.x < nXBlocks) && 
+                        (next.size() < static_cast<size_t>(m_nTiles)); nextKey.x++ )
+                {
+                    if( m_tiles.find(nextKey) == m_tiles.end() )
+                    {
+                        next.push_back(nextKey);
+                    }
+                }
+            }
+        }
+    }
+
+    int nTypeSize = GDALGetDataTypeSize(pBand->eDataType) / 8;
+    int nTileBands = pBand->getTileBandCount();
+    for( const EMUTileKey &nextKey : next )
+    {
+        // already in GDAL's block cache?
+        GDALRasterBlock *pBlock = pBand->TryGetLockedBlockRef(nextKey.x, nextKey.y);
+        if( pBlock != nullptr )
+        {
+            pBlock->DropLock();
+            continue;
+        }
+
+        EMUTileValue val;
+        try
+        {
+            val = m_pDS->getTileOffset(nextKey.ovrLevel, nextKey.band, nextKey.x, nextKey.y);
+        }
+        catch(const std::out_of_range& oor)
+        {
+            continue;
+        }
+        if( (val.offset == 0) || (val.offset == EMU_TILE_CONSTANT) )
+        {
+            // nothing to read
+            continue;
+        }
+
+        int nXValid = std::min<GIntBig>(pBand->nBlockXSize, 
+                pBand->nRasterXSize - static_cast<GIntBig>(nextKey.x) * pBand->nBlockXSize);
+        int nYValid = std::min<GIntBig>(pBand->nBlockYSize, 
+                pBand->nRasterYSize - static_cast<GIntBig>(nextKey.y) * pBand->nBlockYSize);
+        if( val.uncompressedSize != static_cast<uint64_t>(nXValid) * nYValid * nTypeSize * nTileBands )
+        {
+            // IReadBlock will complain about this one
+            continue;
+        }
+        if( !queueTile(nextKey, val, nTypeSize, nXValid, nYValid * nTileBands) )
+        {
+            // no room for any more at the moment
+            break;
+        }
+    }
+}
+
+// returns false if there isn't room for it
+bool EMUReadAhead::queueTile(const EMUTileKey &key, const EMUTileValue &val, 
+                int nTypeSize, int nXValid, int nYValid)
+{
+    std::shared_ptr<EMUReadAheadTile> pTile;
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        if( m_tiles.find(key) != m_tiles.end() )
+        {
+            // another thread got there first
+            return true;
+        }
+        if( m_nBytes + val.uncompressedSize > m_nMaxBytes )
+        {
+            return false;
+        }
+        pTile = std::make_shared<EMUReadAheadTile>();
+        pTile->nBytes = val.uncompressedSize;
+        m_tiles[key] = pTile;
+        m_nBytes += pTile->nBytes;
+    }
+    m_pPool->submit([this, pTile, key, val, nTypeSize, nXValid, nYValid]() {
+        readTile(pTile, key, val, nTypeSize, nXValid, nYValid);
+    });
+    return true;
+}
+
+// Runs on one of the read ahead threads. Errors are ignored - IReadBlock 
+// will try again and report them.
+void EMUReadAhead::readTile(std::shared_ptr<EMUReadAheadTile> pTile, EMUTileKey key, 
+                EMUTileValue val, int nTypeSize, int nXValid, int nYValid)
+{
+    std::shared_ptr<const EMUCacheEntry> pEntry;
+    if( !m_bStop )
+    {
+        CPLPushErrorHandler(CPLQuietErrorHandler);
+        EMUTileCache *pCache = m_pDS->m_pTileCache;
+        EMUCacheKey cacheKey;
+        cacheKey.fileId = m_pDS->m_nCacheFileId;
+        cacheKey.tile = key;
+        std::shared_ptr<const EMUCacheEntry> pCached;
+        if( pCache != nullptr )
+        {
+            pCached = pCache->get(cacheKey);
+            m_pDS->m_ioStats.add(pCached ? EMU_IO_CACHE_HITS : EMU_IO_CACHE_MISSES, 1);
+        }
+
+        if( pCached && pCached->bDecompressed && (pCached->data.size() == val.uncompressedSize) )
+        {
+            pEntry = pCached;
+        }
+        else
+        {
+            std::vector<GByte> tileData;
+            const GByte *pTileData = nullptr;
+            if( pCached && !pCached->bDecompressed && (pCached->data.size() == val.size + 1) )
+            {
+                pTileData = pCached->data.data();
+            }
+            else
+            {
+                // the compression type and the data
+                tileData.resize(val.size + 1);
+                VSILFILE *fp = m_pDS->acquireReadHandle();
+                if( fp != nullptr )
+                {
+                    bool bOK = (VSIFSeekL(fp, val.offset, SEEK_SET) == 0) && 
+                        (VSIFReadL(tileData.data(), tileData.size(), 1, fp) == 1);
+                    m_pDS->releaseReadHandle(fp);
+                    m_pDS->m_ioStats.add(EMU_IO_READ_CALLS, 1);
+                    m_pDS->m_ioStats.add(EMU_IO_BYTES_READ, tileData.size());
+                    if( bOK )
+                    {
+                        pTileData = tileData.data();
+                        if( (pCache != nullptr) && !pCache->cachesDecompressed() )
+                        {
+                            pCache->put(cacheKey, pTileData, tileData.size(), false);
+                        }
+                    }
+                }
+            }
+
+            if( pTileData != nullptr )
+            {
+                auto pNewEntry = std::make_shared<EMUCacheEntry>();
+                pNewEntry->bDecompressed = true;
+                pNewEntry->data.resize(val.uncompressedSize);
+                bool bOK;
+                {
+                    EMUIOTimer timer(m_pDS->m_ioStats, EMU_IO_DECOMPRESS_NS);
+                    bOK = doTileUncompression(pTileData[0], nTypeSize, nXValid, nYValid, 
+                            pTileData + 1, val.size, pNewEntry->data.data(), val.uncompressedSize);
+                }
+                if( bOK )
+                {
+                    m_pDS->m_ioStats.add(EMU_IO_TILES_READ, 1);
+                    m_pDS->m_ioStats.add(EMU_IO_READAHEAD_TILES, 1);
+                    if( (pCache != nullptr) && pCache->cachesDecompressed() )
+                    {
+                        pCache->put(cacheKey, pNewEntry->data.data(), pNewEntry->data.size(), true);
+                    }
+                    pEntry = pNewEntry;
+                }
+            }
+        }
+        CPLPopErrorHandler();
+    }
+
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        if( pTile->bDropped )
+        {
+            // no one will take it so its memory can go now
+            m_nBytes -= pTile->nBytes;
+        }
+        else
+        {
+            pTile->pEntry = pEntry;
+        }
+        pTile->bDone = true;
+    }
+    m_doneCond.notify_all();
+}
+
+std::shared_ptr<const EMUCacheEntry> EMUReadAhead::take(const EMUTileKey &key)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto itr = m_tiles.find(key);
+    if( itr == m_tiles.end() )
+    {
+        return nullptr;
+    }
+    std::shared_ptr<EMUReadAheadTile> pTile = itr->second;
+    m_tiles.erase(itr);
+    if( !pTile->bDone )
+    {
+        EMUIOTimer timer(m_pDS->m_ioStats, EMU_IO_READAHEAD_WAIT_NS);
+        m_doneCond.wait(lock, [&pTile]{ return pTile->bDone; });
+    }
+    // still counted until now as the read was using the memory
+    m_nBytes -= pTile->nBytes;
+    if( pTile->pEntry )
+    {
+        m_pDS->m_ioStats.add(EMU_IO_READAHEAD_HITS, 1);
+    }
+    return pTile->pEntry;
+}
+
+// must have the lock. Tiles still being read are finished but thrown away, 
+// staying in the budget until then.
+void EMUReadAhead::dropTiles(uint64_t nLevel, uint64_t nBand, bool bAll, 
+                uint64_t nXStart, uint64_t nYStart, uint64_t nYEnd)
+{
+    for( auto itr = m_tiles.begin(); itr != m_tiles.end(); )
+    {
+        const EMUTileKey &tileKey = itr->first;
+        if( (tileKey.ovrLevel == nLevel) && (tileKey.band == nBand) && 
+            (bAll || (tileKey.y < nYStart) || ((tileKey.y <= nYEnd) && (tileKey.x < nXStart))) )
+        {
+            if( itr->second->bDone )
+            {
+                m_nBytes -= itr->second->nBytes;
+            }
+            else
+            {
+                itr->second->bDropped = true;
+            }
+            itr = m_tiles.erase(itr);
+        }
+        else
+        {
+            ++itr;
+        }
+    }
+}
@@ -0,0 +1,348 @@
+/*
+ *  emustats.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+#include "emustats.h"
+
+EMUStatsAccumulator::EMUStatsAccumulator(GDALDataType eType, bool bNoData, double dfNoData)
+{
+    m_eType = eType;
+    m_bInteger = !GDALDataTypeIsFloating(eType);
+    m_bNoData = bNoData;
+    m_dfNoData = dfNoData;
+    m_histogram.resize(EMU_HISTO_BINS, 0);
+
+    if( (eType == GDT_Byte) || (eType == GDT_Int8) )
+    {
+        // one bin per value, like everyone else does
+        m_dHistOrigin = (eType == GDT_Byte) ? 0 : -128;
+        m_dHistWidth = 1;
+    }
+}
+
+template <class T>
+static bool isValid(T val, bool bNoData, T noData)
+{
+    if( std::is_floating_point<T>::value && !std::isfinite(static_cast<double>(val)) )
+    {
+        return false;
+    }
+    return !bNoData || (val != noData);
+}
+
+// the bin for dfValue. Clamped before the cast as with the full range
+// bins the offset from the origin can overflow.
+static int getBin(double dfValue, double dfOrigin, double dfScale)
+{
+    double dfBin = (dfValue - dfOrigin) * dfScale;
+    return static_cast<int>(std::min(std::max(dfBin, 0.0), EMU_HISTO_BINS - 1.0));
+}
+
+// the bottom of bin n (or the top of the histogram for EMU_HISTO_BINS). 
+// Halved as the full range bins overflow otherwise, which is still exact 
+// for the power of 2 bins.
+double EMUStatsAccumulator::getBinEdge(int n) const
+{
+    return ((m_dHistOrigin / 2) + (n * (m_dHistWidth / 2))) * 2;
+}
+
+// make sure the histogram covers dfMin to dfMax (and what it had before)
+void EMUStatsAccumulator::growHistogram(double dfMin, double dfMax)
+{
+    if( (m_dHistWidth != 0) && (dfMin >= m_dHistOrigin) && 
+            (dfMax < m_dHistOrigin + (m_dHistWidth * EMU_HISTO_BINS)) )
+    {
+        // already covered
+        return;
+    }
+
+    if( (m_dHistWidth != 0) && (m_nCount > 0) )
+    {
+        // include the old values
+        dfMin = std::min(dfMin, m_dMin);
+        dfMax = std::max(dfMax, m_dMax);
+    }
+
+    double dfWidth = m_dHistWidth;
+    double dfOrigin = 0;
+    bool bFinite = std::isfinite(dfMax - dfMin);
+    if( bFinite )
+    {
+        if( dfWidth == 0 )
+        {
+            // first block
+            if( m_bInteger )
+            {
+                dfWidth = 1;
+            }
+            else
+            {
+                // a power of 2 so merging bins is exact
+                double dfRange = dfMax - dfMin;
+                if( dfRange == 0 )
+                {
+                    dfRange = std::max(std::fabs(dfMin), 1.0);
+                }
+                dfWidth = std::ldexp(1.0, static_cast<int>(std::ceil(std::log2(dfRange / EMU_HISTO_BINS))));
+            }
+        }
+
+        dfOrigin = std::floor(dfMin / dfWidth) * dfWidth;
+        while( dfMax >= dfOrigin + (dfWidth * EMU_HISTO_BINS) )
+        {
+            dfWidth *= 2;
+            dfOrigin = std::floor(dfMin / dfWidth) * dfWidth;
+        }
+        bFinite = std::isfinite(dfOrigin) && std::isfinite(dfOrigin + (dfWidth * EMU_HISTO_BINS));
+    }
+    if( !bFinite )
+    {
+        // near +/-DBL_MAX the range (or the power of 2 bins covering it)
+        // overflows. Use bins that cover every finite value instead, 
+        // which never need to grow again.
+        dfWidth = std::numeric_limits<double>::max() / (EMU_HISTO_BINS / 2);
+        dfOrigin = -std::numeric_limits<double>::max();
+    }
+
+    if( (dfWidth == m_dHistWidth) && (dfOrigin == m_dHistOrigin) )
+    {
+        return;
+    }
+
+    if( m_dHistWidth != 0 )
+    {
+        // merge the old bins into the new ones
+        std::vector<uint64_t> newHist(EMU_HISTO_BINS, 0);
+        for( int n = 0; n < EMU_HISTO_BINS; n++ )
+        {
+            if( m_histogram[n] != 0 )
+            {
+                newHist[getBin(getBinEdge(n), dfOrigin, 1.0 / dfWidth)] += m_histogram[n];
+            }
+        }
+        m_histogram.swap(newHist);
+    }
+    m_dHistWidth = dfWidth;
+    m_dHistOrigin = dfOrigin;
+}
+
+template <class T>
+void EMUStatsAccumulator::addTyped(const T *pData, int nLineSize, int nXValid, int nYValid)
+{
+    T noData = static_cast<T>(m_dfNoData);
+    // a nodata value that can't be represented can't be in the data either
+    bool bNoData = m_bNoData && (static_cast<double>(noData) == m_dfNoData);
+    bool bCheck = bNoData || std::is_floating_point<T>::value;
+
+    // first the count, min, max and mean of this block. The loops without
+    // checks are simple enough for the compiler to vectorise.
+    uint64_t nCount = 0;
+    double dSum = 0;
+    T minVal = std::numeric_limits<T>::max();
+    T maxVal = std::numeric_limits<T>::lowest();
+    for( int y = 0; y < nYValid; y++ )
+    {
+        const T *pRow = pData + static_cast<size_t>(y) * nLineSize;
+        if( !bCheck )
+        {
+            for( int x = 0; x < nXValid; x++ )
+            {
+                dSum += pRow[x];
+                minVal = std::min(minVal, pRow[x]);
+                maxVal = std::max(maxVal, pRow[x]);
+            }
+            nCount += nXValid;
+        }
+        else
+        {
+            for( int x = 0; x < nXValid; x++ )
+            {
+                if( isValid(pRow[x], bNoData, noData) )
+                {
+                    dSum += pRow[x];
+                    minVal = std::min(minVal, pRow[x]);
+                    maxVal = std::max(maxVal, pRow[x]);
+                    nCount++;
+                }
+            }
+        }
+    }
+    if( nCount == 0 )
+    {
+        return;
+    }
+
+    // then the squared differences from the block mean, which is
+    // more accurate than summing the squares
+    double dMean = dSum / nCount;
+    double dM2 = 0;
+    for( int y = 0; y < nYValid; y++ )
+    {
+        const T *pRow = pData + static_cast<size_t>(y) * nLineSize;
+        for( int x = 0; x < nXValid; x++ )
+        {
+            if( !bCheck || isValid(pRow[x], bNoData, noData) )
+            {
+                double dDiff = pRow[x] - dMean;
+                dM2 += dDiff * dDiff;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    growHistogram(minVal, maxVal);
+    double dOrigin = m_dHistOrigin;
+    double dScale = 1.0 / m_dHistWidth;
+    for( int y = 0; y < nYValid; y++ )
+    {
+        const T *pRow = pData + static_cast<size_t>(y) * nLineSize;
+        for( int x = 0; x < nXValid; x++ )
+        {
+            if( !bCheck || isValid(pRow[x], bNoData, noData) )
+            {
+                m_histogram[getBin(pRow[x], dOrigin, dScale)]++;
+            }
+        }
+    }
+
+    // combine with what we have already (Chan et al's version of Welford)
+    if( m_nCount == 0 )
+    {
+        m_dMin = minVal;
+        m_dMax = maxVal;
+        m_dMean = dMean;
+        m_dM2 = dM2;
+        m_nCount = nCount;
+    }
+    else
+    {
+        double dTotal = static_cast<double>(m_nCount) + nCount;
+        double dDelta = dMean - m_dMean;
+        m_dMean += dDelta * (nCount / dTotal);
+        m_dM2 += dM2 + (dDelta * dDelta) * (m_nCount * (nCount / dTotal));
+        m_dMin = std::min<double>(m_dMin, minVal);
+        m_dMax = std::max<double>(m_dMax, maxVal);
+        m_nCount += nCount;
+    }
+}
+
+bool EMUStatsAccumulator::addBlock(const void *pData, int nLineSize, int nXValid, int nYValid)
+{
+    switch( m_eType )
+    {
+        case GDT_Byte:
+            addTyped(static_cast<const uint8_t*>(pData), nLineSize, nXValid, nYValid);
+            break;
+        case GDT_Int8:
+            addTyped(static_cast<const int8_t*>(pData), nLineSize, nXValid, nYValid);
+            break;
+        case GDT_UInt16:
+            addTyped(static_cast<const uint16_t*>(pData), nLineSize, nXValid, nYValid);
+            break;
+        case GDT_Int16:
+            addTyped(static_cast<const int16_t*>(pData), nLineSize, nXValid, nYValid);
+            break;
+        case GDT_UInt32:
+            addTyped(static_cast<const uint32_t*>(pData), nLineSize, nXValid, nYValid);
+            break;
+        case GDT_Int32:
+            addTyped(static_cast<const int32_t*>(pData), nLineSize, nXValid, nYValid);
+            break;
+        case GDT_UInt64:
+            addTyped(static_cast<const uint64_t*>(pData), nLineSize, nXValid, nYValid);
+            break;
+        case GDT_Int64:
+            addTyped(static_cast<const int64_t*>(pData), nLineSize, nXValid, nYValid);
+            break;
+        case GDT_Float32:
+            addTyped(static_cast<const float*>(pData), nLineSize, nXValid, nYValid);
+            break;
+        case GDT_Float64:
+            addTyped(static_cast<const double*>(pData), nLineSize, nXValid, nYValid);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+bool EMUStatsAccumulator::getStatistics(double *pdfMin, double *pdfMax, double *pdfMean, double *pdfStdDev)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if( m_nCount == 0 )
+    {
+        return false;
+    }
+    *pdfMin = m_dMin;
+    *pdfMax = m_dMax;
+    *pdfMean = m_dMean;
+    // population standard deviation, same as GDAL
+    *pdfStdDev = std::sqrt(m_dM2 / m_nCount);
+    return true;
+}
+
+bool EMUStatsAccumulator::getHistogram(double *pdfMin, double *pdfMax, std::vector<uint64_t> &counts)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if( m_nCount == 0 )
+    {
+        return false;
+    }
+
+    // for the 8 bit types we keep all the bins so they start at 0 (or -128).
+    // Otherwise drop the empty bins at either end.
+    int nFirst = 0, nLast = EMU_HISTO_BINS - 1;
+    if( (m_eType != GDT_Byte) && (m_eType != GDT_Int8) )
+    {
+        while( m_histogram[nFirst] == 0 )
+        {
+            nFirst++;
+        }
+        while( m_histogram[nLast] == 0 )
+        {
+            nLast--;
+        }
+    }
+    counts.assign(m_histogram.begin() + nFirst, m_histogram.begin() + nLast + 1);
+
+    *pdfMin = getBinEdge(nFirst);
+    *pdfMax = getBinEdge(nLast + 1);
+    if( m_bInteger )
+    {
+        // so the bins are centred on the integer values
+        *pdfMin -= 0.5;
+        *pdfMax -= 0.5;
+    }
+    return true;
+}
@@ -0,0 +1,102 @@
+/*
+ *  emuthreadpool.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "emuthreadpool.h"
+
+EMUThreadPool::EMUThreadPool(int nThreads)
+{
+    m_nPending = 0;
+    m_bStop = false;
+    for( int n = 0; n < nThreads; n++ )
+    {
+        m_threads.push_back(std::thread(&EMUThreadPool::workerLoop, this));
+    }
+}
+
+EMUThreadPool::~EMUThreadPool()
+{
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+    }
+    m_jobCond.notify_all();
+    for( auto &thread : m_threads )
+    {
+        thread.join();
+    }
+}
+
+void EMUThreadPool::submit(std::function<void()> job)
+{
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+        m_nPending++;
+    }
+    m_jobCond.notify_one();
+}
+
+void EMUThreadPool::waitCompletion()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_doneCond.wait(lock, [this]{ return m_nPending == 0; });
+}
+
+int EMUThreadPool::getThreadCount() const
+{
+    return m_threads.size();
+}
+
+void EMUThreadPool::workerLoop()
+{
+    while( true )
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_jobCond.wait(lock, [this]{ return m_bStop || !m_jobs.empty(); });
+            if( m_jobs.empty() )
+            {
+                // must be stopping and nothing left to do
+                return;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        job();
+
+        {
+            const std::lock_guard<std::mutex> lock(m_mutex);
+            m_nPending--;
+        }
+        m_doneCond.notify_all();
+    }
+}
@@ -0,0 +1,149 @@
+/*
+ *  emutilecache.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "emutilecache.h"
+
+// rough size of the bookkeeping for each entry
+const size_t ENTRY_OVERHEAD = 128;
+
+EMUTileCache *EMUTileCache::getInstance()
+{
+    static std::unique_ptr<EMUTileCache> pInstance;
+    static std::once_flag created;
+    std::call_once(created, []() {
+        double dMB = CPLAtof(CPLGetConfigOption("EMU_CACHE_MB", "0"));
+        if( dMB > 0 )
+        {
+            bool bDecompressed = CPLTestBool(CPLGetConfigOption("EMU_CACHE_DECOMPRESSED", "NO"));
+            pInstance.reset(new EMUTileCache(static_cast<size_t>(dMB * 1024 * 1024), bDecompressed));
+        }
+    });
+    return pInstance.get();
+}
+
+EMUTileCache::EMUTileCache(size_t nMaxBytes, bool bDecompressed)
+{
+    m_nMaxBytes = nMaxBytes;
+    m_bDecompressed = bDecompressed;
+    m_nHits = 0;
+    m_nMisses = 0;
+}
+
+uint64_t EMUTileCache::getFileId(const std::string &osFilename, uint64_t nFileSize, 
+                const std::string &osValidator)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    if( osValidator.empty() )
+    {
+        m_fileIds.erase(osFilename);
+        return m_nNextFileId++;
+    }
+    auto itr = m_fileIds.find(osFilename);
+    if( (itr != m_fileIds.end()) && (itr->second.nFileSize == nFileSize) && 
+        (itr->second.osValidator == osValidator) )
+    {
+        return itr->second.nId;
+    }
+    
+    // new file, or it has been re-written since it was last opened. 
+    // Any old entries will be evicted as they won't get used.
+    EMUCacheFile file;
+    file.nId = m_nNextFileId++;
+    file.nFileSize = nFileSize;
+    file.osValidator = osValidator;
+    m_fileIds[osFilename] = file;
+    return file.nId;
+}
+
+void EMUTileCache::forgetFile(const std::string &osFilename)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_fileIds.erase(osFilename);
+}
+
+std::shared_ptr<const EMUCacheEntry> EMUTileCache::get(const EMUCacheKey &key)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    auto itr = m_map.find(key);
+    if( itr == m_map.end() )
+    {
+        m_nMisses++;
+        return nullptr;
+    }
+    
+    // move to the front
+    m_lru.splice(m_lru.begin(), m_lru, itr->second);
+    m_nHits++;
+    return itr->second->second;
+}
+
+void EMUTileCache::put(const EMUCacheKey &key, const GByte *pData, size_t nSize, bool bDecompressed)
+{
+    if( (nSize + ENTRY_OVERHEAD) > m_nMaxBytes )
+    {
+        return;
+    }
+    
+    // do the copy before we lock
+    std::shared_ptr<EMUCacheEntry> pEntry = std::make_shared<EMUCacheEntry>();
+    pEntry->bDecompressed = bDecompressed;
+    pEntry->data.assign(pData, pData + nSize);
+    
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    auto itr = m_map.find(key);
+    if( itr != m_map.end() )
+    {
+        // another thread got there first
+        return;
+    }
+    m_lru.push_front(std::make_pair(key, pEntry));
+    m_map[key] = m_lru.begin();
+    m_nUsedBytes += (nSize + ENTRY_OVERHEAD);
+    evict();
+}
+
+size_t EMUTileCache::getUsedBytes()
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nUsedBytes;
+}
+
+// remove the least recently used entries until we are under budget. 
+// m_mutex must be held.
+void EMUTileCache::evict()
+{
+    while( (m_nUsedBytes > m_nMaxBytes) && !m_lru.empty() )
+    {
+        const EMUCacheItem &item = m_lru.back();
+        m_nUsedBytes -= (item.second->data.size() + ENTRY_OVERHEAD);
+        m_map.erase(item.first);
+        m_lru.pop_back();
+    }
+}
@@ -0,0 +1,194 @@
+/*
+ *  emutest.h
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Helpers shared by the tests. Each test is a small program that returns
+// non zero if any check failed. Files are written to /vsimem/ so nothing 
+// is left behind.
+
+#ifndef EMUTEST_H
+#define EMUTEST_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "gdal_priv.h"
+#include "cpl_string.h"
+#include "cpl_vsi.h"
+
+CPL_C_START
+void GDALRegister_EMU(void);
+CPL_C_END
+
+static int g_nFailures = 0;
+
+#define EMU_CHECK(cond) \
+    do \
+    { \
+        if( !(cond) ) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            g_nFailures++; \
+        } \
+    } while(0)
+
+// CHECK that stops the test function (which must return void) if it fails
+#define EMU_REQUIRE(cond) \
+    do \
+    { \
+        if( !(cond) ) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            g_nFailures++; \
+            return; \
+        } \
+    } while(0)
+
+static GDALDriver *getEMUDriver()
+{
+    GDALRegister_EMU();
+    return GetGDALDriverManager()->GetDriverByName("EMU");
+}
+
+static std::string tempFilename(const char *pszName)
+{
+    return std::string("/vsimem/emutest_") + pszName + ".emu";
+}
+
+// options are "NAME=VALUE" strings
+static GDALDataset *createEMU(const std::string &osFilename, int nXSize, int nYSize, int nBands, 
+                GDALDataType eType, const std::vector<std::string> &options = {})
+{
+    CPLStringList aosOptions;
+    for( const std::string &osOption : options )
+    {
+        aosOptions.AddString(osOption.c_str());
+    }
+    return getEMUDriver()->Create(osFilename.c_str(), nXSize, nYSize, nBands, eType, aosOptions.List());
+}
+
+// files in tests/data. EMU_TEST_DATA is set by CMake
+#ifndef EMU_TEST_DATA
+#define EMU_TEST_DATA "tests/data"
+#endif
+
+static std::string dataFilename(const char *pszName)
+{
+    return std::string(EMU_TEST_DATA) + "/" + pszName;
+}
+
+static GDALDataset *openEMU(const std::string &osFilename)
+{
+    return GDALDataset::Open(osFilename.c_str(), GDAL_OF_RASTER);
+}
+
+static const char *getIOStat(GDALDataset *pDS, const char *pszName)
+{
+    const char *pszValue = pDS->GetMetadataItem(pszName, "EMU_STATS");
+    return (pszValue != nullptr) ? pszValue : "";
+}
+
+// the value of each pixel written by writePattern and checked by countBadPixels
+typedef double (*EMUPatternFn)(int nBand, int x, int y);
+
+// write the pattern to the whole of every band of pDS
+static bool writePattern(GDALDataset *pDS, EMUPatternFn pfnPattern)
+{
+    int nXSize = pDS->GetRasterXSize(), nYSize = pDS->GetRasterYSize();
+    std::vector<double> data(static_cast<size_t>(nXSize) * nYSize);
+    for( int nBand = 1; nBand <= pDS->GetRasterCount(); nBand++ )
+    {
+        for( int y = 0; y < nYSize; y++ )
+        {
+            for( int x = 0; x < nXSize; x++ )
+            {
+                data[static_cast<size_t>(y) * nXSize + x] = pfnPattern(nBand, x, y);
+            }
+        }
+        if( pDS->GetRasterBand(nBand)->RasterIO(GF_Write, 0, 0, nXSize, nYSize, data.data(),
+                nXSize, nYSize, GDT_Float64, 0, 0, nullptr) != CE_None )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// create a file for pszName and write the pattern to it. Returns "" if
+// either failed
+static std::string writePatternFile(const char *pszName, int nXSize, int nYSize, int nBands,
+                GDALDataType eType, EMUPatternFn pfnPattern, const std::vector<std::string> &options = {})
+{
+    std::string osFilename = tempFilename(pszName);
+    GDALDataset *pDS = createEMU(osFilename, nXSize, nYSize, nBands, eType, options);
+    if( pDS == nullptr )
+    {
+        return "";
+    }
+    bool bOK = writePattern(pDS, pfnPattern);
+    GDALClose(pDS);
+    return bOK ? osFilename : "";
+}
+
+// number of pixels in the window of pBand that aren't the pattern (all of
+// them if it can't be read)
+static int countBadPixels(GDALRasterBand *pBand, EMUPatternFn pfnPattern,
+                int nXOff, int nYOff, int nXSize, int nYSize)
+{
+    std::vector<double> data(static_cast<size_t>(nXSize) * nYSize);
+    if( pBand->RasterIO(GF_Read, nXOff, nYOff, nXSize, nYSize, data.data(), nXSize, nYSize,
+                GDT_Float64, 0, 0, nullptr) != CE_None )
+    {
+        return nXSize * nYSize;
+    }
+    int nBad = 0;
+    for( int y = 0; y < nYSize; y++ )
+    {
+        for( int x = 0; x < nXSize; x++ )
+        {
+            nBad += (data[static_cast<size_t>(y) * nXSize + x] !=
+                    pfnPattern(pBand->GetBand(), nXOff + x, nYOff + y));
+        }
+    }
+    return nBad;
+}
+
+static int finishTests(const char *pszName)
+{
+    if( g_nFailures > 0 )
+    {
+        fprintf(stderr, "%s: %d checks failed\n", pszName, g_nFailures);
+        return 1;
+    }
+    printf("%s: OK\n", pszName);
+    return 0;
+}
+
+#endif //EMUTEST_H
@@ -0,0 +1,116 @@
+/*
+ *  test_constant.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Tiles that are all one value are only stored in the tile index and 
+// filled in by fillBlock when read. Values whose bytes differ (so they 
+// can't just be memset) in partial edge tiles and with INTERLEAVE=PIXEL.
+
+#include <cstdlib>
+
+#include "emutest.h"
+
+// 3 by 2 tiles with partial ones on the right and bottom
+const int TEST_XSIZE = 150;
+const int TEST_YSIZE = 100;
+const int TEST_BLOCK = 64;
+// 0x0102 as Int16, and bytes that aren't all the same as Float64 too
+const double CONSTANT_VALUE = 258;
+// all the bytes are the same as Int16 but not as Float64
+const double OTHER_VALUE = -2;
+
+// tile 1,0 is OTHER_VALUE, 1,1 isn't constant and the rest are CONSTANT_VALUE
+static double pixelValue(int nBand, int x, int y)
+{
+    int nTileX = x / TEST_BLOCK, nTileY = y / TEST_BLOCK;
+    if( (nTileX == 1) && (nTileY == 1) )
+    {
+        return nBand * 100 + x + y;
+    }
+    if( nTileX == 1 )
+    {
+        return OTHER_VALUE;
+    }
+    return CONSTANT_VALUE;
+}
+
+const int CONSTANT_TILES = 5;
+
+static std::string writeTestFile(GDALDataType eType, int nBands, const char *pszInterleave)
+{
+    std::string osFilename = tempFilename("constant");
+    GDALDataset *pDS = createEMU(osFilename, TEST_XSIZE, TEST_YSIZE, nBands, eType, 
+                {CPLSPrintf("BLOCKXSIZE=%d", TEST_BLOCK), CPLSPrintf("BLOCKYSIZE=%d", TEST_BLOCK), 
+                 CPLSPrintf("INTERLEAVE=%s", pszInterleave)});
+    if( pDS == nullptr )
+    {
+        return "";
+    }
+    EMU_CHECK(writePattern(pDS, pixelValue));
+    // with PIXEL a tile is only constant if all its bands are
+    int nTileBands = EQUAL(pszInterleave, "PIXEL") ? 1 : nBands;
+    EMU_CHECK(atoi(getIOStat(pDS, "CONSTANT_TILES_WRITTEN")) == CONSTANT_TILES * nTileBands);
+    GDALClose(pDS);
+    return osFilename;
+}
+
+static void testConstant(GDALDataType eType, int nBands, const char *pszInterleave)
+{
+    std::string osFilename = writeTestFile(eType, nBands, pszInterleave);
+    EMU_REQUIRE(!osFilename.empty());
+
+    // just the bottom right (partial) tile first
+    GDALDataset *pDS = openEMU(osFilename);
+    EMU_REQUIRE(pDS != nullptr);
+    for( int nBand = 1; nBand <= nBands; nBand++ )
+    {
+        EMU_CHECK(countBadPixels(pDS->GetRasterBand(nBand), pixelValue, 130, 70, 20, 30) == 0);
+    }
+    GDALClose(pDS);
+
+    pDS = openEMU(osFilename);
+    EMU_REQUIRE(pDS != nullptr);
+    for( int nBand = 1; nBand <= nBands; nBand++ )
+    {
+        EMU_CHECK(countBadPixels(pDS->GetRasterBand(nBand), pixelValue, 0, 0, TEST_XSIZE, TEST_YSIZE) == 0);
+    }
+    EMU_CHECK(atoi(getIOStat(pDS, "TILES_FILLED")) > 0);
+    GDALClose(pDS);
+    VSIUnlink(osFilename.c_str());
+}
+
+int main()
+{
+    testConstant(GDT_Int16, 1, "BAND");
+    testConstant(GDT_Float64, 1, "BAND");
+    testConstant(GDT_Int16, 2, "BAND");
+    testConstant(GDT_Int16, 3, "PIXEL");
+    testConstant(GDT_Float64, 2, "PIXEL");
+    return finishTests("test_constant");
+}
@@ -0,0 +1,147 @@
+/*
+ *  test_filters.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Each FILTER with each type it applies to reads back what was written. 
+// The raster doesn't divide into tiles so the edge tiles have widths and 
+// element counts that aren't multiples of the 8 and 16 the shuffles 
+// work in (and use their scalar tails after the SSE2 part).
+
+#include "emutest.h"
+
+// 2 by 2 tiles, the bottom right is 37 by 3
+const int TEST_XSIZE = 101;
+const int TEST_YSIZE = 67;
+const int TEST_BLOCK = 64;
+
+// values that use all the bytes of each type
+static double byteValue(int nBand, int x, int y)
+{
+    return (x * 7 + y * 13 + nBand * 5) % 256;
+}
+
+static double uint16Value(int nBand, int x, int y)
+{
+    return (x * 977 + y * 7919 + nBand * 101) % 65536;
+}
+
+static double int16Value(int nBand, int x, int y)
+{
+    return uint16Value(nBand, x, y) - 32768;
+}
+
+static double uint32Value(int nBand, int x, int y)
+{
+    return (x * 977.0 + y * 7919.0) * 6000.0 + nBand;
+}
+
+static double int32Value(int nBand, int x, int y)
+{
+    return uint32Value(nBand, x, y) - 2000000000.0;
+}
+
+// exact as Float32
+static double float32Value(int nBand, int x, int y)
+{
+    return (x - 50) * 0.25 + y * 1.5 + nBand * 0.125;
+}
+
+static double float64Value(int nBand, int x, int y)
+{
+    return (x + 0.1) * (y - 33.3) * 1e10 + nBand;
+}
+
+struct EMUFilterTestType
+{
+    GDALDataType eType;
+    EMUPatternFn pfnPattern;
+};
+
+const EMUFilterTestType TEST_TYPES[] = {
+    {GDT_Byte, byteValue},
+    {GDT_UInt16, uint16Value},
+    {GDT_Int16, int16Value},
+    {GDT_UInt32, uint32Value},
+    {GDT_Int32, int32Value},
+    {GDT_Float32, float32Value},
+    {GDT_Float64, float64Value}
+};
+
+static void testFilter(const char *pszFilter, const EMUFilterTestType &type, int nBands, 
+                const char *pszInterleave)
+{
+    std::string osFilename = writePatternFile("filters", TEST_XSIZE, TEST_YSIZE, nBands, 
+                type.eType, type.pfnPattern, 
+                {CPLSPrintf("FILTER=%s", pszFilter), CPLSPrintf("BLOCKXSIZE=%d", TEST_BLOCK), 
+                 CPLSPrintf("BLOCKYSIZE=%d", TEST_BLOCK), CPLSPrintf("INTERLEAVE=%s", pszInterleave)});
+    if( osFilename.empty() )
+    {
+        fprintf(stderr, "FILTER=%s %s: can't write\n", pszFilter, GDALGetDataTypeName(type.eType));
+    }
+    EMU_REQUIRE(!osFilename.empty());
+
+    GDALDataset *pDS = openEMU(osFilename);
+    EMU_REQUIRE(pDS != nullptr);
+    for( int nBand = 1; nBand <= nBands; nBand++ )
+    {
+        GDALRasterBand *pBand = pDS->GetRasterBand(nBand);
+        int nBad = countBadPixels(pBand, type.pfnPattern, 0, 0, TEST_XSIZE, TEST_YSIZE);
+        if( nBad != 0 )
+        {
+            fprintf(stderr, "FILTER=%s %s INTERLEAVE=%s band %d: %d bad pixels\n", pszFilter, 
+                    GDALGetDataTypeName(type.eType), pszInterleave, nBand, nBad);
+        }
+        EMU_CHECK(nBad == 0);
+    }
+    GDALClose(pDS);
+    VSIUnlink(osFilename.c_str());
+}
+
+static void testFilter(const char *pszFilter, bool bIntegers, bool bFloats)
+{
+    for( const EMUFilterTestType &type : TEST_TYPES )
+    {
+        bool bFloat = GDALDataTypeIsFloating(type.eType) != 0;
+        if( bFloat ? bFloats : bIntegers )
+        {
+            testFilter(pszFilter, type, 1, "BAND");
+            testFilter(pszFilter, type, 3, "PIXEL");
+        }
+    }
+}
+
+int main()
+{
+    testFilter("NONE", true, true);
+    testFilter("PREDICTOR", true, false);
+    testFilter("FPREDICTOR", false, true);
+    testFilter("SHUFFLE", true, true);
+    testFilter("BITSHUFFLE", true, true);
+    return finishTests("test_filters");
+}
@@ -0,0 +1,208 @@
+/*
+ *  test_header.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Version 2 headers (with the section directory) written and read back, with 
+// and without RATs, overviews and any tiles so empty sections are covered too, 
+// and a file from the original (version 1) driver still opening.
+
+#include "emutest.h"
+#include "gdal_rat.h"
+
+#include <cmath>
+
+const int TEST_SIZE = 64;
+const int TEST_OVERVIEWS = 2;
+const int RAT_ROWS = 256;
+
+static double pixelValue(int, int x, int y)
+{
+    return (x + y * 3) % 251;
+}
+
+// what the overview that is a factor of F smaller would have with nearest 
+// neighbour resampling
+template <int F>
+static double overviewValue(int nBand, int x, int y)
+{
+    return pixelValue(nBand, x * F, y * F);
+}
+
+// tests/data/version1.emu has the same pixels and RAT (see testVersion1)
+static void writeTestFile(const std::string &osFilename, bool bOverviews, bool bRAT)
+{
+    std::vector<std::string> options = {"BLOCKXSIZE=32", "BLOCKYSIZE=32"};
+    if( bOverviews )
+    {
+        options.push_back("OVERVIEWS=2,4");
+    }
+    GDALDataset *pDS = createEMU(osFilename, TEST_SIZE, TEST_SIZE, 1, GDT_Byte, options);
+    EMU_REQUIRE(pDS != nullptr);
+    EMU_CHECK(writePattern(pDS, pixelValue));
+
+    if( bRAT )
+    {
+        GDALRasterAttributeTable *pRAT = pDS->GetRasterBand(1)->GetDefaultRAT();
+        EMU_REQUIRE(pRAT != nullptr);
+        EMU_REQUIRE(pRAT->CreateColumn("value", GFT_Integer, GFU_Generic) == CE_None);
+        EMU_REQUIRE(pRAT->CreateColumn("area", GFT_Real, GFU_Generic) == CE_None);
+        EMU_REQUIRE(pRAT->CreateColumn("name", GFT_String, GFU_Name) == CE_None);
+        pRAT->SetRowCount(RAT_ROWS);
+        for( int i = 0; i < RAT_ROWS; i++ )
+        {
+            pRAT->SetValue(i, 0, i * 2);
+            pRAT->SetValue(i, 1, i * 0.5);
+            pRAT->SetValue(i, 2, CPLSPrintf("class%d", i));
+        }
+    }
+    GDALClose(pDS);
+}
+
+static void checkTestFile(const std::string &osFilename, bool bOverviews, bool bRAT)
+{
+    GDALDataset *pDS = openEMU(osFilename);
+    EMU_REQUIRE(pDS != nullptr);
+    EMU_CHECK(pDS->GetRasterXSize() == TEST_SIZE);
+    EMU_CHECK(pDS->GetRasterYSize() == TEST_SIZE);
+    EMU_REQUIRE(pDS->GetRasterCount() == 1);
+    GDALRasterBand *pBand = pDS->GetRasterBand(1);
+    EMU_CHECK(countBadPixels(pBand, pixelValue, 0, 0, TEST_SIZE, TEST_SIZE) == 0);
+
+    EMU_CHECK(pBand->GetOverviewCount() == (bOverviews ? TEST_OVERVIEWS : 0));
+    for( int o = 0; bOverviews && (o < pBand->GetOverviewCount()); o++ )
+    {
+        GDALRasterBand *pOverview = pBand->GetOverview(o);
+        int nSize = TEST_SIZE >> (o + 1);
+        EMU_REQUIRE(pOverview != nullptr);
+        EMU_CHECK(pOverview->GetXSize() == nSize);
+        EMU_CHECK(pOverview->GetYSize() == nSize);
+        std::vector<GByte> data(nSize * nSize);
+        EMU_CHECK(pOverview->RasterIO(GF_Read, 0, 0, nSize, nSize, data.data(), 
+                nSize, nSize, GDT_Byte, 0, 0, nullptr) == CE_None);
+    }
+
+    GDALRasterAttributeTable *pRAT = pBand->GetDefaultRAT();
+    EMU_REQUIRE(pRAT != nullptr);
+    if( bRAT )
+    {
+        EMU_CHECK(pRAT->GetColumnCount() == 3);
+        EMU_REQUIRE(pRAT->GetRowCount() == RAT_ROWS);
+        int nBad = 0;
+        for( int i = 0; i < RAT_ROWS; i++ )
+        {
+            nBad += (pRAT->GetValueAsInt(i, 0) != i * 2);
+            nBad += (pRAT->GetValueAsDouble(i, 1) != i * 0.5);
+            nBad += !EQUAL(pRAT->GetValueAsString(i, 2), CPLSPrintf("class%d", i));
+        }
+        EMU_CHECK(nBad == 0);
+    }
+    else
+    {
+        EMU_CHECK(pRAT->GetColumnCount() == 0);
+        EMU_CHECK(pRAT->GetRowCount() == 0);
+    }
+    GDALClose(pDS);
+}
+
+static void testRoundTrip(bool bOverviews, bool bRAT)
+{
+    std::string osFilename = tempFilename("header");
+    writeTestFile(osFilename, bOverviews, bRAT);
+    checkTestFile(osFilename, bOverviews, bRAT);
+    VSIUnlink(osFilename.c_str());
+}
+
+// closed without anything written so there are no tile grids or RAT chunks
+static void testNothingWritten()
+{
+    std::string osFilename = tempFilename("header_empty");
+    GDALDataset *pDS = createEMU(osFilename, TEST_SIZE, TEST_SIZE, 1, GDT_Byte);
+    EMU_REQUIRE(pDS != nullptr);
+    GDALClose(pDS);
+
+    pDS = openEMU(osFilename);
+    EMU_REQUIRE(pDS != nullptr);
+    EMU_CHECK(pDS->GetRasterXSize() == TEST_SIZE);
+    GByte nValue = 1;
+    EMU_CHECK(pDS->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 1, 1, &nValue, 1, 1, GDT_Byte, 
+                0, 0, nullptr) == CE_None);
+    EMU_CHECK(nValue == 0);
+    EMU_CHECK(pDS->GetRasterBand(1)->GetDefaultRAT()->GetRowCount() == 0);
+    GDALClose(pDS);
+    VSIUnlink(osFilename.c_str());
+}
+
+// a list of tiles rather than grids, square 512 pixel tiles and no size 
+// for the RAT strings. The overviews were written by the caller (as RIOS 
+// does) with nearest neighbour values, and the nodata and stats set.
+static void testVersion1()
+{
+    std::string osFilename = dataFilename("version1.emu");
+    checkTestFile(osFilename, true, true);
+
+    GDALDataset *pDS = openEMU(osFilename);
+    EMU_REQUIRE(pDS != nullptr);
+    GDALRasterBand *pBand = pDS->GetRasterBand(1);
+    EMU_REQUIRE(pBand->GetOverviewCount() == TEST_OVERVIEWS);
+    EMU_CHECK(countBadPixels(pBand->GetOverview(0), overviewValue<2>, 
+                0, 0, TEST_SIZE / 2, TEST_SIZE / 2) == 0);
+    EMU_CHECK(countBadPixels(pBand->GetOverview(1), overviewValue<4>, 
+                0, 0, TEST_SIZE / 4, TEST_SIZE / 4) == 0);
+
+    int bNoDataSet = FALSE;
+    double dfNoData = pBand->GetNoDataValue(&bNoDataSet);
+    EMU_CHECK(bNoDataSet);
+    EMU_CHECK(dfNoData == 250);
+
+    // the pattern without 250
+    const double dfExpectedMean = 125.84713064713064;
+    const double dfExpectedStdDev = 58.391396124253305;
+    double dfMin = 0, dfMax = 0, dfMean = 0, dfStdDev = 0;
+    EMU_CHECK(pBand->GetStatistics(FALSE, FALSE, &dfMin, &dfMax, &dfMean, &dfStdDev) == CE_None);
+    EMU_CHECK(dfMin == 0);
+    EMU_CHECK(dfMax == 249);
+    EMU_CHECK(dfMean == dfExpectedMean);
+    EMU_CHECK(dfStdDev == dfExpectedStdDev);
+    // there was no band metadata in the file so this comes from the stats
+    const char *pszMean = pBand->GetMetadataItem("STATISTICS_MEAN");
+    EMU_REQUIRE(pszMean != nullptr);
+    EMU_CHECK(std::fabs(CPLAtof(pszMean) - dfExpectedMean) < 1e-6);
+    GDALClose(pDS);
+}
+
+int main()
+{
+    testRoundTrip(false, false);
+    testRoundTrip(true, false);
+    testRoundTrip(false, true);
+    testRoundTrip(true, true);
+    testNothingWritten();
+    testVersion1();
+    return finishTests("test_header");
+}
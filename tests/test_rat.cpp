@@ -0,0 +1,326 @@
+/*
+ *  test_rat.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// RAT columns written with ValuesIO and SetValue, read back before 
+// and after the file is closed.
+
+#include <cmath>
+#include <limits>
+
+#include "emutest.h"
+#include "gdal_rat.h"
+
+const int RAT_ROWS = 70000; // more than one chunk
+
+static int intValue(int nRow)
+{
+    return nRow * 3 + 1;
+}
+
+// what rows of the test column should be after the rewrites in testPartialRewrite
+static int rewrittenValue(int nRow)
+{
+    if( nRow == 5 )
+    {
+        return -5;
+    }
+    if( (nRow >= 65530) && (nRow < 65540) )
+    {
+        return -nRow;
+    }
+    return intValue(nRow);
+}
+
+static void checkRewritten(GDALRasterAttributeTable *pRAT)
+{
+    std::vector<int> ints(RAT_ROWS);
+    EMU_REQUIRE(pRAT->ValuesIO(GF_Read, 0, 0, RAT_ROWS, ints.data()) == CE_None);
+    int nBad = 0;
+    for( int i = 0; i < RAT_ROWS; i++ )
+    {
+        if( ints[i] != rewrittenValue(i) )
+        {
+            nBad++;
+        }
+    }
+    EMU_CHECK(nBad == 0);
+    EMU_CHECK(pRAT->GetValueAsInt(6, 0) == intValue(6));
+    EMU_CHECK(pRAT->GetValueAsInt(RAT_ROWS - 1, 0) == intValue(RAT_ROWS - 1));
+
+    std::vector<double> reals(RAT_ROWS);
+    EMU_REQUIRE(pRAT->ValuesIO(GF_Read, 1, 0, RAT_ROWS, reals.data()) == CE_None);
+    nBad = 0;
+    for( int i = 0; i < RAT_ROWS; i++ )
+    {
+        if( reals[i] != ((i == 100) ? 0.25 : i * 0.5) )
+        {
+            nBad++;
+        }
+    }
+    EMU_CHECK(nBad == 0);
+
+    EMU_CHECK(EQUAL(pRAT->GetValueAsString(7, 2), "new"));
+    EMU_CHECK(EQUAL(pRAT->GetValueAsString(8, 2), "row8"));
+    EMU_CHECK(EQUAL(pRAT->GetValueAsString(RAT_ROWS - 1, 2), CPLSPrintf("row%d", RAT_ROWS - 1)));
+}
+
+// rows written again after the whole column was written in one go 
+// shouldn't lose the rest of the older chunk
+static void testPartialRewrite()
+{
+    std::string osFilename = tempFilename("rat_rewrite");
+    GDALDataset *pDS = createEMU(osFilename, 16, 16, 1, GDT_Byte);
+    EMU_REQUIRE(pDS != nullptr);
+    GDALRasterAttributeTable *pRAT = pDS->GetRasterBand(1)->GetDefaultRAT();
+    EMU_REQUIRE(pRAT != nullptr);
+    EMU_REQUIRE(pRAT->CreateColumn("ints", GFT_Integer, GFU_Generic) == CE_None);
+    EMU_REQUIRE(pRAT->CreateColumn("reals", GFT_Real, GFU_Generic) == CE_None);
+    EMU_REQUIRE(pRAT->CreateColumn("strings", GFT_String, GFU_Generic) == CE_None);
+    pRAT->SetRowCount(RAT_ROWS);
+
+    std::vector<int> ints(RAT_ROWS);
+    std::vector<double> reals(RAT_ROWS);
+    for( int i = 0; i < RAT_ROWS; i++ )
+    {
+        ints[i] = intValue(i);
+        reals[i] = i * 0.5;
+    }
+    EMU_CHECK(pRAT->ValuesIO(GF_Write, 0, 0, RAT_ROWS, ints.data()) == CE_None);
+    EMU_CHECK(pRAT->ValuesIO(GF_Write, 1, 0, RAT_ROWS, reals.data()) == CE_None);
+    std::vector<CPLString> strings(RAT_ROWS);
+    std::vector<char*> stringPtrs(RAT_ROWS);
+    for( int i = 0; i < RAT_ROWS; i++ )
+    {
+        strings[i].Printf("row%d", i);
+        stringPtrs[i] = const_cast<char*>(strings[i].c_str());
+    }
+    EMU_CHECK(pRAT->ValuesIO(GF_Write, 2, 0, RAT_ROWS, stringPtrs.data()) == CE_None);
+
+    // one row inside the first chunk (twice, so the first is replaced entirely)
+    pRAT->SetValue(5, 0, 1234);
+    pRAT->SetValue(5, 0, -5);
+    pRAT->SetValue(100, 1, 0.25);
+    pRAT->SetValue(7, 2, "new");
+    // and some rows across the boundary between the first two chunks
+    std::vector<int> rewrite(10);
+    for( int i = 0; i < 10; i++ )
+    {
+        rewrite[i] = -(65530 + i);
+    }
+    EMU_CHECK(pRAT->ValuesIO(GF_Write, 0, 65530, 10, rewrite.data()) == CE_None);
+
+    checkRewritten(pRAT);
+    GDALClose(pDS);
+
+    pDS = openEMU(osFilename);
+    EMU_REQUIRE(pDS != nullptr);
+    pRAT = pDS->GetRasterBand(1)->GetDefaultRAT();
+    EMU_REQUIRE(pRAT != nullptr);
+    EMU_CHECK(pRAT->GetRowCount() == RAT_ROWS);
+    checkRewritten(pRAT);
+    GDALClose(pDS);
+    VSIUnlink(osFilename.c_str());
+}
+
+// values for testEncodings. Each column is chosen so a known encoding is used.
+const int ENCODING_ROWS = 1000;
+
+// PACKED using all 32 bits
+static int packedValue(int nRow)
+{
+    return (nRow % 2 == 0) ? std::numeric_limits<int>::min() + nRow : std::numeric_limits<int>::max() - nRow;
+}
+
+// FLOAT32, including values that aren't finite
+static double floatValue(int nRow)
+{
+    switch( nRow % 5 )
+    {
+        case 0: return std::numeric_limits<double>::quiet_NaN();
+        case 1: return std::numeric_limits<double>::infinity();
+        case 2: return -std::numeric_limits<double>::infinity();
+        case 3: return -0.0;
+        default: return nRow * 0.25;
+    }
+}
+
+// falls back to PLAIN as 0.1 etc don't fit in a float
+static double plainRealValue(int nRow)
+{
+    return (nRow % 5 == 0) ? std::numeric_limits<double>::quiet_NaN() : nRow * 0.1;
+}
+
+// DICTIONARY with an empty string as one of the entries
+static const char *dictionaryValue(int nRow)
+{
+    static const char *apszValues[] = {"", "forest", "water"};
+    return apszValues[nRow % 3];
+}
+
+static bool sameReal(double dfA, double dfB)
+{
+    if( std::isnan(dfA) || std::isnan(dfB) )
+    {
+        return std::isnan(dfA) && std::isnan(dfB);
+    }
+    return (dfA == dfB) && (std::signbit(dfA) == std::signbit(dfB));
+}
+
+static void checkEncodings(GDALRasterAttributeTable *pRAT)
+{
+    EMU_REQUIRE(pRAT->GetColumnCount() == 9);
+    std::vector<int> ints(ENCODING_ROWS);
+    EMU_REQUIRE(pRAT->ValuesIO(GF_Read, 0, 0, ENCODING_ROWS, ints.data()) == CE_None);
+    int nBad = 0;
+    for( int i = 0; i < ENCODING_ROWS; i++ )
+    {
+        nBad += (ints[i] != packedValue(i));
+    }
+    EMU_CHECK(nBad == 0);
+    EMU_CHECK(pRAT->GetValueAsInt(0, 0) == std::numeric_limits<int>::min());
+    EMU_CHECK(pRAT->GetValueAsInt(1, 0) == std::numeric_limits<int>::max() - 1);
+
+    EMU_REQUIRE(pRAT->ValuesIO(GF_Read, 1, 0, ENCODING_ROWS, ints.data()) == CE_None);
+    nBad = 0;
+    for( int i = 0; i < ENCODING_ROWS; i++ )
+    {
+        nBad += (ints[i] != 42);
+    }
+    EMU_CHECK(nBad == 0);
+
+    EMU_REQUIRE(pRAT->ValuesIO(GF_Read, 2, 0, ENCODING_ROWS, ints.data()) == CE_None);
+    nBad = 0;
+    for( int i = 0; i < ENCODING_ROWS; i++ )
+    {
+        nBad += (ints[i] != i % 2);
+    }
+    EMU_CHECK(nBad == 0);
+
+    std::vector<double> reals(ENCODING_ROWS);
+    EMU_REQUIRE(pRAT->ValuesIO(GF_Read, 3, 0, ENCODING_ROWS, reals.data()) == CE_None);
+    nBad = 0;
+    for( int i = 0; i < ENCODING_ROWS; i++ )
+    {
+        nBad += !sameReal(reals[i], floatValue(i));
+    }
+    EMU_CHECK(nBad == 0);
+
+    EMU_REQUIRE(pRAT->ValuesIO(GF_Read, 4, 0, ENCODING_ROWS, reals.data()) == CE_None);
+    nBad = 0;
+    for( int i = 0; i < ENCODING_ROWS; i++ )
+    {
+        nBad += !sameReal(reals[i], plainRealValue(i));
+    }
+    EMU_CHECK(nBad == 0);
+
+    std::vector<char*> strings(ENCODING_ROWS);
+    const int anStringFields[] = {5, 6, 7, 8};
+    for( int iField : anStringFields )
+    {
+        EMU_REQUIRE(pRAT->ValuesIO(GF_Read, iField, 0, ENCODING_ROWS, strings.data()) == CE_None);
+        nBad = 0;
+        for( int i = 0; i < ENCODING_ROWS; i++ )
+        {
+            const char *pszExpected = (iField == 5) ? dictionaryValue(i) : 
+                (iField == 6) ? "same" : (iField == 7) ? "" : CPLSPrintf("row%d", i);
+            nBad += (strcmp(strings[i], pszExpected) != 0);
+            CPLFree(strings[i]);
+        }
+        EMU_CHECK(nBad == 0);
+    }
+    EMU_CHECK(EQUAL(pRAT->GetValueAsString(3, 5), ""));
+    EMU_CHECK(EQUAL(pRAT->GetValueAsString(4, 5), "forest"));
+}
+
+// a column for each of the encodings and for the fallbacks to PLAIN
+static void testEncodings()
+{
+    std::string osFilename = tempFilename("rat_encodings");
+    GDALDataset *pDS = createEMU(osFilename, 16, 16, 1, GDT_Byte);
+    EMU_REQUIRE(pDS != nullptr);
+    GDALRasterAttributeTable *pRAT = pDS->GetRasterBand(1)->GetDefaultRAT();
+    EMU_REQUIRE(pRAT != nullptr);
+    EMU_REQUIRE(pRAT->CreateColumn("packed", GFT_Integer, GFU_Generic) == CE_None);
+    EMU_REQUIRE(pRAT->CreateColumn("constant", GFT_Integer, GFU_Generic) == CE_None);
+    EMU_REQUIRE(pRAT->CreateColumn("bool", GFT_Integer, GFU_Generic) == CE_None);
+    EMU_REQUIRE(pRAT->CreateColumn("float32", GFT_Real, GFU_Generic) == CE_None);
+    EMU_REQUIRE(pRAT->CreateColumn("plain_real", GFT_Real, GFU_Generic) == CE_None);
+    EMU_REQUIRE(pRAT->CreateColumn("dictionary", GFT_String, GFU_Generic) == CE_None);
+    EMU_REQUIRE(pRAT->CreateColumn("single", GFT_String, GFU_Generic) == CE_None);
+    EMU_REQUIRE(pRAT->CreateColumn("empty", GFT_String, GFU_Generic) == CE_None);
+    EMU_REQUIRE(pRAT->CreateColumn("plain_string", GFT_String, GFU_Generic) == CE_None);
+    pRAT->SetRowCount(ENCODING_ROWS);
+
+    std::vector<int> packed(ENCODING_ROWS), constant(ENCODING_ROWS, 42), bools(ENCODING_ROWS);
+    std::vector<double> floats(ENCODING_ROWS), plainReals(ENCODING_ROWS);
+    std::vector<CPLString> rowStrings(ENCODING_ROWS);
+    std::vector<char*> dictionary(ENCODING_ROWS), single(ENCODING_ROWS), empty(ENCODING_ROWS), 
+                plainStrings(ENCODING_ROWS);
+    for( int i = 0; i < ENCODING_ROWS; i++ )
+    {
+        packed[i] = packedValue(i);
+        bools[i] = i % 2;
+        floats[i] = floatValue(i);
+        plainReals[i] = plainRealValue(i);
+        dictionary[i] = const_cast<char*>(dictionaryValue(i));
+        single[i] = const_cast<char*>("same");
+        empty[i] = const_cast<char*>("");
+        rowStrings[i].Printf("row%d", i);
+        plainStrings[i] = const_cast<char*>(rowStrings[i].c_str());
+    }
+    EMU_CHECK(pRAT->ValuesIO(GF_Write, 0, 0, ENCODING_ROWS, packed.data()) == CE_None);
+    EMU_CHECK(pRAT->ValuesIO(GF_Write, 1, 0, ENCODING_ROWS, constant.data()) == CE_None);
+    EMU_CHECK(pRAT->ValuesIO(GF_Write, 2, 0, ENCODING_ROWS, bools.data()) == CE_None);
+    EMU_CHECK(pRAT->ValuesIO(GF_Write, 3, 0, ENCODING_ROWS, floats.data()) == CE_None);
+    EMU_CHECK(pRAT->ValuesIO(GF_Write, 4, 0, ENCODING_ROWS, plainReals.data()) == CE_None);
+    EMU_CHECK(pRAT->ValuesIO(GF_Write, 5, 0, ENCODING_ROWS, dictionary.data()) == CE_None);
+    EMU_CHECK(pRAT->ValuesIO(GF_Write, 6, 0, ENCODING_ROWS, single.data()) == CE_None);
+    EMU_CHECK(pRAT->ValuesIO(GF_Write, 7, 0, ENCODING_ROWS, empty.data()) == CE_None);
+    EMU_CHECK(pRAT->ValuesIO(GF_Write, 8, 0, ENCODING_ROWS, plainStrings.data()) == CE_None);
+
+    checkEncodings(pRAT);
+    GDALClose(pDS);
+
+    pDS = openEMU(osFilename);
+    EMU_REQUIRE(pDS != nullptr);
+    pRAT = pDS->GetRasterBand(1)->GetDefaultRAT();
+    EMU_REQUIRE(pRAT != nullptr);
+    EMU_CHECK(pRAT->GetRowCount() == ENCODING_ROWS);
+    checkEncodings(pRAT);
+    GDALClose(pDS);
+    VSIUnlink(osFilename.c_str());
+}
+
+int main()
+{
+    testPartialRewrite();
+    testEncodings();
+    return finishTests("test_rat");
+}
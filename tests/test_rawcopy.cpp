@@ -0,0 +1,181 @@
+/*
+ *  test_rawcopy.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// RAW_COPY. CreateCopy from another EMU file moving the compressed tiles 
+// across should give the same file as decoding and encoding them again, 
+// and fall back to that when the compression or tile size differs.
+
+#include <cstdlib>
+
+#include "emutest.h"
+
+const int TEST_XSIZE = 150;
+const int TEST_YSIZE = 100;
+const int TEST_BANDS = 2;
+
+static double pixelValue(int nBand, int x, int y)
+{
+    // top left tile constant
+    if( (x < 64) && (y < 64) )
+    {
+        return 7;
+    }
+    return nBand * 1000 + (x * y) % 500;
+}
+
+// with overviews so they are copied too
+static std::string writeSourceFile()
+{
+    return writePatternFile("rawcopy_src", TEST_XSIZE, TEST_YSIZE, TEST_BANDS, GDT_Int16, pixelValue, 
+                {"BLOCKXSIZE=64", "BLOCKYSIZE=64", "OVERVIEWS=2"});
+}
+
+// returns TILES_COPIED, or -1 if the copy failed
+static int copyFile(const std::string &osSrcFilename, const std::string &osDestFilename, 
+                const std::vector<std::string> &options)
+{
+    GDALDataset *pSrcDS = openEMU(osSrcFilename);
+    if( pSrcDS == nullptr )
+    {
+        return -1;
+    }
+    CPLStringList aosOptions;
+    for( const std::string &osOption : options )
+    {
+        aosOptions.AddString(osOption.c_str());
+    }
+    GDALDataset *pDS = getEMUDriver()->CreateCopy(osDestFilename.c_str(), pSrcDS, FALSE, 
+                aosOptions.List(), nullptr, nullptr);
+    int nCopied = -1;
+    if( pDS != nullptr )
+    {
+        nCopied = atoi(getIOStat(pDS, "TILES_COPIED"));
+        GDALClose(pDS);
+    }
+    GDALClose(pSrcDS);
+    return nCopied;
+}
+
+static std::vector<GByte> readWholeFile(const std::string &osFilename)
+{
+    std::vector<GByte> data;
+    VSIStatBufL sStat;
+    VSILFILE *fp = VSIFOpenL(osFilename.c_str(), "rb");
+    if( (fp == nullptr) || (VSIStatL(osFilename.c_str(), &sStat) != 0) )
+    {
+        if( fp != nullptr )
+        {
+            VSIFCloseL(fp);
+        }
+        return data;
+    }
+    data.resize(sStat.st_size);
+    if( VSIFReadL(data.data(), 1, data.size(), fp) != data.size() )
+    {
+        data.clear();
+    }
+    VSIFCloseL(fp);
+    return data;
+}
+
+// pixels of every band and overview that don't match the source
+static int checkPixels(const std::string &osFilename)
+{
+    GDALDataset *pDS = openEMU(osFilename);
+    if( pDS == nullptr )
+    {
+        return -1;
+    }
+    int nBad = 0;
+    std::vector<GInt16> data(TEST_XSIZE * TEST_YSIZE);
+    for( int nBand = 1; nBand <= TEST_BANDS; nBand++ )
+    {
+        GDALRasterBand *pBand = pDS->GetRasterBand(nBand);
+        nBad += countBadPixels(pBand, pixelValue, 0, 0, TEST_XSIZE, TEST_YSIZE);
+        nBad += (pBand->GetOverviewCount() != 1);
+        GDALRasterBand *pOverview = pBand->GetOverview(0);
+        if( (pOverview == nullptr) || (pOverview->RasterIO(GF_Read, 0, 0, pOverview->GetXSize(), 
+                pOverview->GetYSize(), data.data(), pOverview->GetXSize(), pOverview->GetYSize(), 
+                GDT_Int16, 0, 0, nullptr) != CE_None) )
+        {
+            nBad++;
+        }
+    }
+    GDALClose(pDS);
+    return nBad;
+}
+
+static void testSameAsReencoding(const std::string &osSrcFilename)
+{
+    std::string osRawFilename = tempFilename("rawcopy_raw");
+    std::string osDecodedFilename = tempFilename("rawcopy_decoded");
+    EMU_CHECK(copyFile(osSrcFilename, osRawFilename, {"RAW_COPY=YES"}) > 0);
+    EMU_CHECK(copyFile(osSrcFilename, osDecodedFilename, {"RAW_COPY=NO"}) == 0);
+    EMU_CHECK(checkPixels(osRawFilename) == 0);
+
+    std::vector<GByte> raw = readWholeFile(osRawFilename);
+    EMU_CHECK(!raw.empty());
+    EMU_CHECK(raw == readWholeFile(osDecodedFilename));
+    VSIUnlink(osRawFilename.c_str());
+    VSIUnlink(osDecodedFilename.c_str());
+}
+
+// tiles that can't be used as they are are decoded as usual
+static void testFallback(const std::string &osSrcFilename)
+{
+    std::string osFilename = tempFilename("rawcopy_dest");
+    int nAllCopied = copyFile(osSrcFilename, osFilename, {});
+    EMU_CHECK(nAllCopied > 0);
+    EMU_CHECK(copyFile(osSrcFilename, osFilename, {"COMPRESS=NONE"}) == 0);
+    EMU_CHECK(checkPixels(osFilename) == 0);
+    EMU_CHECK(copyFile(osSrcFilename, osFilename, {"FILTER=PREDICTOR"}) == 0);
+    EMU_CHECK(checkPixels(osFilename) == 0);
+    // the overview keeps its tile size so only it is copied
+    int nCopied = copyFile(osSrcFilename, osFilename, {"BLOCKXSIZE=32", "BLOCKYSIZE=32"});
+    EMU_CHECK((nCopied > 0) && (nCopied < nAllCopied));
+    EMU_CHECK(checkPixels(osFilename) == 0);
+    VSIUnlink(osFilename.c_str());
+}
+
+int main()
+{
+    std::string osSrcFilename = writeSourceFile();
+    if( !osSrcFilename.empty() )
+    {
+        testSameAsReencoding(osSrcFilename);
+        testFallback(osSrcFilename);
+        VSIUnlink(osSrcFilename.c_str());
+    }
+    else
+    {
+        EMU_CHECK(!osSrcFilename.empty());
+    }
+    return finishTests("test_rawcopy");
+}
@@ -0,0 +1,193 @@
+/*
+ *  test_stats.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// The STATISTICS_* and STATISTICS_HISTO* metadata collected as the blocks 
+// are written match what GDAL calculates from the same pixels, with and 
+// without nodata, and Float64 values near +/-DBL_MAX still give a usable 
+// histogram.
+
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#include "emutest.h"
+
+// 3 by 2 tiles with partial ones on the right and bottom
+const int TEST_XSIZE = 150;
+const int TEST_YSIZE = 100;
+
+static double intValue(int nBand, int x, int y)
+{
+    return (x * 7 + y * 13 + nBand) % 200;
+}
+
+// exact as Float32
+static double floatValue(int nBand, int x, int y)
+{
+    return intValue(nBand, x, y) * 0.25 - 10;
+}
+
+static double getMetadataDouble(GDALRasterBand *pBand, const char *pszName)
+{
+    const char *pszValue = pBand->GetMetadataItem(pszName);
+    return (pszValue != nullptr) ? CPLAtof(pszValue) : std::nan("");
+}
+
+// the metadata is written with %f
+static bool sameStat(double dfA, double dfB)
+{
+    return std::fabs(dfA - dfB) <= 1e-6 * std::max(1.0, std::fabs(dfB));
+}
+
+static void checkBand(GDALRasterBand *pBand)
+{
+    double dfMin = getMetadataDouble(pBand, "STATISTICS_MINIMUM");
+    double dfMax = getMetadataDouble(pBand, "STATISTICS_MAXIMUM");
+    double dfMean = getMetadataDouble(pBand, "STATISTICS_MEAN");
+    double dfStdDev = getMetadataDouble(pBand, "STATISTICS_STDDEV");
+    double dfHistMin = getMetadataDouble(pBand, "STATISTICS_HISTOMIN");
+    double dfHistMax = getMetadataDouble(pBand, "STATISTICS_HISTOMAX");
+    const char *pszNumBins = pBand->GetMetadataItem("STATISTICS_HISTONUMBINS");
+    int nBins = (pszNumBins != nullptr) ? atoi(pszNumBins) : 0;
+    CPLStringList aosBins(CSLTokenizeString2(pBand->GetMetadataItem("STATISTICS_HISTOBINVALUES"), "|", 0));
+    EMU_REQUIRE(nBins > 0);
+    EMU_REQUIRE(aosBins.Count() == nBins);
+
+    // after reading the metadata as this sets it
+    double dfGDALMin, dfGDALMax, dfGDALMean, dfGDALStdDev;
+    EMU_REQUIRE(pBand->ComputeStatistics(FALSE, &dfGDALMin, &dfGDALMax, &dfGDALMean, &dfGDALStdDev, 
+                nullptr, nullptr) == CE_None);
+    EMU_CHECK(sameStat(dfMin, dfGDALMin));
+    EMU_CHECK(sameStat(dfMax, dfGDALMax));
+    EMU_CHECK(sameStat(dfMean, dfGDALMean));
+    EMU_CHECK(sameStat(dfStdDev, dfGDALStdDev));
+
+    // same bins as GDAL gives the same range
+    EMU_CHECK((dfHistMin <= dfGDALMin) && (dfHistMax >= dfGDALMax));
+    std::vector<GUIntBig> counts(nBins);
+    EMU_REQUIRE(pBand->GetHistogram(dfHistMin, dfHistMax, nBins, counts.data(), FALSE, FALSE, 
+                nullptr, nullptr) == CE_None);
+    int nBad = 0;
+    for( int n = 0; n < nBins; n++ )
+    {
+        nBad += (counts[n] != static_cast<GUIntBig>(CPLAtoGIntBig(aosBins[n])));
+    }
+    EMU_CHECK(nBad == 0);
+}
+
+static void testStats(GDALDataType eType, bool bNoData)
+{
+    EMUPatternFn pfnPattern = GDALDataTypeIsFloating(eType) ? floatValue : intValue;
+    std::string osFilename = tempFilename("stats");
+    GDALDataset *pDS = createEMU(osFilename, TEST_XSIZE, TEST_YSIZE, 2, eType, 
+                {"BLOCKXSIZE=64", "BLOCKYSIZE=64"});
+    EMU_REQUIRE(pDS != nullptr);
+    if( bNoData )
+    {
+        for( int nBand = 1; nBand <= 2; nBand++ )
+        {
+            // a value that is in the data
+            pDS->GetRasterBand(nBand)->SetNoDataValue(pfnPattern(nBand, 0, 0));
+        }
+    }
+    EMU_CHECK(writePattern(pDS, pfnPattern));
+    GDALClose(pDS);
+
+    pDS = openEMU(osFilename);
+    EMU_REQUIRE(pDS != nullptr);
+    for( int nBand = 1; nBand <= 2; nBand++ )
+    {
+        checkBand(pDS->GetRasterBand(nBand));
+    }
+    GDALClose(pDS);
+    VSIUnlink(osFilename.c_str());
+}
+
+static double extremeValue(int, int x, int y)
+{
+    switch( (x + y) % 4 )
+    {
+        case 0: return -DBL_MAX;
+        case 1: return DBL_MAX;
+        case 2: return 0;
+        default: return x * 0.5;
+    }
+}
+
+// the range overflows a double so the histogram can't use power of 2 bins
+static void testExtremes()
+{
+    std::string osFilename = writePatternFile("stats_extremes", TEST_XSIZE, TEST_YSIZE, 1, GDT_Float64, 
+                extremeValue, {"BLOCKXSIZE=64", "BLOCKYSIZE=64"});
+    EMU_REQUIRE(!osFilename.empty());
+    GDALDataset *pDS = openEMU(osFilename);
+    EMU_REQUIRE(pDS != nullptr);
+    GDALRasterBand *pBand = pDS->GetRasterBand(1);
+    EMU_CHECK(getMetadataDouble(pBand, "STATISTICS_MINIMUM") == -DBL_MAX);
+    EMU_CHECK(getMetadataDouble(pBand, "STATISTICS_MAXIMUM") == DBL_MAX);
+    double dfHistMin = getMetadataDouble(pBand, "STATISTICS_HISTOMIN");
+    double dfHistMax = getMetadataDouble(pBand, "STATISTICS_HISTOMAX");
+    EMU_CHECK(std::isfinite(dfHistMin) && std::isfinite(dfHistMax) && (dfHistMin < dfHistMax));
+
+    // every pixel is in a bin, with the extremes in the first and last
+    CPLStringList aosBins(CSLTokenizeString2(pBand->GetMetadataItem("STATISTICS_HISTOBINVALUES"), "|", 0));
+    EMU_REQUIRE(aosBins.Count() > 1);
+    GIntBig nTotal = 0;
+    for( int n = 0; n < aosBins.Count(); n++ )
+    {
+        nTotal += CPLAtoGIntBig(aosBins[n]);
+    }
+    GIntBig nLowest = 0, nHighest = 0;
+    for( int y = 0; y < TEST_YSIZE; y++ )
+    {
+        for( int x = 0; x < TEST_XSIZE; x++ )
+        {
+            nLowest += (extremeValue(1, x, y) == -DBL_MAX);
+            nHighest += (extremeValue(1, x, y) == DBL_MAX);
+        }
+    }
+    EMU_CHECK(nTotal == static_cast<GIntBig>(TEST_XSIZE) * TEST_YSIZE);
+    EMU_CHECK(CPLAtoGIntBig(aosBins[0]) == nLowest);
+    EMU_CHECK(CPLAtoGIntBig(aosBins[aosBins.Count() - 1]) == nHighest);
+    GDALClose(pDS);
+    VSIUnlink(osFilename.c_str());
+}
+
+int main()
+{
+    const GDALDataType aeTypes[] = {GDT_Byte, GDT_Int16, GDT_UInt32, GDT_Float32, GDT_Float64};
+    for( GDALDataType eType : aeTypes )
+    {
+        testStats(eType, false);
+        testStats(eType, true);
+    }
+    testExtremes();
+    return finishTests("test_stats");
+}
@@ -0,0 +1,117 @@
+/*
+ *  test_strips.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// TILE_STRIPS files read back whole and as windows within one tile (which 
+// only decompress the strips needed), including the partial tiles at the 
+// right and bottom edges and strips that don't divide the tile height.
+
+#include <cstdlib>
+
+#include "emutest.h"
+
+// 3 by 2 tiles with partial ones on the right and bottom
+const int TEST_XSIZE = 150;
+const int TEST_YSIZE = 100;
+const int TEST_BLOCK = 64;
+
+static double pixelValue(int nBand, int x, int y)
+{
+    return nBand * 10000 + y * TEST_XSIZE + x - 20000;
+}
+
+static std::string writeTestFile(int nStrips, int nBands, const char *pszInterleave)
+{
+    return writePatternFile("strips", TEST_XSIZE, TEST_YSIZE, nBands, GDT_Int16, pixelValue, 
+                {CPLSPrintf("TILE_STRIPS=%d", nStrips), CPLSPrintf("BLOCKXSIZE=%d", TEST_BLOCK), 
+                 CPLSPrintf("BLOCKYSIZE=%d", TEST_BLOCK), CPLSPrintf("INTERLEAVE=%s", pszInterleave)});
+}
+
+static void testFullRead(const std::string &osFilename, int nBands)
+{
+    GDALDataset *pDS = openEMU(osFilename);
+    EMU_REQUIRE(pDS != nullptr);
+    for( int nBand = 1; nBand <= nBands; nBand++ )
+    {
+        EMU_CHECK(countBadPixels(pDS->GetRasterBand(nBand), pixelValue, 0, 0, TEST_XSIZE, TEST_YSIZE) == 0);
+    }
+    GDALClose(pDS);
+}
+
+// windows within one tile, each the first read of that tile so the strips are used
+static void testWindows(const std::string &osFilename, int nBands)
+{
+    // x, y, xsize, ysize
+    const int anWindows[][4] = {
+        {0, 0, 1, 1},       // first row of the first strip
+        {10, 20, 30, 5},    // across a strip boundary
+        {64, 63, 10, 1},    // last row of a full tile
+        {130, 5, 20, 3},    // right edge tile
+        {5, 90, 7, 10},     // bottom edge tile, to its last row
+        {128, 64, 22, 36}   // all of the bottom right tile
+    };
+    for( int nBand = 1; nBand <= nBands; nBand++ )
+    {
+        GDALDataset *pDS = openEMU(osFilename);
+        EMU_REQUIRE(pDS != nullptr);
+        GDALRasterBand *pBand = pDS->GetRasterBand(nBand);
+        for( const auto &window : anWindows )
+        {
+            EMU_CHECK(countBadPixels(pBand, pixelValue, window[0], window[1], window[2], window[3]) == 0);
+        }
+        // then again now the tiles are in the block cache
+        for( const auto &window : anWindows )
+        {
+            EMU_CHECK(countBadPixels(pBand, pixelValue, window[0], window[1], window[2], window[3]) == 0);
+        }
+        EMU_CHECK(atoi(getIOStat(pDS, "STRIPS_READ")) > 0);
+        GDALClose(pDS);
+    }
+}
+
+static void testStrips(int nStrips, int nBands, const char *pszInterleave)
+{
+    std::string osFilename = writeTestFile(nStrips, nBands, pszInterleave);
+    EMU_REQUIRE(!osFilename.empty());
+    testFullRead(osFilename, nBands);
+    testWindows(osFilename, nBands);
+    VSIUnlink(osFilename.c_str());
+}
+
+int main()
+{
+    // 64 rows in 4 strips of 16
+    testStrips(4, 1, "BAND");
+    // don't divide the height (or the partial tiles' heights)
+    testStrips(5, 1, "BAND");
+    testStrips(7, 2, "BAND");
+    // strips run down all the bands in the tile
+    testStrips(5, 3, "PIXEL");
+    return finishTests("test_strips");
+}
@@ -0,0 +1,84 @@
+/*
+ *  test_tilecache.cpp
+ *  EMUFormat
+ *
+ *  Created by the EMUFormat contributors on 14/10/2026.
+ *  Copyright 2026 EMUFormat. All rights reserved.
+ *
+ *  This file is part of EMUFormat.
+ *
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without restriction, 
+ *  including without limitation the rights to use, copy, modify, 
+ *  merge, publish, distribute, sublicense, and/or sell copies of the 
+ *  Software, and to permit persons to whom the Software is furnished 
+ *  to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ *  OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR 
+ *  ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+ *  CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION 
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// EMU_CACHE_MB tile cache.
+
+#include "emutest.h"
+
+const int TEST_SIZE = 300;
+
+static void writeFile(const std::string &osFilename, GByte nValue)
+{
+    GDALDataset *pDS = createEMU(osFilename, TEST_SIZE, TEST_SIZE, 1, GDT_Byte, 
+                        {"COMPRESS=NONE", "BLOCKXSIZE=128", "BLOCKYSIZE=128"});
+    EMU_REQUIRE(pDS != nullptr);
+    // not all the same, or the tiles would be constant and not cached
+    std::vector<GByte> data(TEST_SIZE * TEST_SIZE);
+    for( size_t i = 0; i < data.size(); i++ )
+    {
+        data[i] = static_cast<GByte>(nValue + (i % 7));
+    }
+    EMU_CHECK(pDS->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, TEST_SIZE, TEST_SIZE, data.data(), 
+                TEST_SIZE, TEST_SIZE, GDT_Byte, 0, 0, nullptr) == CE_None);
+    GDALClose(pDS);
+}
+
+static GByte readFirstPixel(const std::string &osFilename)
+{
+    GDALDataset *pDS = openEMU(osFilename);
+    if( pDS == nullptr )
+    {
+        return 0;
+    }
+    GByte nValue = 0;
+    pDS->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 1, 1, &nValue, 1, 1, GDT_Byte, 0, 0, nullptr);
+    GDALClose(pDS);
+    return nValue;
+}
+
+// a file written again at the same size (easy with COMPRESS=NONE) 
+// mustn't be given the tiles cached from the old one
+static void testRewrittenFile()
+{
+    std::string osFilename = tempFilename("tilecache");
+    writeFile(osFilename, 10);
+    EMU_CHECK(readFirstPixel(osFilename) == 10);
+    writeFile(osFilename, 20);
+    EMU_CHECK(readFirstPixel(osFilename) == 20);
+    VSIUnlink(osFilename.c_str());
+}
+
+int main()
+{
+    // must be set before the cache is first used
+    CPLSetConfigOption("EMU_CACHE_MB", "16");
+    testRewrittenFile();
+    return finishTests("test_tilecache");
+}